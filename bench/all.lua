@@ -0,0 +1,13 @@
+-- Runs all Lua benchmark scripts of this directory.
+--
+-- usage: lua bench/all.lua
+--
+-- The environment variable MTMSG_BENCH_SECONDS sets the minimal duration of
+-- each measurement (default 0.5 seconds).
+
+local dir = arg[0]:match("^(.-)[^/\\]*$") or ""
+
+for _, name in ipairs{ "buffer", "writer", "listener", "threads" } do
+    arg[0] = dir..name..".lua"
+    dofile(arg[0])
+end
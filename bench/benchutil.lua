@@ -0,0 +1,41 @@
+-- Common helpers for the Lua benchmark scripts.
+--
+-- Every measurement prints one line with the number of operations per second
+-- and the time per operation, so that the output of all scripts can be 
+-- compared and collected into one table.
+
+local mtmsg = require("mtmsg")
+
+local M = {}
+
+local minSeconds = tonumber(os.getenv("MTMSG_BENCH_SECONDS")) or 0.5
+
+function M.header(title)
+    print()
+    print(title)
+    print(string.format("%-48s %14s %12s", "operation", "ops/s", "ns/op"))
+    print(string.rep("-", 48).." "..string.rep("-", 14).." "..string.rep("-", 12))
+end
+
+-- Calls f(n), which must perform n operations, with increasing n until the
+-- call takes at least minSeconds.
+function M.measure(name, f)
+    local n = 100
+    while true do
+        collectgarbage()
+        local startTime = mtmsg.time()
+        f(n)
+        local seconds = mtmsg.time() - startTime
+        if seconds >= minSeconds or n >= 1e9 then
+            print(string.format("%-48s %14.0f %12.1f", name, n / seconds, seconds / n * 1e9))
+            return
+        end
+        if seconds < minSeconds / 100 then
+            n = n * 10
+        else
+            n = math.ceil(n * minSeconds / seconds * 1.2)
+        end
+    end
+end
+
+return M
@@ -0,0 +1,44 @@
+-- Cross-process throughput of mtmsg.newbridge() over a Unix domain socket.
+--
+-- A child process adds messages to a local buffer that is forwarded by a
+-- sending bridge, this process takes the messages from the buffer of the
+-- receiving bridge.
+--
+-- usage: lua bridge.lua [message count]
+
+local mtmsg = require("mtmsg")
+
+local lua        = arg[-1] or "lua"
+local count      = tonumber(arg[1]) or 200000
+local socketPath = os.tmpname()
+
+local function run(size)
+    local b = mtmsg.newbuffer()
+    local r = mtmsg.newbridge(b, socketPath, "receive")
+    assert(os.execute(lua..[[ -e '
+        local mtmsg = require("mtmsg")
+        local b = mtmsg.newbuffer()
+        local s = mtmsg.newbridge(b, "]]..socketPath..[[")
+        local payload = string.rep("x", ]]..size..[[)
+        for i = 1, ]]..count..[[ do
+            b:addmsg(i, payload)
+        end
+        while s:msgcnt() < ]]..count..[[ do
+            mtmsg.sleep(0.001)
+        end
+    ' &]]))
+    assert(b:nextmsg(30) == 1)
+    local startTime = mtmsg.time()
+    for i = 2, count do
+        assert(b:nextmsg(30) == i)
+    end
+    local seconds = mtmsg.time() - startTime
+    r:close()
+    print(string.format("%6d bytes: %10.0f msgs/s %8.1f MB/s",
+                        size, (count - 1) / seconds, (count - 1) * size / seconds / 1e6))
+end
+
+for _, size in ipairs{ 0, 100, 1000, 10000 } do
+    run(size)
+end
+os.remove(socketPath)
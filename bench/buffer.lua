@@ -0,0 +1,123 @@
+-- Buffer methods: addmsg/nextmsg with different payloads, setmsg, buffers 
+-- with notifier and lookup of buffers by name and id.
+--
+-- usage: lua buffer.lua
+
+package.path = (arg[0]:match("^(.-)[^/\\]*$") or "").."?.lua;"..package.path
+
+local mtmsg = require("mtmsg")
+local bench = require("benchutil")
+
+local ok, carray = pcall(require, "carray")
+if not ok then carray = nil end
+
+bench.header("buffer")
+
+local b = mtmsg.newbuffer()
+
+bench.measure("addmsg/nextmsg integer", function(n)
+    for i = 1, n do
+        b:addmsg(i)
+        b:nextmsg()
+    end
+end)
+
+bench.measure("addmsg/nextmsg 3 scalars", function(n)
+    for i = 1, n do
+        b:addmsg(i, 0.5, true)
+        b:nextmsg()
+    end
+end)
+
+for _, size in ipairs{ 10, 100, 1000, 10000 } do
+    local s = string.rep("x", size)
+    bench.measure("addmsg/nextmsg string "..size.." bytes", function(n)
+        for i = 1, n do
+            b:addmsg(s)
+            b:nextmsg()
+        end
+    end)
+end
+
+bench.measure("addmsg/nextmsg table {1,2,3}", function(n)
+    local t = { 1, 2, 3 }
+    for i = 1, n do
+        b:addmsg(t)
+        b:nextmsg()
+    end
+end)
+
+if carray then
+    for _, count in ipairs{ 10, 1000 } do
+        local a  = carray.new("double", count)
+        local a2 = carray.new("double")
+        bench.measure("addmsg/nextmsg carray "..count.." doubles", function(n)
+            for i = 1, n do
+                b:addmsg(a)
+                b:nextmsg(nil, a2)
+            end
+        end)
+    end
+else
+    print("(carray not available, skipping carray payloads)")
+end
+
+bench.measure("addmsg x1000, nextmsg x1000", function(n)
+    local rounds = math.ceil(n / 1000)
+    for r = 1, rounds do
+        for i = 1, 1000 do
+            b:addmsg(i)
+        end
+        for i = 1, 1000 do
+            b:nextmsg()
+        end
+    end
+end)
+
+bench.measure("setmsg/nextmsg integer", function(n)
+    for i = 1, n do
+        b:setmsg(i)
+        b:nextmsg()
+    end
+end)
+
+bench.measure("setmsg integer", function(n)
+    for i = 1, n do
+        b:setmsg(i)
+    end
+end)
+b:clear()
+
+do
+    local b2  = mtmsg.newbuffer()
+    local ntf = mtmsg.newbuffer()
+    b2:notifier(ntf, ">")
+    bench.measure("addmsg/nextmsg with notifier", function(n)
+        for i = 1, n do
+            b2:addmsg(i)
+            b2:nextmsg()
+            if i % 1000 == 0 then
+                ntf:clear()
+            end
+        end
+        ntf:clear()
+    end)
+end
+
+do
+    local buffers = {}
+    for i = 1, 1000 do
+        buffers[i] = mtmsg.newbuffer("bench"..i)
+    end
+    local id = buffers[500]:id()
+    bench.measure("mtmsg.buffer(name), 1000 named buffers", function(n)
+        for i = 1, n do
+            mtmsg.buffer("bench500")
+        end
+    end)
+    bench.measure("mtmsg.buffer(id), 1000 named buffers", function(n)
+        for i = 1, n do
+            mtmsg.buffer(id)
+        end
+    end)
+end
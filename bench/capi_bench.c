@@ -0,0 +1,268 @@
+/*
+ * Throughput and latency of mtmsg buffers driven through the receiver and
+ * sender C APIs from several threads.
+ *
+ * Buffers are created in a minimal Lua state, producer threads add messages
+ * via receiver_capi.msgToReceiver and the main thread takes them via
+ * sender_capi.nextMessageFromSender, or for the batch topologies up to 
+ * BATCH_SIZE messages at once via sender_capi.nextMessagesFromSender. 
+ * Listeners have no sender C API, for the listener fan-in topology the main 
+ * thread calls listener:nextmsg(). For the reserve topology the producer
+ * writes the payload as byte array directly into the buffer's memory via
+ * receiver_capi.reserveInReceiver.
+ *
+ * Each message consists of the sending time in nanoseconds and a string
+ * payload. The latency is measured from adding a message until the consumer
+ * has taken it. Producers wait while the buffer is full, the waiting time is
+ * not counted as latency.
+ *
+ * Build with "make bench" in the src directory.
+ *
+ * usage: capi_bench [messages per run] [producer count]
+ *
+ * Output is one CSV line per run preceded by a header line, so that results
+ * of different commits can be compared with standard tools.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+#define RECEIVER_CAPI_IMPLEMENT_GET_CAPI 1
+#include "receiver_capi.h"
+
+#define SENDER_CAPI_IMPLEMENT_GET_CAPI 1
+#include "sender_capi.h"
+
+int luaopen_mtmsg(lua_State* L);
+
+#define BATCH_SIZE 256
+
+typedef enum {
+    SPSC,
+    MPSC,
+    FANIN,
+    SPSC_BATCH,
+    MPSC_BATCH,
+    SPSC_RESERVE
+} Topology;
+
+static const char* const topologyNames[] = { "spsc", "mpsc", "fanin", "spsc_batch", "mpsc_batch", "spsc_reserve" };
+
+typedef struct Producer {
+    pthread_t             thread;
+    const receiver_capi*  api;
+    receiver_object*      receiver;
+    long                  count;
+    size_t                size;
+    int                   reserve;
+    int                   rc;
+} Producer;
+
+static long long nowNanos()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void* producerThread(void* arg)
+{
+    Producer*        p       = arg;
+    receiver_writer* w       = p->api->newWriter(0, 2);
+    char*            payload = malloc(p->size + 1);
+    memset(payload, 'x', p->size);
+    long i;
+    for (i = 0; i < p->count && p->rc == 0; ++i) {
+        for (;;) {
+            p->api->clearWriter(w);
+            p->api->addIntegerToWriter(w, nowNanos());
+            if (p->reserve) {
+                void* data = p->api->reserveInReceiver(p->receiver, w, RECEIVER_UCHAR, p->size, 0, &p->rc);
+                if (data) {
+                    memset(data, 'x', p->size);
+                    p->rc = p->api->commitToReceiver(p->receiver, w, 0, NULL, NULL);
+                }
+            } else {
+                p->api->addStringToWriter(w, payload, p->size);
+                p->rc = p->api->msgToReceiver(p->receiver, w, 0, 0, NULL, NULL);
+            }
+            if (p->rc != 4) {
+                break;
+            }
+            /* buffer is full */
+            sched_yield();
+        }
+    }
+    free(payload);
+    p->api->freeWriter(w);
+    return NULL;
+}
+
+static int compareLatencies(const void* a, const void* b)
+{
+    long long x = *(const long long*)a;
+    long long y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+static double percentileMicros(long long* sorted, long n, double p)
+{
+    return sorted[(long)((n - 1) * p)] / 1000.0;
+}
+
+/**
+ * Creates the buffers for one run, starts the producers, takes all messages
+ * in the calling thread and prints one result line.
+ */
+static int run(lua_State* L, Topology topology, int producerCount, size_t size, long count)
+{
+    const int  top       = lua_gettop(L);
+    const long total     = count * producerCount;
+    const int  capacity  = 64 * 1024 > 16 * (int)size ? 64 * 1024 : 16 * (int)size;
+    long long* latencies = malloc(total * sizeof(long long));
+    Producer*  producers = calloc(producerCount, sizeof(Producer));
+    if (!latencies || !producers) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    lua_getglobal(L, "mtmsg");                                  /* -> mtmsg */
+    int listenerIndex = 0;
+    if (topology == FANIN) {
+        lua_getfield(L, -1, "newlistener");                     /* -> mtmsg, newlistener */
+        lua_call(L, 0, 1);                                      /* -> mtmsg, listener */
+        listenerIndex = lua_gettop(L);
+    }
+    int bufferCount = (topology == FANIN) ? producerCount : 1;
+    int firstBuffer = lua_gettop(L) + 1;
+    int i;
+    for (i = 0; i < bufferCount; ++i) {
+        if (topology == FANIN) {
+            lua_getfield(L, listenerIndex, "newbuffer");
+            lua_pushvalue(L, listenerIndex);
+        } else {
+            lua_getfield(L, top + 1, "newbuffer");
+        }
+        int nargs = (topology == FANIN) ? 1 : 0;
+        lua_pushinteger(L, capacity);
+        lua_pushinteger(L, 0);
+        lua_call(L, nargs + 2, 1);                              /* -> ..., buffer */
+    }
+    const receiver_capi* rapi     = receiver_get_capi(L, firstBuffer, NULL);
+    const sender_capi*   sapi     = sender_get_capi(L, firstBuffer, NULL);
+    sender_object*       sender   = sapi->toSender(L, firstBuffer);
+    sender_reader*       reader   = sapi->newReader(0, 2);
+
+    for (i = 0; i < producerCount; ++i) {
+        Producer* p = &producers[i];
+        p->api      = rapi;
+        p->receiver = rapi->toReceiver(L, firstBuffer + (topology == FANIN ? i : 0));
+        p->count    = count;
+        p->size     = size;
+        p->reserve  = (topology == SPSC_RESERVE);
+    }
+    long long startTime = nowNanos();
+    for (i = 0; i < producerCount; ++i) {
+        pthread_create(&producers[i].thread, NULL, producerThread, &producers[i]);
+    }
+    long n;
+    int  rc = 0;
+    if (topology == FANIN) {
+        lua_getfield(L, listenerIndex, "nextmsg");              /* -> ..., nextmsg */
+        int nextmsg = lua_gettop(L);
+        for (n = 0; n < total; ++n) {
+            lua_pushvalue(L, nextmsg);
+            lua_pushvalue(L, listenerIndex);
+            lua_call(L, 1, 2);                                  /* -> ..., nextmsg, ts, payload */
+            latencies[n] = nowNanos() - (long long)lua_tointeger(L, -2);
+            lua_pop(L, 2);                                      /* -> ..., nextmsg */
+        }
+    } else if (topology == SPSC_BATCH || topology == MPSC_BATCH) {
+        n = 0;
+        while (n < total) {
+            size_t batchCount;
+            rc = sapi->nextMessagesFromSender(sender, reader, 0, -1, BATCH_SIZE, 0, &batchCount, NULL, NULL);
+            if (rc != 0) {
+                break;
+            }
+            long long now = nowNanos();
+            do {
+                sender_capi_value value;
+                sapi->nextValueFromReader(reader, &value);
+                latencies[n++] = now - (long long)value.intVal;
+            } while (sapi->nextMessageFromReader(reader));
+        }
+    } else {
+        for (n = 0; n < total; ++n) {
+            sapi->clearReader(reader);
+            rc = sapi->nextMessageFromSender(sender, reader, 0, -1, NULL, NULL);
+            if (rc != 0) {
+                break;
+            }
+            sender_capi_value value;
+            sapi->nextValueFromReader(reader, &value);
+            latencies[n] = nowNanos() - (long long)value.intVal;
+        }
+    }
+    long long nanos = nowNanos() - startTime;
+    for (i = 0; i < producerCount; ++i) {
+        pthread_join(producers[i].thread, NULL);
+        if (producers[i].rc != 0) {
+            rc = producers[i].rc;
+        }
+    }
+    if (rc == 0) {
+        qsort(latencies, total, sizeof(long long), compareLatencies);
+        double elapsed = nanos / 1e9;
+        printf("%s,%d,%lu,%ld,%.0f,%.0f,%.1f,%.1f,%.1f\n",
+               topologyNames[topology], producerCount, (unsigned long)size, total,
+               total / elapsed, total * (double)size / elapsed,
+               percentileMicros(latencies, total, 0.5),
+               percentileMicros(latencies, total, 0.99),
+               percentileMicros(latencies, total, 0.999));
+        fflush(stdout);
+    } else {
+        fprintf(stderr, "%s with %lu bytes failed (rc=%d)\n",
+                topologyNames[topology], (unsigned long)size, rc);
+    }
+    sapi->freeReader(reader);
+    free(producers);
+    free(latencies);
+    lua_settop(L, top);
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    return rc;
+}
+
+int main(int argc, char** argv)
+{
+    long count         = (argc > 1) ? atol(argv[1]) : 200000;
+    int  producerCount = (argc > 2) ? atoi(argv[2]) : 4;
+
+    static const size_t sizes[] = { 0, 64, 1024, 16384 };
+
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+    lua_pushcfunction(L, luaopen_mtmsg);
+    lua_call(L, 0, 1);
+    lua_setglobal(L, "mtmsg");
+
+    printf("topology,producers,size,messages,msgs_per_s,bytes_per_s,p50_us,p99_us,p999_us\n");
+    int rc = 0;
+    size_t s;
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        rc |= run(L, SPSC,  1,             sizes[s], count);
+        rc |= run(L, MPSC,  producerCount, sizes[s], count / producerCount);
+        rc |= run(L, FANIN, producerCount, sizes[s], count / producerCount);
+        rc |= run(L, SPSC_BATCH, 1,             sizes[s], count);
+        rc |= run(L, MPSC_BATCH, producerCount, sizes[s], count / producerCount);
+        rc |= run(L, SPSC_RESERVE, 1,           sizes[s], count);
+    }
+    lua_close(L);
+    return rc ? 1 : 0;
+}
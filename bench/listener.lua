@@ -0,0 +1,42 @@
+-- Listener with 1, 100 and 10000 buffers: adding one message to each buffer
+-- and taking all messages from the listener.
+--
+-- usage: lua listener.lua
+
+package.path = (arg[0]:match("^(.-)[^/\\]*$") or "").."?.lua;"..package.path
+
+local mtmsg = require("mtmsg")
+local bench = require("benchutil")
+
+bench.header("listener")
+
+for _, count in ipairs{ 1, 100, 10000 } do
+    local l = mtmsg.newlistener()
+    local buffers = {}
+    for i = 1, count do
+        buffers[i] = l:newbuffer()
+    end
+    bench.measure("addmsg/listener:nextmsg "..count.." buffers", function(n)
+        local rounds = math.ceil(n / count)
+        for r = 1, rounds do
+            for i = 1, count do
+                buffers[i]:addmsg(i)
+            end
+            for i = 1, count do
+                l:nextmsg()
+            end
+        end
+    end)
+    bench.measure("addmsg/listener:nextmsg one of "..count.." buffers", function(n)
+        local buffer = buffers[count]
+        for i = 1, n do
+            buffer:addmsg(i)
+            l:nextmsg()
+        end
+    end)
+    bench.measure("listener:clear "..count.." buffers", function(n)
+        for i = 1, n do
+            l:clear()
+        end
+    end)
+end
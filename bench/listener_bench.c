@@ -0,0 +1,238 @@
+/*
+ * Scaling of one listener with many buffers and producer threads.
+ *
+ * For each combination of buffer and producer count three things are
+ * measured:
+ *
+ *   throughput - producers add messages to all buffers of the listener via
+ *                receiver_capi.msgToReceiver, the main thread takes them via
+ *                listener:nextmsg()
+ *   wakeup     - one producer adds single messages to arbitrary buffers while
+ *                the main thread is waiting in listener:nextmsg(), the time
+ *                until the waiting thread has the message is recorded
+ *   lock hold  - duration of listener:clear() and listener:abort() with a
+ *                message in every buffer, both walk all buffers of the
+ *                listener while holding the listener's lock
+ *
+ * Build with "make bench" in the src directory.
+ *
+ * usage: listener_bench [max buffer count]
+ *
+ * Output is one CSV line per combination preceded by a header line.
+ */
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+#define RECEIVER_CAPI_IMPLEMENT_GET_CAPI 1
+#include "receiver_capi.h"
+
+int luaopen_mtmsg(lua_State* L);
+
+#define WAKEUP_COUNT 2000
+
+typedef struct Producer {
+    pthread_t             thread;
+    const receiver_capi*  api;
+    receiver_object**     receivers;
+    int                   first;     /* first buffer index of this producer */
+    int                   step;      /* distance between buffers of this producer */
+    int                   bufferCount;
+    long                  count;
+    long                  pauseNanos;
+    int                   rc;
+} Producer;
+
+static long long nowNanos()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void* producerThread(void* arg)
+{
+    Producer*        p = arg;
+    receiver_writer* w = p->api->newWriter(0, 2);
+    int  b = p->first;
+    long i;
+    for (i = 0; i < p->count && p->rc == 0; ++i) {
+        if (p->pauseNanos > 0) {
+            struct timespec ts = { 0, p->pauseNanos };
+            nanosleep(&ts, NULL);
+        }
+        p->api->addIntegerToWriter(w, nowNanos());
+        p->rc = p->api->msgToReceiver(p->receivers[b], w, 0, 0, NULL, NULL);
+        b += p->step;
+        if (b >= p->bufferCount) {
+            b = p->first;
+        }
+    }
+    p->api->freeWriter(w);
+    return NULL;
+}
+
+static int compareLatencies(const void* a, const void* b)
+{
+    long long x = *(const long long*)a;
+    long long y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Starts the producers and takes all messages with listener:nextmsg(),
+ * the listener is at the top of the stack. Returns the elapsed time in
+ * nanoseconds, latencies receives the time from adding until taking
+ * each message.
+ */
+static long long consume(lua_State* L, Producer* producers, int producerCount,
+                         long long* latencies, long total)
+{
+    int listener = lua_gettop(L);
+    lua_getfield(L, listener, "nextmsg");                       /* -> listener, nextmsg */
+    long long startTime = nowNanos();
+    int i;
+    for (i = 0; i < producerCount; ++i) {
+        pthread_create(&producers[i].thread, NULL, producerThread, &producers[i]);
+    }
+    long n;
+    for (n = 0; n < total; ++n) {
+        lua_pushvalue(L, -1);
+        lua_pushvalue(L, listener);
+        lua_call(L, 1, 1);                                      /* -> listener, nextmsg, ts */
+        latencies[n] = nowNanos() - (long long)lua_tointeger(L, -1);
+        lua_pop(L, 1);                                          /* -> listener, nextmsg */
+    }
+    long long nanos = nowNanos() - startTime;
+    for (i = 0; i < producerCount; ++i) {
+        pthread_join(producers[i].thread, NULL);
+    }
+    lua_pop(L, 1);                                              /* -> listener */
+    return nanos;
+}
+
+static double callMethodMicros(lua_State* L, const char* name, int nargs, ...)
+{
+    lua_getfield(L, -1, name);
+    lua_pushvalue(L, -2);
+    va_list ap;
+    va_start(ap, nargs);
+    int i;
+    for (i = 0; i < nargs; ++i) {
+        lua_pushboolean(L, va_arg(ap, int));
+    }
+    va_end(ap);
+    long long t = nowNanos();
+    lua_call(L, 1 + nargs, 0);
+    return (nowNanos() - t) / 1000.0;
+}
+
+static void run(lua_State* L, int bufferCount, int producerCount, long count)
+{
+    int top = lua_gettop(L);
+
+    lua_getglobal(L, "mtmsg");
+    lua_getfield(L, -1, "newlistener");
+    lua_call(L, 0, 1);                                          /* -> mtmsg, listener */
+    lua_newtable(L);                                            /* -> mtmsg, listener, buffers */
+
+    receiver_object**    receivers = malloc(bufferCount * sizeof(receiver_object*));
+    const receiver_capi* api       = NULL;
+    int i;
+    for (i = 0; i < bufferCount; ++i) {
+        lua_getfield(L, -2, "newbuffer");
+        lua_pushvalue(L, -3);
+        lua_call(L, 1, 1);                                      /* -> mtmsg, listener, buffers, buffer */
+        if (!api) {
+            api = receiver_get_capi(L, -1, NULL);
+        }
+        receivers[i] = api->toReceiver(L, -1);
+        lua_rawseti(L, -2, i + 1);                              /* -> mtmsg, listener, buffers */
+    }
+    lua_insert(L, -2);                                          /* -> mtmsg, buffers, listener */
+
+    long       total     = count * producerCount;
+    long long* latencies = malloc((total > WAKEUP_COUNT ? total : WAKEUP_COUNT) * sizeof(long long));
+    Producer*  producers = calloc(producerCount, sizeof(Producer));
+    for (i = 0; i < producerCount; ++i) {
+        Producer* p    = &producers[i];
+        p->api         = api;
+        p->receivers   = receivers;
+        p->first       = i;
+        p->step        = producerCount;
+        p->bufferCount = bufferCount;
+        p->count       = count;
+    }
+    long long nanos = consume(L, producers, producerCount, latencies, total);
+
+    /* single messages while the consumer is waiting */
+    memset(producers, 0, sizeof(Producer));
+    producers[0].api         = api;
+    producers[0].receivers   = receivers;
+    producers[0].first       = 0;
+    producers[0].step        = 7919 % bufferCount ? 7919 % bufferCount : 1;
+    producers[0].bufferCount = bufferCount;
+    producers[0].count       = WAKEUP_COUNT;
+    producers[0].pauseNanos  = 50000;
+    consume(L, producers, 1, latencies, WAKEUP_COUNT);
+    qsort(latencies, WAKEUP_COUNT, sizeof(long long), compareLatencies);
+
+    /* listener's lock is held while walking all buffers */
+    receiver_writer* w = api->newWriter(0, 2);
+    for (i = 0; i < bufferCount; ++i) {
+        api->addIntegerToWriter(w, 0);
+        api->msgToReceiver(receivers[i], w, 0, 0, NULL, NULL);
+    }
+    api->freeWriter(w);
+    double clearMicros = callMethodMicros(L, "clear", 0);
+    double abortMicros = callMethodMicros(L, "abort", 1, 1);
+    callMethodMicros(L, "abort", 1, 0);
+
+    printf("%d,%d,%ld,%.0f,%.1f,%.1f,%.1f,%.1f,%.1f\n",
+           bufferCount, producerCount, total, total / (nanos / 1e9),
+           latencies[WAKEUP_COUNT / 2] / 1000.0,
+           latencies[(long)(WAKEUP_COUNT * 0.99)] / 1000.0,
+           latencies[WAKEUP_COUNT - 1] / 1000.0,
+           clearMicros, abortMicros);
+    fflush(stdout);
+
+    free(producers);
+    free(latencies);
+    free(receivers);
+    lua_settop(L, top);
+    lua_gc(L, LUA_GCCOLLECT, 0);
+}
+
+int main(int argc, char** argv)
+{
+    int maxBuffers = (argc > 1) ? atoi(argv[1]) : 100000;
+
+    static const int producerCounts[] = { 1, 4, 16 };
+
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+    lua_pushcfunction(L, luaopen_mtmsg);
+    lua_call(L, 0, 1);
+    lua_setglobal(L, "mtmsg");
+
+    printf("buffers,producers,messages,msgs_per_s,wakeup_p50_us,wakeup_p99_us,wakeup_max_us,clear_us,abort_us\n");
+    int bufferCount;
+    for (bufferCount = 10; bufferCount <= maxBuffers; bufferCount *= 10) {
+        size_t j;
+        for (j = 0; j < sizeof(producerCounts) / sizeof(producerCounts[0]); ++j) {
+            int producerCount = producerCounts[j];
+            if (producerCount <= bufferCount) {
+                run(L, bufferCount, producerCount, 400000 / producerCount);
+            }
+        }
+    }
+    lua_close(L);
+    return 0;
+}
@@ -0,0 +1,174 @@
+/*
+ * Memory footprint of idle buffers and heap fragmentation after bursty
+ * traffic.
+ *
+ * For each buffer count N the following steps are measured:
+ *
+ *   idle   - N buffers are created with mtmsg.newbuffer(), the growth of
+ *            resident memory and of the allocated heap divided by N gives
+ *            the cost of one idle buffer
+ *   burst  - in several rounds a tenth of the buffers (at most 1000) at a
+ *            random position receives a burst of messages with random
+ *            sizes via receiver_capi.msgToReceiver, afterwards these
+ *            buffers are cleared again
+ *   after  - resident memory, allocated and free heap are reported after
+ *            the last burst, fragmentation is the part of the heap that is
+ *            free but still held by the process
+ *   closed - all buffers are garbage collected, the remaining resident
+ *            memory shows how much memory is not returned to the system
+ *
+ * Resident memory is taken from /proc/self/statm, heap figures from
+ * mallinfo2() if the C library has it, otherwise they are reported as 0.
+ *
+ * Build with "make bench" in the src directory.
+ *
+ * usage: memory_bench [max buffer count]
+ *
+ * Output is one CSV line per buffer count preceded by a header line.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    #include <malloc.h>
+    #define HAVE_MALLINFO2 1
+#endif
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+#define RECEIVER_CAPI_IMPLEMENT_GET_CAPI 1
+#include "receiver_capi.h"
+
+int luaopen_mtmsg(lua_State* L);
+
+#define BURST_ROUNDS   20
+#define BURST_BUFFERS  1000
+#define BURST_MESSAGES 16
+#define MAX_MSG_SIZE   2048
+
+typedef struct MemInfo {
+    double rss;       /* resident memory */
+    double heapUsed;  /* allocated by malloc */
+    double heapFree;  /* free but held by malloc */
+} MemInfo;
+
+static MemInfo getMemInfo()
+{
+    MemInfo m;
+    memset(&m, 0, sizeof(m));
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (f) {
+        unsigned long size, resident;
+        if (fscanf(f, "%lu %lu", &size, &resident) == 2) {
+            m.rss = (double)resident * sysconf(_SC_PAGESIZE);
+        }
+        fclose(f);
+    }
+#if HAVE_MALLINFO2
+    struct mallinfo2 mi = mallinfo2();
+    m.heapUsed = (double)mi.uordblks + mi.hblkhd;
+    m.heapFree = (double)mi.fordblks;
+#endif
+    return m;
+}
+
+static void fullGc(lua_State* L)
+{
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    lua_gc(L, LUA_GCCOLLECT, 0);
+}
+
+static void run(lua_State* L, int bufferCount)
+{
+    int top = lua_gettop(L);
+    fullGc(L);
+    MemInfo before = getMemInfo();
+
+    lua_getglobal(L, "mtmsg");                                  /* -> mtmsg */
+    lua_newtable(L);                                            /* -> mtmsg, buffers */
+    receiver_object**    receivers = malloc(bufferCount * sizeof(receiver_object*));
+    const receiver_capi* api       = NULL;
+    int i;
+    for (i = 0; i < bufferCount; ++i) {
+        lua_getfield(L, -2, "newbuffer");
+        lua_call(L, 0, 1);                                      /* -> mtmsg, buffers, buffer */
+        if (!api) {
+            api = receiver_get_capi(L, -1, NULL);
+        }
+        receivers[i] = api->toReceiver(L, -1);
+        lua_rawseti(L, -2, i + 1);                              /* -> mtmsg, buffers */
+    }
+    fullGc(L);
+    MemInfo idle = getMemInfo();
+
+    char* payload = malloc(MAX_MSG_SIZE);
+    memset(payload, 'x', MAX_MSG_SIZE);
+    receiver_writer* w = api->newWriter(0, 2);
+    srand(bufferCount);
+    int round;
+    for (round = 0; round < BURST_ROUNDS; ++round) {
+        int first = rand() % bufferCount;
+        int count = bufferCount / 10 < BURST_BUFFERS ? bufferCount / 10 : BURST_BUFFERS;
+        int j;
+        for (j = 0; j < count; ++j) {
+            receiver_object* r = receivers[(first + j) % bufferCount];
+            int k;
+            for (k = 0; k < BURST_MESSAGES; ++k) {
+                api->clearWriter(w);
+                api->addStringToWriter(w, payload, rand() % MAX_MSG_SIZE);
+                api->msgToReceiver(r, w, 0, 0, NULL, NULL);
+            }
+        }
+        for (j = 0; j < count; ++j) {
+            lua_rawgeti(L, -1, (first + j) % bufferCount + 1);
+            lua_getfield(L, -1, "clear");
+            lua_insert(L, -2);
+            lua_call(L, 1, 0);
+        }
+    }
+    api->freeWriter(w);
+    free(payload);
+    fullGc(L);
+    MemInfo after = getMemInfo();
+
+    free(receivers);
+    lua_settop(L, top);
+    fullGc(L);
+    MemInfo closed = getMemInfo();
+
+    double heapTotal = after.heapUsed + after.heapFree;
+    printf("%d,%.0f,%.0f,%.0f,%.0f,%.0f,%.3f,%.0f\n",
+           bufferCount,
+           (idle.rss - before.rss) / bufferCount,
+           (idle.heapUsed - before.heapUsed) / bufferCount,
+           after.rss / 1024,
+           after.heapUsed / 1024,
+           after.heapFree / 1024,
+           heapTotal > 0 ? after.heapFree / heapTotal : 0.0,
+           (closed.rss - before.rss) / 1024);
+    fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+    int maxBuffers = (argc > 1) ? atoi(argv[1]) : 100000;
+
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+    lua_pushcfunction(L, luaopen_mtmsg);
+    lua_call(L, 0, 1);
+    lua_setglobal(L, "mtmsg");
+
+    printf("buffers,idle_rss_bytes_per_buffer,idle_heap_bytes_per_buffer,"
+           "after_rss_kb,after_heap_used_kb,after_heap_free_kb,fragmentation,retained_rss_kb\n");
+    int bufferCount;
+    for (bufferCount = 100; bufferCount <= maxBuffers; bufferCount *= 10) {
+        run(L, bufferCount);
+    }
+    lua_close(L);
+    return 0;
+}
@@ -0,0 +1,155 @@
+/*
+ * Microbenchmark for the message serialization in serialize.c.
+ *
+ * For each value type and argument count the same value is pushed several
+ * times onto the Lua stack and the three steps of a message round trip are
+ * timed separately in tight loops:
+ *
+ *   calc   - mtmsg_serialize_calc_args_size()
+ *   encode - mtmsg_serialize_args_to_buffer()
+ *   decode - mtmsg_serialize_get_msg_args()
+ *
+ * Carray cases are only run if the carray module can be loaded.
+ *
+ * Build with "make bench" in the src directory.
+ *
+ * usage: serialize_bench
+ *
+ * Output is one CSV line per type and argument count preceded by a header
+ * line, so that results of different commits can be compared.
+ */
+#include <time.h>
+
+#include "util.h"
+#include "serialize.h"
+
+typedef struct BenchCase {
+    const char* name;
+    const char* expr; /* Lua expression for the value */
+} BenchCase;
+
+static const BenchCase cases[] =
+{
+    { "nil",            "nil"                                   },
+    { "boolean",        "true"                                  },
+    { "byte",           "200"                                   },
+    { "varint",         "-100000"                               },
+    { "integer",        "math.maxinteger or 2^53"               },
+    { "float",          "0.5"                                   },
+    { "number",         "0.1"                                   },
+    { "string_10",      "string.rep('x', 10)"                   },
+    { "string_1000",    "string.rep('x', 1000)"                 },
+    { "string_100000",  "string.rep('x', 100000)"               },
+    { "numarray_16",    "{ 1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16 }" },
+    { "table_3",        "{ a = 1, b = 'x', c = true }"          },
+    { "carray_16",      "require('carray').new('double', 16)"   },
+    { "carray_1024",    "require('carray').new('double', 1024)" },
+    { "carray_65536",   "require('carray').new('double', 65536)" },
+};
+
+static const int argCounts[] = { 1, 2, 4, 8, 16, 32, 64 };
+
+static double nowSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Pushes the value of expr, returns false if the expression cannot be
+ * evaluated, e.g. because the carray module is not available.
+ */
+static bool pushValue(lua_State* L, const char* expr)
+{
+    lua_pushfstring(L, "return %s", expr);
+    const char* chunk = lua_tostring(L, -1);
+    if (luaL_loadstring(L, chunk) != 0 || lua_pcall(L, 0, 1, 0) != 0) {
+        lua_pop(L, 2);
+        return false;
+    }
+    lua_remove(L, -2);
+    return true;
+}
+
+static void decode(lua_State* L, const char* buffer, size_t len)
+{
+    GetMsgArgsPar par; par.inBuffer       = buffer;
+                       par.inBufferSize   = len;
+                       par.inMaxArgCount  = -1;
+                       par.parsedLength   = 0;
+                       par.parsedArgCount = 0;
+                       par.carrayCapi     = NULL;
+                       par.errorArg       = 0;
+                       par.dict           = NULL;
+                       par.dictCache      = 0;
+    int top = lua_gettop(L);
+    lua_pushcfunction(L, mtmsg_serialize_get_msg_args);
+    lua_pushlightuserdata(L, &par);
+    lua_call(L, 1, LUA_MULTRET);
+    lua_settop(L, top);
+}
+
+static void run(lua_State* L, const BenchCase* c, int argCount)
+{
+    int top = lua_gettop(L);
+    if (!pushValue(L, c->expr)) {
+        return;
+    }
+    int firstArg = top + 1;
+    int i;
+    for (i = 1; i < argCount; ++i) {
+        lua_pushvalue(L, firstArg);
+    }
+    int    errorArg = 0;
+    size_t size     = mtmsg_serialize_calc_args_size(L, firstArg, &errorArg);
+    char*  buffer   = malloc(size);
+    if (errorArg || !buffer) {
+        fprintf(stderr, "cannot serialize %s\n", c->name);
+        free(buffer);
+        lua_settop(L, top);
+        return;
+    }
+    /* roughly the same amount of work for each case */
+    long iterations = (long)(5e7 / (size + 64 * argCount));
+    if (iterations < 10) {
+        iterations = 10;
+    }
+    long   n;
+    double t0 = nowSeconds();
+    for (n = 0; n < iterations; ++n) {
+        mtmsg_serialize_calc_args_size(L, firstArg, &errorArg);
+    }
+    double t1 = nowSeconds();
+    for (n = 0; n < iterations; ++n) {
+        mtmsg_serialize_args_to_buffer(L, firstArg, buffer, NULL);
+    }
+    double t2 = nowSeconds();
+    for (n = 0; n < iterations; ++n) {
+        decode(L, buffer, size);
+    }
+    double t3 = nowSeconds();
+    double args = (double)iterations * argCount;
+    printf("%s,%d,%.1f,%.1f,%.1f,%.1f\n", c->name, argCount, (double)size / argCount,
+           (t1 - t0) / args * 1e9, (t2 - t1) / args * 1e9, (t3 - t2) / args * 1e9);
+    fflush(stdout);
+    free(buffer);
+    lua_settop(L, top);
+    lua_gc(L, LUA_GCCOLLECT, 0);
+}
+
+int main(int argc, char** argv)
+{
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+
+    printf("type,args,bytes_per_arg,calc_ns_per_arg,encode_ns_per_arg,decode_ns_per_arg\n");
+    size_t i, j;
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        for (j = 0; j < sizeof(argCounts) / sizeof(argCounts[0]); ++j) {
+            run(L, &cases[i], argCounts[j]);
+        }
+    }
+    lua_close(L);
+    return 0;
+}
@@ -0,0 +1,57 @@
+-- Messages between threads: a producer thread created with llthreads2 adds
+-- messages, the main thread takes them. The round trip benchmark sends each
+-- message back before the next message is sent.
+--
+-- usage: lua threads.lua
+
+package.path = (arg[0]:match("^(.-)[^/\\]*$") or "").."?.lua;"..package.path
+
+local llthreads = require("llthreads2.ex")
+local mtmsg     = require("mtmsg")
+local bench     = require("benchutil")
+
+bench.header("threads")
+
+local function producer(name, size)
+    bench.measure(name, function(n)
+        local b = mtmsg.newbuffer(64 * 1024 + size, 0)
+        local thread = llthreads.new(function(id, n, size)
+            local mtmsg = require("mtmsg")
+            local b     = mtmsg.buffer(id)
+            local s     = (size > 0) and string.rep("x", size) or nil
+            for i = 1, n do
+                while not b:addmsg(i, s) do
+                    mtmsg.sleep(0)
+                end
+            end
+        end, b:id(), n, size)
+        assert(thread:start())
+        for i = 1, n do
+            b:nextmsg()
+        end
+        assert(thread:join())
+    end)
+end
+
+producer("producer thread integer",          0)
+producer("producer thread string 100 bytes", 100)
+producer("producer thread string 10000 bytes", 10000)
+
+bench.measure("round trip between threads", function(n)
+    local b1 = mtmsg.newbuffer()
+    local b2 = mtmsg.newbuffer()
+    local thread = llthreads.new(function(id1, id2, n)
+        local mtmsg = require("mtmsg")
+        local b1    = mtmsg.buffer(id1)
+        local b2    = mtmsg.buffer(id2)
+        for i = 1, n do
+            b2:addmsg(b1:nextmsg())
+        end
+    end, b1:id(), b2:id(), n)
+    assert(thread:start())
+    for i = 1, n do
+        b1:addmsg(i)
+        assert(b2:nextmsg() == i)
+    end
+    assert(thread:join())
+end)
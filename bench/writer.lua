@@ -0,0 +1,59 @@
+-- Writer and reader objects: building messages with writer:add() and
+-- decoding them with reader:next().
+--
+-- usage: lua writer.lua
+
+package.path = (arg[0]:match("^(.-)[^/\\]*$") or "").."?.lua;"..package.path
+
+local mtmsg = require("mtmsg")
+local bench = require("benchutil")
+
+bench.header("writer/reader")
+
+local b = mtmsg.newbuffer()
+local w = mtmsg.newwriter()
+local r = mtmsg.newreader()
+
+bench.measure("writer:addmsg/reader:nextmsg integer", function(n)
+    for i = 1, n do
+        w:add(i)
+        w:addmsg(b)
+        r:nextmsg(b)
+        r:next()
+    end
+end)
+
+bench.measure("writer:addmsg/reader:nextmsg 10 values", function(n)
+    for i = 1, n do
+        w:add(i, i, i, i, i, "a", "b", "c", 0.5, true)
+        w:addmsg(b)
+        r:nextmsg(b)
+        r:next(10)
+    end
+end)
+
+local s = string.rep("x", 1000)
+bench.measure("writer:addmsg/reader:nextmsg string 1000 bytes", function(n)
+    for i = 1, n do
+        w:add(s)
+        w:addmsg(b)
+        r:nextmsg(b)
+        r:next()
+    end
+end)
+
+bench.measure("writer:setmsg/reader:nextmsg integer", function(n)
+    for i = 1, n do
+        w:add(i)
+        w:setmsg(b)
+        r:nextmsg(b)
+        r:next()
+    end
+end)
+
+bench.measure("writer:add/clear 10 values", function(n)
+    for i = 1, n do
+        w:add(i, i, i, i, i, "a", "b", "c", 0.5, true)
+        w:clear()
+    end
+end)
@@ -66,6 +66,10 @@
     #include <errno.h>
     #include <sys/time.h>
     #include <pthread.h>
+    /* robust mutexes are not available on macOS */
+    #if defined(EOWNERDEAD) && !defined(__APPLE__) && !defined(MTMSG_ASYNC_NO_ROBUST_MUTEX)
+        #define MTMSG_ASYNC_USE_ROBUST_MUTEX
+    #endif
 #endif
 #if defined(MTMSG_ASYNC_USE_WIN32) || defined(MTMSG_ASYNC_USE_WINTHREAD)
     #include <windows.h>
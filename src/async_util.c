@@ -47,6 +47,9 @@ void mtmsg_async_lock_destruct(Lock* lock)
 
 void mtmsg_async_mutex_init(Mutex* mutex)
 {
+#if defined(MTMSG_LOCKSTATS)
+    memset(&mutex->stats, 0, sizeof(MutexStats));
+#endif
 #if defined(MTMSG_ASYNC_USE_PTHREAD)
 
     int rc = pthread_mutexattr_init(&mutex->attr);
@@ -82,6 +85,39 @@ void mtmsg_async_mutex_init(Mutex* mutex)
 #endif
 }
 
+bool mtmsg_async_mutex_init_shared(Mutex* mutex)
+{
+#if defined(MTMSG_LOCKSTATS)
+    memset(&mutex->stats, 0, sizeof(MutexStats));
+#endif
+#if defined(MTMSG_ASYNC_USE_PTHREAD)
+
+    pthread_condattr_t condattr;
+    
+    mutex->ownerDied = 0;
+    if (   pthread_mutexattr_init(&mutex->attr) != 0
+        || pthread_mutexattr_settype(&mutex->attr, PTHREAD_MUTEX_RECURSIVE) != 0
+        || pthread_mutexattr_setpshared(&mutex->attr, PTHREAD_PROCESS_SHARED) != 0
+#if defined(MTMSG_ASYNC_USE_ROBUST_MUTEX)
+        || pthread_mutexattr_setrobust(&mutex->attr, PTHREAD_MUTEX_ROBUST) != 0
+#endif
+        || pthread_mutex_init(&mutex->mutex, &mutex->attr) != 0)
+    {
+        return false;
+    }
+    if (pthread_condattr_init(&condattr) != 0) {
+        return false;
+    }
+    bool ok =    pthread_condattr_setpshared(&condattr, PTHREAD_PROCESS_SHARED) == 0
+              && pthread_cond_init(&mutex->condition, &condattr) == 0;
+    pthread_condattr_destroy(&condattr);
+    return ok;
+
+#else
+    return false;
+#endif
+}
+
 void mtmsg_async_mutex_destruct(Mutex* mutex)
 {
 #if defined(MTMSG_ASYNC_USE_PTHREAD)
@@ -97,12 +133,12 @@ void mtmsg_async_mutex_destruct(Mutex* mutex)
 #endif
 }
 
-void mtmsg_async_mutex_wait(Mutex* mutex) 
+static void waitMutex(Mutex* mutex) 
 {
 #if defined(MTMSG_ASYNC_USE_PTHREAD)
 
     int rc = pthread_cond_wait(&mutex->condition, &mutex->mutex);
-    if (rc != 0) { async_util_abort(rc, __LINE__); }
+    async_mutex_check_acquired(mutex, rc, __LINE__);
 
 #elif defined(MTMSG_ASYNC_USE_WINTHREAD)
 
@@ -124,7 +160,7 @@ void mtmsg_async_mutex_wait(Mutex* mutex)
 }
 
 
-bool mtmsg_async_mutex_wait_millis(Mutex* mutex, int timeoutMillis)
+static bool waitMutexMillis(Mutex* mutex, int timeoutMillis)
 {
 #if defined(MTMSG_ASYNC_USE_PTHREAD)
     struct timespec abstime;
@@ -137,12 +173,11 @@ bool mtmsg_async_mutex_wait_millis(Mutex* mutex, int timeoutMillis)
     
     int rc = pthread_cond_timedwait(&mutex->condition, &mutex->mutex, &abstime);
     
-    if (rc == 0 || rc == ETIMEDOUT) {
-        return (rc == 0);
-    }
-    else {
-        return async_util_abort(rc, __LINE__);
+    if (rc == ETIMEDOUT) {
+        return false;
     }
+    async_mutex_check_acquired(mutex, rc, __LINE__);
+    return true;
 #elif defined(MTMSG_ASYNC_USE_WINTHREAD)
     mutex->waitingCounter += 1;
     LeaveCriticalSection(&mutex->mutex);
@@ -177,3 +212,45 @@ bool mtmsg_async_mutex_wait_millis(Mutex* mutex, int timeoutMillis)
 
 #endif
 }
+
+#if defined(MTMSG_LOCKSTATS)
+
+/* the mutex is released while waiting */
+static int beforeWait(Mutex* mutex)
+{
+    int depth = mutex->stats.depth;
+    mutex->stats.depth = 1;
+    async_lockstats_released(mutex);
+    return depth;
+}
+
+static void afterWait(Mutex* mutex, int depth)
+{
+    mutex->stats.depth     = depth;
+    mutex->stats.holdStart = async_lockstats_now();
+}
+
+#endif /* MTMSG_LOCKSTATS */
+
+void mtmsg_async_mutex_wait(Mutex* mutex)
+{
+#if defined(MTMSG_LOCKSTATS)
+    int depth = beforeWait(mutex);
+    waitMutex(mutex);
+    afterWait(mutex, depth);
+#else
+    waitMutex(mutex);
+#endif
+}
+
+bool mtmsg_async_mutex_wait_millis(Mutex* mutex, int timeoutMillis)
+{
+#if defined(MTMSG_LOCKSTATS)
+    int  depth = beforeWait(mutex);
+    bool rslt  = waitMutexMillis(mutex, timeoutMillis);
+    afterWait(mutex, depth);
+    return rslt;
+#else
+    return waitMutexMillis(mutex, timeoutMillis);
+#endif
+}
@@ -107,6 +107,30 @@ static inline int atomic_set(AtomicCounter* value, int newValue)
 
 /* -------------------------------------------------------------------------------------------- */
 
+static inline void atomic_release_fence()
+{
+#if defined(MTMSG_ASYNC_USE_WIN32)
+    MemoryBarrier();
+#elif defined(MTMSG_ASYNC_USE_STDATOMIC)
+    atomic_thread_fence(memory_order_release);
+#elif defined(MTMSG_ASYNC_USE_GNU)
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+#endif
+}
+
+static inline void atomic_acquire_fence()
+{
+#if defined(MTMSG_ASYNC_USE_WIN32)
+    MemoryBarrier();
+#elif defined(MTMSG_ASYNC_USE_STDATOMIC)
+    atomic_thread_fence(memory_order_acquire);
+#elif defined(MTMSG_ASYNC_USE_GNU)
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+#endif
+}
+
+/* -------------------------------------------------------------------------------------------- */
+
 
 typedef struct
 {
@@ -171,12 +195,47 @@ static inline void async_lock_release(Lock* lock)
 
 /* -------------------------------------------------------------------------------------------- */
 
+#if defined(MTMSG_LOCKSTATS)
+
+/* counters are only modified by the thread that holds the mutex */
+typedef struct
+{
+    unsigned long long    acquisitions;
+    unsigned long long    contended;     /* acquisitions that had to wait */
+    unsigned long long    waitNanos;     /* total time waited for the mutex */
+    unsigned long long    maxHoldNanos;
+    unsigned long long    holdStart;
+    int                   depth;         /* mutexes are recursive */
+} MutexStats;
+
+static inline unsigned long long async_lockstats_now()
+{
+#if defined(MTMSG_ASYNC_USE_WIN32)
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER        counter;
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&counter);
+    return (unsigned long long)((double)counter.QuadPart * 1e9 / frequency.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+#endif /* MTMSG_LOCKSTATS */
+
+/* -------------------------------------------------------------------------------------------- */
+
 typedef struct
 {
 #if defined(MTMSG_ASYNC_USE_PTHREAD)
     pthread_mutexattr_t   attr;
     pthread_mutex_t       mutex;
     pthread_cond_t        condition;
+    unsigned int          ownerDied;     /* owners of a robust mutex that died holding it */
 
 #elif defined(MTMSG_ASYNC_USE_WINTHREAD)
     CRITICAL_SECTION      mutex;
@@ -187,6 +246,9 @@ typedef struct
     mtx_t                 mutex;
     cnd_t                 condition;
 #endif
+#if defined(MTMSG_LOCKSTATS)
+    MutexStats            stats;
+#endif
 } Mutex;
 
 
@@ -197,17 +259,46 @@ void async_mutex_init(Mutex* mutex);
 
 /* -------------------------------------------------------------------------------------------- */
 
+/* for a mutex in shared memory that is used by several processes, the mutex
+ * is robust if supported: if a process dies while holding the mutex, the
+ * next locking thread acquires it and ownerDied is incremented */
+#define async_mutex_init_shared mtmsg_async_mutex_init_shared
+bool async_mutex_init_shared(Mutex* mutex);
+
+/* -------------------------------------------------------------------------------------------- */
+
+#if defined(MTMSG_ASYNC_USE_PTHREAD)
+
+/* checks the result of a function that acquires the mutex */
+static inline void async_mutex_check_acquired(Mutex* mutex, int rc, int line)
+{
+#if defined(MTMSG_ASYNC_USE_ROBUST_MUTEX)
+    if (rc == EOWNERDEAD) {
+        rc = pthread_mutex_consistent(&mutex->mutex);
+        mutex->ownerDied += 1;
+#if defined(MTMSG_LOCKSTATS)
+        mutex->stats.depth = 0;
+#endif
+    }
+#endif
+    if (rc != 0) { async_util_abort(rc, line); }
+}
+
+#endif
+
+/* -------------------------------------------------------------------------------------------- */
+
 #define async_mutex_destruct mtmsg_async_mutex_destruct
 void async_mutex_destruct(Mutex* mutex);
 
 /* -------------------------------------------------------------------------------------------- */
 
-static inline void async_mutex_lock(Mutex* mutex) 
+static inline void async_mutex_lock0(Mutex* mutex) 
 {
 #if defined(MTMSG_ASYNC_USE_PTHREAD)
 
     int rc = pthread_mutex_lock(&mutex->mutex);
-    if (rc != 0) { async_util_abort(rc, __LINE__); }
+    async_mutex_check_acquired(mutex, rc, __LINE__);
 
 #elif defined(MTMSG_ASYNC_USE_WINTHREAD)
     EnterCriticalSection(&mutex->mutex);
@@ -220,15 +311,15 @@ static inline void async_mutex_lock(Mutex* mutex)
 
 /* -------------------------------------------------------------------------------------------- */
 
-static inline bool async_mutex_trylock(Mutex* mutex) 
+static inline bool async_mutex_trylock0(Mutex* mutex) 
 {
 #if defined(MTMSG_ASYNC_USE_PTHREAD)
     int rc = pthread_mutex_trylock(&mutex->mutex);
-    if (rc == 0 || rc == EBUSY) {
-        return (rc == 0);
-    } else {
-        return async_util_abort(rc, __LINE__);
+    if (rc == EBUSY) {
+        return false;
     }
+    async_mutex_check_acquired(mutex, rc, __LINE__);
+    return true;
 #elif defined(MTMSG_ASYNC_USE_WINTHREAD)
     return TryEnterCriticalSection(&mutex->mutex) != 0;
 
@@ -244,7 +335,7 @@ static inline bool async_mutex_trylock(Mutex* mutex)
 
 /* -------------------------------------------------------------------------------------------- */
 
-static inline void async_mutex_unlock(Mutex* mutex) 
+static inline void async_mutex_unlock0(Mutex* mutex) 
 {
 #if defined(MTMSG_ASYNC_USE_PTHREAD)
 
@@ -262,6 +353,72 @@ static inline void async_mutex_unlock(Mutex* mutex)
 
 /* -------------------------------------------------------------------------------------------- */
 
+#if defined(MTMSG_LOCKSTATS)
+
+static inline void async_lockstats_acquired(Mutex* mutex)
+{
+    if (mutex->stats.depth++ == 0) {
+        mutex->stats.acquisitions += 1;
+        mutex->stats.holdStart     = async_lockstats_now();
+    }
+}
+
+static inline void async_lockstats_released(Mutex* mutex)
+{
+    if (--mutex->stats.depth == 0) {
+        unsigned long long hold = async_lockstats_now() - mutex->stats.holdStart;
+        if (hold > mutex->stats.maxHoldNanos) {
+            mutex->stats.maxHoldNanos = hold;
+        }
+    }
+}
+
+#endif /* MTMSG_LOCKSTATS */
+
+/* -------------------------------------------------------------------------------------------- */
+
+static inline void async_mutex_lock(Mutex* mutex) 
+{
+#if defined(MTMSG_LOCKSTATS)
+    if (!async_mutex_trylock0(mutex)) {
+        unsigned long long start = async_lockstats_now();
+        async_mutex_lock0(mutex);
+        mutex->stats.contended += 1;
+        mutex->stats.waitNanos += async_lockstats_now() - start;
+    }
+    async_lockstats_acquired(mutex);
+#else
+    async_mutex_lock0(mutex);
+#endif
+}
+
+/* -------------------------------------------------------------------------------------------- */
+
+static inline bool async_mutex_trylock(Mutex* mutex) 
+{
+#if defined(MTMSG_LOCKSTATS)
+    if (async_mutex_trylock0(mutex)) {
+        async_lockstats_acquired(mutex);
+        return true;
+    }
+    return false;
+#else
+    return async_mutex_trylock0(mutex);
+#endif
+}
+
+/* -------------------------------------------------------------------------------------------- */
+
+static inline void async_mutex_unlock(Mutex* mutex) 
+{
+#if defined(MTMSG_LOCKSTATS)
+    async_lockstats_released(mutex);
+#endif
+    async_mutex_unlock0(mutex);
+}
+
+/* -------------------------------------------------------------------------------------------- */
+
 #define async_mutex_wait mtmsg_async_mutex_wait
 void async_mutex_wait(Mutex* mutex);
 
@@ -0,0 +1,646 @@
+/* system headers must be included before util.h sets the symbol visibility */
+#include "async_defines.h"
+
+#ifndef MTMSG_ASYNC_USE_WIN32
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <sys/un.h>
+#endif
+
+#include "bridge.h"
+#include "buffer.h"
+#include "serialize.h"
+#include "main.h"
+#include "error.h"
+
+static const char* const MTMSG_BRIDGE_CLASS_NAME = "mtmsg.bridge";
+
+#if defined(MTMSG_ASYNC_USE_PTHREAD) && !defined(MTMSG_ASYNC_USE_WIN32)
+
+/* interval for checking if the bridge is closed while waiting */
+#define BRIDGE_POLL_MILLIS 100
+
+/* minimal free space for reading from the socket */
+#define BRIDGE_READ_SIZE   (64 * 1024)
+
+/* maximal time for finishing a partially sent message if the bridge is closed */
+#define BRIDGE_CLOSE_MILLIS 1000
+
+#ifdef MSG_NOSIGNAL
+    #define BRIDGE_SEND_FLAGS MSG_NOSIGNAL
+#else
+    #define BRIDGE_SEND_FLAGS 0
+#endif
+
+typedef struct BridgeUserData {
+    MsgBuffer*    buffer;
+    int           socketFd;      /* listening socket if receiving */
+    int           connFd;        /* accepted connection if receiving */
+    char*         socketPath;    /* is removed on close if receiving */
+    dev_t         socketDev;     /* identifies the socket file that was bound */
+    ino_t         socketIno;
+    bool          socketBound;
+    pthread_t     thread;
+    bool          threadStarted;
+    AtomicCounter stopped;
+    AtomicCounter running;
+    Mutex         mutex;         /* guards msgCount and errorMessage */
+    bool          mutexInitialized;
+    lua_Integer   msgCount;
+    char          errorMessage[256];
+} BridgeUserData;
+
+
+static void setupBridgeMeta(lua_State* L);
+
+static int pushBridgeMeta(lua_State* L)
+{
+    if (luaL_newmetatable(L, MTMSG_BRIDGE_CLASS_NAME)) {
+        setupBridgeMeta(L);
+    }
+    return 1;
+}
+
+static void setError(BridgeUserData* u, const char* what, int error)
+{
+    async_mutex_lock(&u->mutex);
+    if (!u->errorMessage[0]) {
+        if (error) {
+            snprintf(u->errorMessage, sizeof(u->errorMessage), "%s: %s", what, strerror(error));
+        } else {
+            snprintf(u->errorMessage, sizeof(u->errorMessage), "%s", what);
+        }
+    }
+    async_mutex_unlock(&u->mutex);
+}
+
+static void addMsgCount(BridgeUserData* u, int count)
+{
+    async_mutex_lock(&u->mutex);
+    u->msgCount += count;
+    async_mutex_unlock(&u->mutex);
+}
+
+/**
+ * Waits until fd is ready. Returns false if the bridge was closed and
+ * fd did not become ready within BRIDGE_POLL_MILLIS.
+ */
+static bool waitForFd(BridgeUserData* u, int fd, short events)
+{
+    while (true) {
+        struct pollfd p;
+        p.fd      = fd;
+        p.events  = events;
+        p.revents = 0;
+        int rc = poll(&p, 1, BRIDGE_POLL_MILLIS);
+        if (rc > 0) {
+            return true;
+        }
+        if (rc < 0 && errno != EINTR) {
+            setError(u, "cannot wait for socket", errno);
+            return false;
+        }
+        if (rc == 0 && atomic_get(&u->stopped)) {
+            return false;
+        }
+    }
+}
+
+static bool sendAll(BridgeUserData* u, const char* data, size_t len)
+{
+    while (len > 0) {
+        if (!waitForFd(u, u->socketFd, POLLOUT)) {
+            return false;
+        }
+        ssize_t n = send(u->socketFd, data, len, BRIDGE_SEND_FLAGS);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
+                continue;
+            }
+            setError(u, "cannot write to socket", errno);
+            return false;
+        }
+        data += n;
+        len  -= n;
+    }
+    return true;
+}
+
+/**
+ * Sends the framed messages in data. If the bridge is closed, sending stops
+ * at the next message boundary, the message that is being sent is finished
+ * within BRIDGE_CLOSE_MILLIS. Returns the number of sent bytes, which is 
+ * less than len if the bridge was closed or on error.
+ */
+static size_t sendMsgs(BridgeUserData* u, const char* data, size_t len)
+{
+    size_t     sent     = 0;
+    size_t     msgStart = 0;
+    size_t     msgEnd   = 0;
+    lua_Number deadline = -1;
+    while (sent < len) {
+        if (sent == msgEnd) {
+            SerializedMsgSizes sizes;
+            mtmsg_serialize_parse_header(data + msgEnd, &sizes);
+            msgStart = msgEnd;
+            msgEnd  += sizes.header_size + sizes.args_size;
+        }
+        size_t limit = len;
+        if (atomic_get(&u->stopped)) {
+            if (sent == msgStart) {
+                break;
+            }
+            lua_Number now = mtmsg_current_time_seconds();
+            if (deadline < 0) {
+                deadline = now + BRIDGE_CLOSE_MILLIS * 0.001;
+            } else if (now >= deadline) {
+                break;
+            }
+            limit = msgEnd;
+        }
+        struct pollfd p;
+        p.fd      = u->socketFd;
+        p.events  = POLLOUT;
+        p.revents = 0;
+        int rc = poll(&p, 1, BRIDGE_POLL_MILLIS);
+        if (rc < 0 && errno != EINTR) {
+            setError(u, "cannot wait for socket", errno);
+            break;
+        }
+        if (rc <= 0) {
+            continue;
+        }
+        ssize_t n = send(u->socketFd, data + sent, limit - sent, BRIDGE_SEND_FLAGS);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
+                continue;
+            }
+            setError(u, "cannot write to socket", errno);
+            break;
+        }
+        sent += n;
+    }
+    return sent;
+}
+
+static void setBufferError(BridgeUserData* u, int rc)
+{
+    switch (rc) {
+        case -1: setError(u, "buffer was closed", 0); break;
+        case -2: setError(u, "operation was aborted", 0); break;
+        case -3: setError(u, "buffer has a string dictionary", 0); break;
+        case -6: setError(u, "cannot read spill file", 0); break;
+        default: setError(u, "out of memory", 0); break;
+    }
+}
+
+/**
+ * Sends the stream header followed by the framed messages as they are
+ * stored in the buffer. All messages in the buffer are taken at once and
+ * written outside the buffer's lock. Messages that were not sent completely
+ * are put back into the buffer.
+ */
+static void* sendingThread(void* arg)
+{
+    BridgeUserData* u = arg;
+    MemBuffer       out;
+    mtmsg_membuf_init(&out, 0, 2);
+
+    char header[BUFFER_DUMP_HEADER_SIZE];
+    bool portable = atomic_get(&u->buffer->portable);
+    mtmsg_buffer_dump_header(header, portable);
+
+    if (sendAll(u, header, sizeof(header))) {
+        while (!atomic_get(&u->stopped)) {
+            out.bufferStart  = out.bufferData;
+            out.bufferLength = 0;
+            int count = mtmsg_buffer_take_msgs(u->buffer, &out, 0, BRIDGE_POLL_MILLIS * 0.001);
+            if (count < 0) {
+                setBufferError(u, count);
+                break;
+            }
+            if (count > 0 && portable && !mtmsg_serialize_is_portable_msgs(out.bufferStart, out.bufferLength)) {
+                /* the receiver does not check the platform for a portable stream */
+                if (mtmsg_buffer_unget_msgs(u->buffer, out.bufferStart, out.bufferLength, count) != 0) {
+                    setError(u, "unsent messages cannot be put back into buffer", 0);
+                } else {
+                    setError(u, "buffer contains messages that are not portable", 0);
+                }
+                break;
+            }
+            if (count > 0) {
+                size_t sent      = sendMsgs(u, out.bufferStart, out.bufferLength);
+                size_t pos       = 0;
+                int    sentCount = 0;
+                while (sentCount < count) {
+                    SerializedMsgSizes sizes;
+                    mtmsg_serialize_parse_header(out.bufferStart + pos, &sizes);
+                    size_t msgLen = sizes.header_size + sizes.args_size;
+                    if (pos + msgLen > sent) {
+                        break;
+                    }
+                    pos       += msgLen;
+                    sentCount += 1;
+                }
+                addMsgCount(u, sentCount);
+                if (sentCount < count) {
+                    int rc = mtmsg_buffer_unget_msgs(u->buffer, out.bufferStart + pos, out.bufferLength - pos, 
+                                                     count - sentCount);
+                    if (rc != 0) {
+                        setError(u, "unsent messages cannot be put back into buffer", 0);
+                    }
+                    break;
+                }
+            }
+        }
+    }
+    mtmsg_membuf_free(&out);
+    atomic_set(&u->running, 0);
+    return NULL;
+}
+
+/**
+ * Appends the complete messages in the beginning of in to the buffer.
+ * Returns false on error or if the bridge was closed.
+ */
+static bool putMsgs(BridgeUserData* u, MemBuffer* in)
+{
+    size_t len;
+    int    count = mtmsg_serialize_count_complete_msgs(in->bufferStart, in->bufferLength, &len);
+
+    size_t msgSize;
+    if (mtmsg_buffer_is_too_large(u->buffer, in->bufferStart, in->bufferLength, &msgSize)) {
+        setError(u, "message is too large for buffer", 0);
+        return false;
+    }
+    int check = mtmsg_serialize_check_msgs(in->bufferStart, len);
+    if (check != 0) {
+        setError(u, (check == -2) ? "out of memory" : "corrupt message data", 0);
+        return false;
+    }
+    while (count > 0) {
+        size_t putLen;
+        int    rc = mtmsg_buffer_put_msgs(NULL, u->buffer, in->bufferStart, len, count, true, &putLen);
+        if (rc == 0 || rc == -4) {
+            /* buffer is full */
+            if (atomic_get(&u->stopped)) {
+                return false;
+            }
+            poll(NULL, 0, 1);
+            continue;
+        }
+        if (rc < 0) {
+            setBufferError(u, rc);
+            return false;
+        }
+        in->bufferStart  += putLen;
+        in->bufferLength -= putLen;
+        len              -= putLen;
+        count            -= rc;
+        addMsgCount(u, rc);
+    }
+    if (in->bufferLength == 0) {
+        in->bufferStart = in->bufferData;
+    }
+    return true;
+}
+
+/**
+ * Accepts one connection and appends the received messages to the buffer
+ * until the connection is closed by the peer. Connections that are closed
+ * without sending any data, e.g. by newbridge() checking if the socket is 
+ * in use, are ignored.
+ */
+static void* receivingThread(void* arg)
+{
+    BridgeUserData* u = arg;
+    MemBuffer       in;
+    mtmsg_membuf_init(&in, 0, 2);
+    bool headerChecked = false;
+    bool accepting     = true;
+
+    while (accepting) {
+        accepting = false;
+        while (u->connFd < 0 && waitForFd(u, u->socketFd, POLLIN)) {
+            int fd = accept(u->socketFd, NULL, NULL);
+            if (fd >= 0) {
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                u->connFd = fd;
+            } else if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+                setError(u, "cannot accept connection", errno);
+                break;
+            }
+        }
+        while (u->connFd >= 0 && waitForFd(u, u->connFd, POLLIN)) {
+            if (mtmsg_membuf_reserve(&in, BRIDGE_READ_SIZE) != 0) {
+                setError(u, "out of memory", 0);
+                break;
+            }
+            ssize_t n = recv(u->connFd, in.bufferStart + in.bufferLength, BRIDGE_READ_SIZE, 0);
+            if (n < 0) {
+                if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
+                    continue;
+                }
+                setError(u, "cannot read from socket", errno);
+                break;
+            }
+            if (n == 0) {
+                if (!headerChecked && in.bufferLength == 0) {
+                    close(u->connFd);
+                    u->connFd = -1;
+                    accepting = true;
+                } else if (in.bufferLength > 0 || !headerChecked) {
+                    setError(u, "connection closed within message", 0);
+                }
+                break;
+            }
+            in.bufferLength += n;
+            if (!headerChecked) {
+                if (in.bufferLength < BUFFER_DUMP_HEADER_SIZE) {
+                    continue;
+                }
+                const char* reason = mtmsg_buffer_check_dump_header(in.bufferStart, in.bufferLength);
+                if (reason) {
+                    setError(u, reason, 0);
+                    break;
+                }
+                in.bufferStart  += BUFFER_DUMP_HEADER_SIZE;
+                in.bufferLength -= BUFFER_DUMP_HEADER_SIZE;
+                headerChecked = true;
+            }
+            if (!putMsgs(u, &in)) {
+                break;
+            }
+        }
+    }
+    mtmsg_membuf_free(&in);
+    atomic_set(&u->running, 0);
+    return NULL;
+}
+
+static void releaseBuffer(MsgBuffer* b)
+{
+    mtmsg_global_lock_acquire();
+    if (atomic_dec(&b->used) == 0) {
+        mtmsg_free_buffer(b);
+    }
+    async_mutex_unlock(mtmsg_global_lock);
+}
+
+static void closeBridge(BridgeUserData* u)
+{
+    if (u->threadStarted) {
+        atomic_set(&u->stopped, 1);
+        pthread_join(u->thread, NULL);
+        u->threadStarted = false;
+    }
+    if (u->connFd >= 0) {
+        close(u->connFd);
+        u->connFd = -1;
+    }
+    if (u->socketFd >= 0) {
+        close(u->socketFd);
+        u->socketFd = -1;
+        if (u->socketBound) {
+            /* the path could have been bound again by another process */
+            struct stat st;
+            if (   lstat(u->socketPath, &st) == 0 && S_ISSOCK(st.st_mode)
+                && st.st_dev == u->socketDev && st.st_ino == u->socketIno)
+            {
+                unlink(u->socketPath);
+            }
+            u->socketBound = false;
+        }
+    }
+    if (u->socketPath) {
+        free(u->socketPath);
+        u->socketPath = NULL;
+    }
+    if (u->buffer) {
+        releaseBuffer(u->buffer);
+        u->buffer = NULL;
+    }
+}
+
+/**
+ * Removes a socket file that was left over from a previous run, i.e. nobody
+ * is listening on it. Other files are not removed, bind fails for these.
+ */
+static void removeStaleSocket(const struct sockaddr_un* addr)
+{
+    struct stat st;
+    if (lstat(addr->sun_path, &st) != 0 || !S_ISSOCK(st.st_mode)) {
+        return;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0) {
+        if (connect(fd, (const struct sockaddr*)addr, sizeof(*addr)) != 0 && errno == ECONNREFUSED) {
+            unlink(addr->sun_path);
+        }
+        close(fd);
+    }
+}
+
+static int Mtmsg_newBridge(lua_State* L)
+{
+    int arg = 1;
+    BufferUserData* bufferUdata = luaL_checkudata(L, arg++, MTMSG_BUFFER_CLASS_NAME);
+    size_t          pathLength;
+    const char*     path        = luaL_checklstring(L, arg++, &pathLength);
+    bool            sending     = true;
+    if (!lua_isnoneornil(L, arg)) {
+        const char* mode = luaL_checkstring(L, arg);
+        if (strcmp(mode, "receive") == 0) {
+            sending = false;
+        } else if (strcmp(mode, "send") != 0) {
+            return luaL_argerror(L, arg, "\"send\" or \"receive\" expected");
+        }
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    luaL_argcheck(L, pathLength < sizeof(addr.sun_path), 2, "socket path too long");
+    memcpy(addr.sun_path, path, pathLength + 1);
+
+    BridgeUserData* udata = lua_newuserdata(L, sizeof(BridgeUserData));
+    memset(udata, 0, sizeof(BridgeUserData));
+    udata->socketFd = -1;
+    udata->connFd   = -1;
+    pushBridgeMeta(L);
+    lua_setmetatable(L, -2);
+
+    async_mutex_init(&udata->mutex);
+    udata->mutexInitialized = true;
+
+    udata->socketPath = malloc(pathLength + 1);
+    if (!udata->socketPath) {
+        return mtmsg_ERROR_OUT_OF_MEMORY_bytes(L, pathLength + 1);
+    }
+    memcpy(udata->socketPath, path, pathLength + 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        lua_pushfstring(L, "cannot create socket: %s", strerror(errno));
+        return mtmsg_ERROR_FILE_ERROR(L, lua_tostring(L, -1));
+    }
+    if (sending) {
+        if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            int error = errno;
+            close(fd);
+            lua_pushfstring(L, "cannot connect to socket '%s': %s", path, strerror(error));
+            return mtmsg_ERROR_FILE_ERROR(L, lua_tostring(L, -1));
+        }
+    #ifdef SO_NOSIGPIPE
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+    #endif
+    } else {
+        removeStaleSocket(&addr);
+        if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            int error = errno;
+            close(fd);
+            lua_pushfstring(L, "cannot listen on socket '%s': %s", path, strerror(error));
+            return mtmsg_ERROR_FILE_ERROR(L, lua_tostring(L, -1));
+        }
+        struct stat st;
+        if (lstat(path, &st) == 0) {
+            udata->socketDev   = st.st_dev;
+            udata->socketIno   = st.st_ino;
+            udata->socketBound = true;
+        }
+        if (listen(fd, 1) != 0) {
+            int error = errno;
+            udata->socketFd = fd;
+            closeBridge(udata);
+            lua_pushfstring(L, "cannot listen on socket '%s': %s", path, strerror(error));
+            return mtmsg_ERROR_FILE_ERROR(L, lua_tostring(L, -1));
+        }
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    udata->socketFd = fd;
+
+    udata->buffer = bufferUdata->buffer;
+    atomic_inc(&udata->buffer->used);
+
+    atomic_set(&udata->running, 1);
+    int rc = pthread_create(&udata->thread, NULL, sending ? sendingThread : receivingThread, udata);
+    if (rc != 0) {
+        atomic_set(&udata->running, 0);
+        closeBridge(udata);
+        return luaL_error(L, "cannot create thread: %s", strerror(rc));
+    }
+    udata->threadStarted = true;
+    return 1;
+}
+
+static int Bridge_release(lua_State* L)
+{
+    BridgeUserData* udata = luaL_checkudata(L, 1, MTMSG_BRIDGE_CLASS_NAME);
+
+    closeBridge(udata);
+    if (udata->mutexInitialized) {
+        async_mutex_destruct(&udata->mutex);
+        udata->mutexInitialized = false;
+    }
+    return 0;
+}
+
+static int Bridge_close(lua_State* L)
+{
+    BridgeUserData* udata = luaL_checkudata(L, 1, MTMSG_BRIDGE_CLASS_NAME);
+
+    closeBridge(udata);
+    return 0;
+}
+
+static int Bridge_isRunning(lua_State* L)
+{
+    BridgeUserData* udata = luaL_checkudata(L, 1, MTMSG_BRIDGE_CLASS_NAME);
+
+    lua_pushboolean(L, atomic_get(&udata->running));
+    return 1;
+}
+
+static int Bridge_error(lua_State* L)
+{
+    BridgeUserData* udata = luaL_checkudata(L, 1, MTMSG_BRIDGE_CLASS_NAME);
+
+    async_mutex_lock(&udata->mutex);
+    if (udata->errorMessage[0]) {
+        lua_pushstring(L, udata->errorMessage);
+    } else {
+        lua_pushnil(L);
+    }
+    async_mutex_unlock(&udata->mutex);
+    return 1;
+}
+
+static int Bridge_msgcnt(lua_State* L)
+{
+    BridgeUserData* udata = luaL_checkudata(L, 1, MTMSG_BRIDGE_CLASS_NAME);
+
+    async_mutex_lock(&udata->mutex);
+    lua_pushinteger(L, udata->msgCount);
+    async_mutex_unlock(&udata->mutex);
+    return 1;
+}
+
+static const luaL_Reg BridgeMethods[] =
+{
+    { "close",      Bridge_close      },
+    { "isrunning",  Bridge_isRunning  },
+    { "error",      Bridge_error      },
+    { "msgcnt",     Bridge_msgcnt     },
+    { NULL,         NULL } /* sentinel */
+};
+
+static const luaL_Reg BridgeMetaMethods[] =
+{
+    { "__gc",       Bridge_release  },
+
+    { NULL,       NULL } /* sentinel */
+};
+
+static void setupBridgeMeta(lua_State* L)
+{
+    lua_pushstring(L, MTMSG_BRIDGE_CLASS_NAME);
+    lua_setfield(L, -2, "__metatable");
+
+    luaL_setfuncs(L, BridgeMetaMethods, 0);
+
+    lua_newtable(L);  /* BridgeClass */
+        luaL_setfuncs(L, BridgeMethods, 0);
+    lua_setfield (L, -2, "__index");
+}
+
+int mtmsg_bridge_init_module(lua_State* L, int module)
+{
+    if (luaL_newmetatable(L, MTMSG_BRIDGE_CLASS_NAME)) {
+        setupBridgeMeta(L);
+    }
+    lua_pop(L, 1);
+
+    lua_pushcfunction(L, Mtmsg_newBridge);
+    lua_setfield(L, module, "newbridge");
+
+    return 0;
+}
+
+#else /* MTMSG_ASYNC_USE_PTHREAD && !MTMSG_ASYNC_USE_WIN32 */
+
+static int Mtmsg_newBridge(lua_State* L)
+{
+    return luaL_error(L, "%s is not supported on this platform", MTMSG_BRIDGE_CLASS_NAME);
+}
+
+int mtmsg_bridge_init_module(lua_State* L, int module)
+{
+    lua_pushcfunction(L, Mtmsg_newBridge);
+    lua_setfield(L, module, "newbridge");
+
+    return 0;
+}
+
+#endif /* MTMSG_ASYNC_USE_PTHREAD && !MTMSG_ASYNC_USE_WIN32 */
@@ -0,0 +1,8 @@
+#ifndef MTMSG_BRIDGE_H
+#define MTMSG_BRIDGE_H
+
+#include "util.h"
+
+int mtmsg_bridge_init_module(lua_State* L, int module);
+
+#endif /* MTMSG_BRIDGE_H */
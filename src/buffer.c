@@ -6,6 +6,14 @@
 
 #define CARRAY_CAPI_IMPLEMENT_GET_CAPI   1
 
+/* system headers must be included before util.h sets the symbol visibility */
+#include "async_defines.h"
+
+#ifndef MTMSG_ASYNC_USE_WIN32
+    #include <poll.h>
+    #include <sys/stat.h>
+#endif
+
 #include "buffer.h"
 #include "listener.h"
 #include "serialize.h"
@@ -15,6 +23,7 @@
 #include "sender_capi_impl.h"
 #include "notify_capi_impl.h"
 #include "carray_capi.h"
+#include "compress.h"
 
 const char* const MTMSG_BUFFER_CLASS_NAME = "mtmsg.buffer";
 
@@ -98,6 +107,29 @@ void mtmsg_buffer_abort_all(bool abortFlag)
     }
 }
 
+void mtmsg_buffer_totals(BufferTotals* totals)
+{
+    memset(totals, 0, sizeof(BufferTotals));
+    totals->buffers     = atomic_get(&buffer_counter);
+    totals->buckets     = buffer_buckets;
+    totals->bucketUsage = bucket_usage;
+    lua_Integer i;
+    for (i = 0; i < buffer_buckets; ++i) {
+        MsgBuffer* b = buffer_bucket_list[i].firstBuffer;
+        while (b != NULL) {
+            async_mutex_lock(b->sharedMutex);
+            mtmsg_buffer_mem_refresh(b);
+            if (!b->mapFile) {
+                totals->memBytes += b->mem.bufferCapacity;
+            }
+            totals->memBytes += b->spillMem.bufferCapacity;
+            totals->msgCount += b->msgCount;
+            async_mutex_unlock(b->sharedMutex);
+            b = b->nextBuffer;
+        }
+    }
+}
+
 /*static int internalError(lua_State* L, const char* text, int line) 
 {
     return luaL_error(L, "%s (%s:%d)", text, MTMSG_BUFFER_CLASS_NAME, line);
@@ -220,52 +252,139 @@ int mtmsg_buffer_new(lua_State* L, ListenerUserData* listenerUdata, int arg)
 {
     const char* bufferName       = NULL;
     size_t      bufferNameLength = 0;
-    if (lua_gettop(L) >= arg && lua_type(L, arg) == LUA_TSTRING) {
-        bufferName = lua_tolstring(L, arg++, &bufferNameLength);
+    size_t      initialCapacity  = 1024;
+    lua_Number  growFactor       = 2;
+    const char* fileName         = NULL;
+    const char* shmName          = NULL;
+    MapFileSync syncMode         = MTMSG_MAPFILE_SYNC_NEVER;
+
+    if (lua_type(L, arg) == LUA_TTABLE) {
+        int options = arg++;
+        lua_getfield(L, options, "name");
+        if (!lua_isnil(L, -1)) {
+            luaL_argcheck(L, lua_type(L, -1) == LUA_TSTRING, options, "name must be a string");
+            bufferName = lua_tolstring(L, -1, &bufferNameLength);
+        }
+        lua_getfield(L, options, "file");
+        if (!lua_isnil(L, -1)) {
+            luaL_argcheck(L, lua_type(L, -1) == LUA_TSTRING, options, "file must be a string");
+            fileName        = lua_tostring(L, -1);
+            initialCapacity = 1024 * 1024;
+            growFactor      = 0;
+        }
+        lua_getfield(L, options, "shm");
+        if (!lua_isnil(L, -1)) {
+            luaL_argcheck(L, lua_type(L, -1) == LUA_TSTRING, options, "shm must be a string");
+            luaL_argcheck(L, !fileName, options, "file and shm cannot be used together");
+            luaL_argcheck(L, !listenerUdata, options, "shared memory buffer cannot be connected to a listener");
+            shmName         = lua_tostring(L, -1);
+            initialCapacity = 1024 * 1024;
+            growFactor      = 0;
+        }
+        lua_getfield(L, options, "size");
+        if (!lua_isnil(L, -1)) {
+            luaL_argcheck(L, lua_type(L, -1) == LUA_TNUMBER, options, "size must be a number");
+            lua_Number argValue = lua_tonumber(L, -1);
+            initialCapacity = (argValue < 0) ? 0 : argValue;
+        }
+        lua_getfield(L, options, "grow");
+        if (!lua_isnil(L, -1) && !fileName && !shmName) {
+            luaL_argcheck(L, lua_type(L, -1) == LUA_TNUMBER, options, "grow must be a number");
+            growFactor = lua_tonumber(L, -1);
+            if (growFactor < 0) {
+                growFactor = 0;
+            }
+        }
+        lua_getfield(L, options, "sync");
+        if (!lua_isnil(L, -1)) {
+            const char* s = lua_tostring(L, -1);
+            if (s && strcmp(s, "always") == 0) {
+                syncMode = MTMSG_MAPFILE_SYNC_ALWAYS;
+            } else if (!s || strcmp(s, "never") != 0) {
+                return luaL_argerror(L, options, "sync must be \"always\" or \"never\"");
+            }
+        }
+        lua_pop(L, 3); /* name, file and shm remain referenced on stack */
     }
-    
-   size_t initialCapacity = 1024;
-   if (lua_gettop(L) >= arg) {
-        lua_Number argValue = luaL_checknumber(L, arg++);
-        if (argValue < 0) {
-            argValue = 0;
+    else {
+        if (lua_gettop(L) >= arg && lua_type(L, arg) == LUA_TSTRING) {
+            bufferName = lua_tolstring(L, arg++, &bufferNameLength);
+        }
+        if (lua_gettop(L) >= arg) {
+            lua_Number argValue = luaL_checknumber(L, arg++);
+            if (argValue < 0) {
+                argValue = 0;
+            }
+            initialCapacity = argValue;
+        }
+        if (lua_gettop(L) >= arg) {
+            growFactor = luaL_checknumber(L, arg++);
+            if (growFactor < 0) {
+                growFactor = 0;
+            }
         }
-        initialCapacity = argValue;
     }
-
-    lua_Number growFactor = 2;
-    if (lua_gettop(L) >= arg) {
-        growFactor = luaL_checknumber(L, arg++);
-        if (growFactor < 0) {
-            growFactor = 0;
+    MapFile*  mapFile     = NULL;
+    MemBuffer mapMem;
+    int       mapMsgCount = 0;
+    Mutex*    shmMutex    = NULL;
+    if (fileName || shmName) {
+        char errorBuffer[512];
+        if (fileName) {
+            mapFile = mtmsg_mapfile_open(fileName, initialCapacity, syncMode, 
+                                         &mapMem, &mapMsgCount, errorBuffer, sizeof(errorBuffer));
+        } else {
+            mapFile = mtmsg_mapfile_open_shared(shmName, initialCapacity, &mapMem, &mapMsgCount, 
+                                                &shmMutex, errorBuffer, sizeof(errorBuffer));
+        }
+        if (!mapFile) {
+            return mtmsg_ERROR_FILE_ERROR(L, errorBuffer);
         }
     }
     BufferUserData* bufferUdata = lua_newuserdata(L, sizeof(BufferUserData)); /* create before lock */
     memset(bufferUdata, 0, sizeof(BufferUserData));
+    mtmsg_membuf_init(&bufferUdata->msgBuffer, 0, 2);
+    mtmsg_membuf_init(&bufferUdata->readBuffer, 0, 2);
+    mtmsg_membuf_init(&bufferUdata->writeBuffer, 0, 2);
     pushBufferMeta(L);       /* -> udata, meta */
     lua_setmetatable(L, -2); /* -> udata */
     
-    async_mutex_lock(mtmsg_global_lock);
+    mtmsg_global_lock_acquire();
 
     if (mtmsg_abort_flag) {
         async_mutex_unlock(mtmsg_global_lock);
+        if (mapFile) mtmsg_mapfile_close(mapFile);
         return mtmsg_ERROR_OPERATION_ABORTED(L);
     }
 
     /* Examine global BufferList */
     
-    Mutex* sharedMutex = NULL;
+    Mutex* sharedMutex = shmMutex;
     if (listenerUdata != NULL && listenerUdata->listener != NULL) {
         sharedMutex = &listenerUdata->listener->listenerMutex;
     }
     MsgBuffer* newBuffer = createNewBuffer(sharedMutex);
     if (!newBuffer) {
         async_mutex_unlock(mtmsg_global_lock);
+        if (mapFile) mtmsg_mapfile_close(mapFile);
         return mtmsg_ERROR_OUT_OF_MEMORY(L);
     }
     bufferUdata->buffer = newBuffer;
     
-    if (!mtmsg_membuf_init(&newBuffer->mem, initialCapacity, growFactor)) {
+    if (mapFile) {
+        newBuffer->mapFile   = mapFile;
+        newBuffer->sharedMem = (shmMutex != NULL);
+#if defined(MTMSG_ASYNC_USE_ROBUST_MUTEX)
+        if (shmMutex) {
+            async_mutex_lock(shmMutex);
+            newBuffer->ownerDied = shmMutex->ownerDied;
+            async_mutex_unlock(shmMutex);
+        }
+#endif
+        newBuffer->mem       = mapMem;
+        newBuffer->msgCount  = mapMsgCount;
+    }
+    else if (!mtmsg_membuf_init(&newBuffer->mem, initialCapacity, growFactor)) {
         async_mutex_unlock(mtmsg_global_lock);
         return mtmsg_ERROR_OUT_OF_MEMORY_bytes(L, initialCapacity);
     }
@@ -292,7 +411,7 @@ int mtmsg_buffer_new(lua_State* L, ListenerUserData* listenerUdata, int arg)
     toBuckets(newBuffer, buffer_buckets, buffer_bucket_list);
     atomic_inc(&buffer_counter);
 
-    if (sharedMutex != NULL) {
+    if (sharedMutex != NULL && listenerUdata != NULL) {
         async_mutex_lock(sharedMutex);
         MsgListener* listener = listenerUdata->listener; 
         
@@ -307,6 +426,10 @@ int mtmsg_buffer_new(lua_State* L, ListenerUserData* listenerUdata, int arg)
         newBuffer->listener           = listener;
         newBuffer->nextListenerBuffer = listener->firstListenerBuffer;
         listener->firstListenerBuffer = newBuffer;
+        
+        if (newBuffer->mem.bufferLength > 0) {
+            mtmsg_buffer_add_to_ready_list(listener, newBuffer);
+        }
 
         async_mutex_unlock(sharedMutex);
     }
@@ -315,6 +438,14 @@ int mtmsg_buffer_new(lua_State* L, ListenerUserData* listenerUdata, int arg)
     return 1;
 }
 
+static int Mtmsg_unlinkShm(lua_State* L)
+{
+    const char* shmName = luaL_checkstring(L, 1);
+    
+    lua_pushboolean(L, mtmsg_mapfile_unlink_shared(shmName));
+    return 1;
+}
+
 static int Mtmsg_newBuffer(lua_State* L)
 {
     /* Evaluate Args */
@@ -340,6 +471,48 @@ static void removeFromListener(MsgListener* listener, MsgBuffer* b)
     }
 }
 
+static void freeMem(MsgBuffer* b)
+{
+    if (b->mapFile) {
+        mtmsg_mapfile_close(b->mapFile);
+        b->mapFile = NULL;
+        memset(&b->mem, 0, sizeof(MemBuffer));
+    } else {
+        mtmsg_membuf_free(&b->mem);
+    }
+}
+
+void mtmsg_buffer_free_mem(MsgBuffer* b)
+{
+    if (!b->sharedMem) {
+        freeMem(b);
+    }
+    /* else: shared memory contains the buffer's mutex, it is unmapped if the buffer is freed */
+}
+
+static void freeTiming(MsgTiming* timing)
+{
+    if (timing) {
+        mtmsg_timestamps_free(&timing->queue);
+        free(timing);
+    }
+}
+
+void mtmsg_buffer_timing_added(MsgBuffer* b, int count)
+{
+    if (!mtmsg_timestamps_push(&b->timing->queue, mtmsg_latency_now(), count)) {
+        /* out of memory: waiting times cannot be assigned to messages anymore */
+        freeTiming(b->timing);
+        b->timing = NULL;
+    }
+}
+
+void mtmsg_buffer_timing_taken(MsgBuffer* b, int count)
+{
+    mtmsg_timestamps_pop(&b->timing->queue, count, mtmsg_latency_now(), 
+                         &b->timing->histogram, b->listener ? b->listener->latency : NULL);
+}
+
 static void freeBuffer2(MsgBuffer* b)
 {
     if (b->bufferName) {
@@ -355,7 +528,13 @@ static void freeBuffer2(MsgBuffer* b)
         free(b->incNotifier);
         b->incNotifier = NULL;
     }
-    mtmsg_membuf_free(&b->mem);
+    freeMem(b);
+    mtmsg_membuf_free(&b->spillMem);
+    freeTiming(b->timing);
+    mtmsg_dict_release(b->dict);
+    if (b->spillFile) {
+        fclose(b->spillFile);
+    }
     free(b);
 }
 
@@ -433,7 +612,7 @@ static int MsgBuffer_release(lua_State* L)
     MsgBuffer*      b = udata->buffer;
 
     if (b) {
-        async_mutex_lock(mtmsg_global_lock);
+        mtmsg_global_lock_acquire();
 
         if (atomic_dec(&b->used) == 0) {
             mtmsg_free_buffer(b);
@@ -442,6 +621,9 @@ static int MsgBuffer_release(lua_State* L)
         
         async_mutex_unlock(mtmsg_global_lock);
     }
+    mtmsg_membuf_free(&udata->msgBuffer);
+    mtmsg_membuf_free(&udata->readBuffer);
+    mtmsg_membuf_free(&udata->writeBuffer);
     return 0;
 }
 
@@ -457,7 +639,7 @@ static int MsgBuffer_close(lua_State* L)
     if (b->listener) {
         mtmsg_buffer_remove_from_ready_list(b->listener, b, false);
     }
-    mtmsg_membuf_free(&b->mem);
+    mtmsg_buffer_free_mem(b);
     async_mutex_notify(b->sharedMutex);
     async_mutex_unlock(b->sharedMutex);
 
@@ -490,12 +672,15 @@ static int Mtmsg_buffer(lua_State* L)
 
     BufferUserData* userData = lua_newuserdata(L, sizeof(BufferUserData)); /* create before lock */
     memset(userData, 0, sizeof(BufferUserData));
+    mtmsg_membuf_init(&userData->msgBuffer, 0, 2);
+    mtmsg_membuf_init(&userData->readBuffer, 0, 2);
+    mtmsg_membuf_init(&userData->writeBuffer, 0, 2);
     pushBufferMeta(L);       /* -> udata, meta */
     lua_setmetatable(L, -2); /* -> udata */
 
     /* Lock */
     
-    async_mutex_lock(mtmsg_global_lock);
+    mtmsg_global_lock_acquire();
 
     if (mtmsg_abort_flag) {
         async_mutex_unlock(mtmsg_global_lock);
@@ -544,14 +729,22 @@ static int MsgBuffer_clear(lua_State* L)
     } else {
         async_mutex_lock(b->sharedMutex);
     }
-
+    if (!mtmsg_buffer_wait_reserved(b, udata->nonblock)) {
+        async_mutex_unlock(b->sharedMutex);
+        lua_pushboolean(L, false);
+        return 1;
+    }
     if (b->closed) {
         async_mutex_unlock(b->sharedMutex);
         const char* qstring = mtmsg_buffer_tostring(L, b);
         return mtmsg_ERROR_OBJECT_CLOSED(L, qstring);
     }
+    mtmsg_buffer_mem_refresh(b);
+    mtmsg_buffer_stats_discarded(b);
     b->mem.bufferLength = 0;
     b->msgCount = 0;
+    mtmsg_buffer_discard_spill(b);
+    mtmsg_buffer_mem_changed(b);
     
     if (b->listener) {
         mtmsg_buffer_remove_from_ready_list(b->listener, b, false);
@@ -665,18 +858,36 @@ int mtmsg_buffer_call_notifier(lua_State* L, MsgBuffer* b, NotifierHolder* ntf,
     return 0;
 }
 
-int mtmsg_buffer_set_or_add_msg(lua_State* L, MsgBuffer* b, 
-                                              bool nonblock, bool clear, int arg, 
-                                              const char* args, size_t args_size, 
-                                              receiver_error_handler receiver_eh, void* receiver_ehdata)
+/**
+ * mtmsg_membuf_reserve() for new messages, counts memmoves and reallocs
+ * of mtmsg_membuf_reserve0() in the buffer's statistics.
+ */
+static int reserveMsgMem(MsgBuffer* b, MemBuffer* target, size_t additionalLength)
 {
-    if (arg) {
-        int errorArg = 0;
-        args_size = mtmsg_serialize_calc_args_size(L, arg, &errorArg);
-        if (args_size < 0) {
-            return luaL_argerror(L, errorArg, "parameter type not supported");
-        }
+    size_t newLength = target->bufferLength + additionalLength;
+    if (target->bufferStart - target->bufferData + newLength <= target->bufferCapacity) {
+        return 0;
+    }
+    size_t oldCapacity = target->bufferCapacity;
+    if (target->bufferStart != target->bufferData && target->bufferLength > 0) {
+        b->stats.memmoves += 1;
+    }
+    int rc = mtmsg_membuf_reserve0(target, newLength);
+    if (target->bufferCapacity != oldCapacity) {
+        b->stats.reallocs += 1;
     }
+    return rc;
+}
+
+/**
+ * args_size must be given if arg != 0. rawSize is the uncompressed size if 
+ * args is a compressed message, 0 otherwise.
+ */
+static int setOrAddMsg(lua_State* L, MsgBuffer* b, 
+                       bool nonblock, bool clear, int arg, 
+                       const char* args, size_t args_size, size_t rawSize,
+                       receiver_error_handler receiver_eh, void* receiver_ehdata)
+{
     const size_t header_size = mtmsg_serialize_calc_header_size(args_size);
     const size_t msg_size    = header_size + args_size;
     
@@ -687,6 +898,10 @@ int mtmsg_buffer_set_or_add_msg(lua_State* L, MsgBuffer* b,
     } else {
         async_mutex_lock(b->sharedMutex);
     }
+    if (!mtmsg_buffer_wait_reserved(b, nonblock)) {
+        async_mutex_unlock(b->sharedMutex);
+        return 3; /* buffer not ready */
+    }
     if (b->closed) {
         async_mutex_unlock(b->sharedMutex);
         if (L) {
@@ -704,12 +919,42 @@ int mtmsg_buffer_set_or_add_msg(lua_State* L, MsgBuffer* b,
             return 2; /* buffer aborted */
         }
     }
+    mtmsg_buffer_mem_refresh(b);
     if (clear) {
+        mtmsg_buffer_stats_discarded(b);
         b->mem.bufferLength = 0;
         b->msgCount = 0;
+        mtmsg_buffer_discard_spill(b);
+        mtmsg_buffer_mem_changed(b);
+    }
+    /* Spilled messages must be followed by spilled messages to keep the order.
+     * In memory there is always at least one message if messages are spilled. */
+    bool spill = (b->spillCount > 0 
+                  || (b->spillThreshold > 0 && b->mem.bufferLength > 0
+                                            && b->mem.bufferLength + msg_size > b->spillThreshold))
+              && (b->spillFile || (b->spillFile = tmpfile()) != NULL);
+
+    if (spill && b->spillError) {
+        /* would follow messages that cannot be read back */
+        mtmsg_buffer_stats_full(b, 1);
+        async_mutex_unlock(b->sharedMutex);
+        return 4;
     }
+    MemBuffer* target = spill ? &b->spillMem : &b->mem;
     {
-        int rc = mtmsg_membuf_reserve(&b->mem, msg_size);
+        int rc;
+        if (spill && b->mem.growFactor <= 0 && msg_size > b->mem.bufferCapacity) {
+            /* message could not be read back */
+            rc = -1;
+        } else if (b->mapFile && mtmsg_mapfile_would_overlap(&b->mem, msg_size)) {
+            /* wait until enough messages are consumed */
+            rc = -1;
+        } else {
+            rc = reserveMsgMem(b, target, msg_size);
+        }
+        if (rc == -1 && msg_size <= b->mem.bufferCapacity) {
+            mtmsg_buffer_stats_full(b, 1);
+        }
         if (rc != 0) {
             async_mutex_unlock(b->sharedMutex);
             if (rc == -1) {
@@ -735,18 +980,268 @@ int mtmsg_buffer_set_or_add_msg(lua_State* L, MsgBuffer* b,
             }
         }
     }
-    char* msgBufferStart = b->mem.bufferStart + b->mem.bufferLength;
+    char*  msgBufferStart = target->bufferStart + target->bufferLength;
+    size_t oldLength      = target->bufferLength;
+
+    if (arg && b->useDict) {
+        /* string references make the message shorter than calculated */
+        char*  argsStart      = msgBufferStart + header_size;
+        char*  argsEnd        = mtmsg_serialize_args_to_buffer(L, arg, argsStart, b->dict);
+        size_t dictArgsSize   = argsEnd - argsStart;
+        size_t dictHeaderSize = mtmsg_serialize_calc_header_size(dictArgsSize);
+        if (dictHeaderSize < header_size) {
+            memmove(msgBufferStart + dictHeaderSize, argsStart, dictArgsSize);
+        }
+        mtmsg_serialize_header_to_buffer(dictArgsSize, msgBufferStart);
+        target->bufferLength += dictHeaderSize + dictArgsSize;
+    } else {
+        mtmsg_serialize_header_to_buffer(args_size, msgBufferStart);
+
+        if (arg) {
+            mtmsg_serialize_args_to_buffer(L, arg, msgBufferStart + header_size, NULL);
+        }
+        else if (args_size > 0) {
+            memcpy(msgBufferStart + header_size, args, args_size);
+        }
+        target->bufferLength += msg_size;
+    }
+    size_t addedLength = target->bufferLength - oldLength;
+    if (spill) {
+        size_t len = b->spillMem.bufferLength;
+        b->spillMem.bufferLength = 0;
+        if (   len > (size_t)(LONG_MAX - b->spillWritePos)
+            || fseek(b->spillFile, b->spillWritePos, SEEK_SET) != 0
+            || fwrite(b->spillMem.bufferStart, 1, len, b->spillFile) != len) 
+        {
+            mtmsg_buffer_stats_full(b, 1);
+            async_mutex_unlock(b->sharedMutex);
+            return 4; /* spill file is full */
+        }
+        b->spillWritePos += len;
+        b->spillCount    += 1;
+    }
+    b->msgCount += 1;
+    if (!spill) {
+        mtmsg_buffer_mem_changed(b);
+    }
+    mtmsg_buffer_stats_added(b, 1, addedLength);
+    if (rawSize) {
+        b->compressInBytes  += rawSize;
+        b->compressOutBytes += args_size;
+    }
+
+    if (b->listener && !mtmsg_is_on_ready_list(b->listener, b)) {
+        mtmsg_buffer_add_to_ready_list(b->listener, b);
+    }
+
+    NotifierHolder* ntf = b->incNotifier;
+    if (ntf) {
+        if (b->msgCount > ntf->threshold) {
+            atomic_inc(&ntf->used);
+            mtmsg_buffer_stats_notify(b);
+        } else {
+            ntf = NULL;
+        }
+    }
+    
+    async_mutex_notify(b->sharedMutex);
+    async_mutex_unlock(b->sharedMutex);
+    
+    if (ntf) {
+        return mtmsg_buffer_call_notifier(L, b, ntf, &b->incNotifier, receiver_eh, receiver_ehdata);
+    } else {
+        return 0;
+    }
+}
+
+
+/**
+ * Reads spilled messages back into the empty memory buffer: at least one 
+ * message and further messages up to the spill threshold. 
+ * Must be called under the buffer's lock. Returns 0 if messages were read
+ * back, -5 if out of memory and -6 if the spill file cannot be read. After
+ * -5 the messages can be read back by a later call, after -6 the spilled
+ * messages are lost and new messages are refused until the buffer is cleared.
+ */
+int mtmsg_buffer_unspill(MsgBuffer* b)
+{
+    FILE* f = b->spillFile;
+    if (b->spillError || fseek(f, b->spillReadPos, SEEK_SET) != 0) {
+        b->spillError = true;
+        return -6;
+    }
+    int rc = 0;
+    while (b->spillCount > 0) {
+        char   header[1 + sizeof(size_t) + 10];
+        size_t h = 0;
+        int    c = fgetc(f);
+        if (c == EOF) {
+            rc = -6;
+            break;
+        }
+        header[h++] = (char)c;
+        if (c == BUFFER_MSGSIZE_VARINT) {
+            do {
+                c = fgetc(f);
+                header[h++] = (char)c;
+            } while (c != EOF && (c & 0x80) && h < sizeof(header));
+        } else if (c == BUFFER_MSGSIZE) {
+            h += fread(header + h, 1, sizeof(size_t), f);
+        }
+        SerializedMsgSizes sizes;
+        mtmsg_serialize_parse_header(header, &sizes);
+        size_t msg_size = sizes.header_size + sizes.args_size;
+
+        if (b->mem.bufferLength > 0 && b->mem.bufferLength + msg_size > b->spillThreshold) {
+            break;
+        }
+        if (h != sizes.header_size) {
+            rc = -6;
+            break;
+        }
+        if (mtmsg_membuf_reserve(&b->mem, msg_size) != 0) {
+            rc = -5;
+            break;
+        }
+        char* msgStart = b->mem.bufferStart + b->mem.bufferLength;
+        memcpy(msgStart, header, h);
+        if (fread(msgStart + h, 1, sizes.args_size, f) != sizes.args_size) {
+            rc = -6;
+            break;
+        }
+        b->mem.bufferLength += msg_size;
+        b->spillReadPos     += msg_size;
+        b->spillCount       -= 1;
+    }
+    if (b->spillCount == 0) {
+        mtmsg_buffer_discard_spill(b);
+    }
+    if (rc == -6) {
+        b->spillError = true;
+    }
+    return (b->mem.bufferLength > 0) ? 0 : rc;
+}
+
+/**
+ * Traversing tables can raise errors, e.g. if memory for the table path that 
+ * is used to detect cycles cannot be allocated. Therefore tables are not
+ * serialized under the buffer's lock.
+ */
+static bool hasTableArgs(lua_State* L, int arg)
+{
+    int n = lua_gettop(L);
+    for (; arg <= n; ++arg) {
+        if (lua_type(L, arg) == LUA_TTABLE) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    mtmsg_serialize_header_to_buffer(args_size, msgBufferStart);
+static int fileArgsError(lua_State* L)
+{
+    if (L) {
+        return luaL_error(L, "message contains values that cannot be stored in a file");
+    } else {
+        return 7;
+    }
+}
 
+int mtmsg_buffer_set_or_add_msg(lua_State* L, MsgBuffer* b, 
+                                              bool nonblock, bool clear, int arg, 
+                                              const char* args, size_t args_size, 
+                                              receiver_error_handler receiver_eh, void* receiver_ehdata)
+{
+    if (arg) {
+        int errorArg = 0;
+        args_size = mtmsg_serialize_calc_args_size(L, arg, &errorArg);
+        if (errorArg) {
+            return luaL_argerror(L, errorArg, "parameter type not supported");
+        }
+    }
+    /* pointers stored in a file would be invalid after reopening */
+    bool   checkArgs  = (b->mapFile != NULL);
+    if (checkArgs && !arg && !mtmsg_serialize_check_args(args, args_size)) {
+        return fileArgsError(L);
+    }
+    int    threshold  = atomic_get(&b->compressThreshold);
+    bool   portable   = atomic_get(&b->portable);
+    size_t maxRawSize = portable ? mtmsg_serialize_calc_portable_bound(args_size) : args_size;
+    bool   compress   = threshold > 0 && maxRawSize >= (size_t)threshold;
+    if (!compress && !portable && !(arg && (checkArgs || hasTableArgs(L, arg)))) {
+        return setOrAddMsg(L, b, nonblock, clear, arg, args, args_size, 0, receiver_eh, receiver_ehdata);
+    }
+    /* Serializing, converting and compressing is done before locking, string
+     * dictionary is not used for messages with tables. With Lua 
+     * state the temporary memory is a userdata below the arguments so that it 
+     * is collected if an error is raised. */
+    size_t bound        = compress ? 1 + mtmsg_serialize_calc_varint_size(maxRawSize) + mtmsg_compress_bound(maxRawSize) : 0;
+    size_t portableSize = portable ? maxRawSize : 0;
+    size_t nativeSize   = arg ? args_size : 0;
+    char*  tmp;
+    if (L) {
+        tmp = lua_newuserdata(L, bound + portableSize + nativeSize);
+        if (arg) {
+            lua_insert(L, arg);
+            arg += 1;
+        }
+    } else {
+        tmp = malloc(bound + portableSize);
+        if (!tmp) {
+            return 6;
+        }
+    }
+    const char* raw     = args;
+    size_t      rawSize = args_size;
     if (arg) {
-        mtmsg_serialize_args_to_buffer(L, arg, msgBufferStart + header_size);
+        mtmsg_serialize_args_to_buffer(L, arg, tmp + bound + portableSize, NULL);
+        raw = tmp + bound + portableSize;
+        if (checkArgs && !mtmsg_serialize_check_args(raw, rawSize)) {
+            return fileArgsError(L);
+        }
     }
-    else if (args_size > 0) {
-        memcpy(msgBufferStart + header_size, args, args_size);
+    if (portable) {
+        rawSize = mtmsg_serialize_to_portable(raw, rawSize, tmp + bound);
+        raw     = tmp + bound;
+        if (rawSize == 0) {
+            if (L) {
+                return luaL_error(L, "message contains values that cannot be serialized portably");
+            } else {
+                free(tmp);
+                return 7;
+            }
+        }
     }
-    b->mem.bufferLength += msg_size;
+    int rc;
+    if (compress && rawSize >= (size_t)threshold) {
+        char*  out     = tmp;
+        *out++ = BUFFER_COMPRESSED;
+        out = mtmsg_serialize_varint_to_buffer(rawSize, out);
+        size_t outSize = mtmsg_compress(raw, rawSize, out, bound - (out - tmp));
+        if (outSize > 0 && (out - tmp) + outSize < rawSize) {
+            rc = setOrAddMsg(L, b, nonblock, clear, 0, tmp, (out - tmp) + outSize, rawSize, receiver_eh, receiver_ehdata);
+        } else {
+            rc = setOrAddMsg(L, b, nonblock, clear, 0, raw, rawSize, 0, receiver_eh, receiver_ehdata);
+        }
+    } else {
+        rc = setOrAddMsg(L, b, nonblock, clear, 0, raw, rawSize, 0, receiver_eh, receiver_ehdata);
+    }
+    if (!L) {
+        free(tmp);
+    }
+    return rc;
+}
+
+/**
+ * Must be called under the buffer's lock after a message with msg_size bytes 
+ * was appended to mem. Unlocks the buffer and calls the notifier.
+ */
+static int msgAppended(lua_State* L, MsgBuffer* b, size_t msg_size,
+                       receiver_error_handler receiver_eh, void* receiver_ehdata)
+{
     b->msgCount += 1;
+    mtmsg_buffer_mem_changed(b);
+    mtmsg_buffer_stats_added(b, 1, msg_size);
 
     if (b->listener && !mtmsg_is_on_ready_list(b->listener, b)) {
         mtmsg_buffer_add_to_ready_list(b->listener, b);
@@ -756,6 +1251,7 @@ int mtmsg_buffer_set_or_add_msg(lua_State* L, MsgBuffer* b,
     if (ntf) {
         if (b->msgCount > ntf->threshold) {
             atomic_inc(&ntf->used);
+            mtmsg_buffer_stats_notify(b);
         } else {
             ntf = NULL;
         }
@@ -771,6 +1267,161 @@ int mtmsg_buffer_set_or_add_msg(lua_State* L, MsgBuffer* b,
     }
 }
 
+/**
+ * Reserves memory for a message with args_size bytes behind the messages in
+ * mem and writes the message header. *args is set to the memory for the 
+ * message elements. The buffer is not locked until mtmsg_buffer_commit_msg() 
+ * is called, but other messages cannot be added before and readers do not
+ * move the messages in mem. Returns 0 or an error code as 
+ * mtmsg_buffer_set_or_add_msg() without Lua state, 8 if the message would
+ * be compressed, converted to portable encoding, spilled or placed into
+ * shared memory and therefore has to be added by mtmsg_buffer_set_or_add_msg().
+ */
+int mtmsg_buffer_reserve_msg(MsgBuffer* b, bool nonblock, size_t args_size, char** args)
+{
+    const size_t header_size = mtmsg_serialize_calc_header_size(args_size);
+    const size_t msg_size    = header_size + args_size;
+
+    int threshold = atomic_get(&b->compressThreshold);
+    if (atomic_get(&b->portable) || (threshold > 0 && args_size >= (size_t)threshold)) {
+        return 8;
+    }
+    if (nonblock) {
+        if (!async_mutex_trylock(b->sharedMutex)) {
+            return 3; /* buffer not ready */
+        }
+    } else {
+        async_mutex_lock(b->sharedMutex);
+    }
+    if (!mtmsg_buffer_wait_reserved(b, nonblock)) {
+        async_mutex_unlock(b->sharedMutex);
+        return 3; /* buffer not ready */
+    }
+    if (b->closed || b->aborted) {
+        bool closed = b->closed;
+        async_mutex_unlock(b->sharedMutex);
+        return closed ? 1 : 2;
+    }
+    if (b->sharedMem || b->spillCount > 0 
+        || (b->spillThreshold > 0 && b->mem.bufferLength > 0
+                                  && b->mem.bufferLength + msg_size > b->spillThreshold))
+    {
+        /* other processes do not know about the reserved memory */
+        async_mutex_unlock(b->sharedMutex);
+        return 8;
+    }
+    int rc;
+    if (b->mapFile && mtmsg_mapfile_would_overlap(&b->mem, msg_size)) {
+        rc = -1;
+    } else {
+        rc = reserveMsgMem(b, &b->mem, msg_size);
+    }
+    if (rc != 0) {
+        bool full = (rc == -1 && msg_size <= b->mem.bufferCapacity);
+        if (full) {
+            mtmsg_buffer_stats_full(b, 1);
+        }
+        async_mutex_unlock(b->sharedMutex);
+        return full ? 4 : (rc == -1) ? 5 : 6;
+    }
+    char* msg = b->mem.bufferStart + b->mem.bufferLength;
+    mtmsg_serialize_header_to_buffer(args_size, msg);
+    *args = msg + header_size;
+    b->reservedLength = msg_size;
+    async_mutex_unlock(b->sharedMutex);
+    return 0;
+}
+
+/**
+ * Appends the message reserved by mtmsg_buffer_reserve_msg() to the messages
+ * or discards it if cancel. msg_size is the size of the message including 
+ * the header.
+ */
+int mtmsg_buffer_commit_msg(MsgBuffer* b, size_t msg_size, bool cancel,
+                            receiver_error_handler receiver_eh, void* receiver_ehdata)
+{
+    async_mutex_lock(b->sharedMutex);
+    b->reservedLength = 0;
+    if (cancel || b->closed || b->aborted) {
+        int rc = cancel ? 0 : b->closed ? 1 : 2;
+        async_mutex_notify(b->sharedMutex);
+        async_mutex_unlock(b->sharedMutex);
+        return rc;
+    }
+    b->mem.bufferLength += msg_size;
+    return msgAppended(NULL, b, msg_size, receiver_eh, receiver_ehdata);
+}
+
+/**
+ * Adds the message in mem to the buffer by exchanging mem with the buffer's
+ * empty memory. mem contains the message elements behind headroom bytes 
+ * which are used for the message header. Afterwards mem is empty and has 
+ * no headroom. This is only done if the buffer is empty (or cleared), 
+ * its memory is growable and not larger than mem, otherwise -1 is returned 
+ * and the message has to be added by mtmsg_buffer_set_or_add_msg(), which 
+ * is also the case for compressed or portable messages.
+ * Returns 0 or an error code as mtmsg_buffer_set_or_add_msg().
+ */
+int mtmsg_buffer_swap_msg(lua_State* L, MsgBuffer* b, bool nonblock, bool clear, 
+                          MemBuffer* mem, size_t headroom)
+{
+    const size_t args_size   = mem->bufferLength - headroom;
+    const size_t header_size = mtmsg_serialize_calc_header_size(args_size);
+
+    int threshold = atomic_get(&b->compressThreshold);
+    if (atomic_get(&b->portable) || (threshold > 0 && args_size >= (size_t)threshold) 
+                                 || header_size > headroom) 
+    {
+        return -1;
+    }
+    if (nonblock) {
+        if (!async_mutex_trylock(b->sharedMutex)) {
+            return 3; /* buffer not ready */
+        }
+    } else {
+        async_mutex_lock(b->sharedMutex);
+    }
+    if (!mtmsg_buffer_wait_reserved(b, nonblock)) {
+        async_mutex_unlock(b->sharedMutex);
+        return 3; /* buffer not ready */
+    }
+    if (b->closed) {
+        async_mutex_unlock(b->sharedMutex);
+        const char* bstring = mtmsg_buffer_tostring(L, b);
+        return mtmsg_ERROR_OBJECT_CLOSED(L, bstring);
+    }
+    if (b->aborted) {
+        async_mutex_unlock(b->sharedMutex);
+        return mtmsg_ERROR_OPERATION_ABORTED(L);
+    }
+    if (   b->mapFile || b->mem.growFactor <= 0 
+        || (!clear && b->msgCount > 0) 
+        || b->mem.bufferCapacity > mem->bufferCapacity)
+    {
+        async_mutex_unlock(b->sharedMutex);
+        return -1;
+    }
+    if (clear) {
+        mtmsg_buffer_stats_discarded(b);
+        b->msgCount = 0;
+        mtmsg_buffer_discard_spill(b);
+    }
+    char* msg = mem->bufferStart + headroom - header_size;
+    mtmsg_serialize_header_to_buffer(args_size, msg);
+
+    char*  oldData     = b->mem.bufferData;
+    size_t oldCapacity = b->mem.bufferCapacity;
+    b->mem.bufferData     = mem->bufferData;
+    b->mem.bufferStart    = msg;
+    b->mem.bufferLength   = header_size + args_size;
+    b->mem.bufferCapacity = mem->bufferCapacity;
+    mem->bufferData     = oldData;
+    mem->bufferStart    = oldData;
+    mem->bufferLength   = 0;
+    mem->bufferCapacity = oldCapacity;
+
+    return msgAppended(L, b, header_size + args_size, NULL, NULL);
+}
 
 static int MsgBuffer_setMsg(lua_State* L)
 {
@@ -794,9 +1445,10 @@ static int MsgBuffer_addMsg(lua_State* L)
     
 int mtmsg_buffer_next_msg(lua_State* L, BufferUserData* udata,
                           MsgBuffer* b, bool nonblock, int arg, double timeoutSeconds , MemBuffer* resultBuffer, size_t* argsSize,
-                          sender_error_handler sender_eh, void* sender_ehdata)
+                          MsgDict** resultDict, sender_error_handler sender_eh, void* sender_ehdata)
 {
-    lua_Number endTime   = -1; /* -1 = no timeout, wait forever */
+    lua_Number endTime    = -1; /* -1 = no timeout, wait forever */
+    bool       decodeArgs = false;
     int argTop = 0;
     if (L) {
         argTop = lua_gettop(L);
@@ -825,6 +1477,13 @@ int mtmsg_buffer_next_msg(lua_State* L, BufferUserData* udata,
                 }
             }
         }
+        if (resultBuffer == NULL) {
+            mtmsg_serialize_check_carray_args(L, arg);
+            resultBuffer = &udata->msgBuffer;
+            resultBuffer->bufferStart  = resultBuffer->bufferData;
+            resultBuffer->bufferLength = 0;
+            decodeArgs = true;
+        }
     } else {
         if (timeoutSeconds >= 0) { /* timeoutSeconds < 0 -> no timeout, wait forever */
             endTime = mtmsg_current_time_seconds() + timeoutSeconds;
@@ -863,57 +1522,48 @@ again:
             return -2; /* 2 - if sender was aborted. */
         }
     }
+    mtmsg_buffer_mem_refresh(b);
+    if (b->mem.bufferLength == 0 && b->spillCount > 0) {
+        int rc = mtmsg_buffer_unspill(b);
+        if (rc != 0) {
+            async_mutex_unlock(b->sharedMutex);
+            if (L) {
+                return (rc == -5) ? mtmsg_ERROR_OUT_OF_MEMORY(L) 
+                                  : mtmsg_ERROR_FILE_ERROR(L, "cannot read spill file");
+            }
+            return rc; /* 5 - out of memory, 6 - spill file cannot be read */
+        }
+        mtmsg_buffer_mem_changed(b);
+    }
     if (b->mem.bufferLength > 0) {
         SerializedMsgSizes sizes;
         mtmsg_serialize_parse_header(b->mem.bufferStart, &sizes);
         if (argsSize) *argsSize = sizes.args_size;
         
-        size_t msg_size;
-        int    rslt = 0; /* is parsedArgCount for resultBuffer == NULL */
-        if (resultBuffer == NULL) {
-            GetMsgArgsPar par; par.inBuffer       = b->mem.bufferStart + sizes.header_size;
-                               par.inBufferSize   = sizes.args_size;
-                               par.inMaxArgCount  = -1;
-                               par.parsedLength   = 0;
-                               par.parsedArgCount = 0;
-                               par.carrayCapi     = udata->carrayCapi; 
-                               par.errorArg       = 0;
-            lua_pushcfunction(L, mtmsg_serialize_get_msg_args);
-            lua_insert(L, arg);
-            lua_pushlightuserdata(L, &par);
-            lua_insert(L, arg + 1);
-            int nargs = argTop - arg + 1;
-            int rc = lua_pcall(L, nargs + 1, LUA_MULTRET, 0);
-            if (rc != LUA_OK) {
-                async_mutex_unlock(b->sharedMutex);
-                if (par.errorArg) {
-                    return luaL_argerror(L, arg + par.errorArg - 2, lua_tostring(L, -1));
-                } else {
-                    return lua_error(L);
-                }
-            }
-            rslt = par.parsedArgCount;
-            udata->carrayCapi = par.carrayCapi;
-            msg_size = sizes.header_size + par.parsedLength;
-        } else {
-            int rc = mtmsg_membuf_reserve(resultBuffer, sizes.args_size);
-            if (rc != 0) {
-                async_mutex_unlock(b->sharedMutex);
-                /* rc = -1 : buffer should not grow */
-                /* rc = -2 : buffer can    not grow */
-                return (rc == -1) ? -4 : -5;
+        /* Only copy the message under the lock, decoding into Lua values
+         * is done after the lock is released (if decodeArgs). */
+        int rc = mtmsg_membuf_reserve(resultBuffer, sizes.args_size);
+        if (rc != 0) {
+            async_mutex_unlock(b->sharedMutex);
+            if (decodeArgs) {
+                return mtmsg_ERROR_OUT_OF_MEMORY_bytes(L, sizes.args_size);
             }
-            memcpy(resultBuffer->bufferStart + resultBuffer->bufferLength, 
-                   b->mem.bufferStart + sizes.header_size, 
-                   sizes.args_size);
-            resultBuffer->bufferLength += sizes.args_size;
-            
-            msg_size = sizes.header_size + sizes.args_size;
-            rslt = 1;
+            /* rc = -1 : buffer should not grow */
+            /* rc = -2 : buffer can    not grow */
+            return (rc == -1) ? -4 : -5;
         }
+        size_t resultOffset = resultBuffer->bufferLength;
+        memcpy(resultBuffer->bufferStart + resultBuffer->bufferLength, 
+               b->mem.bufferStart + sizes.header_size, 
+               sizes.args_size);
+        resultBuffer->bufferLength += sizes.args_size;
+        
+        MsgDict* dict     = b->dict; /* lives as long as b */
+        size_t   msg_size = sizes.header_size + sizes.args_size;
+        int      rslt     = 1; /* is parsedArgCount if decodeArgs */
 
         b->mem.bufferLength -= msg_size;
-        if (b->mem.bufferLength == 0) {
+        if (b->mem.bufferLength == 0 && b->reservedLength == 0) {
             b->mem.bufferStart = b->mem.bufferData;
         } else {
             b->mem.bufferStart += msg_size;
@@ -922,7 +1572,12 @@ again:
             mtmsg_buffer_remove_from_ready_list(b->listener, b, false);
         }
         b->msgCount -= 1;
-        if (b->mem.bufferLength > 0) {
+        mtmsg_buffer_stats_taken(b, NULL, 1, msg_size);
+        if (b->mem.bufferLength == 0 && b->spillCount > 0) {
+            mtmsg_buffer_unspill(b); /* on error the next reader gets the error */
+        }
+        mtmsg_buffer_mem_changed(b);
+        if (b->mem.bufferLength > 0 || b->spillCount > 0) {
             if (b->listener) {
                 mtmsg_buffer_add_to_ready_list(b->listener, b);
             }
@@ -933,6 +1588,7 @@ again:
         if (ntf) {
             if (ntf->threshold <= 0 || b->msgCount < ntf->threshold) {
                 atomic_inc(&ntf->used);
+                mtmsg_buffer_stats_notify(b);
             } else {
                 ntf = NULL;
             }
@@ -940,18 +1596,61 @@ again:
         
         async_mutex_unlock(b->sharedMutex);
 
+        if (resultDict) {
+            mtmsg_dict_release(*resultDict);
+            *resultDict = mtmsg_dict_retain(dict);
+        }
         if (ntf) {
             int rc2 = mtmsg_buffer_call_notifier(L, b, ntf, &b->decNotifier, sender_eh, sender_ehdata);
             if (rc2 != 0) {
                 return -999;
             }
         }
+        int rc3 = mtmsg_serialize_unwrap_msg(resultBuffer, resultOffset);
+        if (rc3 != 0) {
+            resultBuffer->bufferLength = resultOffset;
+            if (decodeArgs) {
+                return (rc3 == -3) ? luaL_error(L, "corrupt compressed message")
+                                   : (rc3 == -4) ? luaL_error(L, "invalid portable message")
+                                                 : mtmsg_ERROR_OUT_OF_MEMORY(L);
+            }
+            return (rc3 == -1) ? -4 : -5;
+        }
+        if (decodeArgs) {
+            GetMsgArgsPar par; par.inBuffer       = resultBuffer->bufferStart;
+                               par.inBufferSize   = resultBuffer->bufferLength;
+                               par.inMaxArgCount  = -1;
+                               par.parsedLength   = 0;
+                               par.parsedArgCount = 0;
+                               par.carrayCapi     = udata->carrayCapi; 
+                               par.errorArg       = 0;
+                               par.dict           = dict;
+                               par.dictCache      = 0;
+            lua_pushcfunction(L, mtmsg_serialize_get_msg_args);
+            lua_insert(L, arg);
+            lua_pushlightuserdata(L, &par);
+            lua_insert(L, arg + 1);
+            int nargs = argTop - arg + 1;
+            int rc = lua_pcall(L, nargs + 1, LUA_MULTRET, 0);
+            resultBuffer->bufferLength = 0;
+            if (rc != LUA_OK) {
+                if (par.errorArg) {
+                    return luaL_argerror(L, arg + par.errorArg - 2, lua_tostring(L, -1));
+                } else {
+                    return lua_error(L);
+                }
+            }
+            rslt = par.parsedArgCount;
+            udata->carrayCapi = par.carrayCapi;
+        }
         return rslt;
     } else {
         if (endTime >= 0) {
             lua_Number now = mtmsg_current_time_seconds();
             if (now < endTime) {
+                mtmsg_trace_block_start(b->id);
                 async_mutex_wait_millis(b->sharedMutex, (int)((endTime - now) * 1000 + 0.5));
+                mtmsg_trace_block_end(b->id);
                 goto again;
             } else {
                 async_mutex_unlock(b->sharedMutex);
@@ -962,20 +1661,506 @@ again:
                 async_mutex_unlock(b->sharedMutex);
                 return 0;
             } else {
+                mtmsg_trace_block_start(b->id);
                 async_mutex_wait(b->sharedMutex);
+                mtmsg_trace_block_end(b->id);
                 goto again;
             }
         }
     }
 }
 
+/**
+ * Moves framed messages from the buffer to the end of out: all messages
+ * that are in memory or at most maxCount messages if maxCount > 0. 
+ * Waits up to timeoutSeconds for messages, forever if timeoutSeconds < 0.
+ * Returns the number of messages, 0 on timeout, -1 if the buffer is closed, 
+ * -2 if aborted, -3 if the buffer has a string dictionary, -5 if out of memory
+ * and -6 if spilled messages cannot be read back.
+ */
+int mtmsg_buffer_take_msgs(MsgBuffer* b, MemBuffer* out, int maxCount, double timeoutSeconds)
+{
+    lua_Number endTime = -1;
+    if (timeoutSeconds >= 0) {
+        endTime = mtmsg_current_time_seconds() + timeoutSeconds;
+    }
+    async_mutex_lock(b->sharedMutex);
+again:
+    if (b->closed || b->aborted) {
+        bool closed = b->closed;
+        async_mutex_notify(b->sharedMutex);
+        async_mutex_unlock(b->sharedMutex);
+        return closed ? -1 : -2;
+    }
+    if (b->dict) {
+        /* dictionary entries are only valid in this process */
+        async_mutex_unlock(b->sharedMutex);
+        return -3;
+    }
+    mtmsg_buffer_mem_refresh(b);
+    if (b->mem.bufferLength == 0 && b->spillCount > 0) {
+        int rc = mtmsg_buffer_unspill(b);
+        if (rc != 0) {
+            async_mutex_unlock(b->sharedMutex);
+            return rc;
+        }
+        mtmsg_buffer_mem_changed(b);
+    }
+    if (b->mem.bufferLength == 0) {
+        lua_Number now = mtmsg_current_time_seconds();
+        if (endTime < 0) {
+            mtmsg_trace_block_start(b->id);
+            async_mutex_wait(b->sharedMutex);
+            mtmsg_trace_block_end(b->id);
+            goto again;
+        } else if (now < endTime) {
+            mtmsg_trace_block_start(b->id);
+            async_mutex_wait_millis(b->sharedMutex, (int)((endTime - now) * 1000 + 0.5));
+            mtmsg_trace_block_end(b->id);
+            goto again;
+        } else {
+            async_mutex_unlock(b->sharedMutex);
+            return 0;
+        }
+    }
+    int    count = b->msgCount - b->spillCount;
+    size_t len   = b->mem.bufferLength;
+    if (maxCount > 0 && maxCount < count) {
+        len = 0;
+        int i;
+        for (i = 0; i < maxCount; ++i) {
+            SerializedMsgSizes sizes;
+            mtmsg_serialize_parse_header(b->mem.bufferStart + len, &sizes);
+            len += sizes.header_size + sizes.args_size;
+        }
+        count = maxCount;
+    }
+    if (mtmsg_membuf_reserve(out, len) != 0) {
+        async_mutex_unlock(b->sharedMutex);
+        return -5;
+    }
+    memcpy(out->bufferStart + out->bufferLength, b->mem.bufferStart, len);
+    out->bufferLength += len;
+
+    b->mem.bufferLength -= len;
+    if (b->mem.bufferLength == 0 && b->reservedLength == 0) {
+        b->mem.bufferStart = b->mem.bufferData;
+    } else {
+        b->mem.bufferStart += len;
+    }
+    if (b->listener) {
+        mtmsg_buffer_remove_from_ready_list(b->listener, b, false);
+    }
+    b->msgCount -= count;
+    mtmsg_buffer_stats_taken(b, NULL, count, len);
+    if (b->mem.bufferLength == 0 && b->spillCount > 0) {
+        mtmsg_buffer_unspill(b); /* on error the next reader gets the error */
+    }
+    mtmsg_buffer_mem_changed(b);
+    if (b->mem.bufferLength > 0 || b->spillCount > 0) {
+        if (b->listener) {
+            mtmsg_buffer_add_to_ready_list(b->listener, b);
+        }
+        async_mutex_notify(b->sharedMutex);
+    }
+    NotifierHolder* ntf = b->decNotifier;
+    if (ntf) {
+        if (ntf->threshold <= 0 || b->msgCount < ntf->threshold) {
+            atomic_inc(&ntf->used);
+            mtmsg_buffer_stats_notify(b);
+        } else {
+            ntf = NULL;
+        }
+    }
+    async_mutex_unlock(b->sharedMutex);
+
+    if (ntf) {
+        mtmsg_buffer_call_notifier(NULL, b, ntf, &b->decNotifier, NULL, NULL);
+    }
+    return count;
+}
+
+/**
+ * Puts count framed messages with total length len that were taken by
+ * mtmsg_buffer_take_msgs() but could not be delivered back to the front of
+ * the buffer. A buffer with fixed size keeps the additional memory if other
+ * messages were added in the meantime. Returns 0 on success, -4 if the
+ * messages cannot be stored without moving unconsumed messages of a mapped
+ * file over themselves, -5 if out of memory.
+ */
+int mtmsg_buffer_unget_msgs(MsgBuffer* b, const char* msgs, size_t len, int count)
+{
+    if (count == 0) {
+        return 0;
+    }
+    async_mutex_lock(b->sharedMutex);
+    mtmsg_buffer_wait_reserved(b, false);
+    mtmsg_buffer_mem_refresh(b);
+
+    size_t offset = b->mem.bufferStart - b->mem.bufferData;
+    size_t length = b->mem.bufferLength;
+    if (length == 0) {
+        b->mem.bufferStart = b->mem.bufferData;
+        offset = 0;
+    }
+    if (offset < len) {
+        if (b->mapFile) {
+            /* move the messages to the end first, the file remains valid if the process dies */
+            size_t newOffset = b->mem.bufferCapacity - length;
+            if (length > 0 && (len > newOffset || offset + length > newOffset - len)) {
+                async_mutex_unlock(b->sharedMutex);
+                return -4;
+            }
+            if (length > 0) {
+                memcpy(b->mem.bufferData + newOffset, b->mem.bufferStart, length);
+                b->mem.bufferStart = b->mem.bufferData + newOffset;
+                mtmsg_buffer_mem_changed(b);
+            } else if (len > b->mem.bufferCapacity) {
+                async_mutex_unlock(b->sharedMutex);
+                return -4;
+            } else {
+                b->mem.bufferStart = b->mem.bufferData + len;
+            }
+        } else {
+            lua_Number growFactor = b->mem.growFactor;
+            if (growFactor <= 0) {
+                b->mem.growFactor = 1; /* grow only by the needed bytes */
+            }
+            int rc = mtmsg_membuf_reserve0(&b->mem, len + length);
+            b->mem.growFactor = growFactor;
+            if (rc != 0) {
+                async_mutex_unlock(b->sharedMutex);
+                return -5;
+            }
+            memmove(b->mem.bufferData + len, b->mem.bufferData, length);
+            b->mem.bufferStart = b->mem.bufferData + len;
+        }
+    }
+    b->mem.bufferStart  -= len;
+    b->mem.bufferLength += len;
+    memcpy(b->mem.bufferStart, msgs, len);
+    b->msgCount += count;
+    mtmsg_buffer_mem_changed(b);
+
+    /* messages are counted again when they are taken the next time */
+    b->stats.takenMsgs  -= count;
+    b->stats.takenBytes -= len;
+    if (b->timing) {
+        b->timing->queue.untimed += count;
+    }
+    if (b->listener && !mtmsg_is_on_ready_list(b->listener, b)) {
+        mtmsg_buffer_add_to_ready_list(b->listener, b);
+    }
+    async_mutex_notify(b->sharedMutex);
+    async_mutex_unlock(b->sharedMutex);
+    return 0;
+}
+
+/**
+ * Moves at most maxCount messages from the buffer to the end of out in one
+ * critical section. The frame headers are removed and the size of each 
+ * message is appended to lengths as size_t. Further messages are not taken 
+ * if their total size would exceed maxBytes (if maxBytes > 0) or out cannot 
+ * grow, but the first message is always taken. The messages may be 
+ * compressed or portable, see mtmsg_serialize_unwrap_msg().
+ * Waits as mtmsg_buffer_next_msg() without Lua state. Returns the number 
+ * of messages, 0 if no message is available or a negative value as 
+ * mtmsg_buffer_next_msg().
+ */
+int mtmsg_buffer_next_msgs(MsgBuffer* b, bool nonblock, double timeoutSeconds, int maxCount, size_t maxBytes,
+                           MemBuffer* out, MemBuffer* lengths, MsgDict** resultDict,
+                           sender_error_handler sender_eh, void* sender_ehdata)
+{
+    lua_Number endTime = -1; /* -1 = no timeout, wait forever */
+    if (timeoutSeconds >= 0) {
+        endTime = mtmsg_current_time_seconds() + timeoutSeconds;
+        if (timeoutSeconds == 0) {
+            nonblock = true;
+        }
+    }
+    if (nonblock) {
+        if (!async_mutex_trylock(b->sharedMutex)) {
+            return 0;
+        }
+    } else {
+        async_mutex_lock(b->sharedMutex);
+    }
+again:
+    if (b->closed || b->aborted) {
+        bool closed = b->closed;
+        async_mutex_notify(b->sharedMutex);
+        async_mutex_unlock(b->sharedMutex);
+        return closed ? -1 : -2;
+    }
+    mtmsg_buffer_mem_refresh(b);
+    if (b->mem.bufferLength == 0 && b->spillCount > 0) {
+        int rc = mtmsg_buffer_unspill(b);
+        if (rc != 0) {
+            async_mutex_unlock(b->sharedMutex);
+            return rc;
+        }
+        mtmsg_buffer_mem_changed(b);
+    }
+    if (b->mem.bufferLength == 0) {
+        if (nonblock) {
+            async_mutex_unlock(b->sharedMutex);
+            return 0;
+        }
+        lua_Number now = mtmsg_current_time_seconds();
+        if (endTime < 0) {
+            mtmsg_trace_block_start(b->id);
+            async_mutex_wait(b->sharedMutex);
+            mtmsg_trace_block_end(b->id);
+            goto again;
+        } else if (now < endTime) {
+            mtmsg_trace_block_start(b->id);
+            async_mutex_wait_millis(b->sharedMutex, (int)((endTime - now) * 1000 + 0.5));
+            mtmsg_trace_block_end(b->id);
+            goto again;
+        } else {
+            async_mutex_unlock(b->sharedMutex);
+            return 0;
+        }
+    }
+    if (b->listener) {
+        mtmsg_buffer_remove_from_ready_list(b->listener, b, false);
+    }
+    int    count    = 0;
+    size_t outBytes = 0;
+    size_t len      = 0;
+    while (count < maxCount && b->mem.bufferLength > 0) {
+        SerializedMsgSizes sizes;
+        mtmsg_serialize_parse_header(b->mem.bufferStart, &sizes);
+        if (count > 0 && maxBytes > 0 && outBytes + sizes.args_size > maxBytes) {
+            break;
+        }
+        int rc = mtmsg_membuf_reserve(out, sizes.args_size);
+        if (rc == 0) {
+            rc = mtmsg_membuf_reserve(lengths, sizeof(size_t));
+        }
+        if (rc != 0) {
+            if (count > 0) {
+                break;
+            }
+            if (b->listener) {
+                mtmsg_buffer_add_to_ready_list(b->listener, b);
+            }
+            async_mutex_unlock(b->sharedMutex);
+            /* rc = -1 : buffer should not grow */
+            /* rc = -2 : buffer can    not grow */
+            return (rc == -1) ? -4 : -5;
+        }
+        memcpy(out->bufferStart + out->bufferLength, 
+               b->mem.bufferStart + sizes.header_size, 
+               sizes.args_size);
+        out->bufferLength += sizes.args_size;
+        memcpy(lengths->bufferStart + lengths->bufferLength, &sizes.args_size, sizeof(size_t));
+        lengths->bufferLength += sizeof(size_t);
+
+        size_t msg_size = sizes.header_size + sizes.args_size;
+        b->mem.bufferLength -= msg_size;
+        if (b->mem.bufferLength == 0 && b->reservedLength == 0) {
+            b->mem.bufferStart = b->mem.bufferData;
+        } else {
+            b->mem.bufferStart += msg_size;
+        }
+        outBytes += sizes.args_size;
+        len      += msg_size;
+        count    += 1;
+        if (b->mem.bufferLength == 0 && b->spillCount > 0) {
+            mtmsg_buffer_unspill(b); /* on error the next reader gets the error */
+        }
+    }
+    b->msgCount -= count;
+    mtmsg_buffer_stats_taken(b, NULL, count, len);
+    mtmsg_buffer_mem_changed(b);
+    if (b->mem.bufferLength > 0 || b->spillCount > 0) {
+        if (b->listener) {
+            mtmsg_buffer_add_to_ready_list(b->listener, b);
+        }
+        async_mutex_notify(b->sharedMutex);
+    }
+    MsgDict* dict = b->dict; /* lives as long as b */
+
+    NotifierHolder* ntf = b->decNotifier;
+    if (ntf) {
+        if (ntf->threshold <= 0 || b->msgCount < ntf->threshold) {
+            atomic_inc(&ntf->used);
+            mtmsg_buffer_stats_notify(b);
+        } else {
+            ntf = NULL;
+        }
+    }
+    async_mutex_unlock(b->sharedMutex);
+
+    if (resultDict) {
+        mtmsg_dict_release(*resultDict);
+        *resultDict = mtmsg_dict_retain(dict);
+    }
+    if (ntf) {
+        int rc2 = mtmsg_buffer_call_notifier(NULL, b, ntf, &b->decNotifier, sender_eh, sender_ehdata);
+        if (rc2 != 0) {
+            return -999;
+        }
+    }
+    return count;
+}
+
+/**
+ * true if len bytes can be appended to the messages in memory.
+ */
+static bool hasRoomFor(MsgBuffer* b, size_t len)
+{
+    if (b->mapFile && mtmsg_mapfile_would_overlap(&b->mem, len)) {
+        return false;
+    }
+    return b->mem.growFactor > 0 || b->mem.bufferLength + len <= b->mem.bufferCapacity;
+}
+
+/**
+ * Appends count framed messages with total length len to the buffer. If 
+ * partial, only the leading messages that fit into the buffer are appended
+ * and putLength is set to their total length.
+ * Returns the number of appended messages or a negative value as 
+ * mtmsg_buffer_take_msgs(), -4 if the buffer is full. Raises errors 
+ * instead if L is not NULL.
+ */
+int mtmsg_buffer_put_msgs(lua_State* L, MsgBuffer* b, const char* msgs, size_t len, int count, bool partial,
+                          size_t* putLength)
+{
+    if (putLength) {
+        *putLength = 0;
+    }
+    if (count == 0) {
+        return 0;
+    }
+    async_mutex_lock(b->sharedMutex);
+    mtmsg_buffer_wait_reserved(b, false);
+
+    if (b->closed) {
+        async_mutex_unlock(b->sharedMutex);
+        if (L) {
+            const char* qstring = mtmsg_buffer_tostring(L, b);
+            return mtmsg_ERROR_OBJECT_CLOSED(L, qstring);
+        }
+        return -1;
+    }
+    if (b->aborted) {
+        async_mutex_unlock(b->sharedMutex);
+        if (L) {
+            return mtmsg_ERROR_OPERATION_ABORTED(L);
+        }
+        return -2;
+    }
+    mtmsg_buffer_mem_refresh(b);
+    if (b->spillCount > 0) {
+        /* keep the order of messages */
+        if (   len > (size_t)(LONG_MAX - b->spillWritePos)
+            || fseek(b->spillFile, b->spillWritePos, SEEK_SET) != 0
+            || fwrite(msgs, 1, len, b->spillFile) != len) 
+        {
+            mtmsg_buffer_stats_full(b, count);
+            async_mutex_unlock(b->sharedMutex);
+            return -4;
+        }
+        b->spillWritePos += len;
+        b->spillCount    += count;
+    } else {
+        int totalCount = count;
+        if (partial && !hasRoomFor(b, len)) {
+            size_t fitLen   = 0;
+            int    fitCount = 0;
+            while (fitCount < count) {
+                SerializedMsgSizes sizes;
+                mtmsg_serialize_parse_header(msgs + fitLen, &sizes);
+                size_t msgLen = sizes.header_size + sizes.args_size;
+                if (!hasRoomFor(b, fitLen + msgLen)) {
+                    break;
+                }
+                fitLen   += msgLen;
+                fitCount += 1;
+            }
+            len   = fitLen;
+            count = fitCount;
+        }
+        int rc;
+        if (count == 0 || (b->mapFile && mtmsg_mapfile_would_overlap(&b->mem, len))) {
+            rc = -1;
+        } else {
+            rc = reserveMsgMem(b, &b->mem, len);
+        }
+        if (rc == -1) {
+            mtmsg_buffer_stats_full(b, totalCount);
+        }
+        if (rc != 0) {
+            async_mutex_unlock(b->sharedMutex);
+            if (rc == -2) {
+                if (L) {
+                    return mtmsg_ERROR_OUT_OF_MEMORY_bytes(L, b->mem.bufferLength + len);
+                }
+                return -5;
+            }
+            return -4;
+        }
+        memcpy(b->mem.bufferStart + b->mem.bufferLength, msgs, len);
+        b->mem.bufferLength += len;
+    }
+    if (putLength) {
+        *putLength = len;
+    }
+    b->msgCount += count;
+    mtmsg_buffer_mem_changed(b);
+    mtmsg_buffer_stats_added(b, count, len);
+
+    if (b->listener && !mtmsg_is_on_ready_list(b->listener, b)) {
+        mtmsg_buffer_add_to_ready_list(b->listener, b);
+    }
+    NotifierHolder* ntf = b->incNotifier;
+    if (ntf) {
+        if (b->msgCount > ntf->threshold) {
+            atomic_inc(&ntf->used);
+            mtmsg_buffer_stats_notify(b);
+        } else {
+            ntf = NULL;
+        }
+    }
+    async_mutex_notify(b->sharedMutex);
+    async_mutex_unlock(b->sharedMutex);
+
+    if (ntf) {
+        mtmsg_buffer_call_notifier(L, b, ntf, &b->incNotifier, NULL, NULL);
+    }
+    return count;
+}
+
+/**
+ * true if the first message in msgs can never be stored in the buffer, 
+ * because the buffer should not grow. msgSize is set to the message size.
+ */
+bool mtmsg_buffer_is_too_large(MsgBuffer* b, const char* msgs, size_t len, size_t* msgSize)
+{
+    /* capacity does not change for buffers that should not grow */
+    if (len == 0 || b->mem.growFactor > 0) {
+        return false;
+    }
+    char header[1 + sizeof(size_t) + 10] = { 0 };
+    memcpy(header, msgs, len < sizeof(header) ? len : sizeof(header));
+    SerializedMsgSizes sizes;
+    mtmsg_serialize_parse_header(header, &sizes);
+    if (sizes.header_size > len) {
+        return false;
+    }
+    *msgSize = sizes.header_size + sizes.args_size;
+    return sizes.args_size > b->mem.bufferCapacity - sizes.header_size;
+}
+
 static int MsgBuffer_nextMsg(lua_State* L)
 {
     int arg = 1;
     BufferUserData* udata = luaL_checkudata(L, arg++, MTMSG_BUFFER_CLASS_NAME);
     
     int parsedArgCount = mtmsg_buffer_next_msg(L, udata, udata->buffer, udata->nonblock, arg, 0 /* timeout from arg */, NULL, NULL,
-                                                  NULL, NULL);
+                                                  NULL, NULL, NULL);
     return parsedArgCount; /* parsedArgCount because resultBuffer is NULL */
 }
 
@@ -1124,14 +2309,800 @@ static int MsgBuffer_nonblock(lua_State* L)
     return 0;
 }
 
-static int MsgBuffer_isNonblock(lua_State* L)
+static int MsgBuffer_dictionary(lua_State* L)
 {
     int arg = 1;
     BufferUserData* udata = luaL_checkudata(L, arg++, MTMSG_BUFFER_CLASS_NAME);
+    MsgBuffer*      b = udata->buffer;
+    
+    bool useDict = true;
 
-    lua_pushboolean(L, udata->nonblock);
-
-    return 1;
+    if (lua_gettop(L) >= arg) 
+    {
+        luaL_checktype(L, arg, LUA_TBOOLEAN);
+        useDict = lua_toboolean(L, arg++);
+    } 
+    MsgDict* newDict = NULL;
+    if (useDict) {
+        newDict = mtmsg_dict_new(); /* create before lock */
+        if (!newDict) {
+            return mtmsg_ERROR_OUT_OF_MEMORY(L);
+        }
+    }
+    async_mutex_lock(b->sharedMutex);
+
+    if (b->closed) {
+        async_mutex_unlock(b->sharedMutex);
+        mtmsg_dict_release(newDict);
+        const char* qstring = mtmsg_buffer_tostring(L, b);
+        return mtmsg_ERROR_OBJECT_CLOSED(L, qstring);
+    }
+    if (b->aborted) {
+        async_mutex_unlock(b->sharedMutex);
+        mtmsg_dict_release(newDict);
+        return mtmsg_ERROR_OPERATION_ABORTED(L);
+    }
+    if (useDict && b->mapFile) {
+        /* dictionary entries would not survive reopening the file */
+        async_mutex_unlock(b->sharedMutex);
+        mtmsg_dict_release(newDict);
+        return luaL_error(L, "string dictionary is not supported for file buffers");
+    }
+    if (useDict && !b->dict) {
+        b->dict = newDict;
+        newDict = NULL;
+    }
+    b->useDict = useDict;
+
+    async_mutex_unlock(b->sharedMutex);
+    mtmsg_dict_release(newDict);
+    return 0;
+}
+
+static int MsgBuffer_compression(lua_State* L)
+{
+    int arg = 1;
+    BufferUserData* udata = luaL_checkudata(L, arg++, MTMSG_BUFFER_CLASS_NAME);
+    MsgBuffer*      b = udata->buffer;
+    
+    lua_Integer threshold = 1024;
+
+    if (lua_gettop(L) >= arg) 
+    {
+        if (lua_isboolean(L, arg)) {
+            threshold = lua_toboolean(L, arg++) ? 1024 : 0;
+        } else {
+            threshold = luaL_checkinteger(L, arg++);
+            if (threshold < 0) {
+                threshold = 0;
+            } else if (threshold > INT_MAX) {
+                threshold = INT_MAX;
+            }
+        }
+    } 
+    async_mutex_lock(b->sharedMutex);
+
+    if (b->closed) {
+        async_mutex_unlock(b->sharedMutex);
+        const char* qstring = mtmsg_buffer_tostring(L, b);
+        return mtmsg_ERROR_OBJECT_CLOSED(L, qstring);
+    }
+    if (b->aborted) {
+        async_mutex_unlock(b->sharedMutex);
+        return mtmsg_ERROR_OPERATION_ABORTED(L);
+    }
+    atomic_set(&b->compressThreshold, (int)threshold);
+
+    async_mutex_unlock(b->sharedMutex);
+    return 0;
+}
+
+static int MsgBuffer_portable(lua_State* L)
+{
+    int arg = 1;
+    BufferUserData* udata = luaL_checkudata(L, arg++, MTMSG_BUFFER_CLASS_NAME);
+    MsgBuffer*      b = udata->buffer;
+    
+    bool portable = true;
+
+    if (lua_gettop(L) >= arg) {
+        luaL_checktype(L, arg, LUA_TBOOLEAN);
+        portable = lua_toboolean(L, arg++);
+    }
+    async_mutex_lock(b->sharedMutex);
+
+    if (b->closed) {
+        async_mutex_unlock(b->sharedMutex);
+        const char* qstring = mtmsg_buffer_tostring(L, b);
+        return mtmsg_ERROR_OBJECT_CLOSED(L, qstring);
+    }
+    if (b->aborted) {
+        async_mutex_unlock(b->sharedMutex);
+        return mtmsg_ERROR_OPERATION_ABORTED(L);
+    }
+    atomic_set(&b->portable, portable);
+
+    async_mutex_unlock(b->sharedMutex);
+    return 0;
+}
+
+static int MsgBuffer_timing(lua_State* L)
+{
+    int arg = 1;
+    BufferUserData* udata = luaL_checkudata(L, arg++, MTMSG_BUFFER_CLASS_NAME);
+    MsgBuffer*      b = udata->buffer;
+    
+    bool enable = true;
+
+    if (lua_gettop(L) >= arg) {
+        luaL_checktype(L, arg, LUA_TBOOLEAN);
+        enable = lua_toboolean(L, arg++);
+    }
+    MsgTiming*        newTiming  = NULL;
+    LatencyHistogram* newLatency = NULL;
+    if (enable) {
+        newTiming  = calloc(1, sizeof(MsgTiming));
+        newLatency = calloc(1, sizeof(LatencyHistogram));
+        if (!newTiming || !newLatency) {
+            free(newTiming);
+            free(newLatency);
+            return mtmsg_ERROR_OUT_OF_MEMORY(L);
+        }
+    }
+    async_mutex_lock(b->sharedMutex);
+
+    if (b->closed) {
+        async_mutex_unlock(b->sharedMutex);
+        freeTiming(newTiming);
+        free(newLatency);
+        const char* qstring = mtmsg_buffer_tostring(L, b);
+        return mtmsg_ERROR_OBJECT_CLOSED(L, qstring);
+    }
+    if (b->aborted) {
+        async_mutex_unlock(b->sharedMutex);
+        freeTiming(newTiming);
+        free(newLatency);
+        return mtmsg_ERROR_OPERATION_ABORTED(L);
+    }
+    if (b->sharedMem) {
+        async_mutex_unlock(b->sharedMutex);
+        freeTiming(newTiming);
+        free(newLatency);
+        return luaL_error(L, "timing is not supported for buffers in shared memory");
+    }
+    MsgTiming* oldTiming = NULL;
+    if (!enable) {
+        oldTiming = b->timing;
+        b->timing = NULL;
+    } else if (!b->timing) {
+        newTiming->queue.untimed = b->msgCount;
+        b->timing = newTiming;
+        newTiming = NULL;
+        if (b->listener && !b->listener->latency) {
+            b->listener->latency = newLatency;
+            newLatency = NULL;
+        }
+    }
+    async_mutex_unlock(b->sharedMutex);
+
+    freeTiming(oldTiming);
+    freeTiming(newTiming);
+    free(newLatency);
+    return 0;
+}
+
+static int MsgBuffer_latency(lua_State* L)
+{
+    int arg = 1;
+    BufferUserData* udata = luaL_checkudata(L, arg++, MTMSG_BUFFER_CLASS_NAME);
+    MsgBuffer*      b = udata->buffer;
+    
+    bool reset = false;
+
+    if (lua_gettop(L) >= arg) {
+        luaL_checktype(L, arg, LUA_TBOOLEAN);
+        reset = lua_toboolean(L, arg++);
+    }
+    LatencyHistogram* h = malloc(sizeof(LatencyHistogram));
+    if (!h) {
+        return mtmsg_ERROR_OUT_OF_MEMORY(L);
+    }
+    bool     hasTiming = false;
+    bool     hasOldest = false;
+    uint64_t oldest    = 0;
+
+    async_mutex_lock(b->sharedMutex);
+    if (b->timing) {
+        hasTiming = true;
+        memcpy(h, &b->timing->histogram, sizeof(LatencyHistogram));
+        if (reset) {
+            mtmsg_latency_reset(&b->timing->histogram);
+        }
+        TimestampQueue* q = &b->timing->queue;
+        if (q->untimed == 0) {
+            hasOldest = true;
+            if (q->count > 0) {
+                uint64_t now = mtmsg_latency_now();
+                uint64_t t   = q->times[q->first];
+                oldest = (now > t) ? (now - t) : 0;
+            }
+        }
+    }
+    async_mutex_unlock(b->sharedMutex);
+
+    if (hasTiming) {
+        mtmsg_latency_push_table(L, h);
+        if (hasOldest) {
+            lua_pushnumber(L, oldest * 1e-9);
+            lua_setfield(L, -2, "oldest");
+        }
+    } else {
+        lua_pushnil(L);
+    }
+    free(h);
+    return 1;
+}
+
+static int MsgBuffer_spill(lua_State* L)
+{
+    int arg = 1;
+    BufferUserData* udata = luaL_checkudata(L, arg++, MTMSG_BUFFER_CLASS_NAME);
+    MsgBuffer*      b = udata->buffer;
+    
+    lua_Integer threshold = 0;
+    if (!lua_isboolean(L, arg) || lua_toboolean(L, arg)) {
+        threshold = luaL_checkinteger(L, arg++);
+        if (threshold < 0) {
+            threshold = 0;
+        }
+    }
+    async_mutex_lock(b->sharedMutex);
+
+    if (b->closed) {
+        async_mutex_unlock(b->sharedMutex);
+        const char* qstring = mtmsg_buffer_tostring(L, b);
+        return mtmsg_ERROR_OBJECT_CLOSED(L, qstring);
+    }
+    if (b->aborted) {
+        async_mutex_unlock(b->sharedMutex);
+        return mtmsg_ERROR_OPERATION_ABORTED(L);
+    }
+    if (threshold > 0 && b->mapFile) {
+        /* spilled messages would not survive reopening the file */
+        async_mutex_unlock(b->sharedMutex);
+        return luaL_error(L, "spilling is not supported for file buffers");
+    }
+    b->spillThreshold = threshold;
+    if (threshold > 0 && !b->spillMem.bufferData) {
+        mtmsg_membuf_init(&b->spillMem, 0, 2);
+    }
+
+    async_mutex_unlock(b->sharedMutex);
+    return 0;
+}
+
+/**
+ * Dump format: header with magic, version and platform dependent sizes
+ * followed by the framed messages as they are stored in the buffer.
+ * The platform is not checked if all messages in the dump are portable.
+ */
+#define BUFFER_DUMP_VERSION     1
+
+static const char BUFFER_DUMP_MAGIC[8] = "mtmsgbd";
+
+void mtmsg_buffer_dump_header(char* header, bool portable)
+{
+    memset(header, 0, BUFFER_DUMP_HEADER_SIZE);
+    memcpy(header, BUFFER_DUMP_MAGIC, sizeof(BUFFER_DUMP_MAGIC));
+    header[8]  = BUFFER_DUMP_VERSION;
+    header[9]  = sizeof(size_t);
+    header[10] = sizeof(lua_Integer);
+    header[11] = sizeof(lua_Number);
+    header[12] = mtmsg_serialize_is_little_endian();
+    header[13] = portable;
+}
+
+const char* mtmsg_buffer_check_dump_header(const char* data, size_t len)
+{
+    char expected[BUFFER_DUMP_HEADER_SIZE];
+    mtmsg_buffer_dump_header(expected, false);
+    if (   len < BUFFER_DUMP_HEADER_SIZE 
+        || memcmp(data, expected, sizeof(BUFFER_DUMP_MAGIC)) != 0) 
+    {
+        return "invalid dump format";
+    }
+    if (data[8] != expected[8]) {
+        return "unsupported dump version";
+    }
+    if (data[13] == 0 && memcmp(data, expected, BUFFER_DUMP_HEADER_SIZE) != 0) {
+        return "dump was created on an incompatible platform";
+    }
+    return NULL;
+}
+
+/**
+ * Copies header and all messages including spilled messages into data.
+ * Must be called under the buffer's lock. Returns false if the spill file
+ * cannot be read.
+ */
+static bool dumpToMemory(MsgBuffer* b, char* data, size_t len, size_t spillLength)
+{
+    memcpy(data + BUFFER_DUMP_HEADER_SIZE, b->mem.bufferStart, b->mem.bufferLength);
+    if (spillLength > 0) {
+        if (   fseek(b->spillFile, b->spillReadPos, SEEK_SET) != 0
+            || fread(data + len - spillLength, 1, spillLength, b->spillFile) != spillLength) 
+        {
+            return false;
+        }
+    }
+    /* messages added before the buffer's mode was changed keep their format */
+    mtmsg_buffer_dump_header(data, mtmsg_serialize_is_portable_msgs(data + BUFFER_DUMP_HEADER_SIZE, 
+                                                                     len - BUFFER_DUMP_HEADER_SIZE));
+    return true;
+}
+
+/**
+ * Returns the dump of the buffer, the dump is in a userdata that is left
+ * on top of the stack.
+ */
+static char* dumpBuffer(lua_State* L, MsgBuffer* b, size_t* dumpLength)
+{
+    size_t capacity = 0;
+    char*  data     = NULL;
+    while (true) {
+        async_mutex_lock(b->sharedMutex);
+
+        if (b->closed) {
+            async_mutex_unlock(b->sharedMutex);
+            const char* qstring = mtmsg_buffer_tostring(L, b);
+            mtmsg_ERROR_OBJECT_CLOSED(L, qstring);
+            return NULL;
+        }
+        if (b->aborted) {
+            async_mutex_unlock(b->sharedMutex);
+            mtmsg_ERROR_OPERATION_ABORTED(L);
+            return NULL;
+        }
+        if (b->dict) {
+            /* dictionary entries are only valid in this process */
+            async_mutex_unlock(b->sharedMutex);
+            luaL_error(L, "dump is not supported for buffers with string dictionary");
+            return NULL;
+        }
+        mtmsg_buffer_mem_refresh(b);
+        size_t spillLength = (b->spillCount > 0) ? (size_t)(b->spillWritePos - b->spillReadPos) : 0;
+        size_t len         = BUFFER_DUMP_HEADER_SIZE + b->mem.bufferLength + spillLength;
+        if (len <= capacity) {
+            bool ok = dumpToMemory(b, data, len, spillLength);
+            async_mutex_unlock(b->sharedMutex);
+            if (!ok) {
+                mtmsg_ERROR_FILE_ERROR(L, "cannot read spill file");
+                return NULL;
+            }
+            *dumpLength = len;
+            return data;
+        }
+        async_mutex_unlock(b->sharedMutex);
+        
+        /* allocate outside the lock and try again */
+        if (data) {
+            lua_pop(L, 1);
+        }
+        capacity = len + len / 8;
+        data = lua_newuserdata(L, capacity);
+    }
+}
+
+static int MsgBuffer_dump(lua_State* L)
+{
+    int arg = 1;
+    BufferUserData* udata = luaL_checkudata(L, arg++, MTMSG_BUFFER_CLASS_NAME);
+    MsgBuffer*      b = udata->buffer;
+
+    size_t len;
+    char*  data = dumpBuffer(L, b, &len);
+    lua_pushlstring(L, data, len);
+    return 1;
+}
+
+static int MsgBuffer_dumpFile(lua_State* L)
+{
+    int arg = 1;
+    BufferUserData* udata    = luaL_checkudata(L, arg++, MTMSG_BUFFER_CLASS_NAME);
+    MsgBuffer*      b        = udata->buffer;
+    const char*     fileName = luaL_checkstring(L, arg++);
+
+    size_t len;
+    char*  data  = dumpBuffer(L, b, &len);
+    FILE*  f     = fopen(fileName, "wb");
+    bool   ok    = f && fwrite(data, 1, len, f) == len;
+    int    error = errno;
+    if (f && fclose(f) != 0 && ok) {
+        ok    = false;
+        error = errno;
+    }
+    if (!ok) {
+        lua_pushfstring(L, "cannot write file '%s': %s", fileName, strerror(error));
+        return mtmsg_ERROR_FILE_ERROR(L, lua_tostring(L, -1));
+    }
+    return 0;
+}
+
+/**
+ * Appends the messages of a dump to the buffer. Returns false if the 
+ * buffer is full.
+ */
+static bool loadBuffer(lua_State* L, MsgBuffer* b, int arg, const char* data, size_t len)
+{
+    const char* reason = mtmsg_buffer_check_dump_header(data, len);
+    int         count  = reason ? 0 : mtmsg_serialize_count_msgs(data + BUFFER_DUMP_HEADER_SIZE,
+                                                                 len - BUFFER_DUMP_HEADER_SIZE);
+    if (reason || count < 0) {
+        luaL_argerror(L, arg, reason ? reason : "corrupt message data");
+        return false;
+    }
+    int check = mtmsg_serialize_check_msgs(data + BUFFER_DUMP_HEADER_SIZE, len - BUFFER_DUMP_HEADER_SIZE);
+    if (check == -2) {
+        mtmsg_ERROR_OUT_OF_MEMORY(L);
+        return false;
+    } else if (check != 0) {
+        luaL_argerror(L, arg, "corrupt message data");
+        return false;
+    }
+    int rc = mtmsg_buffer_put_msgs(L, b, data + BUFFER_DUMP_HEADER_SIZE, 
+                                         len  - BUFFER_DUMP_HEADER_SIZE, count, false, NULL);
+    return rc >= 0;
+}
+
+static int MsgBuffer_load(lua_State* L)
+{
+    int arg = 1;
+    BufferUserData* udata = luaL_checkudata(L, arg++, MTMSG_BUFFER_CLASS_NAME);
+    MsgBuffer*      b = udata->buffer;
+    
+    size_t      len;
+    const char* data = luaL_checklstring(L, arg, &len);
+    
+    lua_pushboolean(L, loadBuffer(L, b, arg, data, len));
+    return 1;
+}
+
+static int MsgBuffer_loadFile(lua_State* L)
+{
+    int arg = 1;
+    BufferUserData* udata    = luaL_checkudata(L, arg++, MTMSG_BUFFER_CLASS_NAME);
+    MsgBuffer*      b        = udata->buffer;
+    const char*     fileName = luaL_checkstring(L, arg);
+
+    luaL_Buffer buffer;
+    luaL_buffinit(L, &buffer);
+    FILE* f = fopen(fileName, "rb");
+    if (f) {
+        size_t n;
+        do {
+            char* p = luaL_prepbuffer(&buffer);
+            n = fread(p, 1, LUAL_BUFFERSIZE, f);
+            luaL_addsize(&buffer, n);
+        } while (n == LUAL_BUFFERSIZE);
+    }
+    if (!f || ferror(f)) {
+        int error = errno;
+        if (f) fclose(f);
+        lua_pushfstring(L, "cannot read file '%s': %s", fileName, strerror(error));
+        return mtmsg_ERROR_FILE_ERROR(L, lua_tostring(L, -1));
+    }
+    fclose(f);
+    luaL_pushresult(&buffer);
+
+    size_t      len;
+    const char* data = lua_tolstring(L, -1, &len);
+    
+    lua_pushboolean(L, loadBuffer(L, b, arg, data, len));
+    return 1;
+}
+
+#ifndef MTMSG_ASYNC_USE_WIN32
+
+/* interval for checking if the buffer is aborted while waiting for the fd */
+#define WRITETO_POLL_MILLIS 100
+
+/* set as error by writeAll() if the buffer was aborted */
+#define WRITETO_ABORTED     -1
+
+static bool isAborted(MsgBuffer* b)
+{
+    async_mutex_lock(b->sharedMutex);
+    bool aborted = b->aborted;
+    async_mutex_unlock(b->sharedMutex);
+
+    mtmsg_global_lock_acquire();
+    aborted = aborted || mtmsg_abort_flag;
+    async_mutex_unlock(mtmsg_global_lock);
+    return aborted;
+}
+
+/**
+ * Waits until fd is writable. Returns false and sets *error if polling 
+ * fails or if the buffer is aborted while waiting.
+ */
+static bool waitWritable(MsgBuffer* b, int fd, int* error)
+{
+    struct pollfd p;
+    p.fd      = fd;
+    p.events  = POLLOUT;
+    p.revents = 0;
+    while (true) {
+        int rc = poll(&p, 1, WRITETO_POLL_MILLIS);
+        if (rc > 0) {
+            return true; /* also for errors, these are reported by write */
+        }
+        if (rc < 0 && errno != EINTR) {
+            *error = errno;
+            return false;
+        }
+        if (isAborted(b)) {
+            *error = WRITETO_ABORTED;
+            return false;
+        }
+    }
+}
+
+/**
+ * Writes until all data is written or, if nonblock, the file descriptor
+ * would block. Returns the number of written bytes, *error is set to errno
+ * if writing fails or to WRITETO_ABORTED if the buffer is aborted while 
+ * waiting for the file descriptor.
+ */
+static size_t writeAll(MsgBuffer* b, int fd, const char* data, size_t len, bool nonblock, int* error)
+{
+    *error = 0;
+    struct stat st;
+    if (len == 0) {
+        return 0;
+    }
+    if (fstat(fd, &st) != 0) {
+        *error = errno;
+        return 0;
+    }
+    /* A blocking write to a full pipe or socket cannot be interrupted if the
+     * buffer is aborted. Therefore it is waited with poll and only PIPE_BUF 
+     * bytes are written at once, which do not block if the fd is writable. */
+    bool   waitFirst = !nonblock && !S_ISREG(st.st_mode);
+    size_t written   = 0;
+    while (written < len) {
+        size_t chunk = len - written;
+        if (waitFirst) {
+            if (!waitWritable(b, fd, error)) {
+                break;
+            }
+            if (chunk > PIPE_BUF) {
+                chunk = PIPE_BUF;
+            }
+        }
+        ssize_t n = write(fd, data + written, chunk);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (nonblock || !waitWritable(b, fd, error)) {
+                    break;
+                }
+                continue;
+            }
+            *error = errno;
+            break;
+        }
+        written += n;
+    }
+    return written;
+}
+
+static int writeToError(lua_State* L, MsgBuffer* b, int fd, int error, int ungetRc)
+{
+    if (ungetRc == -5) {
+        return mtmsg_ERROR_OUT_OF_MEMORY_bytes(L, b->mem.bufferLength);
+    }
+    if (error == WRITETO_ABORTED && ungetRc == 0) {
+        return mtmsg_ERROR_OPERATION_ABORTED(L);
+    }
+    if (error == 0 || error == WRITETO_ABORTED) {
+        lua_pushfstring(L, "unwritten messages cannot be put back into %s and are lost", 
+                           mtmsg_buffer_tostring(L, b));
+    } else if (ungetRc != 0) {
+        lua_pushfstring(L, "cannot write to file descriptor %d: %s, unwritten messages are lost", 
+                           fd, strerror(error));
+    } else {
+        lua_pushfstring(L, "cannot write to file descriptor %d: %s", fd, strerror(error));
+    }
+    return mtmsg_ERROR_FILE_ERROR(L, lua_tostring(L, -1));
+}
+
+static int MsgBuffer_writeTo(lua_State* L)
+{
+    int arg = 1;
+    BufferUserData* udata    = luaL_checkudata(L, arg++, MTMSG_BUFFER_CLASS_NAME);
+    MsgBuffer*      b        = udata->buffer;
+    int             fd       = (int)luaL_checkinteger(L, arg++);
+    lua_Integer     maxCount = luaL_optinteger(L, arg++, 0);
+
+    int written = 0;
+    int error;
+
+    /* the rest of a message from the last call has to be written first */
+    MemBuffer* pending = &udata->writeBuffer;
+    if (pending->bufferLength > 0) {
+        size_t n = writeAll(b, fd, pending->bufferStart, pending->bufferLength, udata->nonblock, &error);
+        pending->bufferStart  += n;
+        pending->bufferLength -= n;
+        if (error == WRITETO_ABORTED) {
+            /* the rest is written by the next call */
+            return mtmsg_ERROR_OPERATION_ABORTED(L);
+        }
+        if (error) {
+            size_t msgLen = pending->bufferStart - pending->bufferData + pending->bufferLength;
+            int    rc     = mtmsg_buffer_unget_msgs(b, pending->bufferData, msgLen, 1);
+            pending->bufferStart  = pending->bufferData;
+            pending->bufferLength = 0;
+            return writeToError(L, b, fd, error, rc);
+        }
+        if (pending->bufferLength > 0) {
+            lua_pushinteger(L, 0);
+            return 1;
+        }
+        pending->bufferStart = pending->bufferData;
+        written = 1;
+        if (maxCount == 1) {
+            lua_pushinteger(L, written);
+            return 1;
+        }
+        if (maxCount > 1) {
+            maxCount -= 1;
+        }
+    }
+
+    MemBuffer* out = &udata->msgBuffer;
+    out->bufferStart  = out->bufferData;
+    out->bufferLength = 0;
+
+    int count = mtmsg_buffer_take_msgs(b, out, (maxCount > INT_MAX) ? INT_MAX : (int)maxCount, 0);
+    if (count < 0) {
+        switch (count) {
+            case -1:  return mtmsg_ERROR_OBJECT_CLOSED(L, mtmsg_buffer_tostring(L, b));
+            case -2:  return mtmsg_ERROR_OPERATION_ABORTED(L);
+            case -3:  return luaL_error(L, "writeto is not supported for buffers with string dictionary");
+            default:  return mtmsg_ERROR_OUT_OF_MEMORY_bytes(L, b->mem.bufferLength);
+        }
+    }
+    const char* data = out->bufferStart;
+    size_t      len  = out->bufferLength;
+    size_t      n    = writeAll(b, fd, data, len, udata->nonblock, &error);
+
+    /* messages that were written completely */
+    size_t pos = 0;
+    while (count > 0) {
+        SerializedMsgSizes sizes;
+        mtmsg_serialize_parse_header(data + pos, &sizes);
+        size_t msgLen = sizes.header_size + sizes.args_size;
+        if (pos + msgLen > n) {
+            if (pos < n && (!error || error == WRITETO_ABORTED)) {
+                /* keep the rest of a partially written message for the next call */
+                if (mtmsg_membuf_reserve(pending, msgLen) != 0) {
+                    out->bufferLength = 0;
+                    return mtmsg_ERROR_OUT_OF_MEMORY_bytes(L, msgLen);
+                }
+                memcpy(pending->bufferData, data + pos, msgLen);
+                pending->bufferStart  = pending->bufferData + (n - pos);
+                pending->bufferLength = msgLen - (n - pos);
+                pos   += msgLen;
+                count -= 1;
+            }
+            break;
+        }
+        pos     += msgLen;
+        count   -= 1;
+        written += 1;
+    }
+    int rc = mtmsg_buffer_unget_msgs(b, data + pos, len - pos, count);
+    out->bufferLength = 0;
+    if (error || rc != 0) {
+        return writeToError(L, b, fd, error, rc);
+    }
+    lua_pushinteger(L, written);
+    return 1;
+}
+
+static int MsgBuffer_readFrom(lua_State* L)
+{
+    int arg = 1;
+    BufferUserData* udata = luaL_checkudata(L, arg++, MTMSG_BUFFER_CLASS_NAME);
+    MsgBuffer*      b     = udata->buffer;
+    int             fd    = (int)luaL_checkinteger(L, arg++);
+
+    MemBuffer* in = &udata->readBuffer;
+    size_t     len;
+    int        count = mtmsg_serialize_count_complete_msgs(in->bufferStart, in->bufferLength, &len);
+
+    if (count == 0) {
+        /* read only if there are no complete messages left from last call */
+        if (mtmsg_membuf_reserve(in, 64 * 1024) != 0) {
+            return mtmsg_ERROR_OUT_OF_MEMORY_bytes(L, in->bufferLength + 64 * 1024);
+        }
+        size_t  avail = in->bufferCapacity - (in->bufferStart - in->bufferData) - in->bufferLength;
+        ssize_t n;
+        do {
+            n = read(fd, in->bufferStart + in->bufferLength, avail);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                lua_pushinteger(L, 0);
+                return 1;
+            }
+            lua_pushfstring(L, "cannot read from file descriptor %d: %s", fd, strerror(errno));
+            return mtmsg_ERROR_FILE_ERROR(L, lua_tostring(L, -1));
+        }
+        if (n == 0) {
+            if (in->bufferLength > 0) {
+                in->bufferLength = 0;
+                lua_pushfstring(L, "incomplete message at end of file descriptor %d", fd);
+                return mtmsg_ERROR_FILE_ERROR(L, lua_tostring(L, -1));
+            }
+            lua_pushnil(L);
+            return 1;
+        }
+        in->bufferLength += n;
+        count = mtmsg_serialize_count_complete_msgs(in->bufferStart, in->bufferLength, &len);
+    }
+    size_t msgSize;
+    if (mtmsg_buffer_is_too_large(b, in->bufferStart, in->bufferLength, &msgSize)) {
+        return mtmsg_ERROR_MESSAGE_SIZE_bytes(L, msgSize, b->mem.bufferCapacity, mtmsg_buffer_tostring(L, b));
+    }
+    int check = mtmsg_serialize_check_msgs(in->bufferStart, len);
+    if (check != 0) {
+        in->bufferStart  = in->bufferData;
+        in->bufferLength = 0;
+        if (check == -2) {
+            return mtmsg_ERROR_OUT_OF_MEMORY(L);
+        }
+        lua_pushfstring(L, "corrupt message data from file descriptor %d", fd);
+        return mtmsg_ERROR_FILE_ERROR(L, lua_tostring(L, -1));
+    }
+    size_t putLength;
+    int    rc = mtmsg_buffer_put_msgs(L, b, in->bufferStart, len, count, true, &putLength);
+    if (rc < 0) {
+        rc = 0; /* buffer is full */
+    }
+    in->bufferStart  += putLength;
+    in->bufferLength -= putLength;
+    if (in->bufferLength == 0) {
+        in->bufferStart = in->bufferData;
+    }
+    lua_pushinteger(L, rc);
+    return 1;
+}
+
+#else /* MTMSG_ASYNC_USE_WIN32 */
+
+static int MsgBuffer_writeTo(lua_State* L)
+{
+    return luaL_error(L, "writeto is not supported on this platform");
+}
+
+static int MsgBuffer_readFrom(lua_State* L)
+{
+    return luaL_error(L, "readfrom is not supported on this platform");
+}
+
+#endif /* MTMSG_ASYNC_USE_WIN32 */
+
+static int MsgBuffer_isNonblock(lua_State* L)
+{
+    int arg = 1;
+    BufferUserData* udata = luaL_checkudata(L, arg++, MTMSG_BUFFER_CLASS_NAME);
+
+    lua_pushboolean(L, udata->nonblock);
+
+    return 1;
 }
 
 static int MsgBuffer_abort(lua_State* L)
@@ -1171,28 +3142,100 @@ static int MsgBuffer_msgcnt(lua_State* L)
     MsgBuffer*      b = udata->buffer;
 
     async_mutex_lock(b->sharedMutex);
+    mtmsg_buffer_mem_refresh(b);
     lua_pushinteger(L, b->msgCount);
     async_mutex_unlock(b->sharedMutex);
 
     return 1;
 }
 
+static void setIntegerField(lua_State* L, const char* name, size_t value)
+{
+    lua_pushinteger(L, (lua_Integer)value);
+    lua_setfield(L, -2, name);
+}
+
+static int MsgBuffer_stats(lua_State* L)
+{
+    int arg = 1;
+    BufferUserData* udata = luaL_checkudata(L, arg++, MTMSG_BUFFER_CLASS_NAME);
+    MsgBuffer*      b = udata->buffer;
+
+    lua_createtable(L, 0, 18);
+    
+    async_mutex_lock(b->sharedMutex);
+    mtmsg_buffer_mem_refresh(b);
+    BufferStats stats            = b->stats;
+    int         msgCount         = b->msgCount;
+    size_t      length           = b->mem.bufferLength;
+    size_t      capacity         = b->mem.bufferCapacity;
+    size_t      compressInBytes  = b->compressInBytes;
+    size_t      compressOutBytes = b->compressOutBytes;
+    async_mutex_unlock(b->sharedMutex);
+
+    setIntegerField(L, "enqueued_msgs",        stats.addedMsgs);
+    setIntegerField(L, "enqueued_bytes",       stats.addedBytes);
+    setIntegerField(L, "dequeued_msgs",        stats.takenMsgs);
+    setIntegerField(L, "dequeued_bytes",       stats.takenBytes);
+    setIntegerField(L, "discarded_msgs",       stats.discardedMsgs);
+    setIntegerField(L, "msg_count",            msgCount);
+    setIntegerField(L, "peak_msg_count",       stats.peakMsgCount);
+    setIntegerField(L, "length",               length);
+    setIntegerField(L, "peak_length",          stats.peakLength);
+    setIntegerField(L, "capacity",             capacity);
+    setIntegerField(L, "memmoves",             stats.memmoves);
+    setIntegerField(L, "reallocs",             stats.reallocs);
+    setIntegerField(L, "full_rejections",      stats.fullCount);
+    setIntegerField(L, "notifier_calls",       stats.notifierCalls);
+    setIntegerField(L, "compressed_in_bytes",  compressInBytes);
+    setIntegerField(L, "compressed_out_bytes", compressOutBytes);
+    if (compressInBytes > 0) {
+        lua_pushnumber(L, (lua_Number)compressOutBytes / compressInBytes);
+        lua_setfield(L, -2, "compression_ratio");
+    }
+    return 1;
+}
+
+static int MsgBuffer_lockstats(lua_State* L)
+{
+    int arg = 1;
+    BufferUserData* udata = luaL_checkudata(L, arg++, MTMSG_BUFFER_CLASS_NAME);
+    MsgBuffer*      b = udata->buffer;
+
+    mtmsg_util_push_lockstats(L, b->sharedMutex);
+    return 1;
+}
+
 static const luaL_Reg MsgBufferMethods[] = 
 {
-    { "addmsg",     MsgBuffer_addMsg     },
-    { "setmsg",     MsgBuffer_setMsg     },
-    { "clear",      MsgBuffer_clear      },
-    { "nextmsg",    MsgBuffer_nextMsg    },
-    { "id",         MsgBuffer_id         },
-    { "name",       MsgBuffer_name       },
-    { "notifier",   Mtmsg_notifier       },
-    { "nonblock",   MsgBuffer_nonblock   },
-    { "isnonblock", MsgBuffer_isNonblock },
-    { "close",      MsgBuffer_close      },
-    { "abort",      MsgBuffer_abort      },
-    { "isabort",    MsgBuffer_isAbort    },
-    { "msgcnt",     MsgBuffer_msgcnt     },
-    { NULL,         NULL } /* sentinel */
+    { "addmsg",      MsgBuffer_addMsg      },
+    { "setmsg",      MsgBuffer_setMsg      },
+    { "clear",       MsgBuffer_clear       },
+    { "nextmsg",     MsgBuffer_nextMsg     },
+    { "id",          MsgBuffer_id          },
+    { "name",        MsgBuffer_name        },
+    { "notifier",    Mtmsg_notifier        },
+    { "nonblock",    MsgBuffer_nonblock    },
+    { "isnonblock",  MsgBuffer_isNonblock  },
+    { "dictionary",  MsgBuffer_dictionary  },
+    { "compression", MsgBuffer_compression },
+    { "portable",    MsgBuffer_portable    },
+    { "timing",      MsgBuffer_timing      },
+    { "latency",     MsgBuffer_latency     },
+    { "spill",       MsgBuffer_spill       },
+    { "dump",        MsgBuffer_dump        },
+    { "dumpfile",    MsgBuffer_dumpFile    },
+    { "load",        MsgBuffer_load        },
+    { "loadfile",    MsgBuffer_loadFile    },
+    { "writeto",     MsgBuffer_writeTo     },
+    { "readfrom",    MsgBuffer_readFrom    },
+    { "close",       MsgBuffer_close       },
+    { "abort",       MsgBuffer_abort       },
+    { "isabort",     MsgBuffer_isAbort     },
+    { "msgcnt",      MsgBuffer_msgcnt      },
+    { "stats",       MsgBuffer_stats       },
+    { "lockstats",   MsgBuffer_lockstats   },
+    { NULL,          NULL } /* sentinel */
 };
 
 static const luaL_Reg MsgBufferMetaMethods[] = 
@@ -1207,6 +3250,7 @@ static const luaL_Reg ModuleFunctions[] =
 {
     { "newbuffer", Mtmsg_newBuffer  },
     { "buffer",    Mtmsg_buffer     },
+    { "unlinkshm", Mtmsg_unlinkShm  },
     { NULL,        NULL } /* sentinel */
 };
 
@@ -6,11 +6,16 @@
 #include "notify_capi.h"
 #include "receiver_capi.h"
 #include "sender_capi.h"
+#include "mapfile.h"
+#include "latency.h"
+#include "trace.h"
 
 extern const char* const MTMSG_BUFFER_CLASS_NAME;;
 
 typedef struct carray_capi carray_capi;
 
+struct MsgDict;
+
 typedef struct NotifierHolder {
     AtomicCounter      used;
     const notify_capi* notifyapi;
@@ -18,6 +23,31 @@ typedef struct NotifierHolder {
     int                threshold;
 } NotifierHolder;
 
+/**
+ * Counters for buffer:stats(), updated under the buffer's lock.
+ */
+typedef struct BufferStats {
+    size_t             addedMsgs;
+    size_t             addedBytes;
+    size_t             takenMsgs;
+    size_t             takenBytes;
+    size_t             discardedMsgs;      /* messages removed by clearing the buffer */
+    int                peakMsgCount;
+    size_t             peakLength;
+    size_t             memmoves;           /* messages moved to the start of mem to make room */
+    size_t             reallocs;           /* mem was grown */
+    size_t             fullCount;          /* messages rejected because the buffer was full */
+    size_t             notifierCalls;
+} BufferStats;
+
+/**
+ * Waiting times of messages, only allocated if enabled by buffer:timing().
+ */
+typedef struct MsgTiming {
+    TimestampQueue     queue;
+    LatencyHistogram   histogram;
+} MsgTiming;
+
 typedef struct MsgBuffer {
     lua_Integer        id;
     AtomicCounter      used;
@@ -29,9 +59,28 @@ typedef struct MsgBuffer {
     Mutex*             sharedMutex;
     Mutex              ownMutex;
     MemBuffer          mem;
+    size_t             reservedLength;     /* message reserved behind the messages in mem, see mtmsg_buffer_reserve_msg() */
     NotifierHolder*    decNotifier;
     NotifierHolder*    incNotifier;
     int                msgCount;
+    struct MsgDict*    dict;               /* string dictionary, kept for decoding if disabled */
+    bool               useDict;
+    AtomicCounter      compressThreshold;  /* messages of at least this size are compressed if > 0 */
+    size_t             compressInBytes;    /* total size of compressed messages before compression */
+    size_t             compressOutBytes;   /* total size of compressed messages after compression */
+    AtomicCounter      portable;           /* new messages are serialized in portable encoding if != 0 */
+    size_t             spillThreshold;     /* new messages go to spillFile if mem exceeds this size */
+    FILE*              spillFile;          /* temporary file for messages that follow the messages in mem */
+    long               spillReadPos;
+    long               spillWritePos;
+    int                spillCount;         /* number of messages in spillFile */
+    bool               spillError;         /* spilled messages could not be read back */
+    MemBuffer          spillMem;           /* a spilled message is serialized here before writing */
+    MapFile*           mapFile;            /* mem references the data in this file if not NULL */
+    bool               sharedMem;          /* mapFile is shared memory used by other processes */
+    unsigned int       ownerDied;          /* last seen value of sharedMutex->ownerDied */
+    BufferStats        stats;
+    MsgTiming*         timing;
     
     struct MsgListener* listener;          
     struct MsgBuffer*   nextListenerBuffer;
@@ -48,6 +97,9 @@ typedef struct BufferUserData {
     MsgBuffer*         buffer;
     bool               nonblock;
     const carray_capi* carrayCapi;
+    MemBuffer          msgBuffer;   /* next message is copied here and decoded after unlock */
+    MemBuffer          readBuffer;  /* incomplete messages from buffer:readfrom() */
+    MemBuffer          writeBuffer; /* partially written message from buffer:writeto() */
 } BufferUserData;
 
 struct ListenerUserData;
@@ -62,14 +114,199 @@ int mtmsg_buffer_init_module(lua_State* L, int module);
 
 void mtmsg_buffer_abort_all(bool abortFlag);
 
+/**
+ * Totals over all buffers for mtmsg.stats().
+ */
+typedef struct BufferTotals {
+    lua_Integer        buffers;
+    lua_Integer        buckets;
+    lua_Integer        bucketUsage;
+    lua_Integer        memBytes;     /* memory allocated for messages */
+    lua_Integer        msgCount;
+} BufferTotals;
+
+/**
+ * Must be called under mtmsg_global_lock.
+ */
+void mtmsg_buffer_totals(BufferTotals* totals);
+
 void mtmsg_buffer_free_unreachable(MsgListener* listener, MsgBuffer* b);
 
 int mtmsg_buffer_set_or_add_msg(lua_State* L, MsgBuffer* b, bool nonblock, bool clear, int arg, const char* args, size_t args_size,
                                 receiver_error_handler eh, void* ehdata);
 
+int mtmsg_buffer_reserve_msg(MsgBuffer* b, bool nonblock, size_t args_size, char** args);
+
+int mtmsg_buffer_commit_msg(MsgBuffer* b, size_t msg_size, bool cancel,
+                            receiver_error_handler eh, void* ehdata);
+
+int mtmsg_buffer_swap_msg(lua_State* L, MsgBuffer* b, bool nonblock, bool clear, 
+                          MemBuffer* mem, size_t headroom);
+
 int mtmsg_buffer_next_msg(lua_State* L, BufferUserData* u, 
                           MsgBuffer* b, bool nonblock, int arg, double timeoutSeconds, MemBuffer* resultBuffer, size_t* argsSize,
-                          sender_error_handler eh, void* ehdata);
+                          struct MsgDict** resultDict, sender_error_handler eh, void* ehdata);
+
+int mtmsg_buffer_unspill(MsgBuffer* b);
+
+int mtmsg_buffer_take_msgs(MsgBuffer* b, MemBuffer* out, int maxCount, double timeoutSeconds);
+
+int mtmsg_buffer_unget_msgs(MsgBuffer* b, const char* msgs, size_t len, int count);
+
+int mtmsg_buffer_next_msgs(MsgBuffer* b, bool nonblock, double timeoutSeconds, int maxCount, size_t maxBytes,
+                           MemBuffer* out, MemBuffer* lengths, struct MsgDict** resultDict,
+                           sender_error_handler eh, void* ehdata);
+
+int mtmsg_buffer_put_msgs(lua_State* L, MsgBuffer* b, const char* msgs, size_t len, int count, bool partial,
+                          size_t* putLength);
+
+bool mtmsg_buffer_is_too_large(MsgBuffer* b, const char* msgs, size_t len, size_t* msgSize);
+
+/**
+ * Header of buffer dumps and message streams: magic, version, platform
+ * dependent sizes and a flag for streams of portable messages.
+ */
+#define BUFFER_DUMP_HEADER_SIZE 16
+
+void mtmsg_buffer_dump_header(char* header, bool portable);
+
+/**
+ * Returns NULL if the dump header is valid, otherwise the reason.
+ */
+const char* mtmsg_buffer_check_dump_header(const char* data, size_t len);
+
+void mtmsg_buffer_free_mem(MsgBuffer* b);
+
+/**
+ * Must be called under the buffer's lock after the messages in mem have changed.
+ */
+static inline void mtmsg_buffer_mem_changed(MsgBuffer* b)
+{
+    if (b->mapFile) {
+        mtmsg_mapfile_update(b->mapFile, &b->mem, b->msgCount);
+    }
+}
+
+/**
+ * Must be called under the buffer's lock before mem or msgCount are used.
+ * The buffer is aborted if another process died while holding the lock of
+ * the shared memory. The messages remain consistent, because the position
+ * of the messages is stored atomically, see mtmsg_mapfile_update().
+ */
+static inline void mtmsg_buffer_mem_refresh(MsgBuffer* b)
+{
+    if (b->sharedMem) {
+#if defined(MTMSG_ASYNC_USE_ROBUST_MUTEX)
+        if (b->ownerDied != b->sharedMutex->ownerDied) {
+            b->ownerDied = b->sharedMutex->ownerDied;
+            b->aborted   = true;
+            async_mutex_notify(b->sharedMutex);
+        }
+#endif
+        mtmsg_mapfile_refresh(b->mapFile, &b->mem, &b->msgCount);
+    }
+}
+
+void mtmsg_buffer_timing_added(MsgBuffer* b, int count);
+
+void mtmsg_buffer_timing_taken(MsgBuffer* b, int count);
+
+/**
+ * Must be called under the buffer's lock after count messages with total 
+ * length len were appended.
+ */
+static inline void mtmsg_buffer_stats_added(MsgBuffer* b, int count, size_t len)
+{
+    if (b->timing) {
+        mtmsg_buffer_timing_added(b, count);
+    }
+    b->stats.addedMsgs  += count;
+    b->stats.addedBytes += len;
+    if (b->msgCount > b->stats.peakMsgCount) {
+        b->stats.peakMsgCount = b->msgCount;
+    }
+    if (b->mem.bufferLength > b->stats.peakLength) {
+        b->stats.peakLength = b->mem.bufferLength;
+    }
+    mtmsg_trace_enqueue(b->id, count, len);
+}
+
+/**
+ * Must be called under the buffer's lock after count messages with total 
+ * length len were taken, listener is not NULL if taken by the listener.
+ */
+static inline void mtmsg_buffer_stats_taken(MsgBuffer* b, MsgListener* listener, int count, size_t len)
+{
+    if (b->timing) {
+        mtmsg_buffer_timing_taken(b, count);
+    }
+    b->stats.takenMsgs  += count;
+    b->stats.takenBytes += len;
+    mtmsg_trace_dequeue(b->id, listener ? listener->id : 0, count, len);
+}
+
+/**
+ * Must be called under the buffer's lock before all messages are removed.
+ */
+static inline void mtmsg_buffer_stats_discarded(MsgBuffer* b)
+{
+    b->stats.discardedMsgs += b->msgCount;
+    if (b->timing) {
+        mtmsg_timestamps_clear(&b->timing->queue);
+    }
+    if (b->msgCount > 0) {
+        mtmsg_trace_drop(b->id, b->msgCount, MTMSG_TRACE_DROP_CLEARED);
+    }
+}
+
+/**
+ * Must be called under the buffer's lock if count messages were rejected
+ * because the buffer is full.
+ */
+static inline void mtmsg_buffer_stats_full(MsgBuffer* b, int count)
+{
+    b->stats.fullCount += 1;
+    mtmsg_trace_drop(b->id, count, MTMSG_TRACE_DROP_REJECTED);
+}
+
+/**
+ * Must be called under the buffer's lock before a notifier is called.
+ */
+static inline void mtmsg_buffer_stats_notify(MsgBuffer* b)
+{
+    b->stats.notifierCalls += 1;
+    mtmsg_trace_notify(b->id);
+}
+
+static inline void mtmsg_buffer_discard_spill(MsgBuffer* b)
+{
+    b->spillReadPos  = 0;
+    b->spillWritePos = 0;
+    b->spillCount    = 0;
+    b->spillError    = false;
+}
+
+/**
+ * Waits until a message that was reserved by another thread is committed,
+ * the buffer's memory must not be changed before except for taking messages.
+ * Must be called under the buffer's lock. Returns false if nonblock and a
+ * message is reserved.
+ */
+static inline bool mtmsg_buffer_wait_reserved(MsgBuffer* b, bool nonblock)
+{
+    if (b->reservedLength == 0) {
+        return true;
+    }
+    if (nonblock) {
+        return false;
+    }
+    while (b->reservedLength > 0) {
+        async_mutex_wait(b->sharedMutex);
+    }
+    /* the notification could have been meant for a reader */
+    async_mutex_notify(b->sharedMutex);
+    return true;
+}
 
 int mtmsg_buffer_call_notifier(lua_State* L, MsgBuffer* b, NotifierHolder* ntf, NotifierHolder** targNtf,
                                receiver_error_handler receiver_eh, void* receiver_ehdata);
@@ -0,0 +1,157 @@
+#include "compress.h"
+
+#define HASH_BITS     12
+#define MIN_MATCH     4
+#define MAX_OFFSET    0xffff
+
+static inline unsigned int read32(const char* p)
+{
+    unsigned int v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline unsigned int hash32(unsigned int v)
+{
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* writes length extension bytes, returns NULL if dst is too small */
+static inline char* writeLength(size_t len, char* op, const char* opEnd)
+{
+    while (len >= 255) {
+        if (op >= opEnd) return NULL;
+        *op++ = (char)255;
+        len -= 255;
+    }
+    if (op >= opEnd) return NULL;
+    *op++ = (char)len;
+    return op;
+}
+
+static char* writeSequence(const char* literals, size_t litLen, size_t offset, size_t matchLen, 
+                           char* op, const char* opEnd)
+{
+    if (op >= opEnd) return NULL;
+    char* token = op++;
+    size_t m = matchLen ? matchLen - MIN_MATCH : 0;
+    *token = (char)(((litLen < 15 ? litLen : 15) << 4) | (m < 15 ? m : 15));
+    if (litLen >= 15) {
+        op = writeLength(litLen - 15, op, opEnd);
+        if (!op) return NULL;
+    }
+    if (litLen > (size_t)(opEnd - op)) return NULL;
+    memcpy(op, literals, litLen);
+    op += litLen;
+    if (matchLen) {
+        if (opEnd - op < 2) return NULL;
+        *op++ = (char)(offset & 0xff);
+        *op++ = (char)(offset >> 8);
+        if (m >= 15) {
+            op = writeLength(m - 15, op, opEnd);
+        }
+    }
+    return op;
+}
+
+size_t mtmsg_compress(const char* src, size_t srcLen, char* dst, size_t dstCapacity)
+{
+    size_t      table[1 << HASH_BITS];
+    const char* opEnd  = dst + dstCapacity;
+    char*       op     = dst;
+    size_t      anchor = 0;
+    size_t      ip     = 0;
+
+    memset(table, 0, sizeof(table));
+
+    while (ip + MIN_MATCH <= srcLen) {
+        unsigned int h   = hash32(read32(src + ip));
+        size_t       ref = table[h];
+        table[h] = ip;
+        if (ref < ip && ip - ref <= MAX_OFFSET && read32(src + ref) == read32(src + ip)) {
+            size_t len = MIN_MATCH;
+            while (ip + len < srcLen && src[ref + len] == src[ip + len]) {
+                len += 1;
+            }
+            op = writeSequence(src + anchor, ip - anchor, ip - ref, len, op, opEnd);
+            if (!op) return 0;
+            ip    += len;
+            anchor = ip;
+        } else {
+            ip += 1;
+        }
+    }
+    op = writeSequence(src + anchor, srcLen - anchor, 0, 0, op, opEnd);
+    if (!op) return 0;
+    return op - dst;
+}
+
+static inline bool readLength(const unsigned char** ip, const unsigned char* ipEnd, size_t* len)
+{
+    unsigned char c;
+    do {
+        if (*ip >= ipEnd) return false;
+        c = *(*ip)++;
+        *len += c;
+    } while (c == 255);
+    return true;
+}
+
+bool mtmsg_decompress(const char* src, size_t srcLen, char* dst, size_t dstLen)
+{
+    const unsigned char* ip    = (const unsigned char*)src;
+    const unsigned char* ipEnd = ip + srcLen;
+    size_t               op    = 0;
+
+    while (ip < ipEnd) {
+        unsigned char token  = *ip++;
+        size_t        litLen = token >> 4;
+        if (litLen == 15 && !readLength(&ip, ipEnd, &litLen)) {
+            return false;
+        }
+        if (litLen > (size_t)(ipEnd - ip) || litLen > dstLen - op) {
+            return false;
+        }
+        memcpy(dst + op, ip, litLen);
+        ip += litLen;
+        op += litLen;
+        if (ip == ipEnd) {
+            break;
+        }
+        if (ipEnd - ip < 2) {
+            return false;
+        }
+        size_t offset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        size_t matchLen = token & 0x0f;
+        if (matchLen == 15 && !readLength(&ip, ipEnd, &matchLen)) {
+            return false;
+        }
+        matchLen += MIN_MATCH;
+        if (offset == 0 || offset > op || matchLen > dstLen - op) {
+            return false;
+        }
+        size_t i;
+        for (i = 0; i < matchLen; ++i, ++op) {
+            dst[op] = dst[op - offset];
+        }
+    }
+    return op == dstLen;
+}
+
+int mtmsg_decompress_first_byte(const char* src, size_t srcLen)
+{
+    const unsigned char* ip    = (const unsigned char*)src;
+    const unsigned char* ipEnd = ip + srcLen;
+    if (ip >= ipEnd) {
+        return -1;
+    }
+    size_t litLen = *ip++ >> 4;
+    if (litLen == 15 && !readLength(&ip, ipEnd, &litLen)) {
+        return -1;
+    }
+    if (litLen == 0 || ip >= ipEnd) {
+        return -1;
+    }
+    return *ip;
+}
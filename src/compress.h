@@ -0,0 +1,34 @@
+#ifndef MTMSG_COMPRESS_H
+#define MTMSG_COMPRESS_H
+
+#include "util.h"
+
+/**
+ * Simple self-contained LZ77 block compression (LZ4 like sequences of 
+ * literals and back references within a 64K window).
+ */
+
+static inline size_t mtmsg_compress_bound(size_t srcLen)
+{
+    return srcLen + srcLen / 255 + 16;
+}
+
+/**
+ * Returns the compressed length or 0 if the result would not fit
+ * into dstCapacity bytes.
+ */
+size_t mtmsg_compress(const char* src, size_t srcLen, char* dst, size_t dstCapacity);
+
+/**
+ * Returns false if the compressed data is corrupt or does not decompress
+ * to exactly dstLen bytes.
+ */
+bool mtmsg_decompress(const char* src, size_t srcLen, char* dst, size_t dstLen);
+
+/**
+ * Returns the first byte of the decompressed data without decompressing
+ * or -1 if it cannot be determined.
+ */
+int mtmsg_decompress_first_byte(const char* src, size_t srcLen);
+
+#endif /* MTMSG_COMPRESS_H */
@@ -10,6 +10,7 @@ static const char* const MTMSG_ERROR_OPERATION_ABORTED = "operation_aborted";
 static const char* const MTMSG_ERROR_MESSAGE_SIZE      = "message_size";
 static const char* const MTMSG_ERROR_OUT_OF_MEMORY     = "out_of_memory";
 static const char* const MTMSG_ERROR_HAS_NOTIFIER      = "has_notifier";
+static const char* const MTMSG_ERROR_FILE_ERROR        = "file_error";
 
 
 typedef struct Error {
@@ -140,6 +141,12 @@ int mtmsg_ERROR_MESSAGE_SIZE_bytes(lua_State* L, size_t bytes, size_t limit, con
     return throwErrorMessage(L, MTMSG_ERROR_MESSAGE_SIZE);
 }
 
+int mtmsg_ERROR_FILE_ERROR(lua_State* L, const char* details)
+{
+    lua_pushstring(L, details);
+    return throwErrorMessage(L, MTMSG_ERROR_FILE_ERROR);
+}
+
 
 
 static void publishError(lua_State* L, int module, const char* errorName)
@@ -157,6 +164,7 @@ int mtmsg_error_init_module(lua_State* L, int errorModule)
     publishError(L, errorModule, MTMSG_ERROR_OPERATION_ABORTED);
     publishError(L, errorModule, MTMSG_ERROR_MESSAGE_SIZE);
     publishError(L, errorModule, MTMSG_ERROR_OUT_OF_MEMORY);
+    publishError(L, errorModule, MTMSG_ERROR_FILE_ERROR);
     
     return 0;
 }
@@ -22,6 +22,7 @@ int mtmsg_ERROR_OUT_OF_MEMORY(lua_State* L);
 int mtmsg_ERROR_OUT_OF_MEMORY_bytes(lua_State* L, size_t bytes);
 int mtmsg_ERROR_MESSAGE_SIZE_bytes(lua_State* L, size_t bytes, size_t limit, const char* objectString);
 int mtmsg_MTMSG_ERROR_HAS_NOTIFIER(lua_State* L);
+int mtmsg_ERROR_FILE_ERROR(lua_State* L, const char* details);
 
 int mtmsg_error_init_module(lua_State* L, int errorModule);
 
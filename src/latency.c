@@ -0,0 +1,165 @@
+#include "latency.h"
+
+uint64_t mtmsg_latency_now()
+{
+#ifdef MTMSG_ASYNC_USE_WIN32
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER        counter;
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)((double)counter.QuadPart * 1e9 / frequency.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static inline int highestBit(uint64_t v)
+{
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll(v);
+#else
+    int rslt = 0;
+    while (v >>= 1) {
+        ++rslt;
+    }
+    return rslt;
+#endif
+}
+
+static inline int bucketIndex(uint64_t v)
+{
+    if (v < 2 * LATENCY_HALF_COUNT) {
+        return (int)v;
+    }
+    int shift = highestBit(v) - LATENCY_SUB_BITS + 1;
+    return shift * LATENCY_HALF_COUNT + (int)(v >> shift);
+}
+
+static inline uint64_t bucketUpperBound(int i)
+{
+    if (i < 2 * LATENCY_HALF_COUNT) {
+        return i;
+    }
+    int      shift = i / LATENCY_HALF_COUNT - 1;
+    uint64_t mant  = i % LATENCY_HALF_COUNT + LATENCY_HALF_COUNT;
+    return ((mant + 1) << shift) - 1;
+}
+
+void mtmsg_latency_record(LatencyHistogram* h, uint64_t nanos)
+{
+    if (h->count == 0 || nanos < h->min) {
+        h->min = nanos;
+    }
+    if (nanos > h->max) {
+        h->max = nanos;
+    }
+    h->count += 1;
+    h->sum   += nanos;
+    h->buckets[bucketIndex(nanos)] += 1;
+}
+
+uint64_t mtmsg_latency_percentile(const LatencyHistogram* h, double p)
+{
+    if (h->count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(p * h->count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    uint64_t n = 0;
+    int i;
+    for (i = 0; i < LATENCY_BUCKET_COUNT; ++i) {
+        n += h->buckets[i];
+        if (n >= rank) {
+            uint64_t v = bucketUpperBound(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+static void setSeconds(lua_State* L, const char* name, uint64_t nanos)
+{
+    lua_pushnumber(L, nanos * 1e-9);
+    lua_setfield(L, -2, name);
+}
+
+void mtmsg_latency_push_table(lua_State* L, const LatencyHistogram* h)
+{
+    lua_createtable(L, 0, 8);
+    lua_pushinteger(L, (lua_Integer)h->count);
+    lua_setfield(L, -2, "count");
+    if (h->count > 0) {
+        setSeconds(L, "min",  h->min);
+        setSeconds(L, "max",  h->max);
+        setSeconds(L, "mean", h->sum / h->count);
+        setSeconds(L, "p50",  mtmsg_latency_percentile(h, 0.50));
+        setSeconds(L, "p90",  mtmsg_latency_percentile(h, 0.90));
+        setSeconds(L, "p99",  mtmsg_latency_percentile(h, 0.99));
+        setSeconds(L, "p999", mtmsg_latency_percentile(h, 0.999));
+    }
+}
+
+bool mtmsg_timestamps_push(TimestampQueue* q, uint64_t now, int count)
+{
+    if (q->count + count > q->capacity) {
+        size_t newCapacity = q->capacity ? 2 * q->capacity : 64;
+        while (newCapacity < q->count + count) {
+            newCapacity *= 2;
+        }
+        uint64_t* newTimes = malloc(newCapacity * sizeof(uint64_t));
+        if (!newTimes) {
+            return false;
+        }
+        size_t i;
+        for (i = 0; i < q->count; ++i) {
+            newTimes[i] = q->times[(q->first + i) % q->capacity];
+        }
+        free(q->times);
+        q->times    = newTimes;
+        q->capacity = newCapacity;
+        q->first    = 0;
+    }
+    int i;
+    for (i = 0; i < count; ++i) {
+        q->times[(q->first + q->count) % q->capacity] = now;
+        q->count += 1;
+    }
+    return true;
+}
+
+void mtmsg_timestamps_pop(TimestampQueue* q, int count, uint64_t now,
+                          LatencyHistogram* h1, LatencyHistogram* h2)
+{
+    if (q->untimed > 0) {
+        int n = (count < q->untimed) ? count : q->untimed;
+        q->untimed -= n;
+        count      -= n;
+    }
+    while (count > 0 && q->count > 0) {
+        uint64_t t    = q->times[q->first];
+        uint64_t wait = (now > t) ? (now - t) : 0;
+        if (h1) {
+            mtmsg_latency_record(h1, wait);
+        }
+        if (h2) {
+            mtmsg_latency_record(h2, wait);
+        }
+        q->first  = (q->first + 1) % q->capacity;
+        q->count -= 1;
+        count    -= 1;
+    }
+}
+
+void mtmsg_timestamps_free(TimestampQueue* q)
+{
+    free(q->times);
+    q->times    = NULL;
+    q->capacity = 0;
+    mtmsg_timestamps_clear(q);
+}
@@ -0,0 +1,78 @@
+#ifndef MTMSG_LATENCY_H
+#define MTMSG_LATENCY_H
+
+#include "util.h"
+
+/**
+ * Log-linear histogram of durations in nanoseconds: values below
+ * 2^LATENCY_SUB_BITS are counted exactly, larger values in buckets of
+ * 2^(LATENCY_SUB_BITS-1) per power of two, i.e. with a relative error
+ * below 1/2^(LATENCY_SUB_BITS-1).
+ */
+#define LATENCY_SUB_BITS     5
+#define LATENCY_HALF_COUNT   (1 << (LATENCY_SUB_BITS - 1))
+#define LATENCY_BUCKET_COUNT ((64 - LATENCY_SUB_BITS + 3) * LATENCY_HALF_COUNT)
+
+typedef struct LatencyHistogram {
+    uint64_t           count;
+    uint64_t           sum;
+    uint64_t           min;
+    uint64_t           max;
+    uint64_t           buckets[LATENCY_BUCKET_COUNT];
+} LatencyHistogram;
+
+/**
+ * Enqueue times of the messages in a buffer in the same order as the
+ * messages. The first untimed messages were already in the buffer when
+ * the queue was created.
+ */
+typedef struct TimestampQueue {
+    uint64_t*          times;
+    size_t             capacity;
+    size_t             first;
+    size_t             count;
+    int                untimed;
+} TimestampQueue;
+
+uint64_t mtmsg_latency_now();
+
+void mtmsg_latency_record(LatencyHistogram* h, uint64_t nanos);
+
+/**
+ * Returns the upper bound of the bucket that contains the p-th percentile,
+ * 0 <= p <= 1.
+ */
+uint64_t mtmsg_latency_percentile(const LatencyHistogram* h, double p);
+
+static inline void mtmsg_latency_reset(LatencyHistogram* h)
+{
+    memset(h, 0, sizeof(LatencyHistogram));
+}
+
+/**
+ * Pushes the result table of buffer:latency() and listener:latency().
+ */
+void mtmsg_latency_push_table(lua_State* L, const LatencyHistogram* h);
+
+/**
+ * Returns false if out of memory.
+ */
+bool mtmsg_timestamps_push(TimestampQueue* q, uint64_t now, int count);
+
+/**
+ * Removes the times of the first count messages and records the waiting
+ * times into h1 and h2 if they are not NULL.
+ */
+void mtmsg_timestamps_pop(TimestampQueue* q, int count, uint64_t now,
+                          LatencyHistogram* h1, LatencyHistogram* h2);
+
+static inline void mtmsg_timestamps_clear(TimestampQueue* q)
+{
+    q->first   = 0;
+    q->count   = 0;
+    q->untimed = 0;
+}
+
+void mtmsg_timestamps_free(TimestampQueue* q);
+
+#endif /* MTMSG_LATENCY_H */
@@ -57,6 +57,13 @@ static void newBuckets(lua_Integer n, ListenerBucket* newList)
     listener_bucket_list = newList;
 }
 
+void mtmsg_listener_totals(lua_Integer* listeners, lua_Integer* buckets, lua_Integer* bucketUsage)
+{
+    *listeners   = atomic_get(&listener_counter);
+    *buckets     = listener_buckets;
+    *bucketUsage = bucket_usage;
+}
+
 void mtmsg_listener_abort_all(bool abortFlag) 
 {
     lua_Integer i;
@@ -215,12 +222,13 @@ static int Mtmsg_listener(lua_State* L)
 
     ListenerUserData* userData = lua_newuserdata(L, sizeof(ListenerUserData)); /* create before lock */
     memset(userData, 0, sizeof(ListenerUserData));
+    mtmsg_membuf_init(&userData->msgBuffer, 0, 2);
     pushListenerMeta(L); /* -> udata, meta */
     lua_setmetatable(L, -2); /* -> udata */
     
     /* Lock */
     
-    async_mutex_lock(mtmsg_global_lock);
+    mtmsg_global_lock_acquire();
 
     if (mtmsg_abort_flag) {
         async_mutex_notify(mtmsg_global_lock);
@@ -286,10 +294,11 @@ static int Mtmsg_newListener(lua_State* L)
     
     ListenerUserData* userData = lua_newuserdata(L, sizeof(ListenerUserData)); /* create before lock */
     memset(userData, 0, sizeof(ListenerUserData));
+    mtmsg_membuf_init(&userData->msgBuffer, 0, 2);
     pushListenerMeta(L); /* -> udata, meta */
     lua_setmetatable(L, -2); /* -> udata */
 
-    async_mutex_lock(mtmsg_global_lock);
+    mtmsg_global_lock_acquire();
 
     if (mtmsg_abort_flag) {
         async_mutex_unlock(mtmsg_global_lock);
@@ -353,6 +362,7 @@ void mtmsg_listener_free(MsgListener* lst) /* mtmsg_global_lock */
     if (lst->listenerName) {
         free(lst->listenerName);
     }
+    free(lst->latency);
     async_mutex_destruct(&lst->listenerMutex);
     free(lst);
 
@@ -384,7 +394,7 @@ static int MsgListener_release(lua_State* L)
     MsgListener*      listener = udata->listener;
 
     if (listener) {
-        async_mutex_lock(mtmsg_global_lock);
+        mtmsg_global_lock_acquire();
         
         if (atomic_dec(&listener->used) == 0) 
         {
@@ -392,6 +402,9 @@ static int MsgListener_release(lua_State* L)
         }
         async_mutex_unlock(mtmsg_global_lock);
     }
+    mtmsg_membuf_free(&udata->msgBuffer);
+    mtmsg_dict_release(udata->msgDict);
+    udata->msgDict = NULL;
     return 0;
 }
 
@@ -408,9 +421,10 @@ static int MsgListener_newBuffer(lua_State* L)
 
 int mtmsg_listener_next_msg(lua_State* L, ListenerUserData* udata,
                             MsgListener* listener, bool nonblock, int arg, 
-                            MemBuffer* resultBuffer, size_t* argsSize)
+                            MemBuffer* resultBuffer, size_t* argsSize, MsgDict** resultDict)
 {
-    lua_Number endTime = -1; /* -1 = no timeout, wait forever */
+    lua_Number endTime    = -1; /* -1 = no timeout, wait forever */
+    bool       decodeArgs = false;
 
     int argTop = lua_gettop(L);
 
@@ -440,6 +454,13 @@ int mtmsg_listener_next_msg(lua_State* L, ListenerUserData* udata,
             }
         }
     }
+    if (resultBuffer == NULL) {
+        mtmsg_serialize_check_carray_args(L, arg);
+        resultBuffer = &udata->msgBuffer;
+        resultBuffer->bufferStart  = resultBuffer->bufferData;
+        resultBuffer->bufferLength = 0;
+        decodeArgs = true;
+    }
 
     if (nonblock) {
         if (!async_mutex_trylock(&listener->listenerMutex)) {
@@ -470,66 +491,73 @@ again:
     {
         MsgBuffer* b  = listener->firstReadyBuffer;
         while (b != NULL) {
+            if (b->mem.bufferLength == 0 && b->spillCount > 0) {
+                int rc = mtmsg_buffer_unspill(b);
+                if (rc != 0) {
+                    async_mutex_unlock(&listener->listenerMutex);
+                    return (rc == -5) ? mtmsg_ERROR_OUT_OF_MEMORY(L) 
+                                      : mtmsg_ERROR_FILE_ERROR(L, "cannot read spill file");
+                }
+                mtmsg_buffer_mem_changed(b);
+            }
             if (b->mem.bufferLength > 0) {
                 SerializedMsgSizes sizes;
                 mtmsg_serialize_parse_header(b->mem.bufferStart, &sizes);
                 if (argsSize) *argsSize = sizes.args_size;
                 
-                size_t msg_size;
-                int    rslt = 0; /* is parsedArgCount for resultBuffer == NULL */
-                if (resultBuffer == NULL) {
-                    GetMsgArgsPar par; par.inBuffer       = b->mem.bufferStart + sizes.header_size;
-                                       par.inBufferSize   = sizes.args_size;
-                                       par.inMaxArgCount  = -1;
-                                       par.parsedLength   = 0;
-                                       par.parsedArgCount = 0;
-                                       par.carrayCapi     = udata->carrayCapi;
-                                       par.errorArg       = 0;
-                    lua_pushcfunction(L, mtmsg_serialize_get_msg_args);
-                    lua_insert(L, arg);
-                    lua_pushlightuserdata(L, &par);
-                    lua_insert(L, arg + 1);
-                    int nargs = argTop - arg + 1;
-                    int rc = lua_pcall(L, nargs + 1, LUA_MULTRET, 0);
-                    if (rc != LUA_OK) {
-                        async_mutex_unlock(&listener->listenerMutex);
-                        if (par.errorArg) {
-                            return luaL_argerror(L, par.errorArg, lua_tostring(L, -1));
-                        } else {
-                            return lua_error(L);
-                        }
+                /* Only copy the message under the lock, decoding into Lua values
+                 * is done after the lock is released (if decodeArgs). */
+                int rc = mtmsg_membuf_reserve(resultBuffer, sizes.args_size);
+                if (rc != 0) {
+                    async_mutex_unlock(&listener->listenerMutex);
+                    if (decodeArgs) {
+                        return mtmsg_ERROR_OUT_OF_MEMORY_bytes(L, sizes.args_size);
                     }
-                    rslt = par.parsedArgCount;
-                    udata->carrayCapi = par.carrayCapi;
-                    msg_size = sizes.header_size + par.parsedLength;
+                    /* rc = -1 : buffer should not grow */
+                    /* rc = -2 : buffer can    not grow */
+                    return (rc == -1) ? -4 : -5;
+                }
+                size_t resultOffset = resultBuffer->bufferLength;
+                memcpy(resultBuffer->bufferStart + resultBuffer->bufferLength, 
+                       b->mem.bufferStart + sizes.header_size, 
+                       sizes.args_size);
+                resultBuffer->bufferLength += sizes.args_size;
+                
+                size_t msg_size = sizes.header_size + sizes.args_size;
+                int    rslt     = 1; /* is parsedArgCount if decodeArgs */
+                
+                /* b may be freed below, the dictionary is retained by the
+                 * listener (if decodeArgs) or by the caller */
+                MsgDict* dict = mtmsg_dict_retain(b->dict);
+                if (decodeArgs) {
+                    resultDict = &udata->msgDict;
+                }
+                if (resultDict) {
+                    mtmsg_dict_release(*resultDict);
+                    *resultDict = dict;
                 } else {
-                    int rc = mtmsg_membuf_reserve(resultBuffer, sizes.args_size);
-                    if (rc != 0) {
-                        async_mutex_unlock(&listener->listenerMutex);
-                        /* rc = -1 : buffer should not grow */
-                        /* rc = -2 : buffer can    not grow */
-                        return (rc == -1) ? -4 : -5;
-                    }
-                    memcpy(resultBuffer->bufferStart + resultBuffer->bufferLength, 
-                           b->mem.bufferStart + sizes.header_size, 
-                           sizes.args_size);
-                    resultBuffer->bufferLength += sizes.args_size;
-                    
-                    msg_size = sizes.header_size + sizes.args_size;
-                    rslt = 1;
+                    mtmsg_dict_release(dict);
                 }
                 
                 b->mem.bufferLength -= msg_size;
+                mtmsg_buffer_stats_taken(b, listener, 1, msg_size);
                 {
                     mtmsg_buffer_remove_from_ready_list(listener, b, false);
                 }
-                if (b->mem.bufferLength == 0) {
+                if (b->mem.bufferLength == 0 && b->reservedLength == 0) {
+                    b->mem.bufferStart = b->mem.bufferData;
+                    if (b->spillCount > 0) {
+                        mtmsg_buffer_unspill(b); /* on error the next call gets the error */
+                    }
+                } else {
+                    b->mem.bufferStart += msg_size;
+                }
+                mtmsg_buffer_mem_changed(b);
+                if (b->mem.bufferLength == 0 && b->spillCount == 0) {
                     if (b->unreachable) {
                         mtmsg_buffer_free_unreachable(listener, b);
                     }
-                    b->mem.bufferStart = b->mem.bufferData;
                 } else {
-                    b->mem.bufferStart  += msg_size;
                     mtmsg_buffer_add_to_ready_list(listener, b);
                 }
                 b->msgCount -= 1;
@@ -540,6 +568,7 @@ again:
                 if (ntf) {
                     if (ntf->threshold <= 0 || b->msgCount < ntf->threshold) {
                         atomic_inc(&ntf->used);
+                        mtmsg_buffer_stats_notify(b);
                     } else {
                         ntf = NULL;
                     }
@@ -550,6 +579,43 @@ again:
                 if (ntf) {
                     mtmsg_buffer_call_notifier(L, b, ntf, &b->decNotifier, NULL, NULL);
                 }
+                int rc3 = mtmsg_serialize_unwrap_msg(resultBuffer, resultOffset);
+                if (rc3 != 0) {
+                    resultBuffer->bufferLength = resultOffset;
+                    if (decodeArgs) {
+                        return (rc3 == -3) ? luaL_error(L, "corrupt compressed message")
+                                           : (rc3 == -4) ? luaL_error(L, "invalid portable message")
+                                                         : mtmsg_ERROR_OUT_OF_MEMORY(L);
+                    }
+                    return (rc3 == -1) ? -4 : -5;
+                }
+                if (decodeArgs) {
+                    GetMsgArgsPar par; par.inBuffer       = resultBuffer->bufferStart;
+                                       par.inBufferSize   = resultBuffer->bufferLength;
+                                       par.inMaxArgCount  = -1;
+                                       par.parsedLength   = 0;
+                                       par.parsedArgCount = 0;
+                                       par.carrayCapi     = udata->carrayCapi;
+                                       par.errorArg       = 0;
+                                       par.dict           = dict;
+                                       par.dictCache      = 0;
+                    lua_pushcfunction(L, mtmsg_serialize_get_msg_args);
+                    lua_insert(L, arg);
+                    lua_pushlightuserdata(L, &par);
+                    lua_insert(L, arg + 1);
+                    int nargs = argTop - arg + 1;
+                    int rc = lua_pcall(L, nargs + 1, LUA_MULTRET, 0);
+                    resultBuffer->bufferLength = 0;
+                    if (rc != LUA_OK) {
+                        if (par.errorArg) {
+                            return luaL_argerror(L, par.errorArg, lua_tostring(L, -1));
+                        } else {
+                            return lua_error(L);
+                        }
+                    }
+                    rslt = par.parsedArgCount;
+                    udata->carrayCapi = par.carrayCapi;
+                }
                 return rslt;
             }
             else
@@ -563,11 +629,15 @@ again:
     if (endTime >= 0) {
         lua_Number now = mtmsg_current_time_seconds();
         if (now < endTime) {
+            mtmsg_trace_block_start(listener->id);
             async_mutex_wait_millis(&listener->listenerMutex, (int)((endTime - now) * 1000 + 0.5));
+            mtmsg_trace_block_end(listener->id);
             goto again;
         }
     } else if (!nonblock) {
+        mtmsg_trace_block_start(listener->id);
         async_mutex_wait(&listener->listenerMutex);
+        mtmsg_trace_block_end(listener->id);
         goto again;
     }
 
@@ -580,7 +650,7 @@ static int MsgListener_nextMsg(lua_State* L)
     int arg = 1;
     ListenerUserData* udata = luaL_checkudata(L, arg++, MTMSG_LISTENER_CLASS_NAME);
     
-    int parsedArgCount = mtmsg_listener_next_msg(L, udata, udata->listener, udata->nonblock, arg, NULL, NULL);
+    int parsedArgCount = mtmsg_listener_next_msg(L, udata, udata->listener, udata->nonblock, arg, NULL, NULL, NULL);
     return parsedArgCount; /* parsedArgCount because resultBuffer is NULL */
 }
 
@@ -674,15 +744,36 @@ static int MsgListener_clear(lua_State* L)
         async_mutex_lock(&listener->listenerMutex);
     }
 
+    MsgBuffer* b = listener->firstListenerBuffer;
+    while (b != NULL) {
+        if (b->reservedLength > 0) {
+            /* see mtmsg_buffer_wait_reserved() */
+            if (udata->nonblock) {
+                async_mutex_unlock(&listener->listenerMutex);
+                lua_pushboolean(L, false);
+                return 1;
+            }
+            async_mutex_wait(&listener->listenerMutex);
+            async_mutex_notify(&listener->listenerMutex);
+            b = listener->firstListenerBuffer;
+        } else {
+            b = b->nextListenerBuffer;
+        }
+    }
     if (listener->closed) {
         async_mutex_unlock(&listener->listenerMutex);
         const char* listenerString = listenerToLuaString(L, listener);
         return mtmsg_ERROR_OBJECT_CLOSED(L, listenerString);
     }
 
-    MsgBuffer* b = listener->firstListenerBuffer;
+    b = listener->firstListenerBuffer;
     while (b != NULL) {
+        mtmsg_buffer_mem_refresh(b);
+        mtmsg_buffer_stats_discarded(b);
         b->mem.bufferLength = 0;
+        b->msgCount = 0;
+        mtmsg_buffer_discard_spill(b);
+        mtmsg_buffer_mem_changed(b);
         MsgBuffer* b2 = b->nextListenerBuffer;
         mtmsg_buffer_remove_from_ready_list(listener, b, true);
         b = b2;
@@ -706,7 +797,7 @@ static int MsgListener_close(lua_State* L)
         b->closed = true;
         MsgBuffer* b2 = b->nextListenerBuffer;
         mtmsg_buffer_remove_from_ready_list(listener, b, true);
-        mtmsg_membuf_free(&b->mem);
+        mtmsg_buffer_free_mem(b);
         b = b2;
     }
     listener->closed = true;
@@ -766,6 +857,53 @@ static int MsgListener_isAbort(lua_State* L)
     return 1;
 }
 
+static int MsgListener_latency(lua_State* L)
+{
+    int arg = 1;
+    ListenerUserData* udata    = luaL_checkudata(L, arg++, MTMSG_LISTENER_CLASS_NAME);
+    MsgListener*      listener = udata->listener;
+
+    bool reset = false;
+
+    if (lua_gettop(L) >= arg) {
+        luaL_checktype(L, arg, LUA_TBOOLEAN);
+        reset = lua_toboolean(L, arg++);
+    }
+    LatencyHistogram* h = malloc(sizeof(LatencyHistogram));
+    if (!h) {
+        return mtmsg_ERROR_OUT_OF_MEMORY(L);
+    }
+    bool hasTiming = false;
+
+    async_mutex_lock(&listener->listenerMutex);
+    if (listener->latency) {
+        hasTiming = true;
+        memcpy(h, listener->latency, sizeof(LatencyHistogram));
+        if (reset) {
+            mtmsg_latency_reset(listener->latency);
+        }
+    }
+    async_mutex_unlock(&listener->listenerMutex);
+
+    if (hasTiming) {
+        mtmsg_latency_push_table(L, h);
+    } else {
+        lua_pushnil(L);
+    }
+    free(h);
+    return 1;
+}
+
+static int MsgListener_lockstats(lua_State* L)
+{
+    int arg = 1;
+    ListenerUserData* udata    = luaL_checkudata(L, arg++, MTMSG_LISTENER_CLASS_NAME);
+    MsgListener*      listener = udata->listener;
+
+    mtmsg_util_push_lockstats(L, &listener->listenerMutex);
+    return 1;
+}
+
 static const luaL_Reg MsgListenerMethods[] = 
 {
     { "id",           MsgListener_id           },
@@ -778,6 +916,8 @@ static const luaL_Reg MsgListenerMethods[] =
     { "close",        MsgListener_close        },
     { "abort",        MsgListener_abort        },
     { "isabort",      MsgListener_isAbort      },
+    { "latency",      MsgListener_latency      },
+    { "lockstats",    MsgListener_lockstats    },
     { NULL,           NULL } /* sentinel */
 };
 
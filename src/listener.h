@@ -2,6 +2,7 @@
 #define MTMSG_LISTENER_H
 
 #include "util.h"
+#include "latency.h"
 
 typedef struct carray_capi carray_capi;
 
@@ -23,12 +24,16 @@ typedef struct MsgListener {
     
     struct MsgBuffer*    firstReadyBuffer;
     struct MsgBuffer*    lastReadyBuffer;
+
+    LatencyHistogram*    latency;   /* allocated if a buffer of the listener has timing */
 } MsgListener;
 
 typedef struct ListenerUserData {
     MsgListener*       listener;
     bool               nonblock;
     const carray_capi* carrayCapi;
+    MemBuffer          msgBuffer; /* next message is copied here and decoded after unlock */
+    struct MsgDict*    msgDict;   /* string dictionary of the last message's buffer */
 } ListenerUserData;
 
 
@@ -36,9 +41,14 @@ void mtmsg_listener_free(MsgListener* q);
 
 void mtmsg_listener_abort_all(bool abortFlag);
 
+/**
+ * Must be called under mtmsg_global_lock.
+ */
+void mtmsg_listener_totals(lua_Integer* listeners, lua_Integer* buckets, lua_Integer* bucketUsage);
+
 int mtmsg_listener_next_msg(lua_State* L, ListenerUserData* udata,
                             MsgListener* lst, bool nonblock, int arg, 
-                            MemBuffer* resultBuffer, size_t* argsSize);
+                            MemBuffer* resultBuffer, size_t* argsSize, struct MsgDict** resultDict);
 
 int mtmsg_listener_init_module(lua_State* L, int module);
 
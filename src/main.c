@@ -3,7 +3,9 @@
 #include "listener.h"
 #include "writer.h"
 #include "reader.h"
+#include "bridge.h"
 #include "error.h"
+#include "trace.h"
 
 #ifndef MTMSG_VERSION
     #error MTMSG_VERSION is not defined
@@ -23,6 +25,12 @@ static int           stateCounter       = 0;
 Mutex*        mtmsg_global_lock = NULL;
 AtomicCounter mtmsg_id_counter  = 0;
 bool          mtmsg_abort_flag  = false;
+size_t        mtmsg_global_lock_count     = 0;
+size_t        mtmsg_global_lock_contended = 0;
+
+#if !defined(MTMSG_DISABLE_TRACE)
+const mtmsg_trace_hooks* volatile mtmsg_trace_hooks_ptr = NULL;
+#endif
 
 /*static int internalError(lua_State* L, const char* text, int line) 
 {
@@ -38,7 +46,7 @@ static int Mtmsg_time(lua_State* L)
 
 static void mtmsg_abort(bool newFlag)
 {
-    async_mutex_lock(mtmsg_global_lock);
+    mtmsg_global_lock_acquire();
 
     mtmsg_abort_flag = newFlag;
     mtmsg_buffer_abort_all(newFlag);
@@ -63,7 +71,7 @@ static int Mtmsg_abort(lua_State* L)
 
 static int Mtmsg_isAbort(lua_State* L)
 {
-    async_mutex_lock(mtmsg_global_lock);
+    mtmsg_global_lock_acquire();
     lua_pushboolean(L, mtmsg_abort_flag);
     async_mutex_unlock(mtmsg_global_lock);
     return 1;
@@ -78,7 +86,7 @@ static int Mtmsg_sleep(lua_State* L)
 
     lua_Number endTime = mtmsg_current_time_seconds() + waitSeconds;
 
-    async_mutex_lock(mtmsg_global_lock);
+    mtmsg_global_lock_acquire();
 
 again:
     if (mtmsg_abort_flag) {
@@ -117,6 +125,110 @@ static int Mtmsg_type(lua_State* L)
     return 1;
 }
 
+typedef struct StatsField {
+    const char* name;
+    bool        counter;
+    const char* help;
+} StatsField;
+
+static const StatsField statsFields[] =
+{
+    { "buffers",                   false, "Number of buffers."                                 },
+    { "listeners",                 false, "Number of listeners."                               },
+    { "buffer_buckets",            false, "Number of hash buckets in the buffer registry."     },
+    { "buffer_bucket_usage",       false, "Maximal number of buffers in one hash bucket."      },
+    { "listener_buckets",          false, "Number of hash buckets in the listener registry."   },
+    { "listener_bucket_usage",     false, "Maximal number of listeners in one hash bucket."    },
+    { "memory_bytes",              false, "Memory allocated for messages in all buffers."      },
+    { "msg_count",                 false, "Number of messages in all buffers."                 },
+    { "global_lock_acquisitions",  true,  "Acquisitions of the global lock."                   },
+    { "global_lock_contentions",   true,  "Acquisitions of the global lock that had to wait."  },
+};
+
+#define STATS_FIELD_COUNT (sizeof(statsFields) / sizeof(statsFields[0]))
+
+static int Mtmsg_stats(lua_State* L)
+{
+    static const char* const opts[] = { "table", "prometheus", NULL };
+    int format = luaL_checkoption(L, 1, "table", opts);
+
+    lua_Integer  values[STATS_FIELD_COUNT];
+    BufferTotals totals;
+
+    mtmsg_global_lock_acquire();
+    {
+        mtmsg_buffer_totals(&totals);
+        values[0] = totals.buffers;
+        mtmsg_listener_totals(&values[1], &values[4], &values[5]);
+        values[2] = totals.buckets;
+        values[3] = totals.bucketUsage;
+        values[6] = totals.memBytes;
+        values[7] = totals.msgCount;
+        values[8] = (lua_Integer)mtmsg_global_lock_count;
+        values[9] = (lua_Integer)mtmsg_global_lock_contended;
+    }
+    async_mutex_unlock(mtmsg_global_lock);
+
+    size_t i;
+    if (format == 0) {
+        lua_createtable(L, 0, STATS_FIELD_COUNT);
+        for (i = 0; i < STATS_FIELD_COUNT; ++i) {
+            lua_pushinteger(L, values[i]);
+            lua_setfield(L, -2, statsFields[i].name);
+        }
+    } else {
+        luaL_Buffer buf;
+        luaL_buffinit(L, &buf);
+        for (i = 0; i < STATS_FIELD_COUNT; ++i) {
+            const StatsField* f      = &statsFields[i];
+            const char*       suffix = f->counter ? "_total" : "";
+            lua_pushfstring(L, "# HELP mtmsg_%s%s %s\n"
+                               "# TYPE mtmsg_%s%s %s\n"
+                               "mtmsg_%s%s ",
+                            f->name, suffix, f->help,
+                            f->name, suffix, f->counter ? "counter" : "gauge",
+                            f->name, suffix);
+            luaL_addvalue(&buf);
+            char num[32];
+            sprintf(num, "%.0f\n", (double)values[i]);
+            luaL_addstring(&buf, num);
+        }
+        luaL_pushresult(&buf);
+    }
+    return 1;
+}
+
+static int Mtmsg_lockstats(lua_State* L)
+{
+    mtmsg_util_push_lockstats(L, mtmsg_global_lock);
+    return 1;
+}
+
+static int Mtmsg_traceHooks(lua_State* L)
+{
+    const mtmsg_trace_hooks* hooks = NULL;
+    if (!lua_isnoneornil(L, 1)) {
+        luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+        hooks = lua_touserdata(L, 1);
+        if (   hooks->version_major != MTMSG_TRACE_CAPI_VERSION_MAJOR
+            || hooks->version_minor <  MTMSG_TRACE_CAPI_VERSION_MINOR)
+        {
+            return luaL_argerror(L, 1, "incompatible trace hooks version number");
+        }
+    }
+#if !defined(MTMSG_DISABLE_TRACE)
+    mtmsg_global_lock_acquire();
+    {
+        mtmsg_trace_hooks_ptr = hooks;
+    }
+    async_mutex_unlock(mtmsg_global_lock);
+    lua_pushboolean(L, true);
+#else
+    lua_pushboolean(L, false);
+#endif
+    return 1;
+}
+
 static const luaL_Reg ModuleFunctions[] = 
 {
     { "time",          Mtmsg_time         },
@@ -124,12 +236,15 @@ static const luaL_Reg ModuleFunctions[] =
     { "isabort",       Mtmsg_isAbort      },
     { "sleep",         Mtmsg_sleep        },
     { "type",          Mtmsg_type         },
+    { "stats",         Mtmsg_stats        },
+    { "lockstats",     Mtmsg_lockstats    },
+    { "tracehooks",    Mtmsg_traceHooks   },
     { NULL,            NULL } /* sentinel */
 };
 
 static int handleClosingLuaState(lua_State* L)
 {
-    async_mutex_lock(mtmsg_global_lock);
+    mtmsg_global_lock_acquire();
     stateCounter -= 1;
     if (stateCounter == 0) {
 
@@ -163,7 +278,7 @@ DLL_PUBLIC int luaopen_mtmsg(lua_State* L)
     }
     /* ---------------------------------------- */
 
-    async_mutex_lock(mtmsg_global_lock);
+    mtmsg_global_lock_acquire();
     {
         if (!initialized) {
             /* create initial id that could not accidently be mistaken with "normal" integers */
@@ -248,6 +363,7 @@ DLL_PUBLIC int luaopen_mtmsg(lua_State* L)
     mtmsg_listener_init_module(L, module);
     mtmsg_writer_init_module  (L, module);
     mtmsg_reader_init_module  (L, module);
+    mtmsg_bridge_init_module  (L, module);
     mtmsg_error_init_module   (L, errorModule);
     
     lua_settop(L, module);
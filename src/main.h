@@ -6,6 +6,20 @@
 extern Mutex*        mtmsg_global_lock;
 extern AtomicCounter mtmsg_id_counter;
 extern bool          mtmsg_abort_flag;
+extern size_t        mtmsg_global_lock_count;     /* guarded by mtmsg_global_lock */
+extern size_t        mtmsg_global_lock_contended; /* guarded by mtmsg_global_lock */
+
+/**
+ * Locks mtmsg_global_lock and counts acquisitions for mtmsg.stats().
+ */
+static inline void mtmsg_global_lock_acquire()
+{
+    if (!async_mutex_trylock(mtmsg_global_lock)) {
+        async_mutex_lock(mtmsg_global_lock);
+        mtmsg_global_lock_contended += 1;
+    }
+    mtmsg_global_lock_count += 1;
+}
 
 DLL_PUBLIC int luaopen_mtmsg(lua_State* L);
 
@@ -0,0 +1,394 @@
+/* system headers must be included before util.h sets the symbol visibility */
+#include "async_defines.h"
+
+#ifndef MTMSG_ASYNC_USE_WIN32
+    #include <fcntl.h>
+    #include <sys/file.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+#include "mapfile.h"
+#include "serialize.h"
+
+#ifndef MTMSG_ASYNC_USE_WIN32
+
+#define MAPFILE_HEADER_SIZE 4096
+#define MAPFILE_VERSION     1
+#define MAPSHM_VERSION      2   /* robust mutex and sizeOfMutex */
+
+static const char MAPFILE_MAGIC[8] = "mtmsgmf";
+static const char MAPSHM_MAGIC[8]  = "mtmsgsm";
+
+/**
+ * The message position is stored in two slots: the inactive slot is
+ * written and then made active, so that a valid position is found
+ * in the file at every point in time.
+ */
+typedef struct MapFileHeader {
+    char      magic[8];
+    uint32_t  version;
+    uint32_t  headerSize;
+    uint64_t  capacity;
+    uint8_t   sizeOfSizeT;
+    uint8_t   sizeOfInteger;
+    uint8_t   sizeOfNumber;
+    uint8_t   littleEndian;
+    uint32_t  active;
+    struct {
+        uint64_t start;
+        uint64_t end;
+        uint64_t msgCount;
+    } state[2];
+    uint32_t  sizeOfMutex; /* differs e.g. if compiled with MTMSG_LOCKSTATS */
+    Mutex     mutex;       /* only used for shared memory */
+} MapFileHeader;
+
+struct MapFile {
+    int                     fd;
+    char*                   map;
+    size_t                  mapSize;
+    volatile MapFileHeader* header;
+    MapFileSync             syncMode;
+    size_t                  pageSize;
+    bool                    shared;
+};
+
+static bool isLittleEndian()
+{
+    const uint16_t x = 1;
+    return *(const uint8_t*)&x == 1;
+}
+
+static void initHeader(volatile MapFileHeader* h, const char* magic, uint32_t version, size_t capacity)
+{
+    h->version       = version;
+    h->headerSize    = MAPFILE_HEADER_SIZE;
+    h->capacity      = capacity;
+    h->sizeOfSizeT   = sizeof(size_t);
+    h->sizeOfInteger = sizeof(lua_Integer);
+    h->sizeOfNumber  = sizeof(lua_Number);
+    h->littleEndian  = isLittleEndian();
+    h->active        = 0;
+    h->sizeOfMutex   = sizeof(Mutex);
+    atomic_release_fence(); /* header fields are visible before the magic */
+    memcpy((char*)h->magic, magic, sizeof(MAPFILE_MAGIC)); /* magic is written last */
+}
+
+/**
+ * Returns NULL if the header is valid, otherwise the reason.
+ */
+static const char* checkHeader(volatile MapFileHeader* h, const char* magic, uint32_t version, size_t mapSize)
+{
+    if (   memcmp((const char*)h->magic, magic, sizeof(MAPFILE_MAGIC)) != 0
+        || h->version    != version
+        || h->headerSize != MAPFILE_HEADER_SIZE
+        || h->capacity   != mapSize - MAPFILE_HEADER_SIZE
+        || h->active > 1)
+    {
+        return "invalid file format";
+    }
+    if (   h->sizeOfSizeT   != sizeof(size_t)
+        || h->sizeOfInteger != sizeof(lua_Integer)
+        || h->sizeOfNumber  != sizeof(lua_Number)
+        || h->littleEndian  != isLittleEndian())
+    {
+        return "file was written on an incompatible platform";
+    }
+    if (version == MAPSHM_VERSION && h->sizeOfMutex != sizeof(Mutex)) {
+        return "shared memory was created by an incompatible build";
+    }
+    return NULL;
+}
+
+static MapFile* newMapFile(int fd, char* map, size_t mapSize, MapFileSync syncMode,
+                           bool shared, MemBuffer* mem, int* msgCount)
+{
+    MapFile* mf = malloc(sizeof(MapFile));
+    if (!mf) {
+        return NULL;
+    }
+    mf->fd       = fd;
+    mf->map      = map;
+    mf->mapSize  = mapSize;
+    mf->header   = (volatile MapFileHeader*)map;
+    mf->syncMode = syncMode;
+    mf->pageSize = sysconf(_SC_PAGESIZE);
+    mf->shared   = shared;
+
+    memset(mem, 0, sizeof(MemBuffer));
+    mem->bufferData     = map + MAPFILE_HEADER_SIZE;
+    mem->bufferStart    = mem->bufferData;
+    mem->bufferCapacity = mf->header->capacity;
+    mem->growFactor     = 0;
+    mtmsg_mapfile_refresh(mf, mem, msgCount);
+    return mf;
+}
+
+static void syncRange(MapFile* mf, size_t from, size_t to)
+{
+    size_t pageStart = from - from % mf->pageSize;
+    msync(mf->map + pageStart, to - pageStart, MS_SYNC);
+}
+
+MapFile* mtmsg_mapfile_open(const char* path, size_t capacity, MapFileSync syncMode,
+                            MemBuffer* mem, int* msgCount,
+                            char* errorBuffer, size_t errorBufferSize)
+{
+    const char* error = NULL;
+    int         fd    = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        error = strerror(errno);
+        goto failed;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        error = (errno == EWOULDBLOCK) ? "file is in use" : strerror(errno);
+        goto failedClose;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        error = strerror(errno);
+        goto failedClose;
+    }
+    bool isNew = (st.st_size == 0);
+    if (isNew) {
+        if (capacity == 0 || capacity > (size_t)-1 - MAPFILE_HEADER_SIZE) {
+            error = "invalid size";
+            goto failedClose;
+        }
+        if (ftruncate(fd, MAPFILE_HEADER_SIZE + capacity) != 0) {
+            error = strerror(errno);
+            goto failedClose;
+        }
+    } else if (st.st_size < MAPFILE_HEADER_SIZE || (uint64_t)st.st_size > (size_t)-1) {
+        error = "invalid file format";
+        goto failedClose;
+    }
+    size_t mapSize = isNew ? MAPFILE_HEADER_SIZE + capacity : (size_t)st.st_size;
+    char*  map     = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        error = strerror(errno);
+        goto failedClose;
+    }
+    volatile MapFileHeader* h = (volatile MapFileHeader*)map;
+    if (isNew) {
+        initHeader(h, MAPFILE_MAGIC, MAPFILE_VERSION, capacity);
+        if (syncMode == MTMSG_MAPFILE_SYNC_ALWAYS) {
+            msync(map, MAPFILE_HEADER_SIZE, MS_SYNC);
+        }
+    }
+    else if ((error = checkHeader(h, MAPFILE_MAGIC, MAPFILE_VERSION, mapSize)) != NULL) {
+        goto failedUnmap;
+    }
+    uint64_t start = h->state[h->active].start;
+    uint64_t end   = h->state[h->active].end;
+    int      count = (start <= end && end <= h->capacity)
+                     ? mtmsg_serialize_count_msgs(map + MAPFILE_HEADER_SIZE + start, end - start) : -1;
+    if (count < 0) {
+        error = "corrupt message data";
+        goto failedUnmap;
+    }
+    /* a file can be modified outside of mtmsg, messages are checked as for loaded dumps */
+    int check = mtmsg_serialize_check_msgs(map + MAPFILE_HEADER_SIZE + start, end - start);
+    if (check != 0) {
+        error = (check == -2) ? "out of memory" : "corrupt message data";
+        goto failedUnmap;
+    }
+    h->state[h->active].msgCount = count;
+
+    MapFile* mf = newMapFile(fd, map, mapSize, syncMode, false, mem, msgCount);
+    if (!mf) {
+        error = "out of memory";
+        goto failedUnmap;
+    }
+    return mf;
+
+failedUnmap:
+    munmap(map, mapSize);
+failedClose:
+    close(fd);
+failed:
+    snprintf(errorBuffer, errorBufferSize, "cannot open file '%s': %s", path, error);
+    return NULL;
+}
+
+MapFile* mtmsg_mapfile_open_shared(const char* name, size_t capacity,
+                                   MemBuffer* mem, int* msgCount, Mutex** mutex,
+                                   char* errorBuffer, size_t errorBufferSize)
+{
+    const char* error = NULL;
+    char*       map   = MAP_FAILED;
+    size_t      mapSize;
+    int         fd    = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    bool        isNew = (fd >= 0);
+    if (!isNew && errno == EEXIST) {
+        fd = shm_open(name, O_RDWR, 0);
+    }
+    if (fd < 0) {
+        error = strerror(errno);
+        goto failed;
+    }
+    if (isNew) {
+        if (capacity == 0 || capacity > (size_t)-1 - MAPFILE_HEADER_SIZE) {
+            error = "invalid size";
+            goto failedClose;
+        }
+        mapSize = MAPFILE_HEADER_SIZE + capacity;
+        if (ftruncate(fd, mapSize) != 0) {
+            error = strerror(errno);
+            goto failedClose;
+        }
+    } else {
+        /* the creating process may not yet have set the size */
+        struct stat st;
+        int i;
+        for (i = 0; i < 100; ++i) {
+            if (fstat(fd, &st) != 0) {
+                error = strerror(errno);
+                goto failedClose;
+            }
+            if (st.st_size > 0) break;
+            usleep(10000);
+        }
+        if (st.st_size < MAPFILE_HEADER_SIZE || (uint64_t)st.st_size > (size_t)-1) {
+            error = "invalid file format";
+            goto failedClose;
+        }
+        mapSize = st.st_size;
+    }
+    map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        error = strerror(errno);
+        goto failedClose;
+    }
+    volatile MapFileHeader* h = (volatile MapFileHeader*)map;
+    if (isNew) {
+        if (!async_mutex_init_shared((Mutex*)&h->mutex)) {
+            error = "process shared mutex not supported";
+            goto failedClose;
+        }
+        initHeader(h, MAPSHM_MAGIC, MAPSHM_VERSION, capacity);
+    } else {
+        /* the creating process may not yet have initialized the header */
+        int i;
+        for (i = 0; i < 100; ++i) {
+            if (memcmp((const char*)h->magic, MAPSHM_MAGIC, sizeof(MAPSHM_MAGIC)) == 0) break;
+            usleep(10000);
+        }
+        atomic_acquire_fence(); /* pairs with the release fence in initHeader */
+        if ((error = checkHeader(h, MAPSHM_MAGIC, MAPSHM_VERSION, mapSize)) != NULL) {
+            goto failedClose;
+        }
+    }
+    MapFile* mf = newMapFile(fd, map, mapSize, MTMSG_MAPFILE_SYNC_NEVER, true, mem, msgCount);
+    if (!mf) {
+        error = "out of memory";
+        goto failedClose;
+    }
+    *mutex = (Mutex*)&h->mutex;
+    return mf;
+
+failedClose:
+    if (map != MAP_FAILED) {
+        munmap(map, mapSize);
+    }
+    if (isNew) {
+        shm_unlink(name);
+    }
+    close(fd);
+failed:
+    snprintf(errorBuffer, errorBufferSize, "cannot open shared memory '%s': %s", name, error);
+    return NULL;
+}
+
+bool mtmsg_mapfile_unlink_shared(const char* name)
+{
+    return shm_unlink(name) == 0;
+}
+
+void mtmsg_mapfile_close(MapFile* mf)
+{
+    if (!mf->shared) {
+        msync(mf->map, mf->mapSize, MS_SYNC);
+    }
+    munmap(mf->map, mf->mapSize);
+    close(mf->fd);
+    free(mf);
+}
+
+void mtmsg_mapfile_update(MapFile* mf, const MemBuffer* mem, int msgCount)
+{
+    volatile MapFileHeader* h = mf->header;
+    uint64_t start = 0;
+    uint64_t end   = 0;
+    if (mem->bufferLength > 0) {
+        start = mem->bufferStart - mem->bufferData;
+        end   = start + mem->bufferLength;
+    }
+    uint32_t a        = h->active;
+    uint64_t oldStart = h->state[a].start;
+    uint64_t oldEnd   = h->state[a].end;
+    if (start == oldStart && end == oldEnd && h->state[a].msgCount == (uint64_t)msgCount) {
+        return;
+    }
+    if (mf->syncMode == MTMSG_MAPFILE_SYNC_ALWAYS && end > oldEnd) {
+        /* message data must be on disk before it becomes visible */
+        uint64_t from = (start == oldStart) ? oldEnd : start;
+        syncRange(mf, MAPFILE_HEADER_SIZE + from, MAPFILE_HEADER_SIZE + end);
+    }
+    h->state[1 - a].start    = start;
+    h->state[1 - a].end      = end;
+    h->state[1 - a].msgCount = msgCount;
+    h->active                = 1 - a;
+    if (mf->syncMode == MTMSG_MAPFILE_SYNC_ALWAYS) {
+        msync(mf->map, MAPFILE_HEADER_SIZE, MS_SYNC);
+    }
+}
+
+void mtmsg_mapfile_refresh(MapFile* mf, MemBuffer* mem, int* msgCount)
+{
+    volatile MapFileHeader* h = mf->header;
+    uint32_t a = h->active;
+    mem->bufferStart  = mem->bufferData + h->state[a].start;
+    mem->bufferLength = h->state[a].end - h->state[a].start;
+    *msgCount         = h->state[a].msgCount;
+}
+
+#else /* MTMSG_ASYNC_USE_WIN32 */
+
+MapFile* mtmsg_mapfile_open(const char* path, size_t capacity, MapFileSync syncMode,
+                            MemBuffer* mem, int* msgCount,
+                            char* errorBuffer, size_t errorBufferSize)
+{
+    snprintf(errorBuffer, errorBufferSize, "cannot open file '%s': %s", path,
+                                           "not supported on this platform");
+    return NULL;
+}
+
+MapFile* mtmsg_mapfile_open_shared(const char* name, size_t capacity,
+                                   MemBuffer* mem, int* msgCount, Mutex** mutex,
+                                   char* errorBuffer, size_t errorBufferSize)
+{
+    snprintf(errorBuffer, errorBufferSize, "cannot open shared memory '%s': %s", name,
+                                           "not supported on this platform");
+    return NULL;
+}
+
+bool mtmsg_mapfile_unlink_shared(const char* name)
+{
+    return false;
+}
+
+void mtmsg_mapfile_close(MapFile* mf)
+{
+}
+
+void mtmsg_mapfile_update(MapFile* mf, const MemBuffer* mem, int msgCount)
+{
+}
+
+void mtmsg_mapfile_refresh(MapFile* mf, MemBuffer* mem, int* msgCount)
+{
+}
+
+#endif /* MTMSG_ASYNC_USE_WIN32 */
@@ -0,0 +1,75 @@
+#ifndef MTMSG_MAPFILE_H
+#define MTMSG_MAPFILE_H
+
+#include "util.h"
+
+/**
+ * Message storage in a memory mapped file: the file consists of a header
+ * page followed by the message data. The header holds the offsets of the
+ * unconsumed messages, so that these are available again if the file is
+ * reopened.
+ *
+ * The same layout is used for POSIX shared memory that is opened by several 
+ * processes. In this case the header also contains a process shared mutex
+ * and the offsets are the state that is shared between the processes.
+ */
+
+typedef enum MapFileSync {
+    MTMSG_MAPFILE_SYNC_NEVER  = 0, /* written back by the operating system */
+    MTMSG_MAPFILE_SYNC_ALWAYS = 1  /* msync after every change             */
+} MapFileSync;
+
+typedef struct MapFile MapFile;
+
+/**
+ * Opens or creates the file and sets up mem to reference the message
+ * data in the mapped file. capacity is only used if a new file is created.
+ * msgCount is set to the number of unconsumed messages.
+ * Returns NULL and fills errorBuffer on failure.
+ */
+MapFile* mtmsg_mapfile_open(const char* path, size_t capacity, MapFileSync syncMode,
+                            MemBuffer* mem, int* msgCount,
+                            char* errorBuffer, size_t errorBufferSize);
+
+/**
+ * Opens or creates the shared memory object with the given name. capacity 
+ * is only used if a new object is created. mutex is set to the process shared
+ * mutex that must be locked for every access to mem.
+ * Returns NULL and fills errorBuffer on failure.
+ */
+MapFile* mtmsg_mapfile_open_shared(const char* name, size_t capacity,
+                                   MemBuffer* mem, int* msgCount, Mutex** mutex,
+                                   char* errorBuffer, size_t errorBufferSize);
+
+bool mtmsg_mapfile_unlink_shared(const char* name);
+
+/**
+ * Unmaps and closes the file, mem must not be used afterwards.
+ */
+void mtmsg_mapfile_close(MapFile* mf);
+
+/**
+ * Persists the position of the messages in mem. Must be called after
+ * every change of mem.
+ */
+void mtmsg_mapfile_update(MapFile* mf, const MemBuffer* mem, int msgCount);
+
+/**
+ * Sets the position of the messages in mem from the header. Must be called
+ * before mem is accessed if the mapping is shared with other processes.
+ */
+void mtmsg_mapfile_refresh(MapFile* mf, MemBuffer* mem, int* msgCount);
+
+/**
+ * true if reserving additionalLength bytes in mem would move unconsumed
+ * messages over themselves. This is not done for mapped files, because
+ * the messages would be lost if the process dies while moving.
+ */
+static inline bool mtmsg_mapfile_would_overlap(const MemBuffer* mem, size_t additionalLength)
+{
+    size_t offset = mem->bufferStart - mem->bufferData;
+    return    offset + mem->bufferLength + additionalLength > mem->bufferCapacity
+           && offset < mem->bufferLength + additionalLength;
+}
+
+#endif /* MTMSG_MAPFILE_H */
@@ -32,7 +32,7 @@ static notify_notifier* toNotifier(lua_State* L, int index)
 static void retainNotifier(notify_notifier* n)
 {
     MsgBuffer* b = (MsgBuffer*)n;
-    async_mutex_lock(mtmsg_global_lock);
+    mtmsg_global_lock_acquire();
     atomic_inc(&b->used);
     async_mutex_unlock(mtmsg_global_lock);
 }
@@ -41,7 +41,7 @@ static void retainNotifier(notify_notifier* n)
 static void releaseNotifier(notify_notifier* n)
 {
     MsgBuffer* b = (MsgBuffer*)n;
-    async_mutex_lock(mtmsg_global_lock);
+    mtmsg_global_lock_acquire();
     if (atomic_dec(&b->used) == 0) {
         mtmsg_free_buffer(b);
     }
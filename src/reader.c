@@ -16,6 +16,7 @@ struct ReaderUserData
 {
     MemBuffer          mem;
     const carray_capi* carrayCapi;
+    MsgDict*           dict;
 };
 
 static void setupReaderMeta(lua_State* L);
@@ -67,6 +68,8 @@ static int Reader_release(lua_State* L)
     ReaderUserData* udata = luaL_checkudata(L, 1, MTMSG_READER_CLASS_NAME);
     
     mtmsg_membuf_free(&udata->mem);
+    mtmsg_dict_release(udata->dict);
+    udata->dict = NULL;
 
     return 0;    
 }
@@ -112,6 +115,8 @@ static int Reader_next(lua_State* L)
                        par.parsedArgCount = 0;
                        par.carrayCapi     = udata->carrayCapi;
                        par.errorArg       = 0;
+                       par.dict           = udata->dict;
+                       par.dictCache      = 0;
 
     lua_pushcfunction(L, mtmsg_serialize_get_msg_args);
     lua_insert(L, arg);
@@ -159,10 +164,10 @@ static int Reader_nextMsg(lua_State* L)
     int rc = 0;
     if (budata) {
         if (!rudata->carrayCapi) rudata->carrayCapi = budata->carrayCapi;
-        rc = mtmsg_buffer_next_msg  (L, budata, budata->buffer, budata->nonblock, arg, 0 /* timeout from arg */, &rudata->mem, &args_size, NULL, NULL);
+        rc = mtmsg_buffer_next_msg  (L, budata, budata->buffer, budata->nonblock, arg, 0 /* timeout from arg */, &rudata->mem, &args_size, &rudata->dict, NULL, NULL);
     } else {
         if (!rudata->carrayCapi) rudata->carrayCapi = ludata->carrayCapi;
-        rc = mtmsg_listener_next_msg(L, ludata, ludata->listener, ludata->nonblock, arg, &rudata->mem, &args_size);
+        rc = mtmsg_listener_next_msg(L, ludata, ludata->listener, ludata->nonblock, arg, &rudata->mem, &args_size, &rudata->dict);
     }
     if (rc < 0) {
         if (rc == -4) {
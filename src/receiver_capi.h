@@ -3,7 +3,7 @@
 
 #define RECEIVER_CAPI_ID_STRING     "_capi_receiver"
 #define RECEIVER_CAPI_VERSION_MAJOR  2
-#define RECEIVER_CAPI_VERSION_MINOR  0
+#define RECEIVER_CAPI_VERSION_MINOR  1
 #define RECEIVER_CAPI_VERSION_PATCH  0
 
 #ifndef RECEIVER_CAPI_HAVE_LONG_LONG
@@ -192,13 +192,46 @@ struct receiver_capi
     /**
      * Adds an array of primitive numeric C data types as one value.
      * Does not need to be thread safe.
-     * Returns pointer to the reserved memory for unintialized array 
+     * Returns pointer to the reserved memory for uninitialized array 
      * elements. This pointer is valid until the next call to the writer.
      * The caller is responsible for filling in the element data before 
      * the next call to the writer.
      */
     void* (*addArrayToWriter)(receiver_writer* w, receiver_array_type t, 
                               size_t elementCount);
+
+    /**
+     * Must be thread safe. Since version 2.1.
+     *
+     * Reserves memory for a message directly in the receiver to avoid copying
+     * large arrays. The message consists of the writer's content followed by
+     * an array of elementCount elements of the given type.
+     *
+     * Returns pointer to the reserved memory for the uninitialized array 
+     * elements or NULL if rc is set to an error code != 0, the error codes
+     * are the same as for msgToReceiver(). 
+     *
+     * The caller must fill in the element data and then call commitToReceiver()
+     * from the same thread. The receiver is not locked in the meantime, but 
+     * other threads cannot add messages to the receiver until then, therefore
+     * this should be done without delay and without other calls to the 
+     * receiver or writer. If the message cannot be placed into the receiver's 
+     * memory, the memory is reserved in the writer and the message is sent
+     * by commitToReceiver().
+     */
+    void* (*reserveInReceiver)(receiver_object* b, receiver_writer* w,
+                               receiver_array_type t, size_t elementCount,
+                               int nonblock, int* rc);
+
+    /**
+     * Must be thread safe. Since version 2.1.
+     *
+     * Adds the message reserved by reserveInReceiver() to the receiver or
+     * discards it if cancel is not 0. The writer's content is cleared.
+     * Returns 0 on success or an error code as for msgToReceiver().
+     */
+    int (*commitToReceiver)(receiver_object* b, receiver_writer* w, int cancel,
+                            receiver_error_handler eh, void* ehdata);
 };
 
 
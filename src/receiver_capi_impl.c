@@ -7,6 +7,9 @@
 struct receiver_writer
 {
     MemBuffer mem;
+    size_t    reservedSize; /* size of the message reserved in the receiver's memory */
+    bool      reserved;     /* message was reserved by reserveInReceiver() */
+    bool      nonblock;     /* for sending a message reserved in mem */
 };
 
 static receiver_object* toReceiver(lua_State* L, int index)
@@ -33,7 +36,7 @@ static receiver_object* toReceiver(lua_State* L, int index)
 static void retainReceiver(receiver_object* buffer)
 {
     MsgBuffer* b = (MsgBuffer*)buffer;
-    async_mutex_lock(mtmsg_global_lock);
+    mtmsg_global_lock_acquire();
     atomic_inc(&b->used);
     async_mutex_unlock(mtmsg_global_lock);
 }
@@ -42,7 +45,7 @@ static void retainReceiver(receiver_object* buffer)
 static void releaseReceiver(receiver_object* buffer)
 {
     MsgBuffer* b = (MsgBuffer*)buffer;
-    async_mutex_lock(mtmsg_global_lock);
+    mtmsg_global_lock_acquire();
     if (atomic_dec(&b->used) == 0) {
         mtmsg_free_buffer(b);
     }
@@ -53,6 +56,9 @@ static receiver_writer* newWriter(size_t initialCapacity, float growFactor)
 {
     receiver_writer* writer = malloc(sizeof(receiver_writer));
     if (writer) {
+        writer->reservedSize = 0;
+        writer->reserved     = false;
+        writer->nonblock     = false;
         if (!mtmsg_membuf_init(&writer->mem, initialCapacity, growFactor)) {
             free(writer);
             writer = NULL;
@@ -98,7 +104,7 @@ static int addIntegerToWriter(receiver_writer* writer, lua_Integer value)
 
 static int addNumberToWriter(receiver_writer* writer, lua_Number value)
 {
-    size_t args_size = MTMSG_ARG_SIZE_NUMBER;
+    size_t args_size = mtmsg_serialize_calc_number_size(value);
     int rc = mtmsg_membuf_reserve(&writer->mem, args_size);
     if (rc == 0) {
         mtmsg_serialize_number_to_buffer(value, writer->mem.bufferStart + writer->mem.bufferLength);
@@ -133,8 +139,7 @@ static int addBytesToWriter(receiver_writer* writer, const unsigned char* value,
     return rc;
 }
 
-static void* addArrayToWriter(receiver_writer* writer, receiver_array_type type, 
-                              size_t elementCount)
+static bool getArrayInfo(receiver_array_type type, size_t elementCount, carray_info* info)
 {
     carray_type carrayType = 0;
     size_t elementSize = 0;
@@ -158,12 +163,22 @@ static void* addArrayToWriter(receiver_writer* writer, receiver_array_type type,
         case RECEIVER_LLONG:  carrayType = CARRAY_LLONG;   elementSize = sizeof(long long); break;
         case RECEIVER_ULLONG: carrayType = CARRAY_ULLONG;  elementSize = sizeof(unsigned long long); break;
     #endif
-        default: return NULL;
+        default: return false;
+    }
+    memset(info, 0, sizeof(carray_info));
+    info->elementType  = carrayType;
+    info->elementSize  = elementSize;
+    info->elementCount = elementCount;
+    return true;
+}
+
+static void* addArrayToWriter(receiver_writer* writer, receiver_array_type type, 
+                              size_t elementCount)
+{
+    carray_info info;
+    if (!getArrayInfo(type, elementCount, &info)) {
+        return NULL;
     }
-    carray_info info = {0};
-    info.elementType  = carrayType;
-    info.elementSize  = elementSize;
-    info.elementCount = elementCount;
     size_t args_size = mtmsg_serialize_calc_carray_size(&info);
     int rc = mtmsg_membuf_reserve(&writer->mem, args_size);
     if (rc == 0) {
@@ -190,6 +205,61 @@ static int msgToReceiver(receiver_object* buffer, receiver_writer* writer,
     return rc;
 }
 
+static void* reserveInReceiver(receiver_object* buffer, receiver_writer* writer,
+                               receiver_array_type type, size_t elementCount,
+                               int nonblock, int* rc)
+{
+    MsgBuffer*  b = (MsgBuffer*)buffer;
+    carray_info info;
+    if (!getArrayInfo(type, elementCount, &info)) {
+        *rc = 999;
+        return NULL;
+    }
+    size_t args_size = writer->mem.bufferLength + mtmsg_serialize_calc_carray_size(&info);
+    char*  args;
+    *rc = mtmsg_buffer_reserve_msg(b, nonblock, args_size, &args);
+    if (*rc == 0) {
+        memcpy(args, writer->mem.bufferStart, writer->mem.bufferLength);
+        writer->reservedSize = mtmsg_serialize_calc_header_size(args_size) + args_size;
+        writer->reserved     = true;
+        return mtmsg_serialize_carray_header_to_buffer(&info, args + writer->mem.bufferLength);
+    }
+    if (*rc == 8) {
+        /* message has to be converted, compressed or spilled */
+        void* data = addArrayToWriter(writer, type, elementCount);
+        if (data) {
+            *rc = 0;
+            writer->reservedSize = 0;
+            writer->reserved     = true;
+            writer->nonblock     = nonblock;
+        } else {
+            *rc = 6;
+        }
+        return data;
+    }
+    return NULL;
+}
+
+static int commitToReceiver(receiver_object* buffer, receiver_writer* writer, int cancel,
+                            receiver_error_handler eh, void* ehdata)
+{
+    MsgBuffer* b  = (MsgBuffer*)buffer;
+    int        rc = 0;
+    if (writer->reserved) {
+        writer->reserved = false;
+        if (writer->reservedSize > 0) {
+            rc = mtmsg_buffer_commit_msg(b, writer->reservedSize, cancel, eh, ehdata);
+            writer->reservedSize = 0;
+        } else if (!cancel) {
+            rc = mtmsg_buffer_set_or_add_msg(NULL, b, writer->nonblock, false, 0, 
+                                             writer->mem.bufferStart, writer->mem.bufferLength, 
+                                             eh, ehdata);
+        }
+    }
+    clearWriter(writer);
+    return rc;
+}
+
 const receiver_capi mtmsg_receiver_capi_impl =
 {
     RECEIVER_CAPI_VERSION_MAJOR,
@@ -214,5 +284,8 @@ const receiver_capi mtmsg_receiver_capi_impl =
     addNumberToWriter,
     addStringToWriter,
     addBytesToWriter,
-    addArrayToWriter
+    addArrayToWriter,
+
+    reserveInReceiver,
+    commitToReceiver
 };
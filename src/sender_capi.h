@@ -3,7 +3,7 @@
 
 #define SENDER_CAPI_ID_STRING     "_capi_sender"
 #define SENDER_CAPI_VERSION_MAJOR  1
-#define SENDER_CAPI_VERSION_MINOR  0
+#define SENDER_CAPI_VERSION_MINOR  1
 #define SENDER_CAPI_VERSION_PATCH  0
 
 #ifndef SENDER_CAPI_HAVE_LONG_LONG
@@ -210,6 +210,42 @@ struct sender_capi
                                  int nonblock, double timeout,
                                  sender_error_handler eh, void* ehdata);
 
+    /**
+     * Must be thread safe. Since version 1.1.
+     *
+     * Gets up to maxCount messages of a sender into the reader in one atomic step.
+     * Further messages are not taken if the total size of the message elements
+     * would exceed maxBytes (if maxBytes > 0) or the reader's memory limit, but
+     * at least one message is taken. Older message elements in the reader are 
+     * discarded as in nextMessageFromSender().
+     *
+     * After this call the reader is positioned at the first message: 
+     * nextValueFromReader() delivers the elements of the current message and 
+     * sets out->type to SENDER_CAPI_TYPE_NONE at the end of the message, 
+     * nextMessageFromReader() switches to the next message.
+     *
+     * maxCount: maximal number of messages, must be > 0
+     * maxBytes: maximal total size of the messages in the reader, 0 for no limit
+     * count:    receives the number of messages in the reader, 0 if the return 
+     *           code is not 0.
+     *
+     * The other arguments and the return codes are the same as for
+     * nextMessageFromSender().
+     */
+    int (*nextMessagesFromSender)(sender_object* s, sender_reader* r, 
+                                  int nonblock, double timeout,
+                                  size_t maxCount, size_t maxBytes, size_t* count,
+                                  sender_error_handler eh, void* ehdata);
+
+    /**
+     * Does not need to be thread safe. Since version 1.1.
+     *
+     * Discards the remaining elements of the current message and switches
+     * to the next message obtained by nextMessagesFromSender().
+     * Returns 1 if there is a next message, 0 otherwise.
+     */
+    int (*nextMessageFromReader)(sender_reader* r);
+
 };
 
 
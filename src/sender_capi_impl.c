@@ -8,6 +8,12 @@
 struct sender_reader
 {
     MemBuffer mem;
+    MsgDict*  dict;
+    MemBuffer lengths;      /* sizes of the messages from nextMessagesFromSender() */
+    MemBuffer wrapped;      /* compressed or portable messages before unwrapping */
+    size_t    msgIndex;
+    size_t    msgCount;     /* 0 if the reader does not contain multiple messages */
+    size_t    msgRemaining; /* unread bytes of the current message if msgCount > 0 */
 };
 
 
@@ -36,7 +42,7 @@ static sender_object* toSender(lua_State* L, int index)
 static void retainSender(sender_object* s)
 {
     MsgBuffer* b = (MsgBuffer*)s;
-    async_mutex_lock(mtmsg_global_lock);
+    mtmsg_global_lock_acquire();
     atomic_inc(&b->used);
     async_mutex_unlock(mtmsg_global_lock);
 }
@@ -44,7 +50,7 @@ static void retainSender(sender_object* s)
 static void releaseSender(sender_object* s)
 {
     MsgBuffer* b = (MsgBuffer*)s;
-    async_mutex_lock(mtmsg_global_lock);
+    mtmsg_global_lock_acquire();
     if (atomic_dec(&b->used) == 0) {
         mtmsg_free_buffer(b);
     }
@@ -56,6 +62,12 @@ static sender_reader* newReader(size_t initialCapacity, float growFactor)
 {
     sender_reader* reader = malloc(sizeof(sender_reader));
     if (reader) {
+        reader->dict         = NULL;
+        reader->msgIndex     = 0;
+        reader->msgCount     = 0;
+        reader->msgRemaining = 0;
+        mtmsg_membuf_init(&reader->lengths, 0, 2);
+        mtmsg_membuf_init(&reader->wrapped, 0, 2);
         if (!mtmsg_membuf_init(&reader->mem, initialCapacity, growFactor)) {
             free(reader);
             reader = NULL;
@@ -69,6 +81,9 @@ static void freeReader(sender_reader* reader)
 {
     if (reader) {
         mtmsg_membuf_free(&reader->mem);
+        mtmsg_membuf_free(&reader->lengths);
+        mtmsg_membuf_free(&reader->wrapped);
+        mtmsg_dict_release(reader->dict);
         free(reader);
     }
 }
@@ -77,6 +92,9 @@ static void clearReader(sender_reader* reader)
 {
     reader->mem.bufferStart  = reader->mem.bufferData;
     reader->mem.bufferLength = 0;
+    reader->msgIndex         = 0;
+    reader->msgCount         = 0;
+    reader->msgRemaining     = 0;
 }
 
 static void nextValueFromReader(sender_reader* reader, sender_capi_value* out)
@@ -85,7 +103,8 @@ static void nextValueFromReader(sender_reader* reader, sender_capi_value* out)
     size_t parsedLength = 0;
     
     const char* buffer     = reader->mem.bufferStart;
-    size_t      bufferSize = reader->mem.bufferLength;
+    size_t      bufferSize = (reader->msgCount > 0) ? reader->msgRemaining 
+                                                    : reader->mem.bufferLength;
     
     if (bufferSize > 0) {
         char type = buffer[parsedLength++];
@@ -109,6 +128,13 @@ static void nextValueFromReader(sender_reader* reader, sender_capi_value* out)
                 out->intVal = value;
                 break;
             }
+            case BUFFER_VARINT: {
+                SerializeVarint value;
+                parsedLength += mtmsg_serialize_parse_varint(buffer + parsedLength, &value);
+                out->type = SENDER_CAPI_TYPE_INTEGER;
+                out->intVal = mtmsg_serialize_zigzag_decode(value);
+                break;
+            }
             case BUFFER_NUMBER: {
                 lua_Number value;
                 memcpy(&value, buffer + parsedLength, sizeof(lua_Number));
@@ -117,6 +143,14 @@ static void nextValueFromReader(sender_reader* reader, sender_capi_value* out)
                 out->numVal = value;
                 break;
             }
+            case BUFFER_FLOAT: {
+                float value;
+                memcpy(&value, buffer + parsedLength, sizeof(float));
+                parsedLength += sizeof(float);
+                out->type = SENDER_CAPI_TYPE_NUMBER;
+                out->numVal = value;
+                break;
+            }
             case BUFFER_BOOLEAN: {
                 char b = buffer[parsedLength++];
                 out->type    = SENDER_CAPI_TYPE_BOOLEAN;
@@ -133,6 +167,28 @@ static void nextValueFromReader(sender_reader* reader, sender_capi_value* out)
                 parsedLength += len;
                 break;
             }
+            case BUFFER_VARSTRING: {
+                SerializeVarint len;
+                parsedLength += mtmsg_serialize_parse_varint(buffer + parsedLength, &len);
+                out->type = SENDER_CAPI_TYPE_STRING;
+                out->strVal.ptr = buffer + parsedLength;
+                out->strVal.len = len;
+                parsedLength += len;
+                break;
+            }
+            case BUFFER_STRINGREF: {
+                SerializeVarint index;
+                parsedLength += mtmsg_serialize_parse_varint(buffer + parsedLength, &index);
+                if (!reader->dict || index >= (SerializeVarint)atomic_get(&reader->dict->count)) {
+                    /* invalid string reference: no further values */
+                    parsedLength = bufferSize;
+                    break;
+                }
+                out->type = SENDER_CAPI_TYPE_STRING;
+                out->strVal.ptr = reader->dict->strings[index];
+                out->strVal.len = reader->dict->lengths[index];
+                break;
+            }
             case BUFFER_SMALLSTRING: {
                 size_t len = ((size_t)(buffer[parsedLength++])) & 0xff;
                 out->type = SENDER_CAPI_TYPE_STRING;
@@ -157,12 +213,19 @@ static void nextValueFromReader(sender_reader* reader, sender_capi_value* out)
                 out->funcVal = value;
                 break;
             }
-            case BUFFER_CARRAY: {
+            case BUFFER_CARRAY:
+            case BUFFER_VARCARRAY: {
                 carray_type   carrayType   = (unsigned char)buffer[parsedLength++];
                 unsigned char elementSize  = (unsigned char)buffer[parsedLength++];;
                 size_t        elementCount;
-                memcpy(&elementCount, buffer + parsedLength, sizeof(size_t));
-                parsedLength += sizeof(size_t);
+                if (type == BUFFER_VARCARRAY) {
+                    SerializeVarint count;
+                    parsedLength += mtmsg_serialize_parse_varint(buffer + parsedLength, &count);
+                    elementCount = count;
+                } else {
+                    memcpy(&elementCount, buffer + parsedLength, sizeof(size_t));
+                    parsedLength += sizeof(size_t);
+                }
 
                 sender_array_type arrayType;
                 switch (carrayType) {
@@ -187,10 +250,53 @@ static void nextValueFromReader(sender_reader* reader, sender_capi_value* out)
                 out->arrayVal.elementSize  = elementSize;
                 out->arrayVal.elementCount = elementCount;
                 out->arrayVal.data         = buffer + parsedLength;
+                parsedLength += elementSize * elementCount;
+                break;
+            }
+            case BUFFER_NUMARRAY: {
+                char            packedType = buffer[parsedLength++];
+                SerializeVarint count;
+                parsedLength += mtmsg_serialize_parse_varint(buffer + parsedLength, &count);
+
+                sender_array_type arrayType;
+                size_t            elementSize;
+                switch (packedType) {
+                    case BUFFER_BYTE:   arrayType = SENDER_UCHAR; elementSize = 1; break;
+                    case BUFFER_FLOAT:  arrayType = SENDER_FLOAT; elementSize = sizeof(float); break;
+                    case BUFFER_NUMBER: arrayType = (sizeof(lua_Number) == sizeof(double)) ? SENDER_DOUBLE
+                                                  : (sizeof(lua_Number) == sizeof(float))  ? SENDER_FLOAT : 0;
+                                        elementSize = sizeof(lua_Number); break;
+                #if SENDER_CAPI_HAVE_LONG_LONG
+                    case BUFFER_INTEGER: arrayType = (sizeof(lua_Integer) == sizeof(long)) ? SENDER_LONG 
+                                                   : (sizeof(lua_Integer) == sizeof(long long)) ? SENDER_LLONG
+                                                   : (sizeof(lua_Integer) == sizeof(int)) ? SENDER_INT : 0;
+                                         elementSize = sizeof(lua_Integer); break;
+                #else
+                    case BUFFER_INTEGER: arrayType = (sizeof(lua_Integer) == sizeof(long)) ? SENDER_LONG 
+                                                   : (sizeof(lua_Integer) == sizeof(int)) ? SENDER_INT : 0;
+                                         elementSize = sizeof(lua_Integer); break;
+                #endif
+                    default: arrayType = 0; elementSize = 0; break;
+                }
+                out->type = SENDER_CAPI_TYPE_ARRAY;
+                out->arrayVal.type         = arrayType;
+                out->arrayVal.elementSize  = elementSize;
+                out->arrayVal.elementCount = count;
+                out->arrayVal.data         = buffer + parsedLength;
+                parsedLength += elementSize * count;
+                break;
+            }
+            case BUFFER_TABLE: {
+                /* tables cannot be represented in the sender capi */
+                parsedLength = mtmsg_serialize_skip_value(buffer);
+                out->type = SENDER_CAPI_TYPE_NIL;
                 break;
             }
         }
     }
+    if (reader->msgCount > 0) {
+        reader->msgRemaining -= parsedLength;
+    }
     reader->mem.bufferLength -= parsedLength;
     if (reader->mem.bufferLength == 0) {
         reader->mem.bufferStart = reader->mem.bufferData;
@@ -204,10 +310,13 @@ static int nextMessageFromSender(sender_object* sender, sender_reader* reader,
                                  sender_error_handler eh, void* ehdata)
 {
     MsgBuffer* buffer = (MsgBuffer*)sender;
+    if (reader->msgCount > 0) {
+        clearReader(reader);
+    }
     int rc = mtmsg_buffer_next_msg(NULL /* L */, NULL /* udata */,
                                    buffer, nonblock, 0 /* arg */,
                                    timeoutSeconds, &reader->mem, NULL /* args_size */,
-                                   eh, ehdata);
+                                   &reader->dict, eh, ehdata);
     if (rc >= 0) {
         return (rc > 0) ? 0 : 3; /*  3 - if next message is not available */
     } else {
@@ -215,6 +324,124 @@ static int nextMessageFromSender(sender_object* sender, sender_reader* reader,
     }
 }
 
+static size_t getLength(sender_reader* reader, size_t i)
+{
+    size_t len;
+    memcpy(&len, reader->lengths.bufferStart + i * sizeof(size_t), sizeof(size_t));
+    return len;
+}
+
+static void setLength(sender_reader* reader, size_t i, size_t len)
+{
+    memcpy(reader->lengths.bufferStart + i * sizeof(size_t), &len, sizeof(size_t));
+}
+
+static bool isWrapped(const char* msg, size_t len)
+{
+    return len > 0 && (msg[0] == BUFFER_COMPRESSED || msg[0] == BUFFER_PORTABLE);
+}
+
+/**
+ * Replaces compressed or portable messages in the reader by the natively
+ * encoded messages. Returns 0 or an error code of nextMessagesFromSender().
+ */
+static int unwrapMessages(sender_reader* reader)
+{
+    MemBuffer* mem    = &reader->mem;
+    size_t     offset = 0;
+    size_t     i;
+    for (i = 0; i < reader->msgCount; ++i) {
+        size_t len = getLength(reader, i);
+        if (isWrapped(mem->bufferStart + offset, len)) {
+            break;
+        }
+        offset += len;
+    }
+    if (i == reader->msgCount) {
+        return 0;
+    }
+    /* the remaining messages are copied back one after another */
+    MemBuffer* wrapped = &reader->wrapped;
+    size_t     tail    = mem->bufferLength - offset;
+    wrapped->bufferStart  = wrapped->bufferData;
+    wrapped->bufferLength = 0;
+    if (mtmsg_membuf_reserve(wrapped, tail) != 0) {
+        return 5;
+    }
+    memcpy(wrapped->bufferStart, mem->bufferStart + offset, tail);
+    wrapped->bufferLength = tail;
+    mem->bufferLength     = offset;
+
+    const char* msg = wrapped->bufferStart;
+    for (; i < reader->msgCount; ++i) {
+        size_t len = getLength(reader, i);
+        int    rc  = mtmsg_membuf_reserve(mem, len);
+        if (rc == 0) {
+            memcpy(mem->bufferStart + mem->bufferLength, msg, len);
+            mem->bufferLength += len;
+            if (isWrapped(msg, len)) {
+                rc = mtmsg_serialize_unwrap_msg(mem, offset);
+            }
+        }
+        if (rc != 0) {
+            /* rc = -1 : buffer should not grow */
+            /* rc = -2 : buffer can    not grow */
+            return (rc == -1) ? 4 : (rc == -2) ? 5 : 999;
+        }
+        msg    += len;
+        len     = mem->bufferLength - offset;
+        offset += len;
+        setLength(reader, i, len);
+    }
+    return 0;
+}
+
+static int nextMessagesFromSender(sender_object* sender, sender_reader* reader, 
+                                  int nonblock, double timeoutSeconds,
+                                  size_t maxCount, size_t maxBytes, size_t* count,
+                                  sender_error_handler eh, void* ehdata)
+{
+    MsgBuffer* buffer = (MsgBuffer*)sender;
+    clearReader(reader);
+    reader->lengths.bufferStart  = reader->lengths.bufferData;
+    reader->lengths.bufferLength = 0;
+    *count = 0;
+    int rc = mtmsg_buffer_next_msgs(buffer, nonblock, timeoutSeconds, 
+                                    (maxCount > INT_MAX) ? INT_MAX : (int)maxCount, maxBytes,
+                                    &reader->mem, &reader->lengths, &reader->dict, eh, ehdata);
+    if (rc <= 0) {
+        clearReader(reader);
+        return (rc == 0) ? 3 : -rc; /*  3 - if next message is not available */
+    }
+    reader->msgCount = rc;
+    int rc2 = unwrapMessages(reader);
+    if (rc2 != 0) {
+        clearReader(reader);
+        return rc2;
+    }
+    reader->msgRemaining = getLength(reader, 0);
+    *count = rc;
+    return 0;
+}
+
+static int nextMessageFromReader(sender_reader* reader)
+{
+    if (reader->msgCount == 0) {
+        return 0;
+    }
+    size_t skip = reader->msgRemaining;
+    reader->mem.bufferLength -= skip;
+    reader->mem.bufferStart  += skip;
+    reader->msgIndex += 1;
+    if (reader->msgIndex < reader->msgCount) {
+        reader->msgRemaining = getLength(reader, reader->msgIndex);
+        return 1;
+    } else {
+        clearReader(reader);
+        return 0;
+    }
+}
+
 
 const sender_capi mtmsg_sender_capi_impl =
 {
@@ -233,5 +460,8 @@ const sender_capi mtmsg_sender_capi_impl =
 
     clearReader,
     nextValueFromReader,
-    nextMessageFromSender
+    nextMessageFromSender,
+
+    nextMessagesFromSender,
+    nextMessageFromReader
 };
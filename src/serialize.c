@@ -5,150 +5,1270 @@
 #include "carray_capi.h"
 
 #include "serialize.h"
+#include "compress.h"
+
+/* maximal nesting depth of serialized tables */
+#define MTMSG_SERIALIZE_MAX_DEPTH 100
+
+/* sequences shorter than this are not packed */
+#define MTMSG_SERIALIZE_MIN_PACKED 2
+
+#define MTMSG_SERIALIZE_INVALID ((size_t)-1)
+
+typedef struct TableInfo {
+    size_t arrayCount;  /* number of non-nil values t[1], t[2], ... */
+    size_t hashCount;   /* number of all other key/value pairs */
+    char   packedType;  /* element tag for BUFFER_NUMARRAY or BUFFER_NIL */
+} TableInfo;
+
+static bool isArrayKey(lua_State* L, int index, size_t arrayCount)
+{
+    if (lua_type(L, index) == LUA_TNUMBER && lua_isinteger(L, index)) {
+        lua_Integer key = lua_tointeger(L, index);
+        return 1 <= key && (size_t)key <= arrayCount;
+    }
+    return false;
+}
+
+static size_t packedElementSize(char packedType)
+{
+    switch (packedType) {
+        case BUFFER_BYTE:    return 1;
+        case BUFFER_INTEGER: return sizeof(lua_Integer);
+        case BUFFER_FLOAT:   return sizeof(float);
+        default:             return sizeof(lua_Number);
+    }
+}
+
+static void getTableInfo(lua_State* L, int index, TableInfo* info)
+{
+    bool   allBytes    = true;
+    bool   allIntegers = true;
+    bool   allFloats   = true;  /* all floats and representable as float */
+    bool   allNumbers  = true;
+    bool   anyInteger  = false;
+    bool   anyFloat    = false;
+    size_t n = 0;
+    while (lua_rawgeti(L, index, n + 1) != LUA_TNIL) {
+        if (lua_type(L, -1) != LUA_TNUMBER) {
+            allNumbers = false;
+        }
+        else if (lua_isinteger(L, -1)) {
+            lua_Integer value = lua_tointeger(L, -1);
+            if (value < 0 || value > 0xff) {
+                allBytes = false;
+            }
+            allFloats  = false;
+            anyInteger = true;
+        } 
+        else {
+            if (!mtmsg_serialize_is_float(lua_tonumber(L, -1))) {
+                allFloats = false;
+            }
+            allBytes    = false;
+            allIntegers = false;
+            anyFloat    = true;
+        }
+        lua_pop(L, 1);
+        n += 1;
+    }
+    lua_pop(L, 1);
+    
+    size_t h = 0;
+    lua_pushnil(L);
+    while (lua_next(L, index)) {
+        lua_pop(L, 1);
+        if (!isArrayKey(L, -1, n)) {
+            h += 1;
+        }
+    }
+    info->arrayCount = n;
+    info->hashCount  = h;
+    info->packedType = BUFFER_NIL;
+    /* integers and floats are not mixed, so that their subtypes are kept */
+    if (h == 0 && n >= MTMSG_SERIALIZE_MIN_PACKED && allNumbers && !(anyInteger && anyFloat)) {
+        if (allBytes) {
+            info->packedType = BUFFER_BYTE;
+        } else if (allIntegers) {
+            info->packedType = BUFFER_INTEGER;
+        } else if (allFloats) {
+            info->packedType = BUFFER_FLOAT;
+        } else {
+            info->packedType = BUFFER_NUMBER;
+        }
+    }
+}
+
+/**
+ * Returns MTMSG_SERIALIZE_INVALID if the value at index or a value 
+ * contained in it cannot be serialized.
+ * pathIndex is the stack index of a table containing all tables that are
+ * currently visited for detecting cycles, 0 if not yet created.
+ */
+static size_t calcValueSize(lua_State* L, int index, int arg, int* pathIndex, int depth)
+{
+    int type = lua_type(L, index);
+    switch (type) {
+        case LUA_TNIL: {
+            return MTMSG_ARG_SIZE_NIL; 
+        }
+        case LUA_TNUMBER:  {
+            if (lua_isinteger(L, index)) {
+                lua_Integer value = lua_tointeger(L, index);
+                return mtmsg_serialize_calc_integer_size(value);
+            } else {
+                lua_Number value = lua_tonumber(L, index);
+                return mtmsg_serialize_calc_number_size(value);
+            }
+        }
+        case LUA_TBOOLEAN: {
+            return MTMSG_ARG_SIZE_BOOLEAN; 
+        }
+        case LUA_TSTRING: {
+            size_t len = 0;
+            lua_tolstring(L, index, &len);
+            return mtmsg_serialize_calc_string_size(len);
+        }
+        case LUA_TLIGHTUSERDATA: {
+            return MTMSG_ARG_SIZE_LIGHTUSERDATA;
+        }
+        case LUA_TTABLE: {
+            if (depth >= MTMSG_SERIALIZE_MAX_DEPTH) {
+                return luaL_argerror(L, arg, "table nesting too deep");
+            }
+            luaL_checkstack(L, LUA_MINSTACK, NULL);
+            if (*pathIndex == 0) {
+                lua_newtable(L);
+                *pathIndex = lua_gettop(L);
+            }
+            lua_pushvalue(L, index);
+            if (lua_rawget(L, *pathIndex) != LUA_TNIL) {
+                return luaL_argerror(L, arg, "cyclic table");
+            }
+            lua_pop(L, 1);
+            
+            TableInfo info;
+            getTableInfo(L, index, &info);
+            size_t rslt;
+            if (info.packedType != BUFFER_NIL) {
+                rslt = 1 + 1 + mtmsg_serialize_calc_varint_size(info.arrayCount)
+                             + info.arrayCount * packedElementSize(info.packedType);
+            } else {
+                lua_pushvalue(L, index);
+                lua_pushboolean(L, true);
+                lua_rawset(L, *pathIndex);
+                
+                rslt = 1 + mtmsg_serialize_calc_varint_size(info.arrayCount)
+                         + mtmsg_serialize_calc_varint_size(info.hashCount);
+                size_t i;
+                for (i = 1; i <= info.arrayCount; ++i) {
+                    lua_rawgeti(L, index, i);
+                    size_t s = calcValueSize(L, lua_gettop(L), arg, pathIndex, depth + 1);
+                    lua_pop(L, 1);
+                    if (s == MTMSG_SERIALIZE_INVALID) {
+                        return s;
+                    }
+                    rslt += s;
+                }
+                lua_pushnil(L);
+                while (lua_next(L, index)) {
+                    int valueIndex = lua_gettop(L);
+                    if (!isArrayKey(L, valueIndex - 1, info.arrayCount)) {
+                        size_t s1 = calcValueSize(L, valueIndex - 1, arg, pathIndex, depth + 1);
+                        size_t s2 = calcValueSize(L, valueIndex,     arg, pathIndex, depth + 1);
+                        if (s1 == MTMSG_SERIALIZE_INVALID || s2 == MTMSG_SERIALIZE_INVALID) {
+                            lua_pop(L, 2);
+                            return MTMSG_SERIALIZE_INVALID;
+                        }
+                        rslt += s1 + s2;
+                    }
+                    lua_pop(L, 1);
+                }
+                lua_pushvalue(L, index);
+                lua_pushnil(L);
+                lua_rawset(L, *pathIndex);
+            }
+            return rslt;
+        }
+        case LUA_TFUNCTION: {
+            if (lua_iscfunction(L, index)) {
+                return MTMSG_ARG_SIZE_CFUNCTION;
+            }
+        }
+        /* FALLTHROUGH */
+        case LUA_TUSERDATA: {
+            int errorReason;
+            const carray_capi* carrayCapi = carray_get_capi(L, index, &errorReason);
+            if (carrayCapi) {
+                carray_info info;
+                const carray* a = carrayCapi->toReadableCarray(L, index, &info);
+                if (a) {
+                    return mtmsg_serialize_calc_carray_size(&info);
+                } else {
+                    /* FALLTHROUGH */
+                }
+            } else if (errorReason == 1) {
+                return luaL_argerror(L, arg, "carray version mismatch");
+            } else {
+                /* FALLTHROUGH */
+            }
+        }
+
+        /* FALLTHROUGH */
+        case LUA_TTHREAD:
+        default: {
+            return MTMSG_SERIALIZE_INVALID;
+        }
+    }
+}
 
 size_t mtmsg_serialize_calc_args_size(lua_State* L, int firstArg, int* errorArg)
 {
     size_t rslt = MTMSG_ARG_SIZE_INITIAL;
     int n = lua_gettop(L);
+    int pathIndex = 0;
     int i;
     for (i = firstArg; i <= n; ++i)
     {
-        int type = lua_type(L, i);
-        switch (type) {
-            case LUA_TNIL: {
-                rslt += MTMSG_ARG_SIZE_NIL; 
-                break;
-            }
-            case LUA_TNUMBER:  {
-                if (lua_isinteger(L, i)) {
-                    lua_Integer value = lua_tointeger(L, i);
-                    rslt += mtmsg_serialize_calc_integer_size(value);
-                } else {
-                    rslt += MTMSG_ARG_SIZE_NUMBER;
-                }
-                break;
+        size_t s = calcValueSize(L, i, i, &pathIndex, 0);
+        if (s == MTMSG_SERIALIZE_INVALID) {
+            *errorArg = i;
+            lua_settop(L, n);
+            return -1;
+        }
+        rslt += s;
+    }
+    lua_settop(L, n);
+    return rslt;
+}
+
+static AtomicCounter dict_counter = 0;
+
+MsgDict* mtmsg_dict_new()
+{
+    MsgDict* dict = malloc(sizeof(MsgDict));
+    if (dict) {
+        memset(dict, 0, sizeof(MsgDict));
+        dict->used = 1;
+        dict->id   = atomic_inc(&dict_counter);
+    }
+    return dict;
+}
+
+void mtmsg_dict_release(MsgDict* dict)
+{
+    if (dict && atomic_dec(&dict->used) == 0) {
+        int count = atomic_get(&dict->count);
+        int i;
+        for (i = 0; i < count; ++i) {
+            free(dict->strings[i]);
+        }
+        free(dict);
+    }
+}
+
+/**
+ * Returns the index of the given string in the dictionary, the string is 
+ * added if not found. Returns -1 if the string is not suitable or if the
+ * dictionary is full. Must be called under the buffer's lock.
+ */
+int mtmsg_dict_lookup(MsgDict* dict, const char* str, size_t len)
+{
+    if (len < MTMSG_DICT_MIN_STRLEN || len > MTMSG_DICT_MAX_STRLEN) {
+        return -1;
+    }
+    unsigned int h = 2166136261u;
+    size_t i;
+    for (i = 0; i < len; ++i) {
+        h = (h ^ (unsigned char)str[i]) * 16777619u;
+    }
+    size_t p = h % MTMSG_DICT_HASH_SIZE;
+    while (dict->hash[p] != 0) {
+        int index = dict->hash[p] - 1;
+        if (dict->lengths[index] == len && memcmp(dict->strings[index], str, len) == 0) {
+            return index;
+        }
+        p = (p + 1) % MTMSG_DICT_HASH_SIZE;
+    }
+    int index = atomic_get(&dict->count);
+    if (index >= MTMSG_DICT_MAX_ENTRIES) {
+        return -1;
+    }
+    char* copy = malloc(len);
+    if (!copy) {
+        return -1;
+    }
+    memcpy(copy, str, len);
+    dict->strings[index] = copy;
+    dict->lengths[index] = len;
+    dict->hash[p]        = index + 1;
+    atomic_set(&dict->count, index + 1); /* publishes the entry to readers without lock */
+    return index;
+}
+
+static char* valueToBuffer(lua_State* L, int index, char* buffer, MsgDict* dict)
+{
+    int type = lua_type(L, index);
+    switch (type) {
+        case LUA_TNIL: {
+            *buffer++ = BUFFER_NIL;
+            break;
+        }
+        case LUA_TNUMBER:  {
+            if (lua_isinteger(L, index)) {
+                lua_Integer value = lua_tointeger(L, index);
+                buffer = mtmsg_serialize_integer_to_buffer(value, buffer);
+            } else {
+                lua_Number value = lua_tonumber(L, index);
+                buffer = mtmsg_serialize_number_to_buffer(value, buffer);
             }
-            case LUA_TBOOLEAN: {
-                rslt += MTMSG_ARG_SIZE_BOOLEAN; 
-                break;
+            break;
+        }
+        case LUA_TBOOLEAN: {
+            buffer = mtmsg_serialize_boolean_to_buffer(lua_toboolean(L, index), buffer);
+            break;
+        }
+        case LUA_TSTRING: {
+            size_t      len     = 0;
+            const char* content = lua_tolstring(L, index, &len);
+            int         ref     = dict ? mtmsg_dict_lookup(dict, content, len) : -1;
+            if (ref >= 0) {
+                *buffer++ = BUFFER_STRINGREF;
+                buffer = mtmsg_serialize_varint_to_buffer(ref, buffer);
+            } else {
+                buffer = mtmsg_serialize_string_to_buffer(content, len, buffer);
             }
-            case LUA_TSTRING: {
-                size_t len = 0;
-                lua_tolstring(L, i, &len);
-                rslt += mtmsg_serialize_calc_string_size(len);
-                break;
+            break;
+        }
+        case LUA_TLIGHTUSERDATA: {
+            void* value = lua_touserdata(L, index);
+            buffer = mtmsg_serialize_lightuserdata_to_buffer(value, buffer);
+            break;
+        }
+        case LUA_TTABLE: {
+            TableInfo info;
+            getTableInfo(L, index, &info);
+            size_t i;
+            if (info.packedType != BUFFER_NIL) {
+                *buffer++ = BUFFER_NUMARRAY;
+                *buffer++ = info.packedType;
+                buffer = mtmsg_serialize_varint_to_buffer(info.arrayCount, buffer);
+                for (i = 1; i <= info.arrayCount; ++i) {
+                    lua_rawgeti(L, index, i);
+                    switch (info.packedType) {
+                        case BUFFER_BYTE: {
+                            *buffer++ = (char)lua_tointeger(L, -1);
+                            break;
+                        }
+                        case BUFFER_INTEGER: {
+                            lua_Integer value = lua_tointeger(L, -1);
+                            memcpy(buffer, &value, sizeof(lua_Integer));
+                            buffer += sizeof(lua_Integer);
+                            break;
+                        }
+                        case BUFFER_FLOAT: {
+                            float value = (float)lua_tonumber(L, -1);
+                            memcpy(buffer, &value, sizeof(float));
+                            buffer += sizeof(float);
+                            break;
+                        }
+                        default: {
+                            lua_Number value = lua_tonumber(L, -1);
+                            memcpy(buffer, &value, sizeof(lua_Number));
+                            buffer += sizeof(lua_Number);
+                            break;
+                        }
+                    }
+                    lua_pop(L, 1);
+                }
+            } else {
+                luaL_checkstack(L, LUA_MINSTACK, NULL);
+                *buffer++ = BUFFER_TABLE;
+                buffer = mtmsg_serialize_varint_to_buffer(info.arrayCount, buffer);
+                buffer = mtmsg_serialize_varint_to_buffer(info.hashCount,  buffer);
+                for (i = 1; i <= info.arrayCount; ++i) {
+                    lua_rawgeti(L, index, i);
+                    buffer = valueToBuffer(L, lua_gettop(L), buffer, dict);
+                    lua_pop(L, 1);
+                }
+                lua_pushnil(L);
+                while (lua_next(L, index)) {
+                    int valueIndex = lua_gettop(L);
+                    if (!isArrayKey(L, valueIndex - 1, info.arrayCount)) {
+                        buffer = valueToBuffer(L, valueIndex - 1, buffer, dict);
+                        buffer = valueToBuffer(L, valueIndex,     buffer, dict);
+                    }
+                    lua_pop(L, 1);
+                }
             }
-            case LUA_TLIGHTUSERDATA: {
-                rslt += MTMSG_ARG_SIZE_LIGHTUSERDATA;
+            break;
+        }
+        case LUA_TFUNCTION: {
+            lua_CFunction func = lua_tocfunction(L, index);
+            if (func) {
+                buffer = mtmsg_serialize_cfunction_to_buffer(func, buffer);
                 break;
             }
-            case LUA_TFUNCTION: {
-                if (lua_iscfunction(L, i)) {
-                    rslt += MTMSG_ARG_SIZE_CFUNCTION;
+        }
+        /* FALLTHROUGH */
+        case LUA_TUSERDATA: {
+            int errorReason;
+            const carray_capi* carrayCapi = carray_get_capi(L, index, &errorReason);
+            if (carrayCapi) {
+                carray_info info;
+                const carray* a = carrayCapi->toReadableCarray(L, index, &info);
+                if (a) {
+                    const void* data= carrayCapi->getReadableElementPtr(a, 0, info.elementCount);
+                    buffer = mtmsg_serialize_carray_to_buffer(&info, data, buffer);
                     break;
                 }
-            } 
-            case LUA_TUSERDATA: {
-                int errorReason;
-                const carray_capi* carrayCapi = carray_get_capi(L, i, &errorReason);
-                if (carrayCapi) {
-                    carray_info info;
-                    const carray* a = carrayCapi->toReadableCarray(L, i, &info);
-                    if (a) {
-                        rslt += mtmsg_serialize_calc_carray_size(&info);
-                        break;
-                    } else {
-                        /* FALLTHROUGH */
-                    }
-                } else if (errorReason == 1) {
-                    return luaL_argerror(L, i, "carray version mismatch");
-                } else {
-                    /* FALLTHROUGH */
-                }
-            }
-
-            /* FALLTHROUGH */
-            case LUA_TTABLE:
-            case LUA_TTHREAD:
-            default: {
-                *errorArg = i;
-                return -1;
             }
         }
+        default: {
+            break;
+        }
     }
-    return rslt;
+    return buffer;
 }
 
-void mtmsg_serialize_args_to_buffer(lua_State* L, int firstArg, char* buffer)
+/**
+ * Returns the end of the serialized arguments. If a dictionary is given, 
+ * the result may be shorter than calculated by mtmsg_serialize_calc_args_size().
+ */
+char* mtmsg_serialize_args_to_buffer(lua_State* L, int firstArg, char* buffer, MsgDict* dict)
 {
     int    n = lua_gettop(L);
     int    i;
 
     for (i = firstArg; i <= n; ++i)
     {
-        int type = lua_type(L, i);
-        switch (type) {
-            case LUA_TNIL: {
-                *buffer++ = BUFFER_NIL;
-                break;
+        buffer = valueToBuffer(L, i, buffer, dict);
+    }
+    return buffer;
+}
+
+/**
+ * Replaces a compressed message at mem->bufferStart + offset until the end 
+ * of mem by the uncompressed message. Returns 0 on success or if the message
+ * is not compressed, -1 or -2 if mem cannot grow (see mtmsg_membuf_reserve) 
+ * and -3 if the compressed data is corrupt.
+ */
+static int uncompressMsg(MemBuffer* mem, size_t offset)
+{
+    size_t len = mem->bufferLength - offset;
+    if (len == 0 || mem->bufferStart[offset] != BUFFER_COMPRESSED) {
+        return 0;
+    }
+    size_t n = 0;
+    do {
+        if (n >= MTMSG_SERIALIZE_MAX_VARINT_SIZE || 1 + n >= len) {
+            return -3;
+        }
+    } while (((unsigned char)mem->bufferStart[offset + 1 + n++]) & 0x80);
+
+    SerializeVarint rawSize;
+    size_t h = 1 + mtmsg_serialize_parse_varint(mem->bufferStart + offset + 1, &rawSize);
+    if (h == 1 || rawSize > 256 * (SerializeVarint)(len - h) + 64) {
+        /* more than the data can expand to */
+        return -3;
+    }
+    int rc = mtmsg_membuf_reserve(mem, rawSize);
+    if (rc != 0) {
+        return rc;
+    }
+    char* msg = mem->bufferStart + offset;
+    char* raw = mem->bufferStart + mem->bufferLength;
+    if (!mtmsg_decompress(msg + h, len - h, raw, rawSize)) {
+        return -3;
+    }
+    memmove(msg, raw, rawSize);
+    mem->bufferLength = offset + rawSize;
+    return 0;
+}
+
+/* element sizes of carray types in portable encoding, 0 for unknown types */
+static const unsigned char portableCarraySizes[] = { 0, 1, 1, 2, 2, 4, 4, 8, 8, 4, 8, 8, 8 };
+
+static size_t nativeCarraySize(int elementType)
+{
+    switch (elementType) {
+        case CARRAY_UCHAR:
+        case CARRAY_SCHAR:  return sizeof(char);
+        case CARRAY_SHORT:
+        case CARRAY_USHORT: return sizeof(short);
+        case CARRAY_INT:
+        case CARRAY_UINT:   return sizeof(int);
+        case CARRAY_LONG:
+        case CARRAY_ULONG:  return sizeof(long);
+        case CARRAY_FLOAT:  return sizeof(float);
+        case CARRAY_DOUBLE: return sizeof(double);
+#if CARRAY_CAPI_HAVE_LONG_LONG
+        case CARRAY_LLONG:
+        case CARRAY_ULLONG: return sizeof(long long);
+#endif
+        default:            return 0;
+    }
+}
+
+static bool isSignedCarray(int elementType)
+{
+    return elementType == CARRAY_SCHAR || elementType == CARRAY_SHORT 
+        || elementType == CARRAY_INT   || elementType == CARRAY_LONG
+#if CARRAY_CAPI_HAVE_LONG_LONG
+        || elementType == CARRAY_LLONG
+#endif
+        ;
+}
+
+static uint64_t loadUInt(const char* in, size_t n, bool littleEndian)
+{
+    uint64_t v = 0;
+    size_t   i;
+    for (i = 0; i < n; ++i) {
+        unsigned char c = (unsigned char)in[littleEndian ? i : n - 1 - i];
+        v |= ((uint64_t)c) << (8 * i);
+    }
+    return v;
+}
+
+static void storeUInt(uint64_t v, char* out, size_t n, bool littleEndian)
+{
+    size_t i;
+    for (i = 0; i < n; ++i) {
+        out[littleEndian ? i : n - 1 - i] = (char)(v >> (8 * i));
+    }
+}
+
+static uint64_t signExtend(uint64_t v, size_t n)
+{
+    if (n < 8 && ((v >> (8 * n - 1)) & 1)) {
+        v |= ~(uint64_t)0 << (8 * n);
+    }
+    return v;
+}
+
+/* Returns true if v (sign extended if isSigned) can be stored with n bytes. */
+static bool fitsInto(uint64_t v, size_t n, bool isSigned)
+{
+    if (n >= 8) {
+        return true;
+    }
+    uint64_t truncated = v & ~(~(uint64_t)0 << (8 * n));
+    return (isSigned ? signExtend(truncated, n) : truncated) == v;
+}
+
+/* Reverses the byte order of count elements. The loops are kept simple
+ * so that compilers can turn them into vectorized byte shuffles. */
+static void swapElements(const char* in, char* out, size_t elementSize, size_t count)
+{
+    size_t i;
+    switch (elementSize) {
+        case 2: {
+            for (i = 0; i < count; ++i) {
+                uint16_t v; memcpy(&v, in + 2 * i, 2);
+                v = (uint16_t)((v >> 8) | (v << 8));
+                memcpy(out + 2 * i, &v, 2);
             }
-            case LUA_TNUMBER:  {
-                if (lua_isinteger(L, i)) {
-                    lua_Integer value = lua_tointeger(L, i);
-                    buffer = mtmsg_serialize_integer_to_buffer(value, buffer);
-                } else {
-                    lua_Number value = lua_tonumber(L, i);
-                    buffer = mtmsg_serialize_number_to_buffer(value, buffer);
+            break;
+        }
+        case 4: {
+            for (i = 0; i < count; ++i) {
+                uint32_t v; memcpy(&v, in + 4 * i, 4);
+                v = ((v >> 24) & 0xff) | ((v >> 8) & 0xff00) | ((v & 0xff00) << 8) | (v << 24);
+                memcpy(out + 4 * i, &v, 4);
+            }
+            break;
+        }
+        default: {
+            for (i = 0; i < count; ++i) {
+                size_t j;
+                for (j = 0; j < elementSize; ++j) {
+                    out[elementSize * i + j] = in[elementSize * (i + 1) - 1 - j];
                 }
-                break;
             }
-            case LUA_TBOOLEAN: {
-                buffer = mtmsg_serialize_boolean_to_buffer(lua_toboolean(L, i), buffer);
-                break;
+            break;
+        }
+    }
+}
+
+/**
+ * Converts count integer or floating point elements between native and 
+ * portable representation. Returns false if a value does not fit into
+ * the target size.
+ */
+static bool convertElements(const char* in, size_t inSize, char* out, size_t outSize, 
+                            size_t count, bool isSigned, bool toPortable)
+{
+    bool littleEndian = mtmsg_serialize_is_little_endian();
+    if (inSize == outSize) {
+        if (littleEndian || inSize == 1) {
+            memcpy(out, in, inSize * count);
+        } else {
+            swapElements(in, out, inSize, count);
+        }
+        return true;
+    }
+    if (inSize > 8 || outSize > 8) {
+        return false;
+    }
+    size_t i;
+    for (i = 0; i < count; ++i) {
+        uint64_t v = loadUInt(in + inSize * i, inSize, toPortable ? littleEndian : true);
+        if (isSigned) {
+            v = signExtend(v, inSize);
+        }
+        if (!fitsInto(v, outSize, isSigned)) {
+            return false;
+        }
+        storeUInt(v, out + outSize * i, outSize, toPortable ? true : littleEndian);
+    }
+    return true;
+}
+
+/* Converts one lua_Number between native and portable (double) representation. */
+static bool convertNumber(const char* in, char* out, bool toPortable)
+{
+    if (sizeof(double) != 8) {
+        return false;
+    }
+    if (toPortable) {
+        lua_Number n; memcpy(&n, in, sizeof(lua_Number));
+        double     d = (double)n;
+        uint64_t   bits; memcpy(&bits, &d, 8);
+        storeUInt(bits, out, 8, true);
+    } else {
+        uint64_t   bits = loadUInt(in, 8, true);
+        double     d; memcpy(&d, &bits, 8);
+        lua_Number n = (lua_Number)d;
+        memcpy(out, &n, sizeof(lua_Number));
+    }
+    return true;
+}
+
+typedef struct PortableConv {
+    const char* in;
+    const char* end;
+    char*       out;
+    bool        toPortable;
+} PortableConv;
+
+static bool hasInput(PortableConv* c, size_t n)
+{
+    return (size_t)(c->end - c->in) >= n;
+}
+
+static bool copyInput(PortableConv* c, size_t n)
+{
+    if (!hasInput(c, n)) {
+        return false;
+    }
+    memcpy(c->out, c->in, n);
+    c->in  += n;
+    c->out += n;
+    return true;
+}
+
+static bool parseVarint(PortableConv* c, SerializeVarint* value)
+{
+    size_t n = 0;
+    do {
+        if (n >= MTMSG_SERIALIZE_MAX_VARINT_SIZE || !hasInput(c, n + 1)) {
+            return false;
+        }
+    } while (((unsigned char)c->in[n++]) & 0x80);
+    n = mtmsg_serialize_parse_varint(c->in, value);
+    c->in += n;
+    return n > 0;
+}
+
+static bool copyVarint(PortableConv* c, SerializeVarint* value)
+{
+    const char* start = c->in;
+    if (!parseVarint(c, value)) {
+        return false;
+    }
+    memcpy(c->out, start, c->in - start);
+    c->out += c->in - start;
+    return true;
+}
+
+static bool convertElementArray(PortableConv* c, size_t inSize, size_t outSize, 
+                                SerializeVarint count, bool isSigned)
+{
+    if (inSize == 0 || count > (size_t)(c->end - c->in) / inSize || outSize > 2 * inSize) {
+        return false;
+    }
+    if (!convertElements(c->in, inSize, c->out, outSize, count, isSigned, c->toPortable)) {
+        return false;
+    }
+    c->in  += inSize  * count;
+    c->out += outSize * count;
+    return true;
+}
+
+/**
+ * Converts the serialized value at c->in between native and portable encoding. 
+ * Returns false if the value cannot be represented in the target encoding or 
+ * if the input is malformed. The output is at most twice as large as the input.
+ */
+static bool convertValue(PortableConv* c, int depth)
+{
+    if (!hasInput(c, 1)) {
+        return false;
+    }
+    char type = *c->in++;
+    switch (type) {
+        case BUFFER_NIL: {
+            *c->out++ = type;
+            return true;
+        }
+        case BUFFER_BOOLEAN:
+        case BUFFER_BYTE: {
+            *c->out++ = type;
+            return copyInput(c, 1);
+        }
+        case BUFFER_VARINT: {
+            *c->out++ = type;
+            SerializeVarint value;
+            if (!copyVarint(c, &value)) {
+                return false;
             }
-            case LUA_TSTRING: {
-                size_t      len     = 0;
-                const char* content = lua_tolstring(L, i, &len);
-                buffer = mtmsg_serialize_string_to_buffer(content, len, buffer);
-                break;
+            return c->toPortable || sizeof(lua_Integer) >= 8
+                || fitsInto((uint64_t)mtmsg_serialize_zigzag_decode(value), sizeof(lua_Integer), true);
+        }
+        case BUFFER_SMALLSTRING: {
+            *c->out++ = type;
+            if (!hasInput(c, 1)) {
+                return false;
             }
-            case LUA_TLIGHTUSERDATA: {
-                void* value = lua_touserdata(L, i);
-                buffer = mtmsg_serialize_lightuserdata_to_buffer(value, buffer);
-                break;
+            size_t len = ((size_t)(*c->in)) & 0xff;
+            return copyInput(c, 1 + len);
+        }
+        case BUFFER_VARSTRING: {
+            *c->out++ = type;
+            SerializeVarint len;
+            return copyVarint(c, &len) && len <= (size_t)(c->end - c->in) && copyInput(c, len);
+        }
+        case BUFFER_STRING: {
+            size_t len;
+            if (!c->toPortable || !hasInput(c, sizeof(size_t))) {
+                return false;
             }
-            case LUA_TFUNCTION: {
-                lua_CFunction func = lua_tocfunction(L, i);
-                if (func) {
-                    buffer = mtmsg_serialize_cfunction_to_buffer(func, buffer);
-                    break;
+            memcpy(&len, c->in, sizeof(size_t));
+            c->in += sizeof(size_t);
+            *c->out++ = BUFFER_VARSTRING;
+            c->out = mtmsg_serialize_varint_to_buffer(len, c->out);
+            return len <= (size_t)(c->end - c->in) && copyInput(c, len);
+        }
+        case BUFFER_INTEGER: {
+            size_t inSize  = c->toPortable ? sizeof(lua_Integer) : 8;
+            size_t outSize = c->toPortable ? 8 : sizeof(lua_Integer);
+            *c->out++ = type;
+            return convertElementArray(c, inSize, outSize, 1, true);
+        }
+        case BUFFER_FLOAT: {
+            *c->out++ = type;
+            return convertElementArray(c, sizeof(float), 4, 1, false);
+        }
+        case BUFFER_NUMBER: {
+            size_t inSize  = c->toPortable ? sizeof(lua_Number) : 8;
+            size_t outSize = c->toPortable ? 8 : sizeof(lua_Number);
+            *c->out++ = type;
+            if (!hasInput(c, inSize) || !convertNumber(c->in, c->out, c->toPortable)) {
+                return false;
+            }
+            c->in  += inSize;
+            c->out += outSize;
+            return true;
+        }
+        case BUFFER_CARRAY:
+        case BUFFER_VARCARRAY: {
+            if (!hasInput(c, 2)) {
+                return false;
+            }
+            int    elementType = (unsigned char)c->in[0];
+            size_t elementSize = (unsigned char)c->in[1];
+            c->in += 2;
+            SerializeVarint count;
+            if (type == BUFFER_VARCARRAY) {
+                if (!parseVarint(c, &count)) {
+                    return false;
+                }
+            } else {
+                size_t n;
+                if (!c->toPortable || !hasInput(c, sizeof(size_t))) {
+                    return false;
                 }
+                memcpy(&n, c->in, sizeof(size_t));
+                c->in += sizeof(size_t);
+                count = n;
             }
-            case LUA_TUSERDATA: {
-                int errorReason;
-                const carray_capi* carrayCapi = carray_get_capi(L, i, &errorReason);
-                if (carrayCapi) {
-                    carray_info info;
-                    const carray* a = carrayCapi->toReadableCarray(L, i, &info);
-                    if (a) {
-                        const void* data= carrayCapi->getReadableElementPtr(a, 0, info.elementCount);
-                        buffer = mtmsg_serialize_carray_to_buffer(&info, data, buffer);
-                        break;
-                    } else {
-                        /* FALLTHROUGH */
+            size_t nativeSize   = nativeCarraySize(elementType);
+            size_t portableSize = portableCarraySizes[nativeSize ? elementType : 0];
+            if (   nativeSize == 0 || elementSize != (c->toPortable ? nativeSize : portableSize)
+                || ((elementType == CARRAY_FLOAT || elementType == CARRAY_DOUBLE) && nativeSize != portableSize)) 
+            {
+                return false;
+            }
+            size_t outSize = c->toPortable ? portableSize : nativeSize;
+            *c->out++ = BUFFER_VARCARRAY;
+            *c->out++ = (char)elementType;
+            *c->out++ = (char)outSize;
+            c->out = mtmsg_serialize_varint_to_buffer(count, c->out);
+            return convertElementArray(c, elementSize, outSize, count, isSignedCarray(elementType));
+        }
+        case BUFFER_TABLE: {
+            SerializeVarint arrayCount;
+            SerializeVarint hashCount;
+            SerializeVarint i;
+            if (depth >= MTMSG_SERIALIZE_MAX_DEPTH) {
+                return false;
+            }
+            *c->out++ = type;
+            if (!copyVarint(c, &arrayCount) || !copyVarint(c, &hashCount)
+                || arrayCount > (size_t)(c->end - c->in) || hashCount > (size_t)(c->end - c->in)) {
+                return false;
+            }
+            for (i = 0; i < arrayCount + 2 * hashCount; ++i) {
+                if (!convertValue(c, depth + 1)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        case BUFFER_NUMARRAY: {
+            if (!hasInput(c, 1)) {
+                return false;
+            }
+            char packedType = *c->in++;
+            SerializeVarint count;
+            *c->out++ = type;
+            *c->out++ = packedType;
+            if (!copyVarint(c, &count)) {
+                return false;
+            }
+            switch (packedType) {
+                case BUFFER_BYTE: {
+                    return count <= (size_t)(c->end - c->in) && copyInput(c, count);
+                }
+                case BUFFER_INTEGER: {
+                    size_t inSize  = c->toPortable ? sizeof(lua_Integer) : 8;
+                    size_t outSize = c->toPortable ? 8 : sizeof(lua_Integer);
+                    return convertElementArray(c, inSize, outSize, count, true);
+                }
+                case BUFFER_FLOAT: {
+                    return convertElementArray(c, sizeof(float), 4, count, false);
+                }
+                case BUFFER_NUMBER: {
+                    size_t inSize  = c->toPortable ? sizeof(lua_Number) : 8;
+                    size_t outSize = c->toPortable ? 8 : sizeof(lua_Number);
+                    if (inSize == outSize && sizeof(lua_Number) == sizeof(double)) {
+                        return convertElementArray(c, inSize, outSize, count, false);
                     }
-                } else if (errorReason == 1) {
-                    luaL_argerror(L, i, "carray version mismatch");
-                    return;
-                } else {
-                    /* FALLTHROUGH */
+                    if (count > (size_t)(c->end - c->in) / inSize) {
+                        return false;
+                    }
+                    SerializeVarint i;
+                    for (i = 0; i < count; ++i) {
+                        if (!convertNumber(c->in, c->out, c->toPortable)) {
+                            return false;
+                        }
+                        c->in  += inSize;
+                        c->out += outSize;
+                    }
+                    return true;
+                }
+                default: {
+                    return false;
                 }
             }
-            default: {
+        }
+        default: {
+            /* string references, pointers and nested messages are not portable */
+            return false;
+        }
+    }
+}
+
+/**
+ * Converts the natively serialized arguments into the portable encoding. 
+ * out must have room for mtmsg_serialize_calc_portable_bound(len) bytes.
+ * Returns the size of the portable message or 0 if the arguments contain 
+ * values that cannot be represented portably.
+ */
+size_t mtmsg_serialize_to_portable(const char* args, size_t len, char* out)
+{
+    PortableConv c; c.in         = args;
+                    c.end        = args + len;
+                    c.out        = out;
+                    c.toPortable = true;
+    *c.out++ = BUFFER_PORTABLE;
+    *c.out++ = MTMSG_PORTABLE_VERSION;
+    while (c.in < c.end) {
+        if (!convertValue(&c, 0)) {
+            return 0;
+        }
+    }
+    return c.out - out;
+}
+
+/**
+ * Replaces a portable message at mem->bufferStart + offset until the end 
+ * of mem by its native encoding. Returns 0 on success, -1 or -2 if mem 
+ * cannot grow and -4 if the message is malformed or cannot be represented 
+ * on this platform.
+ */
+static int portableToNative(MemBuffer* mem, size_t offset)
+{
+    size_t len = mem->bufferLength - offset;
+    if (len < 2 || mem->bufferStart[offset + 1] != MTMSG_PORTABLE_VERSION) {
+        return -4;
+    }
+    int rc = mtmsg_membuf_reserve(mem, 2 * len);
+    if (rc != 0) {
+        return rc;
+    }
+    char* msg = mem->bufferStart + offset;
+    PortableConv c; c.in         = msg + 2;
+                    c.end        = msg + len;
+                    c.out        = mem->bufferStart + mem->bufferLength;
+                    c.toPortable = false;
+    char* raw = c.out;
+    while (c.in < c.end) {
+        if (!convertValue(&c, 0)) {
+            return -4;
+        }
+    }
+    memmove(msg, raw, c.out - raw);
+    mem->bufferLength = offset + (c.out - raw);
+    return 0;
+}
+
+/**
+ * Replaces a compressed and/or portable message at mem->bufferStart + offset 
+ * until the end of mem by the natively encoded message. Returns 0 on success or 
+ * if the message is neither compressed nor portable, -1 or -2 if mem cannot grow 
+ * (see mtmsg_membuf_reserve), -3 if the compressed data is corrupt and -4 if 
+ * the portable message is invalid.
+ */
+int mtmsg_serialize_unwrap_msg(MemBuffer* mem, size_t offset)
+{
+    int rc = uncompressMsg(mem, offset);
+    if (rc == 0 && mem->bufferLength > offset && mem->bufferStart[offset] == BUFFER_PORTABLE) {
+        rc = portableToNative(mem, offset);
+    }
+    return rc;
+}
+
+/**
+ * Returns the number of complete framed messages at the beginning of buffer,
+ * completeLength is set to their total size.
+ */
+int mtmsg_serialize_count_complete_msgs(const char* buffer, size_t len, size_t* completeLength)
+{
+    int    count = 0;
+    size_t p     = 0;
+    while (p < len) {
+        char   header[1 + sizeof(size_t) + 10] = { 0 };
+        size_t avail = len - p;
+        memcpy(header, buffer + p, avail < sizeof(header) ? avail : sizeof(header));
+
+        SerializedMsgSizes sizes;
+        mtmsg_serialize_parse_header(header, &sizes);
+        if (sizes.header_size > avail || sizes.args_size > avail - sizes.header_size) {
+            break;
+        }
+        p     += sizes.header_size + sizes.args_size;
+        count += 1;
+    }
+    *completeLength = p;
+    return count;
+}
+
+/**
+ * Returns the number of framed messages in buffer or -1 if the data does 
+ * not consist of complete messages.
+ */
+int mtmsg_serialize_count_msgs(const char* buffer, size_t len)
+{
+    size_t completeLength;
+    int    count = mtmsg_serialize_count_complete_msgs(buffer, len, &completeLength);
+    return (completeLength == len) ? count : -1;
+}
+
+static bool skipInput(PortableConv* c, SerializeVarint n)
+{
+    if (n > (size_t)(c->end - c->in)) {
+        return false;
+    }
+    c->in += n;
+    return true;
+}
+
+/**
+ * Checks that the natively serialized value at c->in does not exceed c->end
+ * and does not contain values that are only valid in the process that 
+ * serialized them, i.e. pointers and string references.
+ */
+static bool checkValue(PortableConv* c, int depth)
+{
+    if (!hasInput(c, 1)) {
+        return false;
+    }
+    char type = *c->in++;
+    switch (type) {
+        case BUFFER_NIL:     return true;
+        case BUFFER_BOOLEAN:
+        case BUFFER_BYTE:    return skipInput(c, 1);
+        case BUFFER_INTEGER: return skipInput(c, sizeof(lua_Integer));
+        case BUFFER_NUMBER:  return skipInput(c, sizeof(lua_Number));
+        case BUFFER_FLOAT:   return skipInput(c, sizeof(float));
+        case BUFFER_VARINT: {
+            SerializeVarint value;
+            return parseVarint(c, &value);
+        }
+        case BUFFER_SMALLSTRING: {
+            return hasInput(c, 1) && skipInput(c, 1 + (((size_t)(*c->in)) & 0xff));
+        }
+        case BUFFER_VARSTRING: {
+            SerializeVarint len;
+            return parseVarint(c, &len) && skipInput(c, len);
+        }
+        case BUFFER_STRING: {
+            size_t len;
+            if (!hasInput(c, sizeof(size_t))) {
+                return false;
+            }
+            memcpy(&len, c->in, sizeof(size_t));
+            c->in += sizeof(size_t);
+            return skipInput(c, len);
+        }
+        case BUFFER_CARRAY:
+        case BUFFER_VARCARRAY: {
+            if (!hasInput(c, 2)) {
+                return false;
+            }
+            size_t elementSize = (unsigned char)c->in[1];
+            if (elementSize == 0 || elementSize != nativeCarraySize((unsigned char)c->in[0])) {
+                return false;
+            }
+            c->in += 2;
+            SerializeVarint count;
+            if (type == BUFFER_VARCARRAY) {
+                if (!parseVarint(c, &count)) {
+                    return false;
+                }
+            } else {
+                size_t n;
+                if (!hasInput(c, sizeof(size_t))) {
+                    return false;
+                }
+                memcpy(&n, c->in, sizeof(size_t));
+                c->in += sizeof(size_t);
+                count = n;
+            }
+            return count <= (size_t)(c->end - c->in) / elementSize && skipInput(c, count * elementSize);
+        }
+        case BUFFER_TABLE: {
+            SerializeVarint arrayCount;
+            SerializeVarint hashCount;
+            SerializeVarint i;
+            if (   depth >= MTMSG_SERIALIZE_MAX_DEPTH 
+                || !parseVarint(c, &arrayCount) || !parseVarint(c, &hashCount)
+                || arrayCount > (size_t)(c->end - c->in) || hashCount > (size_t)(c->end - c->in)) {
+                return false;
+            }
+            for (i = 0; i < arrayCount + 2 * hashCount; ++i) {
+                if (!checkValue(c, depth + 1)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        case BUFFER_NUMARRAY: {
+            if (!hasInput(c, 1)) {
+                return false;
+            }
+            char   packedType = *c->in++;
+            size_t elementSize;
+            switch (packedType) {
+                case BUFFER_BYTE:    elementSize = 1;                   break;
+                case BUFFER_INTEGER: elementSize = sizeof(lua_Integer); break;
+                case BUFFER_FLOAT:   elementSize = sizeof(float);       break;
+                case BUFFER_NUMBER:  elementSize = sizeof(lua_Number);  break;
+                default:             return false;
+            }
+            SerializeVarint count;
+            return parseVarint(c, &count) 
+                && count <= (size_t)(c->end - c->in) / elementSize && skipInput(c, count * elementSize);
+        }
+        default: {
+            return false;
+        }
+    }
+}
+
+/**
+ * true if the natively serialized message elements lie within len bytes and
+ * do not contain pointers or string references, see checkValue().
+ */
+bool mtmsg_serialize_check_args(const char* args, size_t len)
+{
+    PortableConv c; c.in  = args;
+                    c.end = args + len;
+                    c.out = NULL;
+    while (c.in < c.end) {
+        if (!checkValue(&c, 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * true if all framed messages were converted to portable format before they
+ * were stored (possibly compressed afterwards). Empty messages are portable.
+ */
+bool mtmsg_serialize_is_portable_msgs(const char* msgs, size_t len)
+{
+    size_t p = 0;
+    while (p < len) {
+        SerializedMsgSizes sizes;
+        mtmsg_serialize_parse_header(msgs + p, &sizes);
+        const char* args = msgs + p + sizes.header_size;
+        p += sizes.header_size + sizes.args_size;
+        if (sizes.args_size == 0 || args[0] == BUFFER_PORTABLE) {
+            continue;
+        }
+        if (args[0] != BUFFER_COMPRESSED) {
+            return false;
+        }
+        SerializeVarint rawSize;
+        size_t h = 1 + mtmsg_serialize_parse_varint(args + 1, &rawSize);
+        if (h >= sizes.args_size || mtmsg_decompress_first_byte(args + h, sizes.args_size - h) != BUFFER_PORTABLE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Checks framed messages from outside of the process, e.g. from a dump or
+ * a file descriptor, before they are added to a buffer: all values must lie 
+ * within their message and must not be pointers or string references. 
+ * Compressed and portable messages are unwrapped for checking. 
+ * Returns 0 if the messages are valid, -2 if out of memory and -4 if not.
+ */
+int mtmsg_serialize_check_msgs(const char* msgs, size_t len)
+{
+    MemBuffer tmp;
+    mtmsg_membuf_init(&tmp, 0, 2);
+    int    rc = 0;
+    size_t p  = 0;
+    while (rc == 0 && p < len) {
+        SerializedMsgSizes sizes;
+        mtmsg_serialize_parse_header(msgs + p, &sizes);
+        const char* args = msgs + p + sizes.header_size;
+        p += sizes.header_size + sizes.args_size;
+        if (sizes.args_size > 0 && (args[0] == BUFFER_COMPRESSED || args[0] == BUFFER_PORTABLE)) {
+            tmp.bufferStart  = tmp.bufferData;
+            tmp.bufferLength = 0;
+            rc = mtmsg_membuf_reserve(&tmp, sizes.args_size);
+            if (rc == 0) {
+                memcpy(tmp.bufferStart, args, sizes.args_size);
+                tmp.bufferLength = sizes.args_size;
+                rc = mtmsg_serialize_unwrap_msg(&tmp, 0);
+                args = tmp.bufferStart;
+                sizes.args_size = tmp.bufferLength;
+            }
+            if (rc != 0) {
+                rc = (rc == -1 || rc == -2) ? -2 : -4;
                 break;
             }
         }
+        if (!mtmsg_serialize_check_args(args, sizes.args_size)) {
+            rc = -4;
+        }
     }
+    mtmsg_membuf_free(&tmp);
+    return rc;
+}
+
+/**
+ * Returns the number of bytes of the serialized value at buffer.
+ */
+size_t mtmsg_serialize_skip_value(const char* buffer)
+{
+    size_t p = 0;
+    char type = buffer[p++];
+    switch (type) {
+        case BUFFER_NIL:           break;
+        case BUFFER_INTEGER:       p += sizeof(lua_Integer);   break;
+        case BUFFER_BYTE:          p += 1;                     break;
+        case BUFFER_NUMBER:        p += sizeof(lua_Number);    break;
+        case BUFFER_FLOAT:         p += sizeof(float);         break;
+        case BUFFER_BOOLEAN:       p += 1;                     break;
+        case BUFFER_LIGHTUSERDATA: p += sizeof(void*);         break;
+        case BUFFER_CFUNCTION:     p += sizeof(lua_CFunction); break;
+        case BUFFER_VARINT:
+        case BUFFER_STRINGREF: {
+            SerializeVarint value;
+            p += mtmsg_serialize_parse_varint(buffer + p, &value);
+            break;
+        }
+        case BUFFER_STRING: {
+            size_t len;
+            memcpy(&len, buffer + p, sizeof(size_t));
+            p += sizeof(size_t) + len;
+            break;
+        }
+        case BUFFER_VARSTRING: {
+            SerializeVarint len;
+            p += mtmsg_serialize_parse_varint(buffer + p, &len);
+            p += len;
+            break;
+        }
+        case BUFFER_SMALLSTRING: {
+            size_t len = ((size_t)(buffer[p++])) & 0xff;
+            p += len;
+            break;
+        }
+        case BUFFER_CARRAY:
+        case BUFFER_VARCARRAY: {
+            size_t elementSize = (unsigned char)buffer[p + 1];
+            size_t elementCount;
+            p += 2;
+            if (type == BUFFER_VARCARRAY) {
+                SerializeVarint count;
+                p += mtmsg_serialize_parse_varint(buffer + p, &count);
+                elementCount = count;
+            } else {
+                memcpy(&elementCount, buffer + p, sizeof(size_t));
+                p += sizeof(size_t);
+            }
+            p += elementSize * elementCount;
+            break;
+        }
+        case BUFFER_TABLE: {
+            SerializeVarint arrayCount;
+            SerializeVarint hashCount;
+            SerializeVarint i;
+            p += mtmsg_serialize_parse_varint(buffer + p, &arrayCount);
+            p += mtmsg_serialize_parse_varint(buffer + p, &hashCount);
+            for (i = 0; i < arrayCount + 2 * hashCount; ++i) {
+                p += mtmsg_serialize_skip_value(buffer + p);
+            }
+            break;
+        }
+        case BUFFER_NUMARRAY: {
+            char            packedType = buffer[p++];
+            SerializeVarint count;
+            p += mtmsg_serialize_parse_varint(buffer + p, &count);
+            p += count * packedElementSize(packedType);
+            break;
+        }
+    }
+    return p;
 }
 
 int raiseCarrayError(lua_State* L, const carray_capi* capi, int reason)
@@ -162,6 +1282,267 @@ int raiseCarrayError(lua_State* L, const carray_capi* capi, int reason)
     }
 }
 
+/**
+ * Raises an argument error if one of the arguments starting at firstArg
+ * is neither nil nor a writable carray. This is checked before a message
+ * is taken out of a buffer, so that the message is not lost if the
+ * arguments are invalid.
+ */
+int mtmsg_serialize_check_carray_args(lua_State* L, int firstArg)
+{
+    int argTop = lua_gettop(L);
+    int arg;
+    for (arg = firstArg; arg <= argTop; ++arg) {
+        if (!lua_isnil(L, arg)) {
+            int                reason = 0;
+            const carray_capi* capi   = carray_get_capi(L, arg, &reason);
+            carray*            carray = NULL;
+            if (capi) {
+                carray = capi->toWritableCarray(L, arg, NULL);
+            }
+            if (!carray) {
+                if (!capi && reason == 1) {
+                    return luaL_argerror(L, arg, "incompatible carray capi version number");
+                } else if (!capi) {
+                    return luaL_argerror(L, arg, "carray expected");
+                } else {
+                    return luaL_argerror(L, arg, "writable carray expected");
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+static const char dictCacheKey = 0;
+
+/**
+ * Pushes a table with the Lua strings of the given dictionary that were
+ * already decoded in this Lua state. The caches are weakly referenced from
+ * the registry, so they are recreated after garbage collection.
+ */
+static void pushDictCache(lua_State* L, MsgDict* dict)
+{
+    luaL_checkstack(L, LUA_MINSTACK, NULL);
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, &dictCacheKey) == LUA_TNIL) {  /* -> nil */
+        lua_pop(L, 1);                                                  /* -> */
+        lua_newtable(L);                                                /* -> caches */
+        lua_newtable(L);                                                /* -> caches, meta */
+        lua_pushstring(L, "v");                                         /* -> caches, meta, "v" */
+        lua_setfield(L, -2, "__mode");                                  /* -> caches, meta */
+        lua_setmetatable(L, -2);                                        /* -> caches */
+        lua_pushvalue(L, -1);                                           /* -> caches, caches */
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &dictCacheKey);               /* -> caches */
+    }
+    if (lua_rawgeti(L, -1, dict->id) == LUA_TNIL) {                     /* -> caches, nil */
+        lua_pop(L, 1);                                                  /* -> caches */
+        lua_newtable(L);                                                /* -> caches, cache */
+        lua_pushvalue(L, -1);                                           /* -> caches, cache, cache */
+        lua_rawseti(L, -3, dict->id);                                   /* -> caches, cache */
+    }
+    lua_remove(L, -2);                                                  /* -> cache */
+}
+
+/**
+ * Pushes the value serialized at buffer + *p onto the stack and advances *p. 
+ * Carrays are always created as new objects. Returns false if nothing
+ * was pushed because of unknown type.
+ */
+static bool pushValue(lua_State* L, GetMsgArgsPar* par, const char* buffer, size_t* pp)
+{
+    size_t p    = *pp;
+    char   type = buffer[p++];
+    switch (type) {
+        case BUFFER_NIL: {
+            lua_pushnil(L);
+            break;
+        }
+        case BUFFER_INTEGER: {
+            lua_Integer value;
+            memcpy(&value, buffer + p, sizeof(lua_Integer));
+            p += sizeof(lua_Integer);
+            lua_pushinteger(L, value);
+            break;
+        }
+        case BUFFER_BYTE: {
+            char byte = buffer[p++];
+            lua_Integer value = ((lua_Integer)byte) & 0xff;
+            lua_pushinteger(L, value);
+            break;
+        }
+        case BUFFER_VARINT: {
+            SerializeVarint value;
+            p += mtmsg_serialize_parse_varint(buffer + p, &value);
+            lua_pushinteger(L, mtmsg_serialize_zigzag_decode(value));
+            break;
+        }
+        case BUFFER_NUMBER: {
+            lua_Number value;
+            memcpy(&value, buffer + p, sizeof(lua_Number));
+            p += sizeof(lua_Number);
+            lua_pushnumber(L, value);
+            break;
+        }
+        case BUFFER_FLOAT: {
+            float value;
+            memcpy(&value, buffer + p, sizeof(float));
+            p += sizeof(float);
+            lua_pushnumber(L, value);
+            break;
+        }
+        case BUFFER_BOOLEAN: {
+            lua_pushboolean(L, buffer[p++]);
+            break;
+        }
+        case BUFFER_STRING: {
+            size_t len;
+            memcpy(&len, buffer + p, sizeof(size_t));
+            p += sizeof(size_t);
+            lua_pushlstring(L, buffer + p, len);
+            p += len;
+            break;
+        }
+        case BUFFER_VARSTRING: {
+            SerializeVarint len;
+            p += mtmsg_serialize_parse_varint(buffer + p, &len);
+            lua_pushlstring(L, buffer + p, len);
+            p += len;
+            break;
+        }
+        case BUFFER_SMALLSTRING: {
+            size_t len = ((size_t)(buffer[p++])) & 0xff;
+            lua_pushlstring(L, buffer + p, len);
+            p += len;
+            break;
+        }
+        case BUFFER_STRINGREF: {
+            SerializeVarint index;
+            p += mtmsg_serialize_parse_varint(buffer + p, &index);
+            if (!par->dict) {
+                return luaL_error(L, "missing string dictionary");
+            }
+            if (index >= (SerializeVarint)atomic_get(&par->dict->count)) {
+                return luaL_error(L, "invalid string reference");
+            }
+            if (lua_rawgeti(L, par->dictCache, index + 1) == LUA_TNIL) {
+                lua_pop(L, 1);
+                lua_pushlstring(L, par->dict->strings[index], par->dict->lengths[index]);
+                lua_pushvalue(L, -1);
+                lua_rawseti(L, par->dictCache, index + 1);
+            }
+            break;
+        }
+        case BUFFER_LIGHTUSERDATA: {
+            void* value = NULL;
+            memcpy(&value, buffer + p, sizeof(void*));
+            p += sizeof(void*);
+            lua_pushlightuserdata(L, value);
+            break;
+        }
+        case BUFFER_CFUNCTION: {
+            lua_CFunction value = NULL;
+            memcpy(&value, buffer + p, sizeof(lua_CFunction));
+            p += sizeof(lua_CFunction);
+            lua_pushcfunction(L, value);
+            break;
+        }
+        case BUFFER_CARRAY:
+        case BUFFER_VARCARRAY: {
+            carray_type   elementType  = (unsigned char)buffer[p++];
+            unsigned char elementSize  = (unsigned char)buffer[p++];;
+            size_t        elementCount;
+            if (type == BUFFER_VARCARRAY) {
+                SerializeVarint count;
+                p += mtmsg_serialize_parse_varint(buffer + p, &count);
+                elementCount = count;
+            } else {
+                memcpy(&elementCount, buffer + p, sizeof(size_t));
+                p += sizeof(size_t);
+            }
+            size_t len = elementSize * elementCount;
+            void*  data;
+            if (!par->carrayCapi) {
+                par->carrayCapi = carray_require_capi(L);
+            }
+            if (!par->carrayCapi->newCarray(L, elementType, CARRAY_DEFAULT, elementCount, &data)) {
+                return luaL_error(L, "internal error creating carray for type %d", elementType);
+            }
+            memcpy(data, buffer + p, len);
+            p += len;
+            break;
+        }
+        case BUFFER_TABLE: {
+            SerializeVarint arrayCount;
+            SerializeVarint hashCount;
+            SerializeVarint i;
+            p += mtmsg_serialize_parse_varint(buffer + p, &arrayCount);
+            p += mtmsg_serialize_parse_varint(buffer + p, &hashCount);
+            luaL_checkstack(L, LUA_MINSTACK, NULL);
+            lua_createtable(L, (int)arrayCount, (int)hashCount);
+            for (i = 1; i <= arrayCount; ++i) {
+                if (!pushValue(L, par, buffer, &p)) {
+                    lua_pushnil(L);
+                }
+                lua_rawseti(L, -2, i);
+            }
+            for (i = 0; i < hashCount; ++i) {
+                bool hasKey   = pushValue(L, par, buffer, &p);
+                bool hasValue = pushValue(L, par, buffer, &p);
+                if (hasKey && hasValue && !lua_isnil(L, -2)) {
+                    lua_rawset(L, -3);
+                } else {
+                    lua_pop(L, (hasKey ? 1 : 0) + (hasValue ? 1 : 0));
+                }
+            }
+            break;
+        }
+        case BUFFER_NUMARRAY: {
+            char            packedType = buffer[p++];
+            SerializeVarint count;
+            SerializeVarint i;
+            p += mtmsg_serialize_parse_varint(buffer + p, &count);
+            lua_createtable(L, (int)count, 0);
+            for (i = 1; i <= count; ++i) {
+                switch (packedType) {
+                    case BUFFER_BYTE: {
+                        lua_pushinteger(L, ((lua_Integer)buffer[p++]) & 0xff);
+                        break;
+                    }
+                    case BUFFER_INTEGER: {
+                        lua_Integer value;
+                        memcpy(&value, buffer + p, sizeof(lua_Integer));
+                        p += sizeof(lua_Integer);
+                        lua_pushinteger(L, value);
+                        break;
+                    }
+                    case BUFFER_FLOAT: {
+                        float value;
+                        memcpy(&value, buffer + p, sizeof(float));
+                        p += sizeof(float);
+                        lua_pushnumber(L, value);
+                        break;
+                    }
+                    default: {
+                        lua_Number value;
+                        memcpy(&value, buffer + p, sizeof(lua_Number));
+                        p += sizeof(lua_Number);
+                        lua_pushnumber(L, value);
+                        break;
+                    }
+                }
+                lua_rawseti(L, -2, i);
+            }
+            break;
+        }
+        default: {
+            *pp = p;
+            return false;
+        }
+    }
+    *pp = p;
+    return true;
+}
+
 int mtmsg_serialize_get_msg_args(lua_State* L)
 {
     int arg    = 1;
@@ -178,6 +1559,10 @@ int mtmsg_serialize_get_msg_args(lua_State* L)
     size_t p = 0;
     int    i = 0;
     
+    if (par->dict) {
+        pushDictCache(L, par->dict);
+        par->dictCache = lua_gettop(L);
+    }
     while (true) {
         if (p >= bufferSize || (hasMaxArg && i >= maxArgCount)) {
             par->parsedLength   = p;
@@ -204,70 +1589,22 @@ int mtmsg_serialize_get_msg_args(lua_State* L)
         if (i % 10 == 0) {
             luaL_checkstack(L, 10 + LUA_MINSTACK, NULL);
         }
-        char type = buffer[p++];
+        char type = buffer[p];
         switch (type) {
-            case BUFFER_NIL: {
-                lua_pushnil(L);
-                break;
-            }
-            case BUFFER_INTEGER: {
-                lua_Integer value;
-                memcpy(&value, buffer + p, sizeof(lua_Integer));
-                p += sizeof(lua_Integer);
-                lua_pushinteger(L, value);
-                break;
-            }
-            case BUFFER_BYTE: {
-                char byte = buffer[p++];
-                lua_Integer value = ((lua_Integer)byte) & 0xff;
-                lua_pushinteger(L, value);
-                break;
-            }
-            case BUFFER_NUMBER: {
-                lua_Number value;
-                memcpy(&value, buffer + p, sizeof(lua_Number));
-                p += sizeof(lua_Number);
-                lua_pushnumber(L, value);
-                break;
-            }
-            case BUFFER_BOOLEAN: {
-                lua_pushboolean(L, buffer[p++]);
-                break;
-            }
-            case BUFFER_STRING: {
-                size_t len;
-                memcpy(&len, buffer + p, sizeof(size_t));
-                p += sizeof(size_t);
-                lua_pushlstring(L, buffer + p, len);
-                p += len;
-                break;
-            }
-            case BUFFER_SMALLSTRING: {
-                size_t len = ((size_t)(buffer[p++])) & 0xff;
-                lua_pushlstring(L, buffer + p, len);
-                p += len;
-                break;
-            }
-            case BUFFER_LIGHTUSERDATA: {
-                void* value = NULL;
-                memcpy(&value, buffer + p, sizeof(void*));
-                p += sizeof(void*);
-                lua_pushlightuserdata(L, value);
-                break;
-            }
-            case BUFFER_CFUNCTION: {
-                lua_CFunction value = NULL;
-                memcpy(&value, buffer + p, sizeof(lua_CFunction));
-                p += sizeof(lua_CFunction);
-                lua_pushcfunction(L, value);
-                break;
-            }
-            case BUFFER_CARRAY: {
+            case BUFFER_CARRAY:
+            case BUFFER_VARCARRAY: {
+                p += 1;
                 carray_type   elementType  = (unsigned char)buffer[p++];
                 unsigned char elementSize  = (unsigned char)buffer[p++];;
                 size_t        elementCount;
-                memcpy(&elementCount, buffer + p, sizeof(size_t));
-                p += sizeof(size_t);
+                if (type == BUFFER_VARCARRAY) {
+                    SerializeVarint count;
+                    p += mtmsg_serialize_parse_varint(buffer + p, &count);
+                    elementCount = count;
+                } else {
+                    memcpy(&elementCount, buffer + p, sizeof(size_t));
+                    p += sizeof(size_t);
+                }
                 size_t len = elementSize * elementCount;
 
                 const carray_capi* capi   = NULL;
@@ -316,7 +1653,9 @@ int mtmsg_serialize_get_msg_args(lua_State* L)
                 break;
             }
             default: {
-                i -= 1;
+                if (!pushValue(L, par, buffer, &p)) {
+                    i -= 1;
+                }
                 break;
             }
         }
@@ -16,15 +16,66 @@ typedef enum {
     BUFFER_SMALLSTRING,
     BUFFER_LIGHTUSERDATA,
     BUFFER_CFUNCTION,
-    BUFFER_CARRAY
+    BUFFER_CARRAY,
+    BUFFER_VARINT,      /* zigzag encoded integer as LEB128 varint */
+    BUFFER_VARSTRING,   /* string with LEB128 varint length */
+    BUFFER_FLOAT,       /* number that is exactly representable as float */
+    BUFFER_VARCARRAY,   /* carray with LEB128 varint element count */
+    BUFFER_TABLE,       /* varint array count, varint hash count, array values, key/value pairs */
+    BUFFER_NUMARRAY,    /* dense number sequence: element tag, varint count, packed elements */
+    BUFFER_STRINGREF,   /* varint index into the buffer's string dictionary */
+    BUFFER_COMPRESSED,  /* whole message: varint uncompressed size, compressed data */
+    BUFFER_PORTABLE     /* whole message: version byte, values in portable encoding */
 } SerializeDataType;
 
+/* Version of the portable encoding: fixed widths in little endian byte order,
+ * integers and doubles with 8 bytes, floats with 4 bytes, lengths as varints. */
+#define MTMSG_PORTABLE_VERSION 1
+
 #define MTMSG_ARG_SIZE_INITIAL       0
 #define MTMSG_ARG_SIZE_NIL           1
 #define MTMSG_ARG_SIZE_NUMBER        (1 + sizeof(lua_Number))
+#define MTMSG_ARG_SIZE_FLOAT         (1 + sizeof(float))
 #define MTMSG_ARG_SIZE_BOOLEAN       (1 + 1)
 #define MTMSG_ARG_SIZE_LIGHTUSERDATA (1 + sizeof(void*))
 #define MTMSG_ARG_SIZE_CFUNCTION     (1 + sizeof(lua_CFunction))
+
+/* Only strings with length in this range are put into a string dictionary. 
+ * A reference is never larger than the referenced string would be. */
+#define MTMSG_DICT_MIN_STRLEN    2
+#define MTMSG_DICT_MAX_STRLEN    64
+#define MTMSG_DICT_MAX_ENTRIES   1024
+#define MTMSG_DICT_HASH_SIZE     (2 * MTMSG_DICT_MAX_ENTRIES)
+
+/**
+ * Append-only string dictionary of a buffer. Entries are added under the 
+ * buffer's lock and are never changed or removed afterwards, so consumers 
+ * holding a reference may read entries with index < atomic_get(&count)
+ * without locking: count is set after the entry has been stored.
+ */
+typedef struct MsgDict {
+    AtomicCounter      used;
+    lua_Integer        id;
+    AtomicCounter      count;
+    char*              strings[MTMSG_DICT_MAX_ENTRIES];
+    size_t             lengths[MTMSG_DICT_MAX_ENTRIES];
+    short              hash[MTMSG_DICT_HASH_SIZE]; /* entry index + 1, 0 if unused */
+} MsgDict;
+
+MsgDict* mtmsg_dict_new();
+
+void mtmsg_dict_release(MsgDict* dict);
+
+int mtmsg_dict_lookup(MsgDict* dict, const char* str, size_t len);
+
+static inline MsgDict* mtmsg_dict_retain(MsgDict* dict)
+{
+    if (dict) {
+        atomic_inc(&dict->used);
+    }
+    return dict;
+}
+
                                     
 typedef struct GetMsgArgsPar {
     const char*        inBuffer;
@@ -34,6 +85,8 @@ typedef struct GetMsgArgsPar {
     int                parsedArgCount;
     const carray_capi* carrayCapi;
     int                errorArg;
+    MsgDict*           dict;
+    int                dictCache; /* stack index of consumer side string cache */
 } GetMsgArgsPar;
 
 typedef struct SerializedMsgSizes {
@@ -43,12 +96,144 @@ typedef struct SerializedMsgSizes {
 
 size_t mtmsg_serialize_calc_args_size(lua_State* L, int firstArg, int* errorArg);
 
+size_t mtmsg_serialize_skip_value(const char* buffer);
+
+int mtmsg_serialize_unwrap_msg(MemBuffer* mem, size_t offset);
+
+size_t mtmsg_serialize_to_portable(const char* args, size_t len, char* out);
+
+/* Maximal size of the portable encoding of len bytes native encoding. */
+static inline size_t mtmsg_serialize_calc_portable_bound(size_t len)
+{
+    return 2 + 2 * len;
+}
+
+static inline bool mtmsg_serialize_is_little_endian()
+{
+    const unsigned short x = 1;
+    return *(const unsigned char*)&x == 1;
+}
+
+int mtmsg_serialize_count_msgs(const char* buffer, size_t len);
+
+int mtmsg_serialize_check_msgs(const char* msgs, size_t len);
+
+bool mtmsg_serialize_check_args(const char* args, size_t len);
+
+bool mtmsg_serialize_is_portable_msgs(const char* msgs, size_t len);
+
+int mtmsg_serialize_count_complete_msgs(const char* buffer, size_t len, size_t* completeLength);
+
+#if defined(LLONG_MAX)
+typedef unsigned long long SerializeVarint;
+#else
+typedef unsigned long      SerializeVarint;
+#endif
+
+/* maximal number of bytes of a valid varint, i.e. 10 for 64 bit */
+#define MTMSG_SERIALIZE_MAX_VARINT_SIZE ((8 * sizeof(SerializeVarint) + 6) / 7)
+
+/* 
+ * Variable length unsigned integers (LEB128): 7 bits per byte, 
+ * the high bit is set if more bytes are following.
+ */
+static inline size_t mtmsg_serialize_calc_varint_size(SerializeVarint value)
+{
+    size_t rslt = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        rslt += 1;
+    }
+    return rslt;
+}
+
+static inline char* mtmsg_serialize_varint_to_buffer(SerializeVarint value, char* buffer)
+{
+    while (value >= 0x80) {
+        *buffer++ = (char)((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    *buffer++ = (char)value;
+    return buffer;
+}
+
+/*
+ * Returns the number of bytes of the varint at buffer or 0 if the data is 
+ * corrupt, i.e. if the varint is longer than MTMSG_SERIALIZE_MAX_VARINT_SIZE
+ * or does not fit into SerializeVarint. 
+ */
+static inline size_t mtmsg_serialize_parse_varint(const char* buffer, SerializeVarint* value)
+{
+    SerializeVarint rslt  = 0;
+    int             shift = 0;
+    size_t          p     = 0;
+    unsigned char   c;
+    do {
+        if (p >= MTMSG_SERIALIZE_MAX_VARINT_SIZE) {
+            *value = 0;
+            return 0;
+        }
+        c = (unsigned char)buffer[p++];
+        SerializeVarint bits = c & 0x7f;
+        if (((bits << shift) >> shift) != bits) {
+            *value = 0;
+            return 0;
+        }
+        rslt |= bits << shift;
+        shift += 7;
+    } while (c & 0x80);
+    *value = rslt;
+    return p;
+}
+
+static inline SerializeVarint mtmsg_serialize_zigzag_encode(lua_Integer value)
+{
+    return (value < 0) ? ~(((SerializeVarint)value) << 1)
+                       :   ((SerializeVarint)value) << 1;
+}
+
+static inline lua_Integer mtmsg_serialize_zigzag_decode(SerializeVarint value)
+{
+    return (value & 1) ? (lua_Integer)~(value >> 1)
+                       : (lua_Integer) (value >> 1);
+}
+
 static inline size_t mtmsg_serialize_calc_integer_size(lua_Integer value) 
 {
     if (0 <= value && value <= 0xff) {
         return 1 + 1;
     } else {
-        return 1 + sizeof(lua_Integer);
+        size_t varSize = mtmsg_serialize_calc_varint_size(mtmsg_serialize_zigzag_encode(value));
+        if (varSize < sizeof(lua_Integer)) {
+            return 1 + varSize;
+        } else {
+            return 1 + sizeof(lua_Integer);
+        }
+    }
+}
+
+/*
+ * true if value can be stored as float without loss. Converting a value 
+ * outside of float's range is undefined. NaN is not stored as float to keep 
+ * its payload.
+ */
+static inline bool mtmsg_serialize_is_float(lua_Number value)
+{
+    if (sizeof(float) >= sizeof(lua_Number) || isnan(value)) {
+        return false;
+    }
+    if (isinf(value)) {
+        return true;
+    }
+    return fabs(value) <= FLT_MAX && (lua_Number)(float)value == value;
+}
+
+static inline size_t mtmsg_serialize_calc_number_size(lua_Number value) 
+{
+    if (mtmsg_serialize_is_float(value)) {
+        return MTMSG_ARG_SIZE_FLOAT;
+    } else {
+        return MTMSG_ARG_SIZE_NUMBER;
     }
 }
 
@@ -57,13 +242,14 @@ static inline size_t mtmsg_serialize_calc_string_size(size_t len)
     if (len <= 0xff) {
         return 1 + 1 + len;
     } else {
-        return 1 + sizeof(size_t) + len;
+        return 1 + mtmsg_serialize_calc_varint_size(len) + len;
     }
 }
 
 static inline size_t mtmsg_serialize_calc_carray_size(carray_info* info) 
 {
-    return 1 + 1 + 1 + sizeof(size_t) + info->elementSize * info->elementCount;
+    return 1 + 1 + 1 + mtmsg_serialize_calc_varint_size(info->elementCount) 
+                     + info->elementSize * info->elementCount;
 }
 
 
@@ -80,18 +266,31 @@ static inline char* mtmsg_serialize_integer_to_buffer(lua_Integer value, char* b
         *buffer++ = BUFFER_BYTE;
         *buffer++ = ((char)value);
     } else {
-        *buffer++ = BUFFER_INTEGER;
-        memcpy(buffer, &value, sizeof(lua_Integer));
-        buffer += sizeof(lua_Integer);
+        SerializeVarint zigzag = mtmsg_serialize_zigzag_encode(value);
+        if (mtmsg_serialize_calc_varint_size(zigzag) < sizeof(lua_Integer)) {
+            *buffer++ = BUFFER_VARINT;
+            buffer = mtmsg_serialize_varint_to_buffer(zigzag, buffer);
+        } else {
+            *buffer++ = BUFFER_INTEGER;
+            memcpy(buffer, &value, sizeof(lua_Integer));
+            buffer += sizeof(lua_Integer);
+        }
     }
     return buffer;
 }
 
 static inline char* mtmsg_serialize_number_to_buffer(lua_Number value, char* buffer)
 {
-    *buffer++ = BUFFER_NUMBER;
-    memcpy(buffer, &value, sizeof(lua_Number));
-    buffer += sizeof(lua_Number);
+    if (mtmsg_serialize_is_float(value)) {
+        float f = (float)value;
+        *buffer++ = BUFFER_FLOAT;
+        memcpy(buffer, &f, sizeof(float));
+        buffer += sizeof(float);
+    } else {
+        *buffer++ = BUFFER_NUMBER;
+        memcpy(buffer, &value, sizeof(lua_Number));
+        buffer += sizeof(lua_Number);
+    }
     return buffer;
 }
 
@@ -101,9 +300,8 @@ static inline char* mtmsg_serialize_string_to_buffer(const char* content, size_t
         *buffer++ = BUFFER_SMALLSTRING;
         *buffer++ = ((char)len);
     } else {
-        *buffer++ = BUFFER_STRING;
-        memcpy(buffer, &len, sizeof(size_t));
-        buffer += sizeof(size_t);
+        *buffer++ = BUFFER_VARSTRING;
+        buffer = mtmsg_serialize_varint_to_buffer(len, buffer);
     }
     memcpy(buffer, content, len);
     buffer += len;
@@ -128,11 +326,10 @@ static inline char* mtmsg_serialize_cfunction_to_buffer(lua_CFunction value, cha
 
 static inline char* mtmsg_serialize_carray_header_to_buffer(carray_info* info, char* buffer)
 {
-    *buffer++ = BUFFER_CARRAY;
+    *buffer++ = BUFFER_VARCARRAY;
     *buffer++ = info->elementType;
     *buffer++ = (unsigned char)info->elementSize;
-    memcpy(buffer, &info->elementCount, sizeof(size_t));
-    buffer += sizeof(size_t);
+    buffer = mtmsg_serialize_varint_to_buffer(info->elementCount, buffer);
     return buffer;
 }
 
@@ -146,32 +343,35 @@ static inline char* mtmsg_serialize_carray_to_buffer(carray_info* info, const vo
 }
 
 
-void mtmsg_serialize_args_to_buffer(lua_State* L, int firstArg, char* buffer);
+char* mtmsg_serialize_args_to_buffer(lua_State* L, int firstArg, char* buffer, MsgDict* dict);
 
 int mtmsg_serialize_get_msg_args(lua_State* L);
 
+int mtmsg_serialize_check_carray_args(lua_State* L, int firstArg);
+
 typedef enum {
-    BUFFER_MSGSIZE = 0xff
+    BUFFER_MSGSIZE_VARINT = 0xfe,
+    BUFFER_MSGSIZE        = 0xff
 } SerializeSizeType;
 
 static inline size_t mtmsg_serialize_calc_header_size(size_t args_size)
 {
-    if (args_size < BUFFER_MSGSIZE) {
+    if (args_size < BUFFER_MSGSIZE_VARINT) {
         return 1;
     }
     else {
-        return 1 + sizeof(size_t);
+        return 1 + mtmsg_serialize_calc_varint_size(args_size);
     }
 }
 
 static inline void mtmsg_serialize_header_to_buffer(size_t args_size, char* buffer)
 {
-    if (args_size < BUFFER_MSGSIZE) {
+    if (args_size < BUFFER_MSGSIZE_VARINT) {
         *buffer     = (char)args_size;
     }
     else {
-        *(buffer++) = (char)BUFFER_MSGSIZE;
-        memcpy(buffer, &args_size, sizeof(size_t)); 
+        *(buffer++) = (char)BUFFER_MSGSIZE_VARINT;
+        mtmsg_serialize_varint_to_buffer(args_size, buffer);
     }
 }
 
@@ -179,16 +379,21 @@ static inline void mtmsg_serialize_header_to_buffer(size_t args_size, char* buff
 static inline void mtmsg_serialize_parse_header(const char* buffer, SerializedMsgSizes* sizes) 
 {
     unsigned char c = *(buffer++);
-    if (c != BUFFER_MSGSIZE) {
-        sizes->header_size = 1;
-        sizes->args_size   = c;
+    if (c == BUFFER_MSGSIZE_VARINT) {
+        SerializeVarint args_size;
+        sizes->header_size = 1 + mtmsg_serialize_parse_varint(buffer, &args_size);
+        sizes->args_size   = args_size;
     }
-    else {
+    else if (c == BUFFER_MSGSIZE) {
         size_t args_size;
         memcpy(&args_size, buffer, sizeof(size_t));
         sizes->header_size = 1 + sizeof(size_t);
         sizes->args_size   = args_size;
     }
+    else {
+        sizes->header_size = 1;
+        sizes->args_size   = c;
+    }
 }
 
 #endif /* MTMSG_SERIALIZE_H */
@@ -0,0 +1,98 @@
+#ifndef MTMSG_TRACE_H
+#define MTMSG_TRACE_H
+
+#include "util.h"
+#include "trace_capi.h"
+
+/**
+ * Tracepoints for the hooks registered by mtmsg.tracehooks() and, if compiled
+ * with MTMSG_USE_SDT, for USDT probes in the provider "mtmsg" that can be
+ * used by bpftrace, perf or SystemTap. If compiled with MTMSG_DISABLE_TRACE
+ * all tracepoints are empty.
+ */
+
+#if !defined(MTMSG_DISABLE_TRACE)
+
+/* Only read without lock: a stale value just delays the (un)registration */
+extern const mtmsg_trace_hooks* volatile mtmsg_trace_hooks_ptr;
+
+#if defined(MTMSG_USE_SDT)
+#  include <sys/sdt.h>
+#  define MTMSG_PROBE1(name, a)          DTRACE_PROBE1(mtmsg, name, a)
+#  define MTMSG_PROBE3(name, a, b, c)    DTRACE_PROBE3(mtmsg, name, a, b, c)
+#  define MTMSG_PROBE4(name, a, b, c, d) DTRACE_PROBE4(mtmsg, name, a, b, c, d)
+#else
+#  define MTMSG_PROBE1(name, a)
+#  define MTMSG_PROBE3(name, a, b, c)
+#  define MTMSG_PROBE4(name, a, b, c, d)
+#endif
+
+#endif /* !MTMSG_DISABLE_TRACE */
+
+static inline void mtmsg_trace_enqueue(lua_Integer bufferId, int count, size_t bytes)
+{
+#if !defined(MTMSG_DISABLE_TRACE)
+    const mtmsg_trace_hooks* h = mtmsg_trace_hooks_ptr;
+    if (h && h->enqueue) {
+        h->enqueue(h->data, bufferId, count, bytes);
+    }
+    MTMSG_PROBE3(enqueue, (long long)bufferId, count, bytes);
+#endif
+}
+
+static inline void mtmsg_trace_dequeue(lua_Integer bufferId, lua_Integer listenerId, int count, size_t bytes)
+{
+#if !defined(MTMSG_DISABLE_TRACE)
+    const mtmsg_trace_hooks* h = mtmsg_trace_hooks_ptr;
+    if (h && h->dequeue) {
+        h->dequeue(h->data, bufferId, listenerId, count, bytes);
+    }
+    MTMSG_PROBE4(dequeue, (long long)bufferId, (long long)listenerId, count, bytes);
+#endif
+}
+
+static inline void mtmsg_trace_block_start(lua_Integer objectId)
+{
+#if !defined(MTMSG_DISABLE_TRACE)
+    const mtmsg_trace_hooks* h = mtmsg_trace_hooks_ptr;
+    if (h && h->block_start) {
+        h->block_start(h->data, objectId);
+    }
+    MTMSG_PROBE1(block__start, (long long)objectId);
+#endif
+}
+
+static inline void mtmsg_trace_block_end(lua_Integer objectId)
+{
+#if !defined(MTMSG_DISABLE_TRACE)
+    const mtmsg_trace_hooks* h = mtmsg_trace_hooks_ptr;
+    if (h && h->block_end) {
+        h->block_end(h->data, objectId);
+    }
+    MTMSG_PROBE1(block__end, (long long)objectId);
+#endif
+}
+
+static inline void mtmsg_trace_notify(lua_Integer bufferId)
+{
+#if !defined(MTMSG_DISABLE_TRACE)
+    const mtmsg_trace_hooks* h = mtmsg_trace_hooks_ptr;
+    if (h && h->notify) {
+        h->notify(h->data, bufferId);
+    }
+    MTMSG_PROBE1(notify, (long long)bufferId);
+#endif
+}
+
+static inline void mtmsg_trace_drop(lua_Integer bufferId, int count, int reason)
+{
+#if !defined(MTMSG_DISABLE_TRACE)
+    const mtmsg_trace_hooks* h = mtmsg_trace_hooks_ptr;
+    if (h && h->drop) {
+        h->drop(h->data, bufferId, count, reason);
+    }
+    MTMSG_PROBE3(drop, (long long)bufferId, count, reason);
+#endif
+}
+
+#endif /* MTMSG_TRACE_H */
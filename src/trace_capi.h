@@ -0,0 +1,83 @@
+#ifndef MTMSG_TRACE_CAPI_H
+#define MTMSG_TRACE_CAPI_H
+
+#include <stddef.h>
+
+#define MTMSG_TRACE_CAPI_VERSION_MAJOR  1
+#define MTMSG_TRACE_CAPI_VERSION_MINOR  0
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Reasons for the drop hook.
+ */
+#define MTMSG_TRACE_DROP_CLEARED   1  /* message was removed by clearing the buffer */
+#define MTMSG_TRACE_DROP_REJECTED  2  /* message was not added because the buffer is full */
+
+/**
+ * Hooks for tracing the lifecycle of messages, e.g. by an external profiler.
+ *
+ * A pointer to this struct is registered as light userdata by calling
+ * mtmsg.tracehooks() from Lua. The registered pointer is read without lock,
+ * therefore the struct and its data must remain valid even after another
+ * struct or nil was registered, because other threads may still be calling
+ * the old hooks, i.e. in practice both should be static.
+ *
+ * Each hook may be NULL. The hooks are invoked in the thread that performs
+ * the operation, most of them while holding the lock of the buffer,
+ * therefore they must be fast, thread safe and must not call functions
+ * of mtmsg. Buffer and listener ids are the values of buffer:id() and
+ * listener:id(), listenerId is 0 for messages that are taken directly
+ * from a buffer.
+ */
+typedef struct mtmsg_trace_hooks
+{
+    int   version_major;
+    int   version_minor;
+
+    /**
+     * Given as first argument to all hooks.
+     */
+    void* data;
+
+    /**
+     * count messages with total size bytes were added to the buffer.
+     */
+    void (*enqueue)(void* data, long long bufferId, int count, size_t bytes);
+
+    /**
+     * count messages with total size bytes were taken from the buffer.
+     */
+    void (*dequeue)(void* data, long long bufferId, long long listenerId, int count, size_t bytes);
+
+    /**
+     * The current thread starts waiting for messages in the buffer or listener
+     * with the given id.
+     */
+    void (*block_start)(void* data, long long objectId);
+
+    /**
+     * The current thread has finished waiting, i.e. a message is available,
+     * the timeout has elapsed or the object was closed or aborted.
+     */
+    void (*block_end)(void* data, long long objectId);
+
+    /**
+     * A notifier of the buffer is going to be called.
+     */
+    void (*notify)(void* data, long long bufferId);
+
+    /**
+     * count messages were dropped, reason is one of MTMSG_TRACE_DROP_*.
+     */
+    void (*drop)(void* data, long long bufferId, int count, int reason);
+
+} mtmsg_trace_hooks;
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* MTMSG_TRACE_CAPI_H */
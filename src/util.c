@@ -87,6 +87,28 @@ int mtmsg_membuf_reserve0(MemBuffer* b, size_t newLength)
     return 0;
 }
 
+void mtmsg_util_push_lockstats(lua_State* L, Mutex* mutex)
+{
+#if defined(MTMSG_LOCKSTATS)
+    async_mutex_lock(mutex);
+    MutexStats stats = mutex->stats;
+    async_mutex_unlock(mutex);
+
+    lua_createtable(L, 0, 4);
+    lua_pushinteger(L, (lua_Integer)stats.acquisitions);
+    lua_setfield(L, -2, "acquisitions");
+    lua_pushinteger(L, (lua_Integer)stats.contended);
+    lua_setfield(L, -2, "contended");
+    lua_pushnumber(L, stats.waitNanos * 1e-9);
+    lua_setfield(L, -2, "wait_time");
+    lua_pushnumber(L, stats.maxHoldNanos * 1e-9);
+    lua_setfield(L, -2, "max_hold_time");
+#else
+    (void)mutex;
+    lua_pushnil(L);
+#endif
+}
+
 void mtmsg_util_quote_lstring(lua_State* L, const char* s, size_t len)
 {
     if (s) {
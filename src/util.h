@@ -6,11 +6,15 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <float.h>
 #include <limits.h>
+#include <math.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #ifdef MTMSG_ASYNC_USE_WIN32
     #include <sys/types.h>
@@ -99,6 +103,12 @@ static inline int mtmsg_membuf_reserve(MemBuffer* b, size_t additionalLength)
 }
 
 
+/**
+ * Pushes a table with the lock statistics of the mutex or nil if not 
+ * compiled with MTMSG_LOCKSTATS.
+ */
+void mtmsg_util_push_lockstats(lua_State* L, Mutex* mutex);
+
 void mtmsg_util_quote_lstring(lua_State* L, const char* s, size_t len);
 
 void mtmsg_util_quote_string(lua_State* L, const char* s);
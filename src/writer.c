@@ -5,10 +5,34 @@
 
 static const char* const MTMSG_WRITER_CLASS_NAME = "mtmsg.writer";
 
+/* maximal size of a message header */
+#define WRITER_HEADROOM      (1 + 10)
+
+/* smaller messages are copied into the buffer */
+#define WRITER_SWAP_MIN_SIZE (4 * 1024)
+
 typedef struct WriterUserData {
-    MemBuffer mem;
+    MemBuffer mem;       /* message elements behind headroom bytes */
+    size_t    headroom;  /* room for the message header if the memory can be given to the buffer */
 } WriterUserData;
 
+/**
+ * Empties the writer and reserves the headroom if memory is growable.
+ */
+static void resetWriter(WriterUserData* udata)
+{
+    udata->mem.bufferStart  = udata->mem.bufferData;
+    udata->mem.bufferLength = 0;
+    if (   udata->mem.growFactor > 0 
+        && mtmsg_membuf_reserve(&udata->mem, WRITER_HEADROOM) == 0) 
+    {
+        udata->headroom = WRITER_HEADROOM;
+    } else {
+        udata->headroom = 0;
+    }
+    udata->mem.bufferLength = udata->headroom;
+}
+
 
 static void setupWriterMeta(lua_State* L);
 
@@ -49,6 +73,7 @@ static int Mtmsg_newWriter(lua_State* L)
     if (!mtmsg_membuf_init(&writerUdata->mem, initialCapacity, growFactor)) {
         return mtmsg_ERROR_OUT_OF_MEMORY_bytes(L, initialCapacity);
     }
+    resetWriter(writerUdata);
     
     return 1;
 }
@@ -66,8 +91,7 @@ static int Writer_release(lua_State* L)
 static int Writer_clear(lua_State* L)
 {
     WriterUserData* udata = luaL_checkudata(L, 1, MTMSG_WRITER_CLASS_NAME);
-    udata->mem.bufferStart  = udata->mem.bufferData;
-    udata->mem.bufferLength = 0;
+    resetWriter(udata);
     return 0;
 }
 
@@ -80,7 +104,7 @@ static int Writer_add(lua_State* L)
     int errorArg = 0;
     const size_t args_size = mtmsg_serialize_calc_args_size(L, arg, &errorArg);
 
-    if (args_size < 0) {
+    if (errorArg) {
         return luaL_argerror(L, errorArg, "parameter type not supported");
     }
 
@@ -92,27 +116,44 @@ static int Writer_add(lua_State* L)
             const char* wstring = luaL_tolstring(L, 1, NULL);
             return mtmsg_ERROR_MESSAGE_SIZE_bytes(L, udata->mem.bufferLength + args_size, udata->mem.bufferCapacity, wstring);
         } else {
-            return mtmsg_ERROR_OUT_OF_MEMORY_bytes(L, udata->mem.bufferLength + args_size);
+            return mtmsg_ERROR_OUT_OF_MEMORY_bytes(L, udata->mem.bufferLength - udata->headroom + args_size);
         }
     }
-    mtmsg_serialize_args_to_buffer(L, arg, udata->mem.bufferStart + udata->mem.bufferLength);
+    mtmsg_serialize_args_to_buffer(L, arg, udata->mem.bufferStart + udata->mem.bufferLength, NULL);
     udata->mem.bufferLength += args_size;
     
     return 0;
 }
 
+/**
+ * Large messages are given to an empty buffer by exchanging the memory of
+ * writer and buffer instead of copying.
+ */
+static int sendMsg(lua_State* L, WriterUserData* wudata, BufferUserData* budata, bool clear)
+{
+    const char* args      = wudata->mem.bufferStart  + wudata->headroom;
+    size_t      args_size = wudata->mem.bufferLength - wudata->headroom;
+    int rc = -1;
+    if (wudata->headroom > 0 && args_size >= WRITER_SWAP_MIN_SIZE) {
+        rc = mtmsg_buffer_swap_msg(L, budata->buffer, budata->nonblock, clear, &wudata->mem, wudata->headroom);
+    }
+    if (rc == -1) {
+        rc = mtmsg_buffer_set_or_add_msg(L, budata->buffer, budata->nonblock, clear, 0, args, args_size, NULL, NULL);
+    }
+    if (rc == 0) {
+        resetWriter(wudata);
+    }
+    lua_pushboolean(L, rc == 0);
+    return 1;
+}
+
 static int Writer_addMsg(lua_State* L)
 {
     int arg = 1;
     WriterUserData* wudata = luaL_checkudata(L, arg++, MTMSG_WRITER_CLASS_NAME);
     BufferUserData* budata = luaL_checkudata(L, arg++, MTMSG_BUFFER_CLASS_NAME);
     bool clear = false;
-    int rc = mtmsg_buffer_set_or_add_msg(L, budata->buffer, budata->nonblock, clear, 0, wudata->mem.bufferStart, wudata->mem.bufferLength, NULL, NULL);
-    if (rc == 0) {
-        wudata->mem.bufferLength = 0;
-    }
-    lua_pushboolean(L, rc == 0);
-    return 1;
+    return sendMsg(L, wudata, budata, clear);
 }
 
 static int Writer_setMsg(lua_State* L)
@@ -121,12 +162,7 @@ static int Writer_setMsg(lua_State* L)
     WriterUserData* wudata = luaL_checkudata(L, arg++, MTMSG_WRITER_CLASS_NAME);
     BufferUserData* budata = luaL_checkudata(L, arg++, MTMSG_BUFFER_CLASS_NAME);
     bool clear = true;
-    int rc = mtmsg_buffer_set_or_add_msg(L, budata->buffer, budata->nonblock, clear, 0, wudata->mem.bufferStart, wudata->mem.bufferLength, NULL, NULL);
-    if (rc == 0) {
-        wudata->mem.bufferLength = 0;
-    }
-    lua_pushboolean(L, rc == 0);
-    return 1;
+    return sendMsg(L, wudata, budata, clear);
 }
 
 static const luaL_Reg WriterMethods[] = 
@@ -0,0 +1,346 @@
+/**
+ * Lua module for testing the C APIs of mtmsg from Lua scripts, see test31.lua,
+ * test32.lua and test33.lua.
+ * Build with e.g.:
+ *     cc -shared -fPIC -I<lua include dir> -I../src capitest.c -o capitest.so
+ */
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#define RECEIVER_CAPI_IMPLEMENT_GET_CAPI 1
+#include "receiver_capi.h"
+
+#define SENDER_CAPI_IMPLEMENT_GET_CAPI 1
+#include "sender_capi.h"
+
+#include "trace_capi.h"
+
+#define CAPITEST_PENDING_CLASS_NAME "capitest.pending"
+
+/**
+ * A message reserved by reserveInReceiver() that is not committed yet.
+ */
+typedef struct Pending {
+    const receiver_capi* capi;
+    receiver_object*     receiver;
+    receiver_writer*     writer;
+    bool                 reserved;
+} Pending;
+
+static void freePending(Pending* p)
+{
+    if (p->reserved) {
+        p->capi->commitToReceiver(p->receiver, p->writer, 1 /* cancel */, NULL, NULL);
+        p->reserved = false;
+    }
+    if (p->writer) {
+        p->capi->freeWriter(p->writer);
+        p->writer = NULL;
+    }
+    if (p->receiver) {
+        p->capi->releaseReceiver(p->receiver);
+        p->receiver = NULL;
+    }
+}
+
+static int Pending_gc(lua_State* L)
+{
+    freePending(luaL_checkudata(L, 1, CAPITEST_PENDING_CLASS_NAME));
+    return 0;
+}
+
+/**
+ * capitest.reserve(buffer, count[, nonblock]): reserves the message
+ * ("reserved", count, array) with an int array of count elements in the
+ * buffer and fills the array with 1..count. Returns the pending message
+ * that has to be given to capitest.commit() or nil and the error code.
+ */
+static int Capitest_reserve(lua_State* L)
+{
+    int errorReason;
+    const receiver_capi* capi = receiver_get_capi(L, 1, &errorReason);
+    if (!capi || capi->version_minor < 1) {
+        return luaL_argerror(L, 1, "receiver C API 2.1 expected");
+    }
+    lua_Integer count    = luaL_checkinteger(L, 2);
+    int         nonblock = lua_toboolean(L, 3);
+
+    Pending* p = lua_newuserdata(L, sizeof(Pending));
+    memset(p, 0, sizeof(Pending));
+    p->capi = capi;
+    luaL_getmetatable(L, CAPITEST_PENDING_CLASS_NAME);
+    lua_setmetatable(L, -2);
+
+    p->writer = capi->newWriter(0, 2);
+    if (!p->writer) {
+        return luaL_error(L, "cannot create writer");
+    }
+    p->receiver = capi->toReceiver(L, 1);
+    capi->retainReceiver(p->receiver);
+
+    capi->addStringToWriter(p->writer, "reserved", 8);
+    capi->addIntegerToWriter(p->writer, count);
+    int  rc;
+    int* data = capi->reserveInReceiver(p->receiver, p->writer, RECEIVER_INT, count, nonblock, &rc);
+    if (!data) {
+        freePending(p);
+        lua_pushnil(L);
+        lua_pushinteger(L, rc);
+        return 2;
+    }
+    p->reserved = true;
+    lua_Integer i;
+    for (i = 0; i < count; ++i) {
+        int v = (int)(i + 1);
+        memcpy(data + i, &v, sizeof(int)); /* reserved memory may be unaligned */
+    }
+    return 1;
+}
+
+/**
+ * capitest.commit(pending[, cancel]): commits or cancels the message
+ * reserved by capitest.reserve(). Returns the error code.
+ */
+static int Capitest_commit(lua_State* L)
+{
+    Pending* p      = luaL_checkudata(L, 1, CAPITEST_PENDING_CLASS_NAME);
+    int      cancel = lua_toboolean(L, 2);
+    if (!p->reserved) {
+        return luaL_argerror(L, 1, "message is not reserved");
+    }
+    p->reserved = false;
+    int rc = p->capi->commitToReceiver(p->receiver, p->writer, cancel, NULL, NULL);
+    freePending(p);
+    lua_pushinteger(L, rc);
+    return 1;
+}
+
+static void pushArray(lua_State* L, const sender_capi_value* v)
+{
+    lua_newtable(L);
+    size_t i;
+    for (i = 0; i < v->arrayVal.elementCount; ++i) {
+        const char* p = (const char*)v->arrayVal.data + i * v->arrayVal.elementSize;
+        switch (v->arrayVal.type) {
+            case SENDER_INT:    { int    x; memcpy(&x, p, sizeof(x)); lua_pushinteger(L, x); break; }
+            case SENDER_DOUBLE: { double x; memcpy(&x, p, sizeof(x)); lua_pushnumber(L, x);  break; }
+            default:            { lua_pushboolean(L, true); break; }
+        }
+        lua_rawseti(L, -2, (int)i + 1);
+    }
+}
+
+/**
+ * capitest.nextmsgs(buffer, maxCount, maxBytes[, maxValues]): takes messages
+ * with nextMessagesFromSender() in nonblock mode. Returns a table with one
+ * table per message that contains the message's values (int and double 
+ * arrays as tables of numbers) and the number of values as field n. Only 
+ * the first maxValues values of each message are read if maxValues is given,
+ * the other values are skipped by nextMessageFromReader(). Returns nil and 
+ * the error code if no message is taken.
+ */
+static int Capitest_nextmsgs(lua_State* L)
+{
+    int errorReason;
+    const sender_capi* capi = sender_get_capi(L, 1, &errorReason);
+    if (!capi || capi->version_minor < 1) {
+        return luaL_argerror(L, 1, "sender C API 1.1 expected");
+    }
+    size_t      maxCount  = (size_t)luaL_checkinteger(L, 2);
+    size_t      maxBytes  = (size_t)luaL_checkinteger(L, 3);
+    lua_Integer maxValues = luaL_optinteger(L, 4, -1);
+
+    sender_object* sender = capi->toSender(L, 1);
+    sender_reader* reader = capi->newReader(0, 2);
+    if (!reader) {
+        return luaL_error(L, "cannot create reader");
+    }
+    size_t count = 0;
+    int    rc    = capi->nextMessagesFromSender(sender, reader, 1 /* nonblock */, 0, 
+                                                maxCount, maxBytes, &count, NULL, NULL);
+    if (rc != 0) {
+        capi->freeReader(reader);
+        lua_pushnil(L);
+        lua_pushinteger(L, rc);
+        return 2;
+    }
+    lua_newtable(L);
+    size_t m = 0;
+    do {
+        lua_newtable(L);
+        lua_Integer n = 0;
+        while (maxValues < 0 || n < maxValues) {
+            sender_capi_value v;
+            capi->nextValueFromReader(reader, &v);
+            if (v.type == SENDER_CAPI_TYPE_NONE) {
+                break;
+            }
+            switch (v.type) {
+                case SENDER_CAPI_TYPE_BOOLEAN: lua_pushboolean(L, v.boolVal);                    break;
+                case SENDER_CAPI_TYPE_INTEGER: lua_pushinteger(L, v.intVal);                     break;
+                case SENDER_CAPI_TYPE_NUMBER:  lua_pushnumber(L, v.numVal);                      break;
+                case SENDER_CAPI_TYPE_STRING:  lua_pushlstring(L, v.strVal.ptr, v.strVal.len);  break;
+                case SENDER_CAPI_TYPE_ARRAY:   pushArray(L, &v);                                 break;
+                default:                       lua_pushnil(L);                                   break;
+            }
+            lua_rawseti(L, -2, (int)++n);
+        }
+        lua_pushinteger(L, n);
+        lua_setfield(L, -2, "n");
+        lua_rawseti(L, -2, (int)++m);
+    } while (capi->nextMessageFromReader(reader));
+    
+    capi->freeReader(reader);
+    if (m != count) {
+        return luaL_error(L, "count is %d, but reader has %d messages", (int)count, (int)m);
+    }
+    return 1;
+}
+
+#define TRACE_MAX_EVENTS 100
+
+/**
+ * Events recorded by the trace hooks. The hooks are not synchronized, 
+ * therefore they may only be registered by single threaded tests.
+ */
+typedef struct TraceLog {
+    int  enqueue;
+    int  dequeue;
+    int  block_start;
+    int  block_end;
+    int  notify;
+    int  drop;
+    int  eventCount;
+    char events[TRACE_MAX_EVENTS][64];
+} TraceLog;
+
+static TraceLog traceLog;
+
+static void addTraceEvent(TraceLog* log, const char* format, ...)
+{
+    if (log->eventCount < TRACE_MAX_EVENTS) {
+        va_list args;
+        va_start(args, format);
+        vsnprintf(log->events[log->eventCount++], sizeof(log->events[0]), format, args);
+        va_end(args);
+    }
+}
+
+static void trace_enqueue(void* data, long long bufferId, int count, size_t bytes)
+{
+    TraceLog* log = data;
+    log->enqueue += count;
+    addTraceEvent(log, "enqueue %lld %d", bufferId, count);
+}
+
+static void trace_dequeue(void* data, long long bufferId, long long listenerId, int count, size_t bytes)
+{
+    TraceLog* log = data;
+    log->dequeue += count;
+    addTraceEvent(log, "dequeue %lld %lld %d", bufferId, listenerId, count);
+}
+
+static void trace_block_start(void* data, long long objectId)
+{
+    TraceLog* log = data;
+    log->block_start += 1;
+    addTraceEvent(log, "block_start %lld", objectId);
+}
+
+static void trace_block_end(void* data, long long objectId)
+{
+    TraceLog* log = data;
+    log->block_end += 1;
+    addTraceEvent(log, "block_end %lld", objectId);
+}
+
+static void trace_notify(void* data, long long bufferId)
+{
+    TraceLog* log = data;
+    log->notify += 1;
+    addTraceEvent(log, "notify %lld", bufferId);
+}
+
+static void trace_drop(void* data, long long bufferId, int count, int reason)
+{
+    TraceLog* log = data;
+    log->drop += count;
+    addTraceEvent(log, "drop %lld %d %d", bufferId, count, reason);
+}
+
+/* static: mtmsg may still call the hooks after they were unregistered */
+static const mtmsg_trace_hooks traceHooks = {
+    MTMSG_TRACE_CAPI_VERSION_MAJOR,
+    MTMSG_TRACE_CAPI_VERSION_MINOR,
+    &traceLog,
+    trace_enqueue,
+    trace_dequeue,
+    trace_block_start,
+    trace_block_end,
+    trace_notify,
+    trace_drop
+};
+
+/**
+ * capitest.tracehooks(): clears the recorded trace events and returns the 
+ * counting trace hooks as light userdata for mtmsg.tracehooks().
+ */
+static int Capitest_tracehooks(lua_State* L)
+{
+    memset(&traceLog, 0, sizeof(traceLog));
+    lua_pushlightuserdata(L, (void*)&traceHooks);
+    return 1;
+}
+
+/**
+ * capitest.traceevents(): returns a table with the number of messages given
+ * to the enqueue, dequeue and drop hooks and the number of calls of the other
+ * hooks, and a table with the recorded events as strings, e.g. 
+ * "dequeue <bufferId> <listenerId> <count>" or "drop <bufferId> <count> <reason>".
+ * Clears the recorded events.
+ */
+static int Capitest_traceevents(lua_State* L)
+{
+    lua_newtable(L);
+    lua_pushinteger(L, traceLog.enqueue);     lua_setfield(L, -2, "enqueue");
+    lua_pushinteger(L, traceLog.dequeue);     lua_setfield(L, -2, "dequeue");
+    lua_pushinteger(L, traceLog.block_start); lua_setfield(L, -2, "block_start");
+    lua_pushinteger(L, traceLog.block_end);   lua_setfield(L, -2, "block_end");
+    lua_pushinteger(L, traceLog.notify);      lua_setfield(L, -2, "notify");
+    lua_pushinteger(L, traceLog.drop);        lua_setfield(L, -2, "drop");
+    lua_newtable(L);
+    int i;
+    for (i = 0; i < traceLog.eventCount; ++i) {
+        lua_pushstring(L, traceLog.events[i]);
+        lua_rawseti(L, -2, i + 1);
+    }
+    memset(&traceLog, 0, sizeof(traceLog));
+    return 2;
+}
+
+int luaopen_capitest(lua_State* L)
+{
+    if (luaL_newmetatable(L, CAPITEST_PENDING_CLASS_NAME)) {
+        lua_pushcfunction(L, Pending_gc);
+        lua_setfield(L, -2, "__gc");
+    }
+    lua_pop(L, 1);
+
+    lua_newtable(L);
+    lua_pushcfunction(L, Capitest_reserve);
+    lua_setfield(L, -2, "reserve");
+    lua_pushcfunction(L, Capitest_commit);
+    lua_setfield(L, -2, "commit");
+    lua_pushcfunction(L, Capitest_nextmsgs);
+    lua_setfield(L, -2, "nextmsgs");
+    lua_pushcfunction(L, Capitest_tracehooks);
+    lua_setfield(L, -2, "tracehooks");
+    lua_pushcfunction(L, Capitest_traceevents);
+    lua_setfield(L, -2, "traceevents");
+    return 1;
+}
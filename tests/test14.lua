@@ -0,0 +1,75 @@
+local mtmsg  = require("mtmsg")
+
+local function PRINT(s)
+    print(s.." ("..debug.getinfo(2).currentline..")")
+end
+local function msgh(err)
+    return debug.traceback(err, 2)
+end
+local function pcall(f, ...)
+    return xpcall(f, msgh, ...)
+end
+
+PRINT("==================================================================================")
+do
+    local values = { 0, 1, 255, 256, -1, -128, 1000, -1000, 65535, 2^31, -2^31, 2^40, -2^40,
+                     0.5, -0.25, 1.5e10, 0.1, 1/3, math.huge, -math.huge,
+                     1e300, -1e300, 3.5e38, -3.5e38, 1e-300 }
+    if math.maxinteger then
+        values[#values + 1] = math.maxinteger
+        values[#values + 1] = math.mininteger
+    end
+    local b = mtmsg.newbuffer()
+    for _, v in ipairs(values) do
+        b:addmsg(v)
+    end
+    for _, v in ipairs(values) do
+        local v2 = b:nextmsg()
+        assert(v2 == v, tostring(v).." ~= "..tostring(v2))
+        if math.type then
+            assert(math.type(v2) == math.type(v))
+        end
+    end
+    assert(b:nextmsg(0) == nil)
+
+    -- numbers outside of float's range in number arrays
+    b:addmsg({ 0.5, 1e300, -3.5e38, 1e-300 }, { 0.5, math.huge, -math.huge }, 0/0)
+    local t2, t3, nan = b:nextmsg()
+    assert(t2[1] == 0.5 and t2[2] == 1e300 and t2[3] == -3.5e38 and t2[4] == 1e-300)
+    assert(t3[1] == 0.5 and t3[2] == math.huge and t3[3] == -math.huge)
+    assert(nan ~= nan)
+end
+PRINT("==================================================================================")
+do
+    local b = mtmsg.newbuffer()
+    local s1 = string.rep("x", 256)
+    local s2 = string.rep("y", 100000)
+    b:addmsg(s1, s2, 300, s1)
+    local r1, r2, r3, r4 = b:nextmsg()
+    assert(r1 == s1 and r2 == s2 and r3 == 300 and r4 == s1)
+end
+PRINT("==================================================================================")
+do
+    -- small integers and lengths are encoded compactly
+    local b = mtmsg.newbuffer(32, 0)
+    b:addmsg(1000, -1000, 0.5, string.rep("x", 10))
+    assert(select("#", b:nextmsg()) == 4)
+end
+PRINT("==================================================================================")
+do
+    local w = mtmsg.newwriter()
+    local r = mtmsg.newreader()
+    local b = mtmsg.newbuffer()
+    for i = -2000, 2000, 7 do
+        w:add(i, i + 0.5)
+    end
+    w:addmsg(b)
+    r:nextmsg(b)
+    for i = -2000, 2000, 7 do
+        local v1, v2 = r:next(2)
+        assert(v1 == i and v2 == i + 0.5)
+    end
+    assert(r:next(1) == nil)
+end
+PRINT("==================================================================================")
+print("OK.")
@@ -0,0 +1,124 @@
+local mtmsg  = require("mtmsg")
+
+local function PRINT(s)
+    print(s.." ("..debug.getinfo(2).currentline..")")
+end
+local function msgh(err)
+    return debug.traceback(err, 2)
+end
+local function pcall(f, ...)
+    return xpcall(f, msgh, ...)
+end
+
+local function deepEqual(a, b)
+    if type(a) ~= "table" or type(b) ~= "table" then
+        return a == b and (not math.type or math.type(a) == math.type(b))
+    end
+    for k, v in pairs(a) do
+        if not deepEqual(v, b[k]) then return false end
+    end
+    for k, v in pairs(b) do
+        if a[k] == nil then return false end
+    end
+    return true
+end
+
+PRINT("==================================================================================")
+do
+    local values = {
+        {},
+        { 1, 2, 3 },
+        { 1, 2, 300, -4 },
+        { 1.5, 2.5, 0.25 },
+        { 0.1, 0.2, 1/3 },
+        { 1, 2.5, "x" },
+        { a = 1, b = "x", c = { d = true, e = { 1, 2, { f = false } } } },
+        { 1, 2, nil, 4, x = "y" },
+        { [true] = 1, [1.5] = 2, [-1] = 3, [0] = 4 },
+        { string.rep("x", 1000), { string.rep("y", 10) } },
+    }
+    local b = mtmsg.newbuffer()
+    for _, v in ipairs(values) do
+        b:addmsg(v, 1, v)
+    end
+    for _, v in ipairs(values) do
+        local v1, v2, v3 = b:nextmsg()
+        assert(deepEqual(v, v1))
+        assert(v2 == 1)
+        assert(deepEqual(v, v3))
+        assert(v1 ~= v3)
+    end
+    assert(b:nextmsg(0) == nil)
+end
+PRINT("==================================================================================")
+do
+    local t = {}
+    for i = 1, 10000 do t[i] = i * 1000 end
+    local b = mtmsg.newbuffer()
+    b:addmsg(t)
+    assert(deepEqual(t, b:nextmsg()))
+
+    local w = mtmsg.newwriter()
+    local r = mtmsg.newreader()
+    w:add(t, { x = t })
+    w:addmsg(b)
+    r:nextmsg(b)
+    local t1, t2 = r:next(2)
+    assert(deepEqual(t, t1))
+    assert(deepEqual(t, t2.x))
+end
+PRINT("==================================================================================")
+do
+    local shared = { 1, 2 }
+    local t = { shared, shared, { shared } }
+    local b = mtmsg.newbuffer()
+    b:addmsg(t)
+    local t2 = b:nextmsg()
+    assert(deepEqual(t, t2))
+end
+PRINT("==================================================================================")
+do
+    local t = { 1, 2 }
+    t[3] = t
+    local b = mtmsg.newbuffer()
+    local ok, err = pcall(function() b:addmsg("x", t) end)
+    print(err)
+    assert(not ok and err:match("bad argument #2 to 'addmsg' %(cyclic table%)"))
+
+    local t = { a = { b = {} } }
+    t.a.b.c = t.a
+    local ok, err = pcall(function() b:addmsg(t) end)
+    assert(not ok and err:match("cyclic table"))
+
+    local ok, err = pcall(function() b:addmsg({ 1, 2, function() end }) end)
+    print(err)
+    assert(not ok and err:match("parameter type not supported"))
+
+    local t = {}
+    local t1 = t
+    for i = 1, 1000 do
+        t1[1] = {}
+        t1 = t1[1]
+    end
+    local ok, err = pcall(function() b:addmsg(t) end)
+    print(err)
+    assert(not ok and err:match("table nesting too deep"))
+
+    assert(b:nextmsg(0) == nil)
+end
+PRINT("==================================================================================")
+if math.type then
+    -- sequences that mix integers and floats keep the number subtypes
+    local b = mtmsg.newbuffer()
+    local big = 9007199254740993 -- 2^53 + 1
+    b:addmsg({ 1, 0.5, big }, { 0.5, 1, 2.5 }, { 1, 2, big }, { 0.5, 1.5 })
+    local t1, t2, t3, t4 = b:nextmsg()
+    assert(math.type(t1[1]) == "integer" and t1[1] == 1)
+    assert(math.type(t1[2]) == "float"   and t1[2] == 0.5)
+    assert(math.type(t1[3]) == "integer" and t1[3] == big)
+    assert(math.type(t2[1]) == "float" and math.type(t2[2]) == "integer" and t2[3] == 2.5)
+    assert(math.type(t3[3]) == "integer" and t3[3] == big)
+    assert(math.type(t4[1]) == "float" and t4[2] == 1.5)
+end
+PRINT("==================================================================================")
+print("OK.")
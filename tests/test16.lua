@@ -0,0 +1,106 @@
+local mtmsg  = require("mtmsg")
+local llthreads = require("llthreads2.ex")
+
+local function PRINT(s)
+    print(s.." ("..debug.getinfo(2).currentline..")")
+end
+local function msgh(err)
+    return debug.traceback(err, 2)
+end
+local function pcall(f, ...)
+    return xpcall(f, msgh, ...)
+end
+
+PRINT("==================================================================================")
+do
+    local b = mtmsg.newbuffer()
+    b:dictionary()
+    local s = string.rep("x", 40)
+    b:addmsg(s, "status", "event")
+    b:addmsg(s, "status", "event")
+    for i = 1, 2 do
+        local a1, a2, a3 = b:nextmsg()
+        assert(a1 == s and a2 == "status" and a3 == "event")
+    end
+    assert(b:nextmsg(0) == nil)
+    b:addmsg({ event = "x1", status = { event = "ok" } })
+    local t = b:nextmsg()
+    assert(t.event == "x1" and t.status.event == "ok")
+end
+PRINT("==================================================================================")
+do
+    local b = mtmsg.newbuffer()
+    b:dictionary(true)
+    b:addmsg("abc", 1, "abc")
+    b:addmsg("abc", 2, "def")
+    b:dictionary(false)
+    b:addmsg("abc", 3, "def")
+    local r = mtmsg.newreader()
+    for i = 1, 3 do
+        assert(r:nextmsg(b))
+        local a, n = r:next(2)
+        assert(a == "abc" and n == i)
+        collectgarbage()
+        assert(r:next(1) == (i == 1 and "abc" or "def"))
+    end
+end
+PRINT("==================================================================================")
+do
+    local l = mtmsg.newlistener()
+    local b1 = l:newbuffer()
+    local b2 = l:newbuffer()
+    b1:dictionary()
+    b1:addmsg("b1", "event")
+    b2:addmsg("b2", "event")
+    b1:addmsg("b1", "status")
+    local r = mtmsg.newreader()
+    local m = {}
+    for i = 1, 3 do
+        local a1, a2 = l:nextmsg()
+        m[#m + 1] = a1..":"..a2
+    end
+    table.sort(m)
+    assert(table.concat(m, ",") == "b1:event,b1:status,b2:event")
+    b1:addmsg("b1", "status")
+    r:nextmsg(l)
+    b1 = nil
+    collectgarbage()
+    assert(r:next() == "b1")
+    assert(r:next() == "status")
+end
+PRINT("==================================================================================")
+do
+    local b = mtmsg.newbuffer()
+    b:dictionary()
+    local thread = llthreads.new(function(id)
+                                    local mtmsg = require("mtmsg")
+                                    local b = mtmsg.buffer(id)
+                                    for i = 1, 2000 do
+                                        b:addmsg("event", "k"..i, i)
+                                    end
+                                 end,
+                                 b:id())
+    thread:start()
+    for i = 1, 2000 do
+        local e, k, n = b:nextmsg()
+        assert(e == "event" and k == "k"..i and n == i)
+    end
+    assert(thread:join())
+end
+PRINT("==================================================================================")
+do
+    -- references to unknown dictionary entries, e.g. from foreign data
+    local b = mtmsg.newbuffer()
+    b:addmsg(true)
+    local data = b:dump():sub(1, 16).."\2\16\5" -- string reference with index 5
+    local b2 = mtmsg.newbuffer()
+    b2:dictionary()
+    b2:addmsg("abc", "abc")
+    local ok, err = pcall(function() b2:load(data) end)
+    assert(not ok and err:match("corrupt message data"))
+    local a1, a2 = b2:nextmsg()
+    assert(a1 == "abc" and a2 == "abc")
+    assert(b2:nextmsg(0) == nil)
+end
+PRINT("==================================================================================")
+print("OK.")
@@ -0,0 +1,72 @@
+local mtmsg  = require("mtmsg")
+
+local function PRINT(s)
+    print(s.." ("..debug.getinfo(2).currentline..")")
+end
+local function msgh(err)
+    return debug.traceback(err, 2)
+end
+local function pcall(f, ...)
+    return xpcall(f, msgh, ...)
+end
+
+local text = string.rep("2024-01-01 INFO some log line with repeated content\n", 200)
+
+PRINT("==================================================================================")
+do
+    local b = mtmsg.newbuffer(2000, 0)
+    local ok, err = pcall(function() b:addmsg(text) end)
+    assert(not ok and err:match(mtmsg.error.message_size))
+    b:compression()
+    assert(b:addmsg(text, 1, "x"))
+    assert(b:addmsg(text, 2, "x"))
+    local t, n, x = b:nextmsg()
+    assert(t == text and n == 1 and x == "x")
+    local t, n, x = b:nextmsg()
+    assert(t == text and n == 2 and x == "x")
+    assert(b:nextmsg(0) == nil)
+end
+PRINT("==================================================================================")
+do
+    local b = mtmsg.newbuffer()
+    b:compression(100)
+    local r = mtmsg.newreader()
+    local w = mtmsg.newwriter()
+    b:addmsg("short")
+    w:add(text, { 1, 2, 3 })
+    w:addmsg(b)
+    b:addmsg(text, text)
+    assert(b:nextmsg() == "short")
+    assert(r:nextmsg(b))
+    assert(r:next() == text)
+    local t = r:next()
+    assert(#t == 3 and t[3] == 3)
+    local l = mtmsg.newlistener()
+    local b2 = l:newbuffer()
+    b2:compression(true)
+    b2:addmsg(text, text)
+    assert(r:nextmsg(l))
+    assert(r:next() == text and r:next() == text)
+    assert(r:nextmsg(b))
+    assert(r:next() == text and r:next() == text)
+end
+PRINT("==================================================================================")
+do
+    -- incompressible data is stored uncompressed
+    local t = {}
+    local x = 12345
+    for i = 1, 5000 do
+        x = (x * 1103515245 + 12345) % 2147483648
+        t[i] = string.char(x % 256)
+    end
+    local s = table.concat(t)
+    local b = mtmsg.newbuffer()
+    b:compression(1)
+    b:addmsg(s)
+    assert(b:nextmsg() == s)
+    b:compression(false)
+    b:addmsg(text)
+    assert(b:nextmsg() == text)
+end
+PRINT("==================================================================================")
+print("OK.")
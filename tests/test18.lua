@@ -0,0 +1,140 @@
+local mtmsg  = require("mtmsg")
+local llthreads = require("llthreads2.ex")
+
+local function PRINT(s)
+    print(s.." ("..debug.getinfo(2).currentline..")")
+end
+local function msgh(err)
+    return debug.traceback(err, 2)
+end
+local function pcall(f, ...)
+    return xpcall(f, msgh, ...)
+end
+
+PRINT("==================================================================================")
+do
+    local b = mtmsg.newbuffer()
+    b:spill(100)
+    local s = string.rep("x", 40)
+    for i = 1, 1000 do
+        b:addmsg(i, s)
+    end
+    assert(b:msgcnt() == 1000)
+    for i = 1, 500 do
+        local n, s2 = b:nextmsg()
+        assert(n == i and s2 == s)
+    end
+    for i = 1001, 1100 do
+        b:addmsg(i, s)
+    end
+    b:spill(false)
+    b:addmsg(1101, s)
+    for i = 501, 1101 do
+        local n, s2 = b:nextmsg()
+        assert(n == i and s2 == s)
+    end
+    assert(b:nextmsg(0) == nil)
+    b:addmsg("a")
+    assert(b:nextmsg() == "a")
+end
+PRINT("==================================================================================")
+do
+    -- fixed size buffer is not full if messages are spilled
+    local b = mtmsg.newbuffer(100, 0)
+    b:spill(50)
+    for i = 1, 100 do
+        assert(b:addmsg(i, string.rep("y", 30)))
+    end
+    local ok, err = pcall(function() b:addmsg(string.rep("z", 200)) end)
+    assert(not ok and err:match(mtmsg.error.message_size))
+    b:clear()
+    assert(b:nextmsg(0) == nil)
+    b:addmsg(1, 2)
+    b:addmsg(3, 4)
+    assert(b:nextmsg() == 1)
+    assert(b:nextmsg() == 3)
+    assert(b:nextmsg(0) == nil)
+end
+PRINT("==================================================================================")
+do
+    local l = mtmsg.newlistener()
+    local b1 = l:newbuffer()
+    local b2 = l:newbuffer()
+    b1:spill(64)
+    b2:spill(64)
+    b2:dictionary()
+    b2:compression(50)
+    local text = string.rep("some text ", 20)
+    for i = 1, 200 do
+        b1:addmsg("b1", i)
+        b2:addmsg("b2", i, text)
+    end
+    local n1, n2 = 0, 0
+    for i = 1, 400 do
+        local id, n, t = l:nextmsg()
+        if id == "b1" then
+            n1 = n1 + 1; assert(n == n1)
+        else
+            n2 = n2 + 1; assert(n == n2 and t == text)
+        end
+    end
+    assert(n1 == 200 and n2 == 200)
+    assert(l:nextmsg(0) == nil)
+end
+PRINT("==================================================================================")
+do
+    local b = mtmsg.newbuffer()
+    b:spill(1000)
+    local thread = llthreads.new(function(id)
+                                    local mtmsg = require("mtmsg")
+                                    local b = mtmsg.buffer(id)
+                                    for i = 1, 20000 do
+                                        b:addmsg("event", i)
+                                    end
+                                 end,
+                                 b:id())
+    thread:start()
+    for i = 1, 20000 do
+        local e, n = b:nextmsg()
+        assert(e == "event" and n == i)
+    end
+    assert(thread:join())
+end
+PRINT("==================================================================================")
+do
+    -- spilled messages that cannot be read back raise an error (Linux only: 
+    -- the temporary file is truncated via /proc)
+    local function truncateSpillFile(marker)
+        for fd = 3, 255 do
+            local f = io.open("/proc/self/fd/"..fd, "rb")
+            local data = f and f:read("*a")
+            if f then f:close() end
+            if data and data:find(marker, 1, true) then
+                io.open("/proc/self/fd/"..fd, "wb"):close()
+                return true
+            end
+        end
+        return false
+    end
+    local b = mtmsg.newbuffer()
+    b:spill(2000)
+    local s = string.rep("spilled", 1000)
+    for i = 1, 10 do
+        b:addmsg(i, s)
+    end
+    assert(b:nextmsg() == 1) -- spilled messages are read back and written out
+    if truncateSpillFile(s) then
+        assert(b:nextmsg() == 2)
+        local ok, err = pcall(function() b:nextmsg() end)
+        assert(not ok and err:match(mtmsg.error.file_error) and err:match("cannot read spill file"))
+        local ok, err = pcall(function() b:nextmsg() end)
+        assert(not ok and err:match("cannot read spill file"))
+        assert(not b:addmsg(11, s))
+        b:clear()
+        assert(b:addmsg(12, s))
+        assert(b:nextmsg() == 12)
+        assert(b:nextmsg(0) == nil)
+    end
+end
+PRINT("==================================================================================")
+print("OK.")
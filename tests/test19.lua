@@ -0,0 +1,166 @@
+local mtmsg  = require("mtmsg")
+
+local function PRINT(s)
+    print(s.." ("..debug.getinfo(2).currentline..")")
+end
+local function msgh(err)
+    return debug.traceback(err, 2)
+end
+local function pcall(f, ...)
+    return xpcall(f, msgh, ...)
+end
+
+local fileName = os.tmpname()
+os.remove(fileName)
+
+PRINT("==================================================================================")
+do
+    local b = mtmsg.newbuffer{ file = fileName, size = 10000 }
+    for i = 1, 100 do
+        b:addmsg(i, "message "..i, { i })
+    end
+    for i = 1, 10 do
+        local n, s, t = b:nextmsg()
+        assert(n == i and s == "message "..i and t[1] == i)
+    end
+    local ok, err = pcall(function() mtmsg.newbuffer{ file = fileName } end)
+    print(err)
+    assert(not ok and err:match(mtmsg.error.file_error) and err:match("file is in use"))
+    b:close()
+end
+PRINT("==================================================================================")
+do
+    local b = mtmsg.newbuffer{ file = fileName, sync = "always" }
+    assert(b:msgcnt() == 90)
+    for i = 11, 20 do
+        local n, s = b:nextmsg()
+        assert(n == i and s == "message "..i)
+    end
+    b:addmsg("last")
+    b = nil
+    collectgarbage()
+end
+PRINT("==================================================================================")
+do
+    local l = mtmsg.newlistener()
+    local b = l:newbuffer{ file = fileName }
+    assert(b:msgcnt() == 81)
+    for i = 21, 100 do
+        local n, s = l:nextmsg()
+        assert(n == i and s == "message "..i)
+    end
+    assert(l:nextmsg() == "last")
+    assert(l:nextmsg(0) == nil)
+    b:close()
+    b = mtmsg.newbuffer{ file = fileName }
+    assert(b:msgcnt() == 0)
+    b:close()
+end
+PRINT("==================================================================================")
+do
+    -- file buffer has fixed size, messages are never moved over unconsumed messages
+    os.remove(fileName)
+    local b = mtmsg.newbuffer{ file = fileName, size = 100 }
+    local s = string.rep("x", 30)
+    assert(b:addmsg(s))
+    assert(b:addmsg(s))
+    assert(b:addmsg(s))
+    assert(not b:addmsg(s))
+    assert(b:nextmsg() == s)
+    assert(not b:addmsg(s))
+    assert(b:nextmsg() == s)
+    assert(b:addmsg(s))
+    assert(b:nextmsg() == s)
+    assert(b:nextmsg() == s)
+    assert(b:nextmsg(0) == nil)
+    local ok, err = pcall(function() b:addmsg(string.rep("x", 200)) end)
+    assert(not ok and err:match(mtmsg.error.message_size))
+    b:setmsg(1, 2)
+    b:close()
+    b = mtmsg.newbuffer{ file = fileName }
+    local x, y = b:nextmsg()
+    assert(x == 1 and y == 2)
+    local ok, err = pcall(function() b:dictionary() end)
+    assert(not ok and err:match("not supported for file buffers"))
+    local ok, err = pcall(function() b:spill(10) end)
+    assert(not ok and err:match("not supported for file buffers"))
+    b:close()
+end
+PRINT("==================================================================================")
+do
+    -- messages near the end of the file are not overwritten when moved to the front
+    os.remove(fileName)
+    local b = mtmsg.newbuffer{ file = fileName, size = 100 }
+    local function s(i) return string.rep(tostring(i), 17) end -- 20 bytes
+    local s2 = string.rep("y", 47) -- 50 bytes
+    for i = 1, 5 do
+        assert(b:addmsg(s(i)))
+    end
+    for i = 1, 3 do
+        assert(b:nextmsg() == s(i))
+    end
+    assert(not b:addmsg(s2))
+    b:close()
+    b = mtmsg.newbuffer{ file = fileName }
+    assert(b:msgcnt() == 2)
+    assert(b:nextmsg() == s(4))
+    assert(b:addmsg(s2))
+    assert(b:nextmsg() == s(5))
+    assert(b:nextmsg() == s2)
+    assert(b:nextmsg(0) == nil)
+    b:close()
+end
+PRINT("==================================================================================")
+do
+    local f = io.open(fileName, "wb")
+    f:write("no message file")
+    f:close()
+    local ok, err = pcall(function() mtmsg.newbuffer{ file = fileName } end)
+    print(err)
+    assert(not ok and err:match(mtmsg.error.file_error) and err:match("invalid file format"))
+    local ok, err = pcall(function() mtmsg.newbuffer{ file = fileName, sync = "sometimes" } end)
+    assert(not ok and err:match("sync must be"))
+    os.remove(fileName)
+end
+PRINT("==================================================================================")
+do
+    -- pointers are not valid after the file is reopened
+    os.remove(fileName)
+    local b = mtmsg.newbuffer{ file = fileName, size = 1000 }
+    local ok, err = pcall(function() b:addmsg(1, string.rep) end)
+    assert(not ok and err:match("cannot be stored in a file"))
+    local ok, err = pcall(function() b:addmsg({ f = string.rep }) end)
+    assert(not ok and err:match("cannot be stored in a file"))
+    local w = mtmsg.newwriter()
+    w:add(1, print)
+    local ok, err = pcall(function() w:addmsg(b) end)
+    assert(not ok and err:match("cannot be stored in a file"))
+    assert(b:msgcnt() == 0)
+    b:addmsg(0.1)
+    b:close()
+    if string.pack then
+        -- a number that is turned into a light userdata in the file is rejected
+        local f = io.open(fileName, "rb")
+        local data = f:read("*a")
+        f:close()
+        local pos = data:find("\3"..string.pack("d", 0.1), 4097, true)
+        assert(pos)
+        f = io.open(fileName, "r+b")
+        f:seek("set", pos - 1)
+        f:write("\7")
+        f:close()
+        local ok, err = pcall(function() mtmsg.newbuffer{ file = fileName } end)
+        print(err)
+        assert(not ok and err:match(mtmsg.error.file_error) and err:match("corrupt message data"))
+    end
+    os.remove(fileName)
+end
+PRINT("==================================================================================")
+do
+    local b = mtmsg.newbuffer{ name = "optbuffer", size = 10, grow = 0 }
+    assert(b:name() == "optbuffer")
+    local ok, err = pcall(function() b:addmsg(string.rep("x", 20)) end)
+    assert(not ok and err:match(mtmsg.error.message_size))
+end
+PRINT("==================================================================================")
+print("OK.")
@@ -0,0 +1,101 @@
+local mtmsg  = require("mtmsg")
+
+local function PRINT(s)
+    print(s.." ("..debug.getinfo(2).currentline..")")
+end
+local function msgh(err)
+    return debug.traceback(err, 2)
+end
+local function pcall(f, ...)
+    return xpcall(f, msgh, ...)
+end
+
+PRINT("==================================================================================")
+do
+    local b = mtmsg.newbuffer()
+    for i = 1, 1000 do
+        b:addmsg(i, "message "..i, { x = i })
+    end
+    local d = b:dump()
+    assert(b:msgcnt() == 1000)
+
+    local b2 = mtmsg.newbuffer()
+    b2:addmsg("first")
+    assert(b2:load(d) == true)
+    assert(b2:msgcnt() == 1001)
+    assert(b2:nextmsg() == "first")
+    for i = 1, 1000 do
+        local n, s, t = b2:nextmsg()
+        assert(n == i and s == "message "..i and t.x == i)
+    end
+    assert(b2:nextmsg(0) == nil)
+    assert(b2:load(mtmsg.newbuffer():dump()) == true)
+    assert(b2:nextmsg(0) == nil)
+end
+PRINT("==================================================================================")
+do
+    local fileName = os.tmpname()
+    local b = mtmsg.newbuffer()
+    b:spill(100)
+    for i = 1, 100 do
+        b:addmsg(i, string.rep("x", i))
+    end
+    b:dumpfile(fileName)
+    local l = mtmsg.newlistener()
+    local b2 = l:newbuffer()
+    assert(b2:loadfile(fileName))
+    for i = 1, 100 do
+        local n, s = l:nextmsg()
+        assert(n == i and s == string.rep("x", i))
+    end
+    os.remove(fileName)
+    local ok, err = pcall(function() b2:loadfile(fileName) end)
+    assert(not ok and err:match(mtmsg.error.file_error))
+end
+PRINT("==================================================================================")
+do
+    local b = mtmsg.newbuffer(100, 0)
+    local b2 = mtmsg.newbuffer()
+    for i = 1, 10 do
+        b2:addmsg(string.rep("x", 20))
+    end
+    assert(b:load(b2:dump()) == false)
+    assert(b:msgcnt() == 0)
+
+    local d = b2:dump()
+    local ok, err = pcall(function() b:load("xyz") end)
+    assert(not ok and err:match("invalid dump format"))
+    local ok, err = pcall(function() b:load(d:sub(1, 8).."\99"..d:sub(10)) end)
+    assert(not ok and err:match("unsupported dump version"))
+    local ok, err = pcall(function() b:load(d:sub(1, 9).."\99"..d:sub(11)) end)
+    assert(not ok and err:match("incompatible platform"))
+    local ok, err = pcall(function() b:load(d:sub(1, -2)) end)
+    assert(not ok and err:match("corrupt message data"))
+
+    -- values must lie within their message
+    local b3 = mtmsg.newbuffer()
+    b3:addmsg("abc")
+    local d = b3:dump()
+    assert(d:byte(-4) == 3)
+    local ok, err = pcall(function() b:load(d:sub(1, -5).."\50"..d:sub(-3)) end)
+    assert(not ok and err:match("corrupt message data"))
+    b3:clear()
+    b3:addmsg({ 1, 2, 3 })
+    local d = b3:dump()
+    assert(d:byte(-4) == 3)
+    local ok, err = pcall(function() b:load(d:sub(1, -5).."\100"..d:sub(-3)) end)
+    assert(not ok and err:match("corrupt message data"))
+
+    -- pointers are only valid in the process that added them
+    b3:clear()
+    b3:addmsg(print)
+    local ok, err = pcall(function() b:load(b3:dump()) end)
+    assert(not ok and err:match("corrupt message data"))
+    assert(b:msgcnt() == 0)
+
+    b2:dictionary()
+    local ok, err = pcall(function() b2:dump() end)
+    assert(not ok and err:match("string dictionary"))
+end
+PRINT("==================================================================================")
+print("OK.")
@@ -0,0 +1,124 @@
+local mtmsg  = require("mtmsg")
+
+local function PRINT(s)
+    print(s.." ("..debug.getinfo(2).currentline..")")
+end
+local function msgh(err)
+    return debug.traceback(err, 2)
+end
+local function pcall(f, ...)
+    return xpcall(f, msgh, ...)
+end
+
+local lua = arg[-1] or "lua"
+local shmName = "/mtmsg-test21-"..os.time().."-"..math.random(1000000)
+
+PRINT("==================================================================================")
+do
+    local b1 = mtmsg.newbuffer{ shm = shmName, size = 10000 }
+    local b2 = mtmsg.newbuffer{ shm = shmName }
+    assert(b1:id() ~= b2:id())
+    b1:addmsg(1, "a", { x = 1 })
+    b1:addmsg(2, "b")
+    assert(b2:msgcnt() == 2)
+    local n, s, t = b2:nextmsg()
+    assert(n == 1 and s == "a" and t.x == 1)
+    assert(b1:msgcnt() == 1)
+    b1:close()
+    assert(b2:nextmsg() == 2)
+    assert(b2:nextmsg(0) == nil)
+    b2:addmsg("kept")
+end
+collectgarbage()
+PRINT("==================================================================================")
+do
+    -- messages are kept in shared memory until it is unlinked
+    local b = mtmsg.newbuffer{ shm = shmName }
+    assert(b:nextmsg(0) == "kept")
+    -- another process adds messages
+    assert(os.execute(lua..[[ -e '
+        local mtmsg = require("mtmsg")
+        local b = mtmsg.newbuffer{ shm = "]]..shmName..[[" }
+        for i = 1, 5000 do
+            while not b:addmsg("msg", i) do
+                mtmsg.sleep(0.001)
+            end
+        end
+        b:addmsg("done")
+    ' &]]))
+    for i = 1, 5000 do
+        local m, n = b:nextmsg(10)
+        assert(m == "msg" and n == i)
+    end
+    assert(b:nextmsg(10) == "done")
+end
+PRINT("==================================================================================")
+do
+    local l = mtmsg.newlistener()
+    local ok, err = pcall(function() l:newbuffer{ shm = shmName } end)
+    assert(not ok and err:match("cannot be connected to a listener"))
+    local ok, err = pcall(function() mtmsg.newbuffer{ shm = shmName, file = "x" } end)
+    assert(not ok and err:match("cannot be used together"))
+end
+PRINT("==================================================================================")
+do
+    -- the buffer is aborted if another process dies while holding the lock
+    local b = mtmsg.newbuffer{ shm = shmName }
+    local pidFile = os.tmpname()
+    local died = false
+    for i = 1, 50 do
+        assert(os.execute(lua..[[ -e '
+            local mtmsg = require("mtmsg")
+            local b = mtmsg.newbuffer{ shm = "]]..shmName..[[" }
+            while true do
+                b:addmsg("x")
+                b:nextmsg(0)
+            end
+        ' & echo $! > ]]..pidFile))
+        mtmsg.sleep(0.1)
+        local f = io.open(pidFile)
+        local pid = f:read("*n")
+        f:close()
+        assert(os.execute("kill -9 "..pid))
+        mtmsg.sleep(0.1)
+        b:msgcnt()
+        if b:isabort() then
+            died = true
+            local ok, err = pcall(function() b:addmsg("y") end)
+            assert(not ok and err:match(mtmsg.error.operation_aborted))
+            b:abort(false)
+            break
+        end
+    end
+    os.remove(pidFile)
+    assert(died)
+    b:clear()
+    b:addmsg("z")
+    assert(b:nextmsg(0) == "z")
+    assert(not b:isabort())
+end
+PRINT("==================================================================================")
+do
+    -- shared memory with another header layout is rejected
+    local name = shmName.."-v"
+    mtmsg.newbuffer{ shm = name, size = 1000 }
+    local f = io.open("/dev/shm"..name, "r+b")
+    if f then
+        f:seek("set", 8) -- version
+        f:write("\1\0\0\0")
+        f:close()
+        local ok, err = pcall(function() mtmsg.newbuffer{ shm = name } end)
+        assert(not ok and err:match("invalid file format"))
+    end
+    assert(mtmsg.unlinkshm(name) == true)
+end
+PRINT("==================================================================================")
+do
+    assert(mtmsg.unlinkshm(shmName) == true)
+    assert(mtmsg.unlinkshm(shmName) == false)
+    local ok, err = pcall(function() mtmsg.newbuffer{ shm = "/a/b" } end)
+    print(err)
+    assert(not ok and err:match(mtmsg.error.file_error))
+end
+PRINT("==================================================================================")
+print("OK.")
@@ -0,0 +1,190 @@
+local mtmsg  = require("mtmsg")
+
+local function PRINT(s)
+    print(s.." ("..debug.getinfo(2).currentline..")")
+end
+local function msgh(err)
+    return debug.traceback(err, 2)
+end
+local function pcall(f, ...)
+    return xpcall(f, msgh, ...)
+end
+
+local lua = arg[-1] or "lua"
+local socketPath = os.tmpname()
+os.remove(socketPath)
+
+local function waitFor(f)
+    local endTime = mtmsg.time() + 10
+    while not f() do
+        assert(mtmsg.time() < endTime, "timeout")
+        mtmsg.sleep(0.001)
+    end
+end
+
+PRINT("==================================================================================")
+do
+    local b1 = mtmsg.newbuffer()
+    local b2 = mtmsg.newbuffer()
+    local r  = mtmsg.newbridge(b2, socketPath, "receive")
+    local s  = mtmsg.newbridge(b1, socketPath)
+    assert(mtmsg.type(s) == "mtmsg.bridge" or _VERSION == "Lua 5.1" or _VERSION == "Lua 5.2")
+    assert(s:isrunning() and r:isrunning())
+    b1:addmsg("a", 1, { x = true })
+    b1:addmsg(string.rep("x", 100000))
+    for i = 1, 10000 do
+        b1:addmsg(i)
+    end
+    local a, n, t = b2:nextmsg(10)
+    assert(a == "a" and n == 1 and t.x == true)
+    assert(b2:nextmsg(10) == string.rep("x", 100000))
+    for i = 1, 10000 do
+        assert(b2:nextmsg(10) == i)
+    end
+    waitFor(function() return s:msgcnt() == 10002 end)
+    assert(r:msgcnt() == 10002)
+    s:close()
+    waitFor(function() return not r:isrunning() end)
+    assert(s:error() == nil and r:error() == nil)
+    r:close()
+    assert(b2:nextmsg(0) == nil)
+end
+PRINT("==================================================================================")
+do
+    -- receiving buffer that should not grow
+    local b1 = mtmsg.newbuffer()
+    local b2 = mtmsg.newbuffer(100, 0)
+    local r  = mtmsg.newbridge(b2, socketPath, "receive")
+    local s  = mtmsg.newbridge(b1, socketPath)
+    for i = 1, 1000 do
+        b1:addmsg("msg", i)
+    end
+    for i = 1, 1000 do
+        local m, n = b2:nextmsg(10)
+        assert(m == "msg" and n == i)
+    end
+    b1:addmsg(string.rep("x", 200))
+    waitFor(function() return not r:isrunning() end)
+    assert(r:error():match("too large"))
+    s:close()
+    r:close()
+end
+PRINT("==================================================================================")
+do
+    -- unsent messages are put back if the bridge is closed
+    local b1 = mtmsg.newbuffer()
+    local b2 = mtmsg.newbuffer(2000, 0)
+    local r  = mtmsg.newbridge(b2, socketPath, "receive")
+    local s  = mtmsg.newbridge(b1, socketPath)
+    local x  = string.rep("x", 1000)
+    for i = 1, 5000 do
+        b1:addmsg(i, x)
+    end
+    waitFor(function() return b1:msgcnt() < 5000 end)
+    mtmsg.sleep(0.2)
+    s:close()
+    assert(s:error() == nil)
+    local sent = s:msgcnt()
+    assert(sent < 5000 and b1:msgcnt() == 5000 - sent)
+    for i = 1, sent do
+        local n, m = b2:nextmsg(10)
+        assert(n == i and m == x)
+    end
+    waitFor(function() return not r:isrunning() end)
+    assert(r:msgcnt() == sent)
+    r:close()
+    for i = sent + 1, 5000 do
+        local n, m = b1:nextmsg(0)
+        assert(n == i and m == x)
+    end
+end
+PRINT("==================================================================================")
+do
+    -- other files are not removed
+    local f = io.open(socketPath, "w")
+    f:write("x")
+    f:close()
+    local ok, err = pcall(function() mtmsg.newbridge(mtmsg.newbuffer(), socketPath, "receive") end)
+    assert(not ok and err:match(mtmsg.error.file_error))
+    local f = io.open(socketPath, "r")
+    assert(f:read("*a") == "x")
+    f:close()
+    os.remove(socketPath)
+
+    -- sockets that are in use are not removed
+    local b1 = mtmsg.newbuffer()
+    local r1 = mtmsg.newbridge(b1, socketPath, "receive")
+    local ok, err = pcall(function() mtmsg.newbridge(mtmsg.newbuffer(), socketPath, "receive") end)
+    assert(not ok and err:match(mtmsg.error.file_error))
+    mtmsg.sleep(0.2)
+    assert(r1:isrunning() and r1:error() == nil)
+    local b2 = mtmsg.newbuffer()
+    local s1 = mtmsg.newbridge(b2, socketPath)
+    b2:addmsg("ok")
+    assert(b1:nextmsg(10) == "ok")
+    s1:close()
+    r1:close()
+end
+PRINT("==================================================================================")
+do
+    local b = mtmsg.newbuffer()
+    local ok, err = pcall(function() mtmsg.newbridge(b, socketPath) end)
+    print(err)
+    assert(not ok and err:match(mtmsg.error.file_error))
+    local ok, err = pcall(function() mtmsg.newbridge(b, socketPath, "x") end)
+    assert(not ok and err:match("\"send\" or \"receive\" expected"))
+
+    local r  = mtmsg.newbridge(mtmsg.newbuffer(), socketPath, "receive")
+    local s  = mtmsg.newbridge(b, socketPath)
+    b:dictionary()
+    b:addmsg("x")
+    waitFor(function() return not s:isrunning() end)
+    assert(s:error() == "buffer has a string dictionary")
+    s:close()
+    r:close()
+end
+PRINT("==================================================================================")
+do
+    -- portable stream does not forward native messages
+    local b  = mtmsg.newbuffer()
+    local b2 = mtmsg.newbuffer()
+    b:addmsg(1)
+    b:portable()
+    local r  = mtmsg.newbridge(b2, socketPath, "receive")
+    local s  = mtmsg.newbridge(b, socketPath)
+    waitFor(function() return not s:isrunning() end)
+    assert(s:error() == "buffer contains messages that are not portable")
+    assert(b:msgcnt() == 1 and b2:msgcnt() == 0)
+    s:close()
+    r:close()
+    assert(b:nextmsg(0) == 1)
+end
+PRINT("==================================================================================")
+do
+    -- messages from another process
+    local b = mtmsg.newbuffer()
+    local r = mtmsg.newbridge(b, socketPath, "receive")
+    assert(os.execute(lua..[[ -e '
+        local mtmsg = require("mtmsg")
+        local b = mtmsg.newbuffer()
+        local s = mtmsg.newbridge(b, "]]..socketPath..[[")
+        for i = 1, 5000 do
+            b:addmsg("msg", i)
+        end
+        b:addmsg("done")
+        while s:msgcnt() < 5001 do
+            mtmsg.sleep(0.001)
+        end
+    ' &]]))
+    for i = 1, 5000 do
+        local m, n = b:nextmsg(10)
+        assert(m == "msg" and n == i)
+    end
+    assert(b:nextmsg(10) == "done")
+    waitFor(function() return not r:isrunning() end)
+    assert(r:error() == nil)
+    r:close()
+end
+PRINT("==================================================================================")
+os.remove(socketPath)
+print("OK.")
@@ -0,0 +1,159 @@
+local mtmsg  = require("mtmsg")
+
+local function PRINT(s)
+    print(s.." ("..debug.getinfo(2).currentline..")")
+end
+local function msgh(err)
+    return debug.traceback(err, 2)
+end
+local function pcall(f, ...)
+    return xpcall(f, msgh, ...)
+end
+
+local lua = arg[-1] or "lua"
+local fileName = os.tmpname()
+
+local function execute(cmd)
+    local rc = os.execute(cmd)
+    return rc == true or rc == 0
+end
+
+local producer = [[ -e '
+    local mtmsg = require("mtmsg")
+    local b = mtmsg.newbuffer(100, 0)
+    local n = 0
+    for i = 1, 10000 do
+        if not b:addmsg("msg", i, { i }) then
+            n = n + b:writeto(1, 7)
+            assert(b:addmsg("msg", i, { i }))
+        end
+    end
+    while not b:addmsg(string.rep("x", 50)) do
+        n = n + b:writeto(1)
+    end
+    while b:msgcnt() > 0 do
+        n = n + b:writeto(1)
+    end
+    assert(n == 10001)
+']]
+
+local consumer = [[ -e '
+    local mtmsg = require("mtmsg")
+    local b = mtmsg.newbuffer()
+    local n = 0
+    while true do
+        local c = b:readfrom(0)
+        if not c then break end
+        n = n + c
+    end
+    assert(n == 10001 and b:msgcnt() == n)
+    for i = 1, 10000 do
+        local m, j, t = b:nextmsg(0)
+        assert(m == "msg" and j == i and t[1] == i)
+    end
+    assert(b:nextmsg(0) == string.rep("x", 50))
+']]
+
+PRINT("==================================================================================")
+do
+    -- pipe
+    assert(execute(lua..producer.." | "..lua..consumer))
+    assert(not execute(lua.." -e 'assert(false)' 2>/dev/null | "..lua..consumer.." 2>/dev/null"))
+end
+PRINT("==================================================================================")
+do
+    -- file
+    assert(execute(lua..producer.." > "..fileName))
+    assert(execute(lua..consumer.." < "..fileName))
+end
+PRINT("==================================================================================")
+do
+    -- receiving buffer is full
+    assert(execute(lua..[[ -e '
+        local mtmsg = require("mtmsg")
+        local b = mtmsg.newbuffer(60, 0)
+        local n = 0
+        while n < 10001 do
+            local c = b:readfrom(0)
+            assert(c)
+            for i = 1, c do
+                b:nextmsg(0)
+            end
+            n = n + c
+        end
+        assert(b:readfrom(0) == nil)
+    ' < ]]..fileName))
+    assert(execute(lua..[[ -e '
+        local mtmsg = require("mtmsg")
+        local b = mtmsg.newbuffer(10, 0)
+        local ok, err = pcall(function() while true do b:readfrom(0) b:nextmsg(0) end end)
+        assert(not ok and err:match(mtmsg.error.message_size))
+    ' < ]]..fileName))
+end
+PRINT("==================================================================================")
+do
+    local b = mtmsg.newbuffer()
+    assert(b:writeto(-1) == 0)
+    b:addmsg("x")
+    b:addmsg("y")
+    local ok, err = pcall(function() b:writeto(-1) end)
+    print(err)
+    assert(not ok and err:match(mtmsg.error.file_error))
+    -- messages are not lost if writing fails
+    assert(b:msgcnt() == 2 and b:stats().dequeued_msgs == 0)
+    b:addmsg("z")
+    local ok, err = pcall(function() b:writeto(-1, 1) end)
+    assert(not ok and err:match(mtmsg.error.file_error))
+    assert(b:nextmsg(0) == "x" and b:nextmsg(0) == "y" and b:nextmsg(0) == "z")
+    assert(b:nextmsg(0) == nil)
+    local ok, err = pcall(function() b:readfrom(-1) end)
+    assert(not ok and err:match(mtmsg.error.file_error))
+
+    local b2 = mtmsg.newbuffer(20, 0)
+    b2:addmsg("x")
+    b2:addmsg("y")
+    local ok, err = pcall(function() b2:writeto(-1) end)
+    assert(not ok and err:match(mtmsg.error.file_error))
+    assert(b2:nextmsg(0) == "x" and b2:nextmsg(0) == "y")
+
+    b:dictionary()
+    b:addmsg("x")
+    local ok, err = pcall(function() b:writeto(-1) end)
+    assert(not ok and err:match("string dictionary"))
+end
+PRINT("==================================================================================")
+do
+    -- waiting for a full pipe can be aborted
+    os.remove(fileName)
+    assert(execute(lua..[[ -e '
+        local mtmsg     = require("mtmsg")
+        local llthreads = require("llthreads2.ex")
+        local b = mtmsg.newbuffer()
+        for i = 1, 100 do
+            b:addmsg(i, string.rep("x", 10000))
+        end
+        local thread = llthreads.new(function(id)
+                                         local mtmsg = require("mtmsg")
+                                         mtmsg.sleep(0.3)
+                                         mtmsg.buffer(id):abort()
+                                     end,
+                                     b:id())
+        thread:start()
+        local ok, err = pcall(function() b:writeto(1) end)
+        assert(not ok and err:match(mtmsg.error.operation_aborted))
+        assert(thread:join())
+        b:abort(false)
+        local n = b:msgcnt()
+        assert(n > 0 and n < 100)
+        assert(select(1, b:nextmsg(0)) == 101 - n)
+        local f = io.open("]]..fileName..[[", "w")
+        f:write("done")
+        f:close()
+    ' | sleep 2]]))
+    local f = io.open(fileName)
+    assert(f and f:read("*a") == "done")
+    f:close()
+end
+PRINT("==================================================================================")
+os.remove(fileName)
+print("OK.")
@@ -0,0 +1,181 @@
+local mtmsg  = require("mtmsg")
+local carray = require("carray")
+
+local function PRINT(s)
+    print(s.." ("..debug.getinfo(2).currentline..")")
+end
+local function msgh(err)
+    return debug.traceback(err, 2)
+end
+local function pcall(f, ...)
+    return xpcall(f, msgh, ...)
+end
+
+local function deepEqual(a, b)
+    if type(a) ~= "table" or type(b) ~= "table" then
+        return a == b or (a ~= a and b ~= b)
+    end
+    for k, v in pairs(a) do
+        if not deepEqual(v, b[k]) then return false end
+    end
+    for k in pairs(b) do
+        if a[k] == nil then return false end
+    end
+    return true
+end
+
+local maxint = math.maxinteger or 2^53
+local minint = math.mininteger or -2^53
+
+PRINT("==================================================================================")
+do
+    local b = mtmsg.newbuffer()
+    b:portable()
+    local values = { 0, 1, 255, 256, -1, 1000000, maxint, minint, 0.5, 1/3, -1e300,
+                     math.huge, "", "x", string.rep("y", 1000), true, false,
+                     { 1, 2, 3 }, { 1000, -2, maxint }, { 0.5, 1.5 }, { 0.1, 1e200 },
+                     { a = { b = { 1, "c", x = false } } } }
+    for i, v in ipairs(values) do
+        b:addmsg(v, nil, v)
+    end
+    for i, v in ipairs(values) do
+        local v1, n, v2 = b:nextmsg(0)
+        assert(deepEqual(v1, v) and n == nil and deepEqual(v2, v), i)
+    end
+    local x, y = math.tointeger and math.tointeger(3), 0/0
+    b:addmsg(x, y)
+    local x1, y1 = b:nextmsg(0)
+    assert(x1 == x and y1 ~= y1)
+    assert(not math.type or math.type(x1) == "integer")
+end
+PRINT("==================================================================================")
+do
+    -- byte layout: little endian with fixed size
+    local b = mtmsg.newbuffer()
+    b:portable()
+    b:addmsg(maxint)
+    b:addmsg(0.1)
+    local d = b:dump()
+    assert(#d == 16 + 2 * 12)
+    assert(d:byte(14) == 1)
+    if math.maxinteger then
+        assert(d:sub(17, 28) == "\11\18\1\1\255\255\255\255\255\255\255\127")
+    end
+    assert(d:sub(29, 40) == "\11\18\1\3\154\153\153\153\153\153\185\63")
+
+    -- dumps of portable buffers are not checked for the platform
+    local foreign = d:sub(1, 9).."\255\255\255\255"..d:sub(14)
+    local b2 = mtmsg.newbuffer()
+    assert(b2:load(foreign))
+    assert(b2:nextmsg(0) == maxint)
+    assert(b2:nextmsg(0) == 0.1)
+
+    b:portable(false)
+    b:clear()
+    b:addmsg(1)
+    local d = b:dump()
+    assert(d:byte(14) == 0)
+    local ok, err = pcall(function() b2:load(d:sub(1, 9).."\255"..d:sub(11)) end)
+    assert(not ok and err:match("incompatible platform"))
+
+    -- messages keep the format they were added with, the dump is only
+    -- portable if all messages are portable
+    b:portable(true)
+    local d = b:dump()
+    assert(d:byte(14) == 0)
+    b:addmsg(2)
+    b:compression(1)
+    b:addmsg(string.rep("x", 100))
+    assert(b:dump():byte(14) == 0)
+    assert(b:nextmsg() == 1)
+    local d = b:dump()
+    assert(d:byte(14) == 1)
+    assert(b2:load(d:sub(1, 9).."\255"..d:sub(11)))
+    assert(b2:nextmsg() == 2 and b2:nextmsg() == string.rep("x", 100))
+    b:compression(0)
+    b:clear()
+    
+    -- invalid version, messages are checked when loaded
+    local ok, err = pcall(function() 
+        b2:load(foreign:sub(1, 18).."\2"..foreign:sub(20))
+    end)
+    assert(not ok and err:match("corrupt message data"))
+    -- truncated value
+    local ok, err = pcall(function() 
+        b2:load(foreign:sub(1, 16).."\10\18\1\1\255\255\255\255\255\255\255")
+    end)
+    assert(not ok and err:match("corrupt message data"))
+    assert(b2:msgcnt() == 0)
+end
+PRINT("==================================================================================")
+do
+    -- carrays
+    local b = mtmsg.newbuffer()
+    b:portable()
+    local types = { "uchar", "short", "ushort", "int", "uint",
+                    "long", "ulong", "float", "double" }
+    for _, t in ipairs(types) do
+        local a = carray.new(t, 3)
+        a:set(1, 1, 2, 100)
+        b:addmsg(t, a)
+    end
+    for _, t in ipairs(types) do
+        local t1, a = b:nextmsg(0)
+        assert(t1 == t)
+        assert(a:len() == 3)
+        assert(a:get(1) == 1 and a:get(2) == 2 and a:get(3) == 100)
+    end
+    local a = carray.new("int", 2)
+    a:set(1, -7, 7)
+    b:addmsg(a)
+    local a2 = carray.new("int")
+    assert(b:nextmsg(0, a2) == a2)
+    assert(a2:len() == 2 and a2:get(1) == -7 and a2:get(2) == 7)
+end
+PRINT("==================================================================================")
+do
+    -- with compression
+    local b = mtmsg.newbuffer()
+    b:portable()
+    b:compression(100)
+    local t = {}
+    for i = 1, 1000 do t[i] = i * 1000 end
+    b:addmsg(string.rep("abc", 1000), t, { x = string.rep("z", 500) })
+    local s, t2, t3 = b:nextmsg(0)
+    assert(s == string.rep("abc", 1000) and deepEqual(t, t2) and t3.x == string.rep("z", 500))
+end
+PRINT("==================================================================================")
+do
+    -- values that cannot be serialized portably
+    local b = mtmsg.newbuffer()
+    b:portable()
+    local ok, err = pcall(function() b:addmsg(1, print) end)
+    assert(not ok and err:match("cannot be serialized portably"))
+    assert(b:msgcnt() == 0)
+    b:portable(false)
+    b:addmsg(print)
+    assert(b:nextmsg(0) == print)
+
+    -- string dictionary is not used
+    b:dictionary()
+    b:portable(true)
+    b:addmsg("abc", "abc")
+    local x, y = b:nextmsg(0)
+    assert(x == "abc" and y == "abc")
+
+    local ok, err = pcall(function() b:portable(1) end)
+    assert(not ok and err:match("boolean expected"))
+end
+PRINT("==================================================================================")
+do
+    -- portable messages via writer
+    local b = mtmsg.newbuffer()
+    b:portable()
+    local w = mtmsg.newwriter()
+    w:add(1, maxint, 0.25, "x")
+    w:addmsg(b)
+    local a, m, f, s = b:nextmsg(0)
+    assert(a == 1 and m == maxint and f == 0.25 and s == "x")
+end
+PRINT("==================================================================================")
+print("OK.")
@@ -0,0 +1,119 @@
+local mtmsg  = require("mtmsg")
+
+local function PRINT(s)
+    print(s.." ("..debug.getinfo(2).currentline..")")
+end
+local function msgh(err)
+    return debug.traceback(err, 2)
+end
+local function pcall(f, ...)
+    return xpcall(f, msgh, ...)
+end
+
+PRINT("==================================================================================")
+do
+    local b = mtmsg.newbuffer()
+    local s = b:stats()
+    assert(s.enqueued_msgs == 0 and s.enqueued_bytes == 0)
+    assert(s.dequeued_msgs == 0 and s.dequeued_bytes == 0)
+    assert(s.discarded_msgs == 0)
+    assert(s.msg_count == 0 and s.peak_msg_count == 0)
+    assert(s.length == 0 and s.peak_length == 0)
+    assert(s.capacity == 1024)
+    assert(s.memmoves == 0 and s.reallocs == 0)
+    assert(s.full_rejections == 0 and s.notifier_calls == 0)
+    assert(s.compressed_in_bytes == 0 and s.compressed_out_bytes == 0)
+    assert(s.compression_ratio == nil)
+end
+PRINT("==================================================================================")
+do
+    local b = mtmsg.newbuffer()
+    b:addmsg("a", 1)
+    b:addmsg("b", 2)
+    b:addmsg("c", 3)
+    local s = b:stats()
+    assert(s.enqueued_msgs == 3 and s.enqueued_bytes > 0 and s.enqueued_bytes % 3 == 0)
+    assert(s.msg_count == 3 and s.peak_msg_count == 3)
+    assert(s.length == s.enqueued_bytes and s.peak_length == s.length)
+    local msgSize = s.enqueued_bytes / 3
+
+    assert(b:nextmsg() == "a")
+    s = b:stats()
+    assert(s.dequeued_msgs == 1 and s.dequeued_bytes == msgSize)
+    assert(s.msg_count == 2 and s.peak_msg_count == 3)
+    assert(s.length == 2 * msgSize and s.peak_length == 3 * msgSize)
+
+    b:setmsg("d", 4)
+    s = b:stats()
+    assert(s.discarded_msgs == 2 and s.enqueued_msgs == 4 and s.msg_count == 1)
+
+    b:clear()
+    s = b:stats()
+    assert(s.discarded_msgs == 3 and s.msg_count == 0 and s.length == 0)
+    assert(s.enqueued_msgs == s.dequeued_msgs + s.discarded_msgs)
+end
+PRINT("==================================================================================")
+do
+    local b = mtmsg.newbuffer(20, 0)
+    local n = 0
+    while b:addmsg(n) do
+        n = n + 1
+    end
+    assert(not b:addmsg(n))
+    local s = b:stats()
+    assert(s.full_rejections == 2 and s.enqueued_msgs == n and s.capacity == 20)
+    assert(s.reallocs == 0)
+end
+PRINT("==================================================================================")
+do
+    local b = mtmsg.newbuffer(16)
+    b:addmsg(string.rep("x", 100))
+    local s = b:stats()
+    assert(s.reallocs == 1 and s.capacity > 100 and s.full_rejections == 0)
+end
+PRINT("==================================================================================")
+do
+    local b = mtmsg.newbuffer(100, 0)
+    local m = string.rep("x", 17) -- 20 bytes per message
+    for i = 1, 4 do
+        assert(b:addmsg(m))
+    end
+    assert(b:stats().length == 80)
+    b:nextmsg()
+    b:nextmsg()
+    assert(b:addmsg(m) and b:addmsg(m))
+    local s = b:stats()
+    assert(s.memmoves == 1 and s.reallocs == 0 and s.length == 80)
+end
+PRINT("==================================================================================")
+do
+    local b = mtmsg.newbuffer()
+    b:compression(10)
+    b:addmsg(string.rep("a", 1000))
+    local s = b:stats()
+    assert(s.compressed_in_bytes > 1000 and s.compressed_out_bytes < 100)
+    assert(s.compression_ratio == s.compressed_out_bytes / s.compressed_in_bytes)
+    assert(b:nextmsg() == string.rep("a", 1000))
+end
+PRINT("==================================================================================")
+do
+    local l  = mtmsg.newlistener()
+    local b1 = l:newbuffer()
+    local b2 = l:newbuffer()
+    b1:addmsg(1)
+    b1:addmsg(2)
+    b2:addmsg(3)
+    assert(l:nextmsg() == 1)
+    assert(b1:stats().dequeued_msgs == 1)
+    l:clear()
+    assert(b1:msgcnt() == 0 and b2:msgcnt() == 0)
+    assert(b1:stats().discarded_msgs == 1 and b2:stats().discarded_msgs == 1)
+end
+PRINT("==================================================================================")
+do
+    local b = mtmsg.newbuffer()
+    b:close()
+    assert(b:stats().msg_count == 0)
+end
+PRINT("==================================================================================")
+print("OK.")
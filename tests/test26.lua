@@ -0,0 +1,67 @@
+local mtmsg  = require("mtmsg")
+
+local function PRINT(s)
+    print(s.." ("..debug.getinfo(2).currentline..")")
+end
+local function msgh(err)
+    return debug.traceback(err, 2)
+end
+local function pcall(f, ...)
+    return xpcall(f, msgh, ...)
+end
+
+PRINT("==================================================================================")
+do
+    collectgarbage()
+    local s0 = mtmsg.stats()
+    assert(s0.buffers == 0 and s0.listeners == 0 and s0.msg_count == 0 and s0.memory_bytes == 0)
+
+    local b1 = mtmsg.newbuffer(100)
+    local b2 = mtmsg.newbuffer(200)
+    local l  = mtmsg.newlistener()
+    local b3 = l:newbuffer(300)
+    b1:addmsg(1)
+    b3:addmsg(2)
+    b3:addmsg(3)
+
+    local s1 = mtmsg.stats()
+    assert(s1.buffers == 3 and s1.listeners == 1)
+    assert(s1.msg_count == 3)
+    assert(s1.memory_bytes == 600)
+    assert(s1.buffer_buckets > 0 and s1.buffer_bucket_usage >= 1)
+    assert(s1.listener_buckets > 0 and s1.listener_bucket_usage >= 1)
+    assert(s1.global_lock_acquisitions >= s0.global_lock_acquisitions + 4)
+    assert(s1.global_lock_contentions >= s0.global_lock_contentions)
+
+    assert(mtmsg.buffer(b2:id()))
+    local s2 = mtmsg.stats("table")
+    assert(s2.global_lock_acquisitions == s1.global_lock_acquisitions + 2)
+
+    b1, b2, b3, l = nil
+    collectgarbage()
+    local s3 = mtmsg.stats()
+    assert(s3.buffers == 0 and s3.listeners == 0 and s3.msg_count == 0)
+end
+PRINT("==================================================================================")
+do
+    local b = mtmsg.newbuffer()
+    b:addmsg("x")
+    local text = mtmsg.stats("prometheus")
+    assert(type(text) == "string")
+    assert(text:match("\n# TYPE mtmsg_buffers gauge\nmtmsg_buffers 1\n"))
+    assert(text:match("\nmtmsg_msg_count 1\n"))
+    assert(text:match("# TYPE mtmsg_global_lock_acquisitions_total counter\nmtmsg_global_lock_acquisitions_total %d+\n"))
+    local n = 0
+    for line in text:gmatch("[^\n]+") do
+        if not line:match("^#") then
+            assert(line:match("^mtmsg_[a-z_]+ %d+$"))
+            n = n + 1
+        end
+    end
+    assert(n == 10)
+
+    local ok, err = pcall(function() mtmsg.stats("xxx") end)
+    assert(not ok and err:match("invalid option"))
+end
+PRINT("==================================================================================")
+print("OK.")
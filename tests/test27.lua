@@ -0,0 +1,118 @@
+local mtmsg  = require("mtmsg")
+
+local function PRINT(s)
+    print(s.." ("..debug.getinfo(2).currentline..")")
+end
+local function msgh(err)
+    return debug.traceback(err, 2)
+end
+local function pcall(f, ...)
+    return xpcall(f, msgh, ...)
+end
+
+PRINT("==================================================================================")
+do
+    local b = mtmsg.newbuffer()
+    assert(b:latency() == nil)
+    b:addmsg(1)
+    b:timing()
+    local lat = b:latency()
+    assert(lat.count == 0 and lat.p50 == nil)
+    assert(lat.oldest == nil) -- message was added before timing was enabled
+
+    b:addmsg(2)
+    assert(b:nextmsg() == 1)
+    lat = b:latency()
+    assert(lat.count == 0)
+    assert(lat.oldest >= 0)
+
+    mtmsg.sleep(0.05)
+    assert(b:latency().oldest >= 0.04)
+    assert(b:nextmsg() == 2)
+    lat = b:latency()
+    assert(lat.count == 1 and lat.oldest == 0)
+    assert(lat.min >= 0.04 and lat.min == lat.max)
+    assert(lat.p50 >= 0.04 and lat.p50 <= lat.max and lat.p999 <= lat.max)
+    assert(lat.mean >= 0.04 and lat.mean <= lat.max)
+end
+PRINT("==================================================================================")
+do
+    local b = mtmsg.newbuffer()
+    b:timing(true)
+    for i = 1, 100 do
+        b:addmsg(i)
+    end
+    for i = 1, 100 do
+        assert(b:nextmsg() == i)
+    end
+    local lat = b:latency()
+    assert(lat.count == 100)
+    assert(lat.min <= lat.p50 and lat.p50 <= lat.p90 and lat.p90 <= lat.p99
+                              and lat.p99 <= lat.p999 and lat.p999 <= lat.max)
+    assert(b:latency(true).count == 100)
+    assert(b:latency().count == 0)
+
+    b:addmsg(1)
+    b:addmsg(2)
+    b:clear()
+    b:addmsg(3)
+    assert(b:nextmsg() == 3)
+    assert(b:latency().count == 1)
+    b:addmsg(4)
+    b:setmsg(5)
+    assert(b:nextmsg() == 5)
+    assert(b:latency().count == 2)
+
+    b:timing(false)
+    assert(b:latency() == nil)
+end
+PRINT("==================================================================================")
+do
+    -- loaded messages are timed from loading
+    local b = mtmsg.newbuffer()
+    b:timing()
+    b:addmsg("a")
+    b:addmsg("b")
+    local b2 = mtmsg.newbuffer()
+    b2:timing()
+    local data = b:dump()
+    b2:load(data)
+    assert(b2:nextmsg() == "a")
+    assert(b2:latency().count == 1 and b2:latency().oldest >= 0)
+end
+PRINT("==================================================================================")
+do
+    local l  = mtmsg.newlistener()
+    local b1 = l:newbuffer()
+    local b2 = l:newbuffer()
+    assert(l:latency() == nil)
+    b1:timing()
+    b2:timing()
+    b1:addmsg(1)
+    b2:addmsg(2)
+    b2:addmsg(3)
+    assert(l:nextmsg() == 1)
+    assert(l:nextmsg() == 2)
+    assert(b2:nextmsg() == 3)
+    assert(b1:latency().count == 1)
+    assert(b2:latency().count == 2)
+    local lat = l:latency()
+    assert(lat.count == 3 and lat.oldest == nil)
+    assert(l:latency(true).count == 3)
+    assert(l:latency().count == 0)
+
+    b1:addmsg(4)
+    l:clear()
+    b1:addmsg(5)
+    assert(l:nextmsg() == 5)
+    assert(l:latency().count == 1)
+end
+PRINT("==================================================================================")
+do
+    local b = mtmsg.newbuffer()
+    b:close()
+    local ok, err = pcall(function() b:timing() end)
+    assert(not ok and err:match(mtmsg.error.object_closed))
+end
+PRINT("==================================================================================")
+print("OK.")
@@ -0,0 +1,58 @@
+local mtmsg  = require("mtmsg")
+
+local function PRINT(s)
+    print(s.." ("..debug.getinfo(2).currentline..")")
+end
+local function msgh(err)
+    return debug.traceback(err, 2)
+end
+local function pcall(f, ...)
+    return xpcall(f, msgh, ...)
+end
+
+PRINT("==================================================================================")
+if not mtmsg.lockstats() then
+    local b = mtmsg.newbuffer()
+    local l = mtmsg.newlistener()
+    assert(b:lockstats() == nil and l:lockstats() == nil)
+    print("mtmsg was compiled without MTMSG_LOCKSTATS")
+    print("OK.")
+    return
+end
+PRINT("==================================================================================")
+do
+    local b  = mtmsg.newbuffer()
+    local s0 = b:lockstats()
+    assert(s0.acquisitions >= 1 and s0.contended == 0)
+    assert(s0.wait_time == 0 and s0.max_hold_time >= 0)
+    b:addmsg(1)
+    b:nextmsg()
+    local s1 = b:lockstats()
+    assert(s1.acquisitions == s0.acquisitions + 3)
+
+    -- waiting for messages does not count as holding the lock
+    assert(b:nextmsg(0.1) == nil)
+    assert(b:lockstats().max_hold_time < 0.05)
+end
+PRINT("==================================================================================")
+do
+    local l  = mtmsg.newlistener()
+    local b  = l:newbuffer()
+    local s0 = l:lockstats()
+    b:addmsg(1)
+    assert(l:nextmsg() == 1)
+    local s1 = l:lockstats()
+    assert(s1.acquisitions == s0.acquisitions + 3)
+    assert(b:lockstats().acquisitions == s1.acquisitions + 1)
+end
+PRINT("==================================================================================")
+do
+    local s0 = mtmsg.lockstats()
+    local b  = mtmsg.newbuffer()
+    local s1 = mtmsg.lockstats()
+    assert(s1.acquisitions == s0.acquisitions + 2)
+    assert(s1.contended >= s0.contended)
+    assert(s1.wait_time >= s0.wait_time)
+end
+PRINT("==================================================================================")
+print("OK.")
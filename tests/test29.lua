@@ -0,0 +1,45 @@
+local mtmsg  = require("mtmsg")
+
+local function PRINT(s)
+    print(s.." ("..debug.getinfo(2).currentline..")")
+end
+local function msgh(err)
+    return debug.traceback(err, 2)
+end
+local function pcall(f, ...)
+    return xpcall(f, msgh, ...)
+end
+
+PRINT("==================================================================================")
+do
+    -- hooks can only be registered from C, see trace_capi.h
+    local enabled = mtmsg.tracehooks(nil)
+    assert(type(enabled) == "boolean")
+    assert(mtmsg.tracehooks() == enabled)
+    if not enabled then
+        print("mtmsg was compiled with MTMSG_DISABLE_TRACE")
+    end
+
+    local ok, err = pcall(function() mtmsg.tracehooks({}) end)
+    assert(not ok and err:match("bad argument #1 to 'tracehooks'"))
+    local ok, err = pcall(function() mtmsg.tracehooks("x") end)
+    assert(not ok and err:match("bad argument #1 to 'tracehooks'"))
+end
+PRINT("==================================================================================")
+do
+    -- all tracepoints are passed without hooks
+    local b = mtmsg.newbuffer(20, 0)
+    b:addmsg(1)
+    assert(b:nextmsg(0.01) == 1)
+    assert(b:nextmsg(0.01) == nil)
+    b:addmsg(("x"):rep(10))
+    assert(b:addmsg(("x"):rep(10)) == false)
+    b:clear()
+    local l = mtmsg.newlistener()
+    local lb = l:newbuffer()
+    lb:addmsg(2)
+    assert(l:nextmsg(0.01) == 2)
+    assert(l:nextmsg(0.01) == nil)
+end
+PRINT("==================================================================================")
+print("OK.")
@@ -0,0 +1,117 @@
+local mtmsg  = require("mtmsg")
+
+local function PRINT(s)
+    print(s.." ("..debug.getinfo(2).currentline..")")
+end
+local function msgh(err)
+    return debug.traceback(err, 2)
+end
+local function pcall(f, ...)
+    return xpcall(f, msgh, ...)
+end
+
+local big1 = ("a"):rep(10000)
+local big2 = ("b"):rep(20000)
+
+PRINT("==================================================================================")
+do
+    -- large messages are given to empty buffers without copying
+    local w = mtmsg.newwriter()
+    local b = mtmsg.newbuffer()
+    for i = 1, 3 do
+        w:add(i, big1)
+        assert(w:addmsg(b) == true)
+        local n, s = b:nextmsg()
+        assert(n == i and s == big1)
+        assert(b:nextmsg(0) == nil)
+    end
+    w:add(4, big1)
+    w:addmsg(b)
+    w:add(5, big2)
+    w:addmsg(b)
+    w:add(6, "x")
+    w:addmsg(b)
+    assert(select(2, b:nextmsg()) == big1)
+    assert(select(2, b:nextmsg()) == big2)
+    assert(b:nextmsg() == 6)
+    assert(b:nextmsg(0) == nil)
+    local stats = b:stats()
+    assert(stats.enqueued_msgs == 6 and stats.dequeued_msgs == 6)
+    assert(stats.enqueued_bytes == stats.dequeued_bytes)
+end
+PRINT("==================================================================================")
+do
+    -- setmsg replaces older messages
+    local w = mtmsg.newwriter()
+    local b = mtmsg.newbuffer()
+    b:addmsg(1)
+    b:addmsg(2)
+    w:add(big2)
+    assert(w:setmsg(b) == true)
+    assert(b:nextmsg() == big2)
+    assert(b:nextmsg(0) == nil)
+    assert(b:stats().discarded_msgs == 2)
+
+    -- the writer can be reused
+    w:add(big1)
+    w:add(3)
+    w:addmsg(b)
+    w:clear()
+    w:add(big1)
+    w:addmsg(b)
+    local s, n = b:nextmsg()
+    assert(s == big1 and n == 3)
+    local s, n = b:nextmsg()
+    assert(s == big1 and n == nil)
+end
+PRINT("==================================================================================")
+do
+    -- fixed size buffers and writers
+    local w = mtmsg.newwriter()
+    local b = mtmsg.newbuffer(15000, 0)
+    w:add(big1)
+    assert(w:addmsg(b) == true)
+    w:add(big1)
+    assert(w:addmsg(b) == false)
+    assert(b:nextmsg() == big1)
+    assert(w:addmsg(b) == true)
+    assert(b:nextmsg() == big1)
+
+    local w2 = mtmsg.newwriter(20000, 0)
+    local b2 = mtmsg.newbuffer()
+    w2:add(big1)
+    w2:addmsg(b2)
+    w2:add(big1)
+    w2:addmsg(b2)
+    assert(b2:nextmsg() == big1)
+    assert(b2:nextmsg() == big1)
+end
+PRINT("==================================================================================")
+do
+    -- compressed messages and listener buffers
+    local w = mtmsg.newwriter()
+    local b = mtmsg.newbuffer()
+    b:compression(100)
+    w:add(big2)
+    w:addmsg(b)
+    assert(b:stats().compressed_in_bytes > 0)
+    assert(b:nextmsg() == big2)
+
+    local l  = mtmsg.newlistener()
+    local lb = l:newbuffer()
+    w:add(big1)
+    w:addmsg(lb)
+    assert(l:nextmsg() == big1)
+    assert(l:nextmsg(0) == nil)
+end
+PRINT("==================================================================================")
+do
+    local w = mtmsg.newwriter()
+    local b = mtmsg.newbuffer()
+    b:close()
+    w:add(big1)
+    local ok, err = pcall(function() w:addmsg(b) end)
+    assert(not ok and err:match(mtmsg.error.object_closed))
+end
+PRINT("==================================================================================")
+print("OK.")
@@ -0,0 +1,134 @@
+local mtmsg     = require("mtmsg")
+local llthreads = require("llthreads2.ex")
+local capitest  = require("capitest") -- see capitest.c
+
+local function PRINT(s)
+    print(s.." ("..debug.getinfo(2).currentline..")")
+end
+local function msgh(err)
+    return debug.traceback(err, 2)
+end
+local function pcall(f, ...)
+    return xpcall(f, msgh, ...)
+end
+
+local function checkReserved(b, count)
+    local s, n, a = b:nextmsg(0)
+    assert(s == "reserved" and n == count and a:len() == count)
+    for i = 1, count do
+        assert(a:get(i) == i)
+    end
+end
+
+PRINT("==================================================================================")
+do
+    -- reserve and commit
+    local b = mtmsg.newbuffer()
+    b:addmsg("first")
+    local p = capitest.reserve(b, 10)
+    assert(capitest.commit(p) == 0)
+    b:addmsg("last")
+    assert(b:nextmsg(0) == "first")
+    checkReserved(b, 10)
+    assert(b:nextmsg(0) == "last")
+    assert(b:nextmsg(0) == nil)
+
+    -- cancel
+    local p = capitest.reserve(b, 10)
+    assert(capitest.commit(p, true) == 0)
+    assert(b:msgcnt() == 0 and b:nextmsg(0) == nil)
+    b:addmsg("x")
+    assert(b:nextmsg(0) == "x")
+end
+PRINT("==================================================================================")
+do
+    -- the buffer is not locked while a message is reserved
+    local b = mtmsg.newbuffer()
+    b:addmsg("a")
+    local p = capitest.reserve(b, 1000)
+    assert(mtmsg.stats().msg_count >= 1)
+    assert(b:msgcnt() == 1)
+    assert(b:nextmsg(0) == "a")
+    assert(b:nextmsg(0) == nil)
+
+    -- other messages cannot be added until the reserved message is committed
+    local nb = mtmsg.buffer(b:id())
+    nb:nonblock(true)
+    assert(nb:addmsg("b") == false)
+    local thread = llthreads.new(function(id)
+                                     local mtmsg = require("mtmsg")
+                                     mtmsg.buffer(id):addmsg("after")
+                                 end,
+                                 b:id())
+    thread:start()
+    mtmsg.sleep(0.1)
+    assert(b:msgcnt() == 0)
+    assert(capitest.commit(p) == 0)
+    assert(thread:join())
+    checkReserved(b, 1000)
+    assert(b:nextmsg(0) == "after")
+    assert(b:nextmsg(0) == nil)
+end
+PRINT("==================================================================================")
+do
+    -- listener buffers
+    local l = mtmsg.newlistener()
+    local b = l:newbuffer()
+    b:addmsg("a")
+    local p = capitest.reserve(b, 5)
+    assert(l:nextmsg(0) == "a")
+    assert(l:nextmsg(0) == nil)
+    assert(capitest.commit(p) == 0)
+    local s, n, a = l:nextmsg(0)
+    assert(s == "reserved" and n == 5 and a:get(5) == 5)
+end
+PRINT("==================================================================================")
+do
+    -- messages that are compressed, portable or spilled are reserved in the
+    -- writer and added on commit
+    local b = mtmsg.newbuffer()
+    b:compression(100)
+    local p = capitest.reserve(b, 1000)
+    assert(b:msgcnt() == 0)
+    assert(capitest.commit(p) == 0)
+    checkReserved(b, 1000)
+    local p = capitest.reserve(b, 1000)
+    assert(capitest.commit(p, true) == 0)
+    assert(b:msgcnt() == 0)
+    b:compression(0)
+
+    b:portable()
+    local p = capitest.reserve(b, 10)
+    assert(capitest.commit(p) == 0)
+    checkReserved(b, 10)
+    b:portable(false)
+
+    b:spill(100)
+    b:addmsg(string.rep("x", 90))
+    local p = capitest.reserve(b, 20)
+    assert(capitest.commit(p) == 0)
+    assert(b:nextmsg(0) == string.rep("x", 90))
+    checkReserved(b, 20)
+    assert(b:nextmsg(0) == nil)
+end
+PRINT("==================================================================================")
+do
+    -- errors
+    local b = mtmsg.newbuffer(100, 0)
+    local p, rc = capitest.reserve(b, 100)
+    assert(p == nil and rc == 5) -- message too large
+    local p = capitest.reserve(b, 5)
+    assert(capitest.commit(p) == 0)
+    local p = capitest.reserve(b, 5)
+    assert(capitest.commit(p) == 0)
+    local p, rc = capitest.reserve(b, 5)
+    assert(p == nil and rc == 4) -- buffer is full
+    checkReserved(b, 5)
+    local p = capitest.reserve(b, 5)
+    b:close()
+    assert(capitest.commit(p) == 1) -- buffer was closed
+    local p, rc = capitest.reserve(b, 5)
+    assert(p == nil and rc == 1)
+end
+PRINT("==================================================================================")
+print("OK.")
@@ -0,0 +1,102 @@
+local mtmsg    = require("mtmsg")
+local carray   = require("carray")
+local capitest = require("capitest") -- see capitest.c
+
+local function PRINT(s)
+    print(s.." ("..debug.getinfo(2).currentline..")")
+end
+local function msgh(err)
+    return debug.traceback(err, 2)
+end
+local function pcall(f, ...)
+    return xpcall(f, msgh, ...)
+end
+
+PRINT("==================================================================================")
+do
+    -- maxCount
+    local b = mtmsg.newbuffer()
+    for i = 1, 10 do
+        b:addmsg(i, "msg"..i)
+    end
+    local msgs = capitest.nextmsgs(b, 4, 0)
+    assert(#msgs == 4)
+    for i = 1, 4 do
+        assert(msgs[i].n == 2 and msgs[i][1] == i and msgs[i][2] == "msg"..i)
+    end
+    local msgs = capitest.nextmsgs(b, 100, 0)
+    assert(#msgs == 6 and msgs[1][1] == 5 and msgs[6][1] == 10)
+    assert(b:msgcnt() == 0)
+    local msgs, rc = capitest.nextmsgs(b, 100, 0)
+    assert(msgs == nil and rc == 3)
+end
+PRINT("==================================================================================")
+do
+    -- maxBytes, the first message is taken even if it is larger
+    local b = mtmsg.newbuffer()
+    local s = string.rep("x", 100)
+    for i = 1, 5 do
+        b:addmsg(s)
+    end
+    local msgs = capitest.nextmsgs(b, 10, 1)
+    assert(#msgs == 1 and msgs[1][1] == s)
+    local msgs = capitest.nextmsgs(b, 10, 250)
+    assert(#msgs == 2 and msgs[2][1] == s)
+    local msgs = capitest.nextmsgs(b, 10, 0)
+    assert(#msgs == 2)
+    assert(b:msgcnt() == 0)
+end
+PRINT("==================================================================================")
+do
+    -- message boundaries
+    local b = mtmsg.newbuffer()
+    b:addmsg(1)
+    b:addmsg(2, "x")
+    b:addmsg()
+    b:addmsg(nil, true, 3.5)
+    b:addmsg("last")
+    local msgs = capitest.nextmsgs(b, 10, 0)
+    assert(#msgs == 5)
+    assert(msgs[1].n == 1 and msgs[1][1] == 1)
+    assert(msgs[2].n == 2 and msgs[2][1] == 2 and msgs[2][2] == "x")
+    assert(msgs[3].n == 0)
+    assert(msgs[4].n == 3 and msgs[4][1] == nil and msgs[4][2] == true and msgs[4][3] == 3.5)
+    assert(msgs[5].n == 1 and msgs[5][1] == "last")
+
+    -- remaining values are skipped when switching to the next message
+    b:addmsg(1, 2, 3)
+    b:addmsg(4, 5)
+    b:addmsg(6)
+    local msgs = capitest.nextmsgs(b, 10, 0, 1)
+    assert(#msgs == 3)
+    assert(msgs[1].n == 1 and msgs[1][1] == 1)
+    assert(msgs[2].n == 1 and msgs[2][1] == 4)
+    assert(msgs[3].n == 1 and msgs[3][1] == 6)
+end
+PRINT("==================================================================================")
+do
+    -- compressed and portable messages within a batch
+    local b = mtmsg.newbuffer()
+    local text = string.rep("some text ", 50)
+    local a    = carray.new("int", 3)
+    a:set(1, 10, 20, 30)
+    b:addmsg(1, "plain")
+    b:compression(100)
+    b:addmsg(2, text)
+    b:portable()
+    b:addmsg(3, text, a)
+    b:compression(0)
+    b:addmsg(4, 0.25, a)
+    b:portable(false)
+    b:addmsg(5, a)
+    assert(b:stats().compressed_in_bytes > 0)
+    local msgs = capitest.nextmsgs(b, 10, 0)
+    assert(#msgs == 5)
+    assert(msgs[1].n == 2 and msgs[1][2] == "plain")
+    assert(msgs[2].n == 2 and msgs[2][1] == 2 and msgs[2][2] == text)
+    assert(msgs[3].n == 3 and msgs[3][1] == 3 and msgs[3][2] == text and msgs[3][3][3] == 30)
+    assert(msgs[4].n == 3 and msgs[4][2] == 0.25 and #msgs[4][3] == 3 and msgs[4][3][1] == 10)
+    assert(msgs[5].n == 2 and msgs[5][2][2] == 20)
+end
+PRINT("==================================================================================")
+print("OK.")
@@ -0,0 +1,79 @@
+local mtmsg    = require("mtmsg")
+local capitest = require("capitest") -- see capitest.c
+
+local function PRINT(s)
+    print(s.." ("..debug.getinfo(2).currentline..")")
+end
+local function msgh(err)
+    return debug.traceback(err, 2)
+end
+local function pcall(f, ...)
+    return xpcall(f, msgh, ...)
+end
+
+local function checkEvents(events, expected)
+    for i = 1, math.max(#events, #expected) do
+        if events[i] ~= expected[i] then
+            error("event "..i..": expected '"..tostring(expected[i]).."', got '"..tostring(events[i]).."'", 2)
+        end
+    end
+end
+
+PRINT("==================================================================================")
+if not mtmsg.tracehooks(capitest.tracehooks()) then
+    print("mtmsg was compiled with MTMSG_DISABLE_TRACE")
+else
+    local b  = mtmsg.newbuffer(20, 0)
+    local nb = mtmsg.newbuffer()
+    b:notifier(nb, ">")
+    b:addmsg(1)
+    b:addmsg(2, 3)
+    assert(b:nextmsg(0.01) == 1)
+    assert(b:nextmsg(0.01) == 2)
+    assert(b:nextmsg(0.01) == nil)
+    b:addmsg(("x"):rep(10))
+    assert(b:addmsg(("x"):rep(10)) == false)
+    b:clear()
+    local l  = mtmsg.newlistener()
+    local lb = l:newbuffer()
+    lb:addmsg(4)
+    assert(l:nextmsg(0.01) == 4)
+    assert(l:nextmsg(0.01) == nil)
+
+    assert(mtmsg.tracehooks(nil))
+    b:addmsg(5)
+    assert(b:nextmsg() == 5)
+
+    local counts, events = capitest.traceevents()
+    assert(counts.enqueue     == 7)
+    assert(counts.dequeue     == 3)
+    assert(counts.block_start == 2)
+    assert(counts.block_end   == 2)
+    assert(counts.notify      == 3)
+    assert(counts.drop        == 2)
+
+    local b, nb, l, lb = b:id(), nb:id(), l:id(), lb:id()
+    checkEvents(events, {
+        "enqueue "..b.." 1",        -- b:addmsg(1)
+        "notify "..b,
+        "enqueue "..nb.." 1",       -- buffer as notifier
+        "enqueue "..b.." 1",        -- b:addmsg(2, 3)
+        "notify "..b,
+        "enqueue "..nb.." 1",
+        "dequeue "..b.." 0 1",
+        "dequeue "..b.." 0 1",
+        "block_start "..b,          -- timeout
+        "block_end "..b,
+        "enqueue "..b.." 1",
+        "notify "..b,
+        "enqueue "..nb.." 1",
+        "drop "..b.." 1 2",         -- MTMSG_TRACE_DROP_REJECTED
+        "drop "..b.." 1 1",         -- MTMSG_TRACE_DROP_CLEARED
+        "enqueue "..lb.." 1",
+        "dequeue "..lb.." "..l.." 1",
+        "block_start "..l,
+        "block_end "..l
+    })
+end
+PRINT("==================================================================================")
+print("OK.")